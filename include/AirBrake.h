@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+// Automatic air brake of the train: driver's brake valve, brake pipe,
+// distributor with auxiliary reservoir and brake cylinder.
+// Pressures are integer millibar and the model advances on the same fixed
+// tick as TrainPhysics, so it is deterministic and cheap to run.
+class AirBrake {
+public:
+    // Driver's brake valve positions
+    enum class Valve {
+        RELEASE, // Recharge the brake pipe
+        LAP,     // Hold the current pipe pressure
+        APPLY    // Vent the brake pipe
+    };
+
+    // Brake pipe running pressure and the reduction giving a full service application
+    static constexpr int32_t RUNNING_PRESSURE_MBAR = 5000;
+    static constexpr int32_t FULL_SERVICE_REDUCTION_MBAR = 1500;
+
+    // Brake cylinder pressure at full service
+    static constexpr int32_t MAX_CYLINDER_MBAR = 3800;
+
+    // Set the driver's brake valve position
+    void setValve(Valve position) {
+        valve = position;
+    }
+
+    // Advance the model by one TrainPhysics::TICK_MS step
+    void tick();
+
+    // Pressures in millibar
+    int32_t getPipeMbar() const { return pipeMbar; }
+    int32_t getAuxReservoirMbar() const { return auxReservoirMbar; }
+    int32_t getCylinderMbar() const { return cylinderMbar; }
+
+    // Brake force demand derived from the cylinder pressure (0-100%)
+    int getBrakePercent() const {
+        return cylinderMbar * 100 / MAX_CYLINDER_MBAR;
+    }
+
+private:
+    Valve valve = Valve::LAP;
+
+    int32_t pipeMbar = RUNNING_PRESSURE_MBAR;
+    int32_t auxReservoirMbar = RUNNING_PRESSURE_MBAR;
+    int32_t cylinderMbar = 0;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FreeRTOS.h>
+#include <event_groups.h>
+
+// Boot split into phases running behind the splash screen. The control core
+// mounts the filesystem, loads the configuration and brings the network up
+// while the UI core initialises the display and the menus. Every phase is
+// timestamped so the boot time can be broken down on the device.
+class BootSequence {
+public:
+    enum class Phase : uint8_t {
+        FILESYSTEM, // LittleFS mounted
+        CONFIG,     // Configuration loaded, commit task running
+        UI,         // Display, menus and splash ready (UI core)
+        WIFI,       // Associated with the access point
+        STATION,    // Command station connected
+        COUNT
+    };
+
+    // Longest wait for the network phases before boot gives up on them
+    static constexpr uint32_t LINK_TIMEOUT_MS = 30000;
+
+    // Start the boot task on the control core
+    static void start();
+
+    // Timestamp the start and the end of a phase run outside the boot task
+    static void beginPhase(Phase phase);
+    static void endPhase(Phase phase);
+
+    // Block until a phase has completed
+    static void waitFor(Phase phase);
+
+    // Check whether a phase has completed
+    static bool isDone(Phase phase);
+
+    // Start/end time of each phase since reset, in ms
+    static String report();
+
+private:
+    static void bootTask(void* param);
+
+    // Wait for the connection manager to reach a link state; false on timeout
+    static bool waitForLink(uint8_t state, uint32_t deadline);
+
+    static EventGroupHandle_t events;
+    static volatile uint32_t startedMs[(int)Phase::COUNT];
+    static volatile uint32_t doneMs[(int)Phase::COUNT];
+};
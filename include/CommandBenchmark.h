@@ -0,0 +1,24 @@
+#pragma once
+
+#include <Arduino.h>
+
+// On-device cost of turning a speed change into a command on the wire:
+// slot update, flush, encoding and batching, against a transport that
+// discards everything (and answers the Z21 handshake and the LocoNet slot
+// request). Comparing a build with LOCO_VIRTUAL_DISPATCH set to one without
+// shows what resolving the encode calls at compile time saves.
+class CommandBenchmark {
+public:
+    static constexpr int ITERATIONS = 1000;
+
+    // How long the Z21 and LocoNet backends may take to become able to send
+    static constexpr uint32_t READY_TIMEOUT_MS = 2000;
+
+    // Human readable result, one line per backend built into the firmware
+    static String run();
+
+private:
+    // Nanoseconds per speed command of one backend
+    template <typename Backend>
+    static uint32_t measure();
+};
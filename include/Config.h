@@ -2,3 +2,32 @@
 
 #define POTENTIOMETER_PIN A0 // Pin for potentiometer
 
+// Core placement on the RP2040: UI and rendering on one core,
+// network, simulation and input sampling on the other
+#define UI_CORE 0
+#define CONTROL_CORE 1
+
+// Wired link to a DCC-EX command station (UART1; GP4 and GP8, its other TX
+// pins, drive the display)
+#define COMMAND_STATION_SERIAL Serial2
+#define COMMAND_STATION_TX_PIN 20
+#define COMMAND_STATION_RX_PIN 5
+
+
+// Command station protocols built into the firmware. LOCO_BACKEND_RUNTIME
+// keeps every backend and picks one from the configuration; a single
+// protocol (e.g. -DLOCO_BACKEND=LOCO_BACKEND_DCCEX) leaves the others out
+#define LOCO_BACKEND_RUNTIME 0
+#define LOCO_BACKEND_DCCEX 1
+#define LOCO_BACKEND_JMRI 2
+#define LOCO_BACKEND_Z21 3
+#define LOCO_BACKEND_LOCONET 4
+#ifndef LOCO_BACKEND
+#define LOCO_BACKEND LOCO_BACKEND_RUNTIME
+#endif
+
+// Baseline for the command benchmark: 1 sends through the send loop from
+// before LocoCommandBackend, one virtual call per command instead of per flush
+#ifndef LOCO_VIRTUAL_DISPATCH
+#define LOCO_VIRTUAL_DISPATCH 0
+#endif
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <semphr.h>
+
+// Unified configuration of the controller, kept in RAM and stored on
+// LittleFS as a compact binary TLV file:
+//
+//   header:  magic "TCFG" | version u16 | record count u16 | payload length u32 | CRC32 u32
+//   record:  key u8 | type u8 | length u16 | value
+//
+// The CRC covers the header fields and the payload, so a damaged file is
+// rejected as a whole. Changes are committed once they have been quiet for
+// QUIET_PERIOD_MS, through a temporary file renamed over the old one, so a
+// power cut leaves either the old or the new content. JSON is only used to
+// import/export the configuration through the web server and to migrate the
+// old per-manager JSON files once.
+class ConfigStore {
+public:
+    // Stored keys; values are written to flash, never renumber them
+    enum class Key : uint8_t {
+        WIFI_SSID = 1,
+        WIFI_PASSWORD = 2,
+        WIFI_IP = 3,
+        WIFI_MASK = 4,
+        WIFI_ROUTER = 5,
+        WIFI_DNS = 6,
+        WIFI_DHCP = 7,
+        // Last successful association and DHCP lease, reused for a fast
+        // reconnect; runtime cache, left out of the JSON view
+        WIFI_LINK_BSSID = 8,
+        WIFI_LINK_CHANNEL = 9,
+        WIFI_LEASE_IP = 10,
+        WIFI_LEASE_MASK = 11,
+        WIFI_LEASE_ROUTER = 12,
+        WIFI_LEASE_DNS = 13,
+        LOCO_MANAGER_TYPE = 16,
+        LOCO_CONNECTION_URL = 17,
+        LOCO_TRANSPORT = 18,   // "tcp" or "serial" (DCC-EX only)
+        LOCO_BAUD_RATE = 19,
+        FUNCTION_KEY_MAP = 20  // Function keys per loco, see FunctionKeyMap
+    };
+
+    // Binary file and format revision; a file of a newer revision is read
+    // but never rewritten, changes then only last until the next reboot
+    static constexpr const char* FILE_PATH = "/config.bin";
+    static constexpr uint16_t SCHEMA_VERSION = 1;
+
+    // Time without changes before the file is committed
+    static constexpr uint32_t QUIET_PERIOD_MS = 2000;
+
+    // Get the singleton instance
+    static ConfigStore& getInstance() {
+        static ConfigStore instance;
+        return instance;
+    }
+
+    // Delete copy/move constructors and assignment operators
+    ConfigStore(const ConfigStore&) = delete;
+    ConfigStore& operator=(const ConfigStore&) = delete;
+    ConfigStore(ConfigStore&&) = delete;
+    ConfigStore& operator=(ConfigStore&&) = delete;
+
+    // Read the configuration from flash (first access does it otherwise)
+    void load();
+
+    // Start the commit task; changes made before are committed once it runs
+    void start();
+
+    // Typed accessors; a missing key (or one stored with another type) returns the fallback
+    String getString(Key key, const String& fallback = "");
+    int32_t getInt(Key key, int32_t fallback = 0);
+    bool getBool(Key key, bool fallback = false);
+
+    // Setters only mark the store dirty when the value actually changes
+    void setString(Key key, const String& value);
+    void setInt(Key key, int32_t value);
+    void setBool(Key key, bool value);
+
+    // Commit pending changes now
+    void flush();
+
+    // JSON view of the configuration, grouped by section ("wifi", "locoCommandManager");
+    // secrets such as the WiFi password are left out unless asked for
+    void exportJson(JsonDocument& doc, bool includeSecrets = false);
+
+    // Apply the known fields of a JSON document; returns the number of fields applied
+    int importJson(JsonVariantConst doc);
+
+    // Flash commits done and changes absorbed by a later commit
+    uint32_t getCommitCount() const {
+        return commitCount;
+    }
+
+    uint32_t getCoalescedCount() const {
+        return coalescedCount;
+    }
+
+private:
+    ConfigStore() {
+        mutex = xSemaphoreCreateRecursiveMutex();
+        commitMutex = xSemaphoreCreateMutex();
+    }
+
+    enum class Type : uint8_t {
+        INT = 1,
+        BOOL = 2,
+        STRING = 3
+    };
+
+    struct Record {
+        Key key;
+        Type type;
+        int32_t number; // INT and BOOL
+        String text;    // STRING
+    };
+
+    // Upper bounds of the stored data
+    static constexpr int MAX_RECORDS = 24;
+    static constexpr uint32_t MAX_PAYLOAD = 2048;
+    static constexpr uint32_t MAGIC = 0x47464354; // "TCFG"
+    static constexpr uint32_t PERIOD_MS = 250;
+
+    static void storeTask(void* param);
+
+    // Load the binary file (or migrate the JSON files) on first access
+    void ensureLoaded();
+    bool loadBinary();
+    void importLegacyFiles();
+
+    // Record lookup and update, called with the mutex taken
+    Record* find(Key key);
+    Record* findOrAdd(Key key, Type type);
+    void markDirty();
+
+    // Commit if dirty and, unless forced, quiet
+    void commit(bool force);
+    size_t serialize(uint8_t* buffer, size_t capacity);
+    static bool writeAtomically(const String& path, const uint8_t* data, size_t length);
+    static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t length);
+
+    Record records[MAX_RECORDS];
+    int recordCount = 0;
+    bool loaded = false;
+    bool dirty = false;
+    bool newerFile = false; // Written by a newer firmware: read, never overwritten
+    uint32_t lastChange = 0;
+
+    SemaphoreHandle_t mutex = nullptr;       // Guards the records
+    SemaphoreHandle_t commitMutex = nullptr; // Serialises flash commits
+    TaskHandle_t taskHandle = nullptr;
+    volatile uint32_t commitCount = 0;
+    volatile uint32_t coalescedCount = 0;
+};
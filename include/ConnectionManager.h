@@ -0,0 +1,144 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <queue.h>
+#include "LocoCommandManager.h"
+
+class WebServerManager;
+
+// Background state machine keeping WiFi and the command station socket up.
+// It runs on the control core, retries failed attempts with exponential
+// backoff and posts link-state events to the UI, which never blocks on the
+// network itself.
+class ConnectionManager {
+public:
+    // Overall state of the link, as seen by the UI; ordered, each state includes the previous
+    enum class LinkState : uint8_t {
+        OFFLINE,        // Network not requested
+        WIFI_CONNECTING, // Joining the access point
+        WIFI_UP,        // Access point joined, command station not reachable yet
+        ONLINE          // Command station socket connected
+    };
+
+    // Transitions posted to the UI
+    enum class LinkEvent : uint8_t {
+        WIFI_UP,
+        WIFI_DOWN,
+        WIFI_FAILED,    // One join attempt timed out, retrying with backoff
+        STATION_UP,
+        STATION_DOWN,
+        STATION_FAILED  // One socket connect failed, retrying with backoff
+    };
+
+    // Get the singleton instance
+    static ConnectionManager& getInstance() {
+        static ConnectionManager instance;
+        return instance;
+    }
+
+    // Delete copy/move constructors and assignment operators
+    ConnectionManager(const ConnectionManager&) = delete;
+    ConnectionManager& operator=(const ConnectionManager&) = delete;
+    ConnectionManager(ConnectionManager&&) = delete;
+    ConnectionManager& operator=(ConnectionManager&&) = delete;
+
+    // Start the connection task; connects right away if a network is configured
+    void start();
+
+    // Ask for the network to be brought up (and kept up) or taken down
+    void requestConnect();
+    void requestDisconnect();
+
+    // Current link state
+    LinkState getLinkState() const {
+        return linkState.load(std::memory_order_relaxed);
+    }
+
+    // Fetch the next pending event without blocking; false if there is none
+    bool pollEvent(LinkEvent& event);
+
+    // Time from the connect request (or the link loss) to the last WiFi join, in ms,
+    // and whether that join used the cached access point
+    uint32_t getLastJoinTime() const {
+        return lastJoinMs;
+    }
+
+    bool wasLastJoinFast() const {
+        return lastJoinFast;
+    }
+
+private:
+    ConnectionManager() {}
+
+    // Task period and retry timing
+    static constexpr uint32_t PERIOD_MS = 100;
+    static constexpr uint32_t WIFI_JOIN_TIMEOUT_MS = 10000;
+    static constexpr uint32_t INITIAL_BACKOFF_MS = 500;
+    static constexpr uint32_t MAX_BACKOFF_MS = 8000;
+    static constexpr int EVENT_QUEUE_LENGTH = 8;
+
+    enum class Command : uint8_t {
+        CONNECT,
+        DISCONNECT
+    };
+
+    // FreeRTOS task running the state machine
+    static void connectionTask(void* param);
+
+    // One pass of the state machine
+    void step();
+
+    // WiFi and command station halves of the state machine
+    void stepWiFi(uint32_t now);
+    void stepStation(uint32_t now);
+
+    // Bring up the backend of a changed configuration next to the current one
+    // and swap them once it is connected
+    void stepSwap(uint32_t now);
+
+    // Bring the command station link down after WiFi was lost or dropped
+    void dropStation();
+
+    void post(LinkEvent event);
+
+    // Double a backoff delay up to MAX_BACKOFF_MS
+    static uint32_t nextBackoff(uint32_t backoff);
+
+    // Wrap-safe "now has reached deadline"
+    static bool reached(uint32_t now, uint32_t deadline) {
+        return (int32_t)(now - deadline) >= 0;
+    }
+
+    TaskHandle_t taskHandle = nullptr;
+    QueueHandle_t commandQueue = nullptr;
+    QueueHandle_t eventQueue = nullptr;
+    std::atomic<LinkState> linkState{LinkState::OFFLINE};
+
+    // Owned by the connection task
+    bool wifiWanted = false;
+    bool wifiUp = false;
+    bool wifiJoining = false;
+    uint32_t wifiJoinStart = 0;
+    uint32_t wifiNextAttempt = 0;
+    uint32_t wifiBackoffMs = INITIAL_BACKOFF_MS;
+    bool wifiTryFast = true;        // Next join may use the cached access point
+    bool wifiJoinedFast = false;    // Current join used it
+    bool linkRemembered = false;    // Lease of the current join cached (DHCP granted it)
+    uint32_t wifiRequestedAt = 0;   // Start of the time-to-link measurement
+    volatile uint32_t lastJoinMs = 0;
+    volatile bool lastJoinFast = false;
+
+    WebServerManager* webServer = nullptr; // Configuration and latency API, listening while WiFi is up
+
+    LocoCommandManager* station = nullptr; // Manager the link state refers to
+    bool stationUp = false;
+    uint32_t stationNextAttempt = 0;
+    uint32_t stationBackoffMs = INITIAL_BACKOFF_MS;
+
+    LocoCommandManager* swapCandidate = nullptr; // Replacement being connected
+    uint32_t swapNextAttempt = 0;
+    uint32_t swapBackoffMs = INITIAL_BACKOFF_MS;
+};
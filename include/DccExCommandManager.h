@@ -1,25 +1,123 @@
 #pragma once
 
-#include "LocoCommandManager.h"
+#include "LocoCommandBackend.h"
+#include "LineParser.h"
+#include "SerialClient.h"
 #include <Arduino.h> // For Arduino's String class
+#include <WiFi.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <semphr.h>
+
+// Native DCC-EX protocol client over the command station's WiFi/Ethernet port
+class DccExCommandManager final : public LocoCommandBackend<DccExCommandManager> {
+    friend class LocoCommandBackend<DccExCommandManager>;
 
-class DccExCommandManager : public LocoCommandManager {
 public:
+    // Default DCC-EX command port
+    static constexpr uint16_t DEFAULT_PORT = 2560;
+
+    // DCC-EX never talks unprompted: poll it with <#>, which both times the
+    // round trip and keeps the link checked, and drop the socket when nothing
+    // came back for KEEPALIVE_TIMEOUT_MS, so a dead link is noticed
+    static constexpr uint32_t ECHO_INTERVAL_MS = 2000;
+    static constexpr uint32_t KEEPALIVE_TIMEOUT_MS = 15000;
+
+    // Time the station gets to answer the <#> sent when the serial link opens
+    static constexpr uint32_t LINK_PROBE_TIMEOUT_MS = 1000;
+
     // Public constructor
-    DccExCommandManager() {}
-    
+    DccExCommandManager();
+
+    // Use an externally provided transport instead of the internal WiFiClient
+    explicit DccExCommandManager(Client& transport);
+
+    // Talk to the command station over its serial port (COMMAND_STATION_SERIAL)
+    explicit DccExCommandManager(uint32_t serialBaudRate);
+
+    // Talk to the command station over the given UART
+    explicit DccExCommandManager(SerialUART& serial, uint32_t serialBaudRate = SerialClient::DEFAULT_BAUD_RATE);
+
+    ~DccExCommandManager() override;
+
     void connect(const String& connectionUrl) override;
     void disconnect() override;
+    bool isConnected() override;
+    bool usesNetwork() const override;
     void sendCommand(const String& command) override;
 
 protected:
-    void sendSpeedCommand(int speed) override;
-    void sendBrakeCommand(int brake) override;
-    void sendFrontLightsCommand(LightStatus status) override;
-    void sendBackLightsCommand(LightStatus status) override;
-    void sendBellCommand(bool active) override;
-    void sendHornCommand(bool active) override;
+    void acquireLoco(int address) override;
+    void releaseLoco(int address) override;
+    void beginBatch() override;
+    void endBatch() override;
+    void sendSpeedCommand(int address, int speed, bool forward) override;
+    void sendBrakeCommand(int address, int brake) override;
+    void sendFrontLightsCommand(int address, LightStatus status) override;
+    void sendBackLightsCommand(int address, LightStatus status) override;
+    void sendBellCommand(int address, bool active) override;
+    void sendHornCommand(int address, bool active) override;
+    void sendFunctionGroup(int address, int group, uint8_t states) override;
+    void sendEmergencyStop() override;
+    uint8_t confirmedFields() const override;
+    bool supportsNativeConsist() const override;
+    void sendNativeConsist(int consistAddress, const ConsistMember* members, int count, bool active) override;
 
 private:
     String lightStatusToString(LightStatus status);
-};
\ No newline at end of file
+
+    // Send <#> on a freshly opened serial link and wait for the station's
+    // answer. Called from connect() with clientMutex held
+    bool probeLink();
+
+    // Send a command, or append it to the open batch
+    void queueCommand(const String& command);
+
+    // Set a function of the given loco
+    void sendFunctionCommand(int address, int function, bool active);
+
+    // Function groups <f> accepts (F0-F28)
+    static constexpr int LEGACY_FUNCTION_GROUPS = 5;
+
+    // Parse a "<l cab reg speedByte functMap>" loco state broadcast
+    static bool parseLocoState(const char* line, StateReport& report);
+
+    // Roster sync: "<jR id1 id2 ...>" lists the roster, only the entries the
+    // cache lacks are asked for with <JR id>, answered by "<jR id "name" "functions">".
+    // The cache is only rewritten when the list changed. Called by the session
+    // task with clientMutex released, as it reads and writes the roster file.
+    // A list longer than the parser's line (about 50 locos) is dropped and the
+    // cached roster is kept as it was
+    void handleRosterLine(const char* line);
+
+    // Give up on roster entries that never came
+    static constexpr uint32_t ROSTER_TIMEOUT_MS = 5000;
+
+    // Pass period of the session task
+    static constexpr uint32_t SESSION_PERIOD_MS = 20;
+
+    // FreeRTOS task draining the socket and sending keepalives
+    static void sessionTask(void* param);
+
+    WiFiClient ownClient;
+    SerialClient serialClient;
+    Client* client;
+
+    SemaphoreHandle_t clientMutex = nullptr;  // Serialises access from UI and session tasks
+    volatile bool opening = false;            // connect() holds clientMutex while opening the link
+
+    LineParser<256> parser; // Fits the roster list of about 50 locos, longer lists are dropped
+    unsigned long lastReceive = 0;
+    unsigned long lastKeepalive = 0;
+    bool keepaliveAnswered = true; // The <# n> reply to the last <#> came back
+
+    // Roster entries asked for and not answered yet, owned by the session task
+    // (disconnect() only touches them once the task stopped)
+    int rosterPending = 0;
+    uint32_t rosterEtag = 0;
+    unsigned long rosterRequestedAt = 0;
+
+    // Commands collected between beginBatch() and endBatch()
+    String batchBuffer;
+    bool batching = false;
+};
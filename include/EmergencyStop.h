@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Arduino.h>
+#include "SeqLock.h"
+
+// Emergency stop, the shortest path from the keyboard to the command station.
+// The input sampler triggers it from its own task on the control core as soon
+// as a sample shows the stop key or the brake chord (both brake keys), so no
+// queue, batch, rate limit or UI pass sits in between. Every use records the
+// time from that sample to the end of the socket write against LATENCY_BUDGET_US.
+class EmergencyStop {
+public:
+    // Sample to wire; the key itself is seen at most one sampling period earlier
+    static constexpr uint32_t LATENCY_BUDGET_US = 5000;
+
+    struct Stats {
+        uint32_t count = 0;
+        uint32_t lastMicros = 0;
+        uint32_t worstMicros = 0;
+        uint32_t overBudget = 0; // Uses slower than LATENCY_BUDGET_US
+    };
+
+    // Get the singleton instance
+    static EmergencyStop& getInstance() {
+        static EmergencyStop instance;
+        return instance;
+    }
+
+    // Delete copy/move constructors and assignment operators
+    EmergencyStop(const EmergencyStop&) = delete;
+    EmergencyStop& operator=(const EmergencyStop&) = delete;
+    EmergencyStop(EmergencyStop&&) = delete;
+    EmergencyStop& operator=(EmergencyStop&&) = delete;
+
+    // Whether a key state asks for an emergency stop
+    static bool isRequested(uint16_t keys);
+
+    // Stop every loco now; sampledAt is the micros() of the key sample asking for it.
+    // Called by the input sampler only
+    void trigger(uint32_t sampledAt);
+
+    // Latency of the uses so far
+    Stats getStats() const {
+        return stats.read();
+    }
+
+private:
+    EmergencyStop() {}
+
+    SeqLock<Stats> stats;
+};
@@ -10,6 +10,7 @@ namespace ExtendedKeys {
         
         // You can add more keys if needed
         KEY_HORN = 128,         // Weight: 128
-        KEY_BELL = 256          // Weight: 256
+        KEY_BELL = 256,         // Weight: 256
+        KEY_ESTOP = 512         // Weight: 512
     };
 }
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <Arduino.h>
+
+// DCC functions driven by the function keys of the cab (horn, bell), per loco.
+// The map is stored in the configuration as text, e.g.
+//
+//   "*:horn=2,bell=1;1234:horn=3,bell=8"
+//
+// An entry for an address overrides the "*" defaults, which themselves fall
+// back to F2 for the horn and F1 for the bell. Used by the UI task only.
+class FunctionKeyMap {
+public:
+    // Get the singleton instance
+    static FunctionKeyMap& getInstance() {
+        static FunctionKeyMap instance;
+        return instance;
+    }
+
+    // Delete copy/move constructors and assignment operators
+    FunctionKeyMap(const FunctionKeyMap&) = delete;
+    FunctionKeyMap& operator=(const FunctionKeyMap&) = delete;
+    FunctionKeyMap(FunctionKeyMap&&) = delete;
+    FunctionKeyMap& operator=(FunctionKeyMap&&) = delete;
+
+    // Function a key drives on the given loco, -1 if it is not a function key
+    int functionFor(int address, uint16_t key);
+
+    // The horn sounds while its key is held, other function keys toggle their function
+    static bool isMomentary(uint16_t key);
+
+private:
+    FunctionKeyMap() {}
+
+    static constexpr int MAX_ENTRIES = 16;
+    static constexpr int DEFAULT_HORN_FUNCTION = 2;
+    static constexpr int DEFAULT_BELL_FUNCTION = 1;
+
+    struct Entry {
+        int address;     // 0 for the "*" defaults
+        uint16_t key;
+        uint8_t function;
+    };
+
+    // Parse the stored map again when the configuration changed it
+    void reload();
+
+    // Key named in the map ("horn", "bell"), 0 if unknown
+    static uint16_t keyFromName(const String& name);
+
+    Entry entries[MAX_ENTRIES];
+    int entryCount = 0;
+    String source;
+    bool loaded = false;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <IKeyboard.h>
+#include <Arduino.h>
+#include <atomic>
+#include <FreeRTOS.h>
+#include <task.h>
+#include "AnalogSwitch.h"
+
+// Scans the keyboard on the control core and publishes the latest key state.
+// The UI reads the published state through the IKeyboard interface, so it
+// never touches the GPIOs or the analog switch itself. An emergency stop is
+// not left to the UI: the sampler triggers it from the sample that shows it.
+class InputSampler : public IKeyboard {
+public:
+    // Sampling period of the keyboard
+    static constexpr uint32_t SAMPLE_PERIOD_MS = 5;
+
+    InputSampler(IKeyboard* source, AnalogSwitch* analogSwitch);
+    ~InputSampler();
+
+    // Start the sampling task
+    void start();
+
+    // Latest sampled keys
+    uint16_t getPressedKeys() override;
+
+private:
+    static void sampleTask(void* param);
+
+    IKeyboard* source;
+    AnalogSwitch* analogSwitch;
+    TaskHandle_t taskHandle = nullptr;
+    std::atomic<uint16_t> keys{0};
+    bool stopHeld = false; // Emergency stop keys down in the last sample
+};
@@ -1,25 +1,105 @@
 #pragma once
 
-#include "LocoCommandManager.h"
+#include "LocoCommandBackend.h"
+#include "LineParser.h"
 #include <Arduino.h> // For Arduino's String class
+#include <WiFi.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <semphr.h>
+
+// WiThrottle client for JMRI (and compatible servers such as DCC-EX's WiThrottle port)
+class JMRICommandManager final : public LocoCommandBackend<JMRICommandManager> {
+    friend class LocoCommandBackend<JMRICommandManager>;
 
-class JMRICommandManager : public LocoCommandManager {
 public:
-    // Public constructor 
-    JMRICommandManager() {}
-    
+    // Default WiThrottle server port
+    static constexpr uint16_t DEFAULT_PORT = 12090;
+
+    // Public constructor
+    JMRICommandManager();
+
+    // Use an externally provided transport instead of the internal WiFiClient
+    // (e.g. a scripted WiThrottle stand-in on the host)
+    explicit JMRICommandManager(Client& transport);
+
+    ~JMRICommandManager() override;
+
     void connect(const String& connectionUrl) override;
     void disconnect() override;
     void sendCommand(const String& command) override;
 
+    // Check if the WiThrottle session is up
+    bool isConnected() override;
+
 protected:
-    void sendSpeedCommand(int speed) override;
-    void sendBrakeCommand(int brake) override;
-    void sendFrontLightsCommand(LightStatus status) override;
-    void sendBackLightsCommand(LightStatus status) override;
-    void sendBellCommand(bool active) override;
-    void sendHornCommand(bool active) override;
+    void acquireLoco(int address) override;
+    void releaseLoco(int address) override;
+    void beginBatch() override;
+    void endBatch() override;
+    void sendSpeedCommand(int address, int speed, bool forward) override;
+    void sendBrakeCommand(int address, int brake) override;
+    void sendFrontLightsCommand(int address, LightStatus status) override;
+    void sendBackLightsCommand(int address, LightStatus status) override;
+    void sendBellCommand(int address, bool active) override;
+    void sendHornCommand(int address, bool active) override;
+    void sendFunctionGroup(int address, int group, uint8_t states) override;
+    void sendEmergencyStop() override;
+    uint8_t confirmedFields() const override;
 
 private:
     String lightStatusToString(LightStatus status);
-};
\ No newline at end of file
+
+    // Throttle key of an address ("S3", "L1234")
+    static String locoKey(int address);
+
+    // Send a command, or append it to the open batch
+    void queueCommand(const String& command);
+
+    // Send a forced function state for the given loco
+    void sendFunctionCommand(int address, int function, bool active);
+
+    // Handle one complete line received from the server; true if it reported
+    // the state of one of our locos (speed, direction or a function)
+    bool handleLine(const char* line, size_t length, StateReport& report);
+
+    // "RL<count>]\[name}|{address}|{L]\[...": the server's roster, sent after
+    // connecting; the cache is only rewritten when the line changed. Called by
+    // the session task with clientMutex released. A roster longer than the
+    // parser's line (about 40 locos) is dropped and the cache kept as it was
+    static void handleRoster(const char* line);
+
+    // TCP keepalive: probe after 5 s idle, every 2 s, give up after 3 misses
+    static constexpr int KEEPALIVE_IDLE_S = 5;
+    static constexpr int KEEPALIVE_INTERVAL_S = 2;
+    static constexpr int KEEPALIVE_COUNT = 3;
+
+    // Pass period of the session task
+    static constexpr uint32_t SESSION_PERIOD_MS = 20;
+
+    // FreeRTOS task reading the socket and sending heartbeats
+    static void sessionTask(void* param);
+
+    WiFiClient ownClient;
+    Client* client;
+
+    SemaphoreHandle_t clientMutex = nullptr;  // Serialises writes from UI and session tasks
+    volatile bool opening = false;            // connect() holds clientMutex for the TCP connect
+
+    LineParser<1024> parser; // The roster line is the longest, about 40 locos fit
+    String rosterLine;       // Roster line of the current pass, owned by the session task
+
+    // Heartbeat interval requested by the server (0 = not required)
+    volatile uint32_t heartbeatIntervalMs = 0;
+    unsigned long lastHeartbeat = 0;
+
+    // Lines collected between beginBatch() and endBatch()
+    String batchBuffer;
+    bool batching = false;
+
+    // Round trip probe: a speed query ("MTA*<;>qV") answered with one
+    // "MTA<key><;>V<speed>" line per loco; needs a loco on the throttle
+    static constexpr uint32_t ECHO_INTERVAL_MS = 2000;
+    bool echoPending = false;     // Owned by the session task
+    unsigned long echoSentAt = 0;
+};
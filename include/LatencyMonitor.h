@@ -0,0 +1,57 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FreeRTOS.h>
+#include <semphr.h>
+
+// Round trip statistics of the command station link: a fixed-bucket
+// histogram over the whole session plus the last samples in a ring buffer.
+// Samples come from the backend's session task, the UI and the web server
+// read consistent snapshots.
+class LatencyMonitor {
+public:
+    // Upper bound of each histogram bucket in ms; the last bucket is open-ended
+    static constexpr int BUCKET_COUNT = 8;
+    static constexpr uint16_t BUCKET_LIMITS_MS[BUCKET_COUNT - 1] = {5, 10, 20, 50, 100, 200, 500};
+
+    // Number of recent samples kept
+    static constexpr int HISTORY_SIZE = 32;
+
+    struct Snapshot {
+        uint32_t buckets[BUCKET_COUNT] = {0};
+        uint16_t history[HISTORY_SIZE] = {0}; // Oldest first
+        int historyCount = 0;
+        uint32_t samples = 0;
+        uint32_t timeouts = 0; // Probes that got no reply
+        uint32_t minMs = 0;
+        uint32_t maxMs = 0;
+        uint32_t averageMs = 0;
+    };
+
+    LatencyMonitor();
+    ~LatencyMonitor();
+
+    LatencyMonitor(const LatencyMonitor&) = delete;
+    LatencyMonitor& operator=(const LatencyMonitor&) = delete;
+
+    // Add a measured round trip
+    void record(uint32_t ms);
+
+    // Count a probe whose reply never came
+    void recordTimeout();
+
+    // Forget every sample
+    void reset();
+
+    // Consistent copy of the statistics
+    Snapshot snapshot() const;
+
+    // "<5", "<10", ..., ">=500"
+    static String bucketLabel(int bucket);
+
+private:
+    SemaphoreHandle_t mutex = nullptr;
+    Snapshot data;
+    int historyHead = 0;   // Next write position
+    uint64_t totalMs = 0;
+};
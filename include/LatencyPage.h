@@ -0,0 +1,39 @@
+#pragma once
+
+#include <IPage.h>
+#include <Arduino.h>
+#include "LatencyMonitor.h"
+#include "EmergencyStop.h"
+
+// Diagnostics of the command station round trips: histogram of every
+// sample of the session, the recent samples as a strip chart and the
+// summary figures, plus the key-to-wire time of the emergency stops.
+// Refreshed as new samples arrive; OK goes back. The address of
+// /api/latency is shown while WiFi is up.
+class LatencyPage : public IPage {
+public:
+    LatencyPage();
+
+    void draw() override;
+    void handleInput(IKeyboard* keyboard) override;
+
+private:
+    // Samples + timeouts + emergency stops of the data on screen, to spot new ones
+    uint32_t shownCount = 0;
+    LatencyMonitor::Snapshot stats;
+    EmergencyStop::Stats stopStats;
+    String apiUrl; // Where WebServerManager serves these figures, empty without WiFi
+
+    // Re-read the monitor of the current backend
+    void refresh();
+
+    // Screen areas
+    static constexpr int HISTOGRAM_X = 50;
+    static constexpr int HISTOGRAM_Y = 40;
+    static constexpr int BAR_HEIGHT = 12;
+    static constexpr int BAR_MAX_WIDTH = 140;
+    static constexpr int CHART_X = 10;
+    static constexpr int CHART_Y = 150;
+    static constexpr int CHART_WIDTH = 300;
+    static constexpr int CHART_HEIGHT = 60;
+};
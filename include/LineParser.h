@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Incremental line assembler over a fixed buffer.
+// Bytes are fed as they arrive from the socket and the callback is invoked
+// once per complete line, without any heap allocation. Lines longer than the
+// buffer are dropped up to the next terminator.
+template <size_t Capacity>
+class LineParser {
+public:
+    // Feed raw bytes; onLine(const char* line, size_t length) is called for
+    // every complete line. The line is NUL-terminated and only valid during the call.
+    template <typename Callback>
+    void feed(const uint8_t* data, size_t length, Callback&& onLine) {
+        for (size_t i = 0; i < length; i++) {
+            char c = static_cast<char>(data[i]);
+
+            if (c == '\n' || c == '\r') {
+                if (!overflow && used > 0) {
+                    buffer[used] = '\0';
+                    onLine(static_cast<const char*>(buffer), used);
+                }
+                used = 0;
+                overflow = false;
+                continue;
+            }
+
+            if (overflow) {
+                continue; // Skip the rest of an oversized line
+            }
+
+            if (used < Capacity - 1) {
+                buffer[used++] = c;
+            } else {
+                overflow = true;
+            }
+        }
+    }
+
+    // Discard any partially received line
+    void reset() {
+        used = 0;
+        overflow = false;
+    }
+
+private:
+    char buffer[Capacity];
+    size_t used = 0;
+    bool overflow = false;
+};
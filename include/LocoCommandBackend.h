@@ -0,0 +1,90 @@
+#pragma once
+
+#include "LocoCommandManager.h"
+
+// Compile-time half of a protocol backend (CRTP). Backend is the final
+// backend class: the send loop of a flush is instantiated on it, so every
+// encode call (sendSpeedCommand, batching, ...) is resolved statically and
+// can be inlined, leaving one virtual call per flush instead of one per
+// command. A backend derives from LocoCommandBackend<Self>, is declared
+// final and befriends its base so the loop can reach its protected hooks.
+// LOCO_VIRTUAL_DISPATCH swaps in the per-command virtual loop, to measure
+// against; the two loops must send the same commands.
+template <typename Backend>
+class LocoCommandBackend : public LocoCommandManager {
+protected:
+    bool sendDirtySlots(uint32_t now, bool singleBatch) override final {
+#if LOCO_VIRTUAL_DISPATCH
+        return sendDirtySlotsVirtual(now, singleBatch);
+#else
+        Backend& self = static_cast<Backend&>(*this);
+        bool sentAny = false;
+
+        if (singleBatch) {
+            self.beginBatch();
+        }
+        for (LocoSlot& slot : slots) {
+            if (slot.address == 0 || slot.dirty == 0) {
+                continue;
+            }
+
+            uint8_t dirty = slot.dirty;
+            slot.dirty = 0;
+
+            if (!singleBatch) {
+                self.beginBatch();
+            }
+            if (dirty & DIRTY_SPEED) {
+                self.sendSpeedCommand(slot.address, slot.speed, slot.forward);
+
+                // Software consist: every member in the same write, scaled and oriented
+                if (!slot.nativeConsist) {
+                    for (int i = 0; i < slot.consistSize; i++) {
+                        const ConsistMember& member = slot.consist[i];
+                        int memberSpeed = min(slot.speed * member.speedScale / 100, MAX_SPEED_STEP);
+                        self.sendSpeedCommand(member.address, memberSpeed, slot.forward != member.reversed);
+                    }
+                }
+            }
+            if (dirty & DIRTY_BRAKE) self.sendBrakeCommand(slot.address, slot.brake);
+
+            // One write per changed function group; the F0-F4 group carries
+            // the cab controls too, which then need no command of their own
+            uint8_t single = dirty;
+            if (dirty & DIRTY_FUNCTIONS) {
+                uint16_t groups = slot.dirtyGroups;
+                slot.dirtyGroups = 0;
+                for (int group = 0; group < FUNCTION_GROUPS; group++) {
+                    if (groups & (1 << group)) {
+                        self.sendFunctionGroup(slot.address, group, functionGroupStates(slot, group));
+                    }
+                }
+                if (groups & 1) {
+                    single &= ~(DIRTY_FRONT_LIGHTS | DIRTY_BACK_LIGHTS | DIRTY_BELL | DIRTY_HORN);
+                }
+            }
+            if (single & DIRTY_FRONT_LIGHTS) self.sendFrontLightsCommand(slot.address, slot.frontLights);
+            if (single & DIRTY_BACK_LIGHTS) self.sendBackLightsCommand(slot.address, slot.backLights);
+            if (single & DIRTY_BELL) self.sendBellCommand(slot.address, slot.bell);
+            if (single & DIRTY_HORN) self.sendHornCommand(slot.address, slot.horn);
+            if (!singleBatch) {
+                self.endBatch();
+            }
+
+            slot.sent |= dirty;
+            sentAny = true;
+
+            // Wait for the command station to confirm the values it reports back
+            uint8_t tracked = dirty & self.confirmedFields();
+            if (tracked) {
+                slot.pending |= tracked;
+                slot.pendingSince = now;
+            }
+        }
+        if (singleBatch) {
+            self.endBatch();
+        }
+        return sentAny;
+#endif
+    }
+};
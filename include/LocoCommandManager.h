@@ -1,7 +1,13 @@
 #pragma once
 
-#include <optional>
 #include <Arduino.h> // For Arduino's String class
+#include <atomic>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <semphr.h>
+#include <queue.h>
+#include "Config.h"
+#include "LatencyMonitor.h"
 
 class LocoCommandManager {
 public:
@@ -13,13 +19,84 @@ public:
         DITCHES
     };
 
+    // Address acquired when no other locomotive has been selected
+    static constexpr int DEFAULT_LOCO_ADDRESS = 3;
+
+    // Highest DCC speed step (128 step mode)
+    static constexpr int MAX_SPEED_STEP = 126;
+
+    // Maximum number of locomotives held by the throttle at once
+    static constexpr int MAX_LOCO_SLOTS = 4;
+
+    // Maximum number of locos added to the lead loco of a consist
+    static constexpr int MAX_CONSIST_MEMBERS = 4;
+
+    // Highest DCC function, and the groups DCC sends them in: F0-F4, F5-F8,
+    // F9-F12, F13-F20, F21-F28, then eight per group up to F68
+    static constexpr int MAX_FUNCTION = 68;
+    static constexpr int FUNCTION_GROUPS = 10;
+
+    // Bits marking which cached values of a slot still have to be sent
+    enum DirtyField : uint8_t {
+        DIRTY_SPEED = 1 << 0,
+        DIRTY_BRAKE = 1 << 1,
+        DIRTY_FRONT_LIGHTS = 1 << 2,
+        DIRTY_BACK_LIGHTS = 1 << 3,
+        DIRTY_BELL = 1 << 4,
+        DIRTY_HORN = 1 << 5,
+        DIRTY_FUNCTIONS = 1 << 6, // Function groups listed in LocoSlot::dirtyGroups
+        DIRTY_ALL = 0x7F
+    };
+
+    // Slot values changed by the command station (another throttle, a restart)
+    struct StateChange {
+        int address;
+        uint8_t fields; // DIRTY_* bits of the values that changed
+    };
+
+    // Loco running in multiple with the lead loco of a slot
+    struct ConsistMember {
+        int address = 0;
+        bool reversed = false;   // Runs in the opposite direction of the lead
+        uint8_t speedScale = 100; // Percentage of the lead speed step
+    };
+
+    // Cached state of one acquired locomotive
+    struct LocoSlot {
+        int address = 0; // 0 marks a free slot
+        int speed = 0;   // DCC speed step (0-126)
+        bool forward = true;
+        int brake = 0;
+        LightStatus frontLights = LightStatus::OFF;
+        LightStatus backLights = LightStatus::OFF;
+        bool bell = false;
+        bool horn = false;
+        bool stopHeld = false; // Emergency stopped: speeds are ignored until the stop is confirmed
+        uint32_t functions[3] = {0, 0, 0}; // F4-F68, bit n for Fn; F0-F3 are the cab controls above
+        uint16_t dirtyGroups = 0;  // Function groups changed since the last flush
+        uint8_t dirty = 0;     // Values changed since the last flush
+        uint8_t sent = 0;      // Values sent at least once to the command station
+        uint8_t pending = 0;   // Values sent but not confirmed by the command station yet
+        uint8_t retries = 0;   // Retransmissions of the pending values so far
+        uint32_t pendingSince = 0; // millis() of the last send of pending values
+
+        // Consist led by this loco
+        ConsistMember consist[MAX_CONSIST_MEMBERS];
+        uint8_t consistSize = 0;
+        bool nativeConsist = false; // Consisting done by the decoders (CV19)
+    };
+
     // Delete copy/move constructors and assignment operators to prevent duplication
     LocoCommandManager(const LocoCommandManager&) = delete;
     LocoCommandManager& operator=(const LocoCommandManager&) = delete;
     LocoCommandManager(LocoCommandManager&&) = delete;
     LocoCommandManager& operator=(LocoCommandManager&&) = delete;
 
-    virtual ~LocoCommandManager() {}
+    virtual ~LocoCommandManager() {
+        vSemaphoreDelete(stateMutex);
+        vSemaphoreDelete(sessionExited);
+        vQueueDelete(changeQueue);
+    }
 
     // Connect to the system with the specified connection URL
     virtual void connect(const String& connectionUrl) = 0;
@@ -27,12 +104,47 @@ public:
     // Disconnect from the system
     virtual void disconnect() = 0;
 
+    // Check if the command station link is up
+    virtual bool isConnected() = 0;
+
+    // Whether the link runs over WiFi; a wired link is kept up without it
+    virtual bool usesNetwork() const { return true; }
+
     // Send a generic command
     virtual void sendCommand(const String& command) = 0;
 
-    // Set speed value (0-100%)
+    // Valid DCC addresses are 1-10239
+    static bool isValidAddress(int address) {
+        return address >= 1 && address <= 10239;
+    }
+
+    // Make the given address the active loco, acquiring a slot for it if needed.
+    // Returns false if the address is invalid.
+    bool selectLoco(int address);
+
+    // Make an already acquired slot the active one (no command station traffic)
+    bool selectSlot(int index);
+
+    // Index of the active slot, -1 if no loco is selected. Like getSlot(), for
+    // the control core only: the UI reads TrainSimulator's copy of the slot
+    int getActiveSlotIndex() const {
+        return activeSlot;
+    }
+
+    // Read access to a slot of the table
+    const LocoSlot& getSlot(int index) const {
+        return slots[index];
+    }
+
+    // Consistent copy of the active slot, an empty one (address 0) if no loco is selected
+    LocoSlot copyActiveSlot();
+
+    // Set speed as a DCC speed step (0-126)
     void setSpeed(int speed);
 
+    // Set direction of travel
+    void setDirection(bool forward);
+
     // Set brake value (0-100%)
     void setBrake(int brake);
 
@@ -48,23 +160,278 @@ public:
     // Activate or deactivate the horn
     void setHorn(bool active);
 
+    // Switch a function (F0-F68) of the active loco; F0-F3 go to the cab
+    // controls above. Functions changed before the next flush are sent as one
+    // write per function group
+    void setFunction(int function, bool active);
+
+    // State of a function of the active loco
+    bool getFunction(int function);
+
+    // Stop every loco on the command station at once, ahead of anything queued
+    // or batched: the stop is written before the slot table is locked. The
+    // slots stay at speed 0, ignoring new speeds, until the
+    // command station reports each loco stopped (with a backend that reports
+    // no speeds, until the active loco is given a zero speed again), so a
+    // stale speed cannot restart them
+    void emergencyStop();
+
+    // Add a loco to the consist led by the active loco
+    bool addConsistMember(int address, bool reversed, int speedScale);
+
+    // Stop the members and dissolve the consist of the active loco
+    void clearConsist();
+
+    // Send every pending change, one batched write per slot. While the link is
+    // down nothing is sent: the changes stay in the slot table
+    void flush();
+
+    // Radio hooks, installed by the factory on the backends it builds: flushes
+    // that sent commands are reported, so the radio can leave power save while
+    // they flow, and round trips are averaged per radio mode. A backend built
+    // outside the factory (the command benchmark) has none
+    struct RadioHooks {
+        void (*commandsSent)() = nullptr;
+        bool (*lowLatency)() = nullptr;
+    };
+
+    void setRadioHooks(const RadioHooks& hooks) {
+        radioHooks = hooks;
+    }
+
+    // Round trip of commands answered by the command station, in ms: last sample
+    // and running average per radio mode (power save / low latency)
+    uint32_t getLastRoundTrip() const {
+        return lastRoundTripMs;
+    }
+
+    uint32_t getAverageRoundTrip(bool lowLatency) const {
+        return averageRoundTripMs[lowLatency ? 1 : 0];
+    }
+
+    // Histogram and recent history of the round trips
+    LatencyMonitor& getLatencyMonitor() {
+        return latency;
+    }
+
+    // Values retransmitted because no confirmation came back in time
+    uint32_t getRetryCount() const {
+        return retryCount;
+    }
+
+    // Changes replaced by a later one before being sent (mostly while offline)
+    uint32_t getCoalescedCount() const {
+        return coalescedCount;
+    }
+
+    // Times the command station reported a state changed outside the throttle
+    // or never confirmed a value despite the retries
+    uint32_t getDivergenceCount() const {
+        return divergenceCount;
+    }
+
+    // Fetch the next slot change reported by the command station without blocking;
+    // false if there is none. Meant for a single consumer, the driver page
+    bool pollStateChange(StateChange& change);
+
 protected:
+    // Builds backends and hands the slot table over between them
+    friend class LocoCommandManagerFactory;
+
     // Protected constructor for singleton pattern
-    LocoCommandManager() {}
+    LocoCommandManager() {
+        stateMutex = xSemaphoreCreateRecursiveMutex();
+        sessionExited = xSemaphoreCreateBinary();
+        changeQueue = xQueueCreate(CHANGE_QUEUE_LENGTH, sizeof(StateChange));
+    }
+
+    // DCC function numbers driven by the cab controls
+    static constexpr int FRONT_LIGHTS_FUNCTION = 0;
+    static constexpr int BELL_FUNCTION = 1;
+    static constexpr int HORN_FUNCTION = 2;
+    static constexpr int BACK_LIGHTS_FUNCTION = 3;
 
-    // State variables to track the last sent values
-    std::optional<int> lastSpeed;
-    std::optional<int> lastBrake;
-    std::optional<LightStatus> lastFrontLights;
-    std::optional<LightStatus> lastBackLights;
-    std::optional<bool> lastBell;
-    std::optional<bool> lastHorn;
+    // First function of each group, and one past the last of the last group
+    static constexpr uint8_t FUNCTION_GROUP_FIRST[FUNCTION_GROUPS + 1] = {0, 5, 9, 13, 21, 29, 37, 45, 53, 61, 69};
+
+    // Group a function belongs to
+    static int functionGroup(int function);
+
+    // Functions of a group as set on a slot, the first function of the group in bit 0
+    static uint8_t functionGroupStates(const LocoSlot& slot, int group);
+
+    // DCC instruction bytes setting a function group, as carried by DCC-EX <f>
+    // and LocoNet immediate packets (F0 in bit 4 of the first group); returns the length
+    static size_t dccFunctionInstruction(int group, uint8_t states, uint8_t* instruction);
+
+    // Wait for a confirmation before retransmitting, and retransmissions before giving up
+    static constexpr uint32_t ACK_TIMEOUT_MS = 1000;
+    static constexpr uint8_t MAX_RETRIES = 3;
+
+    // State of a loco as reported by the command station; parts not carried
+    // by the message are left unknown
+    struct StateReport {
+        int address = 0;
+        int speed = -1;           // Speed step, -1 if unknown
+        int8_t forward = -1;      // 1 forward, 0 reverse, -1 if unknown
+        uint32_t functionMask = 0;   // Functions (F0-F31) the report carries
+        uint32_t functionStates = 0;
+    };
+
+    // Reports a session task collects in one pass before applying them
+    static constexpr int MAX_REPORTS_PER_PASS = 8;
+
+    // Guards the slot table; the UI and simulation tasks both drive it
+    SemaphoreHandle_t stateMutex = nullptr;
+
+    // Holds stateMutex for the lifetime of the object
+    class StateLock {
+    public:
+        explicit StateLock(SemaphoreHandle_t mutex) : mutex(mutex) {
+            xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+        }
+        ~StateLock() {
+            xSemaphoreGiveRecursive(mutex);
+        }
+    private:
+        SemaphoreHandle_t mutex;
+    };
+
+    // Session task of a backend, reading the link on the control core. It is
+    // never deleted from outside: a task stopped while applying a report would
+    // leave stateMutex taken. Instead it checks sessionRunning() at the start of
+    // every pass, where it holds no lock, and ends itself with endSession()
+    void startSession(TaskFunction_t task, const char* name);
+    bool sessionRunning() const {
+        return sessionActive.load(std::memory_order_acquire);
+    }
+    void endSession();
+
+    // Ask the session task to stop and wait until it has; must not be called
+    // with stateMutex held, the task may be waiting for it
+    void stopSession();
+
+    // Slot table keyed by DCC address
+    LocoSlot slots[MAX_LOCO_SLOTS];
+    int activeSlot = -1;
+    int nextEvictSlot = 0;
+
+    // Mark every slot as never sent so the full state goes out on the next flush
+    void invalidateSlots();
+
+    // Send the full desired state of every slot in a single write, on reconnect
+    void replayState();
+
+    // Adopt the slot table of the backend being replaced (stateMutex of both
+    // held by the caller); when already connected, acquires the locos and sends it
+    void takeOver(const LocoCommandManager& previous);
+
+    // Match a report against the slot of its loco: confirms pending values and
+    // takes over values changed outside the throttle, posting a StateChange.
+    // Takes stateMutex, so backends call it without their client mutex held
+    void applyReport(const StateReport& report);
+
+    // Send every value of the slot driving an address (as lead or consist member)
+    // again, for backends that only become able to reach a loco after acquiring it.
+    // Takes stateMutex, so backends call it without their client mutex held
+    void resendLoco(int address);
+
+    // Values whose confirmations the backend reports; the others are never tracked
+    virtual uint8_t confirmedFields() const { return 0; }
+
+    // Add a round trip measured by the backend's echo probe, or count a probe left unanswered
+    void recordRoundTrip(uint32_t ms);
+    void recordRoundTripTimeout();
+
+    // Acquire/release a locomotive on the command station
+    virtual void acquireLoco(int address) = 0;
+    virtual void releaseLoco(int address) = 0;
+
+    // Send the dirty values of every slot, one write per slot or one in all;
+    // true if anything was sent. Implemented by LocoCommandBackend
+    virtual bool sendDirtySlots(uint32_t now, bool singleBatch) = 0;
+
+#if LOCO_VIRTUAL_DISPATCH
+    // The loop of LocoCommandBackend built here, where no backend is known, so
+    // every encode call goes through the vtable (see LOCO_VIRTUAL_DISPATCH)
+    bool sendDirtySlotsVirtual(uint32_t now, bool singleBatch);
+#endif
+
+    // Bracket the commands of one slot so the backend can send them as a single write
+    virtual void beginBatch() {}
+    virtual void endBatch() {}
+
+    // Native consisting support; when available, a consist whose members all run
+    // at full scale is set up once in the decoders and driven through the lead address
+    virtual bool supportsNativeConsist() const { return false; }
+    virtual void sendNativeConsist(int consistAddress, const ConsistMember* members, int count, bool active) {}
 
     // Pure virtual methods for derived classes to implement specific commands
-    virtual void sendSpeedCommand(int speed) = 0;
-    virtual void sendBrakeCommand(int brake) = 0;
-    virtual void sendFrontLightsCommand(LightStatus status) = 0;
-    virtual void sendBackLightsCommand(LightStatus status) = 0;
-    virtual void sendBellCommand(bool active) = 0;
-    virtual void sendHornCommand(bool active) = 0;
-};
\ No newline at end of file
+    virtual void sendSpeedCommand(int address, int speed, bool forward) = 0;
+    virtual void sendBrakeCommand(int address, int brake) = 0;
+    virtual void sendFrontLightsCommand(int address, LightStatus status) = 0;
+    virtual void sendBackLightsCommand(int address, LightStatus status) = 0;
+    virtual void sendBellCommand(int address, bool active) = 0;
+    virtual void sendHornCommand(int address, bool active) = 0;
+
+    // Set every function of a group at once; states as given by functionGroupStates()
+    virtual void sendFunctionGroup(int address, int group, uint8_t states) = 0;
+
+    // Write the protocol's stop-all-locos command to the link right away,
+    // bypassing any open batch. Called without stateMutex, so it takes no
+    // lock but the one guarding the link
+    virtual void sendEmergencyStop() = 0;
+
+private:
+    volatile uint32_t lastRoundTripMs = 0;
+    volatile uint32_t averageRoundTripMs[2] = {0, 0};
+    LatencyMonitor latency;
+    volatile uint32_t retryCount = 0;
+    volatile uint32_t divergenceCount = 0;
+    volatile uint32_t coalescedCount = 0;
+    RadioHooks radioHooks;
+
+    // Schedule the retransmission of values left unconfirmed for ACK_TIMEOUT_MS
+    void checkConfirmations(uint32_t now);
+
+    // Emergency stops written so far, counted without stateMutex, and the last
+    // one the slot table was brought to (under stateMutex)
+    std::atomic<uint32_t> stopGeneration{0};
+    uint32_t heldGeneration = 0;
+
+    // Zero and hold every slot's speed once per emergency stop written,
+    // dropping the speeds not sent yet; called under stateMutex by whoever
+    // uses the table first after the stop
+    void holdStoppedSlots();
+
+    // sendDirtySlots() guarded against a stop written while it runs
+    bool sendSlots(uint32_t now, bool singleBatch);
+
+    // Confirm a field of a slot; true if the report differs from a value the
+    // throttle is not sending, i.e. the slot must take the reported value
+    bool acceptReport(LocoSlot& slot, uint8_t bit, bool matches);
+
+    // Session task lifecycle, see startSession()
+    TaskHandle_t sessionTaskHandle = nullptr;
+    std::atomic<bool> sessionActive{false};
+    SemaphoreHandle_t sessionExited = nullptr; // Given by the task on its way out
+
+    // Backend that took over the slot table; set by the factory on a swap
+    LocoCommandManager* successor = nullptr;
+
+    static constexpr int CHANGE_QUEUE_LENGTH = 8;
+    QueueHandle_t changeQueue = nullptr;
+
+    // Pick software or native consisting for a slot and set up the decoders
+    void updateConsistMode(LocoSlot& slot);
+
+    // Undo the consist of a slot and stop its members
+    void dissolveConsist(LocoSlot& slot);
+
+    // Mark every value of a slot to be sent, functions included
+    static void markSlotDirty(LocoSlot& slot);
+
+    // Mark a field of the active slot dirty if its value changed
+    template <typename T>
+    void updateField(T LocoSlot::*field, T value, uint8_t bit);
+};
@@ -1,11 +1,23 @@
 #pragma once
 
+#include "Config.h"
 #include "LocoCommandManager.h"
 #include "DccExCommandManager.h"
 #include "JMRICommandManager.h"
-#include <ArduinoJson.h>
+#include "Z21CommandManager.h"
+#include "LocoNetCommandManager.h"
 #include <memory>
+#include <atomic>
+#include <FreeRTOS.h>
+#include <semphr.h>
 
+// Owner of the command station backend. A configuration change does not
+// replace the backend under its users: the connection task builds the new
+// one, connects it next to the old one, migrates the slot table and swaps
+// the pointer (RCU style). The old backend is destroyed after a grace period,
+// once every reader task has passed a quiescent point, so a pointer obtained
+// from getLocoCommandManager() stays valid until the end of the caller's
+// current loop pass; it must not be kept longer.
 class LocoCommandManagerFactory {
 public:
     // Delete copy/move constructors and assignment operators
@@ -14,19 +26,21 @@ public:
     LocoCommandManagerFactory(LocoCommandManagerFactory&&) = delete;
     LocoCommandManagerFactory& operator=(LocoCommandManagerFactory&&) = delete;
 
-    // Get the singleton instance with configurable file path
-    static LocoCommandManagerFactory& getInstance(const char* configFilePath = "/locoCommandManager.json") {
-        static LocoCommandManagerFactory instance(configFilePath);
+    // Get the singleton instance
+    static LocoCommandManagerFactory& getInstance() {
+        static LocoCommandManagerFactory instance;
         return instance;
     }
 
-    // Get the appropriate LocoCommandManager implementation
+    // Get the current LocoCommandManager implementation
     LocoCommandManager* getLocoCommandManager();
     
     // Enum for manager types
     enum class ManagerType {
         DccEx,
-        JMRI
+        JMRI,
+        Z21,
+        LocoNet
     };
     
     // Get current manager type
@@ -38,36 +52,119 @@ public:
     String getConnectionUrl() const {
         return connectionUrl;
     }
+
+    // Link to the command station; the serial port is only used by DCC-EX
+    enum class Transport {
+        Network, // TCP/UDP over WiFi, to the connection URL
+        Serial   // COMMAND_STATION_SERIAL, the URL is ignored
+    };
+
+    // Default line speed of the serial link
+    static constexpr uint32_t DEFAULT_BAUD_RATE = 115200;
+
+    Transport getTransport() const {
+        return transport;
+    }
+
+    uint32_t getBaudRate() const {
+        return baudRate;
+    }
+
+    // Set the transport and save configuration
+    bool setTransport(Transport value);
+    
+    // Check whether a backend is built into this firmware (see LOCO_BACKEND)
+    static bool isAvailable(ManagerType type);
     
-    // Set manager type and save configuration
+    // Set manager type and save configuration; false if the type is not built in
     bool setManagerType(ManagerType type);
     
     // Set connection URL and save configuration
     bool setConnectionUrl(const String& url);
     
-    // Save current configuration to file
+    // Save current configuration to the configuration store; the backend is
+    // replaced in the background
     bool saveConfiguration();
 
+    // Read the settings again after the configuration store was changed
+    // directly (a configuration import); the backend is replaced in the
+    // background if they differ. Returns whether they did
+    bool reloadConfiguration();
+
+    // Reader tasks (those using the backend every loop pass) register once and
+    // mark the end of each pass, when they hold no backend pointer. Static so
+    // tasks can register before the configuration is loaded
+    static int registerReader();
+    static void quiescent(int reader) {
+        if (reader >= 0) {
+            readerPasses[reader] = readerPasses[reader] + 1;
+        }
+    }
+
+    // Swap steps, run by the connection task:
+    // the backend to connect for a pending configuration change (nullptr if none)
+    LocoCommandManager* preparePendingManager();
+
+    // whether commitSwap() can run now (the previous swap has been reclaimed)
+    bool canSwap() const {
+        return pendingManager && !retiredManager;
+    }
+
+    // whether the current backend must be disconnected before the pending one
+    // connects: the serial port cannot be opened twice, and a WiThrottle server
+    // would see the same hardware id twice
+    bool swapNeedsDisconnect();
+
+    // stop the session task of the current backend, migrate the slot table
+    // into the pending backend and make it the current one; called without
+    // any StateLock held
+    void commitSwap();
+
+    // destroy a replaced backend no reader can hold anymore
+    void reclaim();
+
 private:
-    // Private constructor for singleton pattern that accepts a file path
-    LocoCommandManagerFactory(const char* filePath);
-    
-    // Load configuration from JSON file
-    bool loadConfiguration();
-    
-    // Create default configuration file if it doesn't exist
-    bool createDefaultConfigFile();
+    // Private constructor for singleton pattern
+    LocoCommandManagerFactory();
     
-    // The current command manager instance
-    std::unique_ptr<LocoCommandManager> commandManager;
+    // Load configuration from the configuration store
+    void loadConfiguration();
+
+    // New backend of the configured type, hooked to the radio power policy
+    std::unique_ptr<LocoCommandManager> createManager();
+
+    // New backend of the configured type, bare
+    std::unique_ptr<LocoCommandManager> createBackend();
+
+    // Readers and the minimum time a replaced backend is kept, which also
+    // covers short users outside the reader tasks (web server handlers)
+    static constexpr int MAX_READERS = 4;
+    static constexpr uint32_t GRACE_PERIOD_MS = 1000;
     
-    // Configuration file path
-    const char* configFilePath;
+    // Current backend, read without locking; owned by activeManager
+    std::atomic<LocoCommandManager*> current{nullptr};
+    std::unique_ptr<LocoCommandManager> activeManager;
+
+    // Owned by the connection task
+    std::unique_ptr<LocoCommandManager> pendingManager; // Being connected
+    ManagerType activeType = ManagerType::DccEx;        // Types of activeManager and pendingManager
+    ManagerType pendingType = ManagerType::DccEx;
+    std::unique_ptr<LocoCommandManager> retiredManager; // Waiting for its grace period
+    uint32_t retiredAt = 0;
+    uint32_t retiredPasses[MAX_READERS];
+
+    static volatile uint32_t readerPasses[MAX_READERS];
+    static volatile int readerCount;
+    std::atomic<bool> reconfigure{false};   // Configuration changed since the last swap
+    SemaphoreHandle_t swapMutex = nullptr;  // Serialises creation and swaps
     
     // Connection URL for the command manager
     String connectionUrl;
     
-    // Type of command manager to use (DccEx or JMRI)
+    // Type of command manager to use (DccEx, JMRI, Z21 or LocoNet)
     ManagerType currentManagerType;
-    bool isInitialized;
-};
\ No newline at end of file
+
+    // Link used by the DCC-EX manager
+    Transport transport = Transport::Network;
+    uint32_t baudRate = DEFAULT_BAUD_RATE;
+};
@@ -4,14 +4,27 @@
 #include <Arduino.h>
 #include "LocoCommandManager.h"
 #include "LocoCommandManagerFactory.h" // Include factory instead of specific implementation
+#include "ConnectionManager.h"
 
 class LocoDriverPage : public IPage {
 private:
-    LocoCommandManager* locoManager; // Changed from reference to pointer
+    // Current command manager; fetched on each use, as the backend can be swapped
+    static LocoCommandManager* manager() {
+        return LocoCommandManagerFactory::getInstance().getLocoCommandManager();
+    }
     
     // Current values
-    int currentSpeed = 0;
-    int currentBrake = 0;
+    int currentAddress = 0;
+    int currentThrottle = 0;  // Throttle position (0-100%)
+    int currentSpeed = 0;     // Simulated speed (km/h)
+    int currentBrake = 0;     // Brake cylinder pressure (0.1 bar)
+    int currentBrakePipe = 0; // Brake pipe pressure (0.1 bar)
+    int speedGaugeMax = 100;  // Top of the speed gauge (km/h)
+    const int brakeGaugeMax = 8; // Top of the brake gauge (bar)
+    ConnectionManager::LinkState currentLink = ConnectionManager::LinkState::OFFLINE;
+    uint16_t previousKeys = 0; // Keys of the last pass, to find presses and releases
+    uint32_t emergencyStops = 0; // Emergency stops of the simulator already handled
+    bool emergencyStopped = false; // Shown until the throttle is opened again
     
     // UI positions and dimensions
     const int speedGaugeX = 80;
@@ -20,20 +33,32 @@ private:
     const int brakeGaugeY = 120;
     const int gaugeRadius = 70;
     
+    // Copy the simulator's snapshot of the active slot into the page; true if the loco changed
+    bool loadActiveSlot();
+    
+    // Drive the functions mapped to the function keys for the current loco
+    void handleFunctionKeys(uint16_t keys);
+    
+    // Repaint a single gauge without clearing the screen
+    void redrawSpeedGauge();
+    void redrawBrakeGauge();
+    
     // Helper methods for drawing
     void drawSpeedGauge(TFT_eSPI& tft);
     void drawBrakeGauge(TFT_eSPI& tft);
     void drawNeedle(TFT_eSPI& tft, int centerX, int centerY, int value, int maxValue, int radius, uint16_t color);
     void drawGaugeLabels(TFT_eSPI& tft, int centerX, int centerY, int maxValue, int radius);
+    void drawLinkIndicator(TFT_eSPI& tft);
 
 public:
     // Constructor that uses LocoCommandManagerFactory
     LocoDriverPage();
+    ~LocoDriverPage() override;
     
     void draw() override;
     void handleInput(IKeyboard* keyboard) override;
     
-    // Methods to update gauge values
-    void updateSpeed(int speed);
-    void updateBrake(int brake);
+    // Update a gauge value, repainting only that gauge when it changed
+    void updateSpeed(int speed);                // km/h
+    void updateBrake(int brake, int brakePipe); // Cylinder and pipe pressure, 0.1 bar
 };
\ No newline at end of file
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "LocoCommandBackend.h"
+#include "LineParser.h"
+#include <Arduino.h> // For Arduino's String class
+#include <WiFi.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <semphr.h>
+
+// LocoNet client over JMRI's LbServer (LocoNet over TCP). LocoNet messages
+// travel as hex text lines: "SEND A0 01 20 7E" to the bus, "RECEIVE ..." for
+// every message seen on it (ours included) and "SENT OK" once a send went out.
+// Locos are driven through command station slots, acquired asynchronously
+// (OPC_LOCO_ADR, then a null move) and cached by address.
+class LocoNetCommandManager final : public LocoCommandBackend<LocoNetCommandManager> {
+    friend class LocoCommandBackend<LocoNetCommandManager>;
+
+public:
+    // Default LbServer port
+    static constexpr uint16_t DEFAULT_PORT = 1234;
+
+    // Public constructor
+    LocoNetCommandManager();
+
+    // Use an externally provided transport instead of the internal WiFiClient
+    explicit LocoNetCommandManager(Client& transport);
+
+    ~LocoNetCommandManager() override;
+
+    void connect(const String& connectionUrl) override;
+    void disconnect() override;
+    bool isConnected() override;
+
+    // Send a raw LbServer line, e.g. "SEND 83 7C" (power on)
+    void sendCommand(const String& command) override;
+
+protected:
+    void acquireLoco(int address) override;
+    void releaseLoco(int address) override;
+    void beginBatch() override;
+    void endBatch() override;
+    void sendSpeedCommand(int address, int speed, bool forward) override;
+    void sendBrakeCommand(int address, int brake) override;
+    void sendFrontLightsCommand(int address, LightStatus status) override;
+    void sendBackLightsCommand(int address, LightStatus status) override;
+    void sendBellCommand(int address, bool active) override;
+    void sendHornCommand(int address, bool active) override;
+    void sendFunctionGroup(int address, int group, uint8_t states) override;
+    void sendEmergencyStop() override;
+    uint8_t confirmedFields() const override;
+
+private:
+    // LocoNet opcodes
+    static constexpr uint8_t OPC_IDLE = 0x85;
+    static constexpr uint8_t OPC_LOCO_SPD = 0xA0;
+    static constexpr uint8_t OPC_LOCO_DIRF = 0xA1;
+    static constexpr uint8_t OPC_LOCO_SND = 0xA2;
+    static constexpr uint8_t OPC_LONG_ACK = 0xB4;
+    static constexpr uint8_t OPC_SLOT_STAT1 = 0xB5;
+    static constexpr uint8_t OPC_MOVE_SLOTS = 0xBA;
+    static constexpr uint8_t OPC_RQ_SL_DATA = 0xBB;
+    static constexpr uint8_t OPC_LOCO_ADR = 0xBF;
+    static constexpr uint8_t OPC_SL_RD_DATA = 0xE7;
+    static constexpr uint8_t OPC_IMM_PACKET = 0xED;
+
+    // Times the command station repeats an immediate packet on the track
+    static constexpr uint8_t IMM_PACKET_REPEATS = 2;
+
+    // Slot status (STAT1 bits 4-5) and direction bit of DIRF
+    static constexpr uint8_t STAT1_STATUS = 0x30;
+    static constexpr uint8_t STAT1_IN_USE = 0x30;
+    static constexpr uint8_t STAT1_COMMON = 0x10;
+    static constexpr uint8_t DIRF_REVERSE = 0x20;
+
+    // Longest LocoNet message handled (slot data is 14 bytes)
+    static constexpr size_t MAX_MESSAGE = 16;
+
+    // Slot request left unanswered for this long is sent again
+    static constexpr uint32_t SLOT_TIMEOUT_MS = 2000;
+
+    // Pass period of the session task
+    static constexpr uint32_t SESSION_PERIOD_MS = 20;
+
+    // LbServer never talks unprompted: every ECHO_INTERVAL_MS a slot read goes
+    // out, its "SENT" reply times the round trip, and the socket is dropped when
+    // nothing came back for KEEPALIVE_TIMEOUT_MS
+    static constexpr uint32_t ECHO_INTERVAL_MS = 2000;
+    static constexpr uint32_t KEEPALIVE_TIMEOUT_MS = 15000;
+
+    // TCP keepalive: probe after 5 s idle, every 2 s, give up after 3 misses
+    static constexpr int KEEPALIVE_IDLE_S = 5;
+    static constexpr int KEEPALIVE_INTERVAL_S = 2;
+    static constexpr int KEEPALIVE_COUNT = 3;
+
+    // Progress of the command station slot of a loco
+    enum class SlotState : uint8_t {
+        REQUESTED, // OPC_LOCO_ADR sent, waiting for the slot data
+        MOVING,    // Null move sent to take the slot in use
+        IN_USE,    // Ours: commands can be sent
+        RELEASED   // Slot number kept to skip the address lookup next time
+    };
+
+    // Cached slot of one loco (lead or consist member)
+    struct SlotEntry {
+        int address = 0; // 0 marks a free entry
+        uint8_t slot = 0;
+        SlotState state = SlotState::RELEASED;
+        uint8_t stat1 = 0;
+        uint8_t dirf = 0;  // Direction and F0-F4, as last sent or seen on the bus
+        uint8_t snd = 0;   // F5-F8
+        uint32_t requestedAt = 0;
+    };
+
+    static constexpr int SLOT_CACHE_SIZE = MAX_LOCO_SLOTS * (1 + MAX_CONSIST_MEMBERS);
+
+    // FreeRTOS task reading the socket, answering slot data and probing the link
+    static void sessionTask(void* param);
+
+    // Send a message (checksum added), or append it to the open batch
+    void queueMessage(const uint8_t* message, size_t length);
+
+    // Write a message right away, clientMutex taken by the caller
+    void writeMessage(const uint8_t* message, size_t length);
+
+    // Format "SEND xx .. ck\n" into a buffer; returns the text length
+    static size_t formatSend(const uint8_t* message, size_t length, char* text);
+
+    // Decode the hex bytes of a RECEIVE line in place into a message;
+    // returns its length, 0 if malformed or failing the checksum
+    static size_t decodeMessage(const char* hex, uint8_t* message);
+
+    // Handle one received LocoNet message, clientMutex taken; true if it
+    // reported the state of a loco we hold
+    bool handleMessage(const uint8_t* message, size_t length, StateReport& report, int& readyAddress);
+
+    // Cache lookup; clientMutex taken by the caller
+    SlotEntry* findEntry(int address);
+    SlotEntry* findSlot(uint8_t slot);
+
+    // Request the slot of a cache entry (address lookup or null move)
+    void requestSlot(SlotEntry& entry, uint32_t now);
+
+    // Update the cached DIRF/SND byte of a loco we hold and send it
+    void sendFunctionCommand(int address, int function, bool active);
+
+    // Slot data bytes into a report (speed, direction, F0-F8)
+    static void reportSlotData(int address, uint8_t speed, uint8_t dirf, uint8_t snd, StateReport& report);
+
+    WiFiClient ownClient;
+    Client* client;
+
+    SemaphoreHandle_t clientMutex = nullptr;  // Serialises access from UI and session tasks
+    volatile bool opening = false;            // connect() holds clientMutex for the TCP connect
+
+    LineParser<64> parser;
+    SlotEntry slotCache[SLOT_CACHE_SIZE];     // Guarded by clientMutex
+
+    // Sends written and "SENT" replies received; LbServer answers in order
+    uint32_t sendsWritten = 0;
+    uint32_t sendsAnswered = 0;
+
+    // Owned by the session task
+    unsigned long lastReceive = 0;
+    unsigned long echoSentAt = 0;
+    uint32_t echoTarget = 0;   // sendsWritten right after the probe
+    bool echoPending = false;
+
+    // Lines collected between beginBatch() and endBatch()
+    String batchBuffer;
+    uint32_t batchSends = 0;
+    bool batching = false;
+};
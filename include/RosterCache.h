@@ -0,0 +1,96 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FreeRTOS.h>
+#include <semphr.h>
+#include <LittleFS.h>
+#include <vector>
+
+// Loco roster of the command station, cached on LittleFS so it is not fetched
+// again on every boot. The file holds fixed-size records sorted by address:
+//
+//   header:  magic "TRST" | version u16 | record count u16 | ETag u32 | reserved u32
+//   record:  address u16 | name (NAME_LENGTH bytes, NUL padded)
+//
+// RAM only keeps the address of the first record of every BLOCK_SIZE
+// records: a lookup is a binary search of that index, then of the records
+// of one block in the file, and pages are read straight from the file.
+// Backends compare the ETag (a hash of the station's roster listing) with
+// the cached one and rebuild the file only when it changed, through a
+// temporary file renamed over the old one.
+class RosterCache {
+public:
+    static constexpr const char* FILE_PATH = "/roster.bin";
+    static constexpr uint16_t SCHEMA_VERSION = 1;
+
+    // Longest name kept, and entries kept at most
+    static constexpr int NAME_LENGTH = 30;
+    static constexpr int MAX_ENTRIES = 1024;
+
+    struct Entry {
+        uint16_t address = 0;
+        char name[NAME_LENGTH + 1] = {0};
+    };
+
+    // Get the singleton instance
+    static RosterCache& getInstance() {
+        static RosterCache instance;
+        return instance;
+    }
+
+    // Delete copy/move constructors and assignment operators
+    RosterCache(const RosterCache&) = delete;
+    RosterCache& operator=(const RosterCache&) = delete;
+    RosterCache(RosterCache&&) = delete;
+    RosterCache& operator=(RosterCache&&) = delete;
+
+    // Number of cached entries and the ETag of the roster they came from
+    int getCount();
+    uint32_t getEtag();
+
+    // Entry of an address; false if the address is not in the roster
+    bool find(int address, Entry& entry);
+
+    // Copy up to maxCount entries, in address order, starting at position
+    // first; returns the number copied
+    int readPage(int first, Entry* entries, int maxCount);
+
+    // Rebuild: add the entries, in any order, between beginUpdate() and
+    // commitUpdate(). beginUpdate() fails while another update is running
+    bool beginUpdate();
+    void addEntry(int address, const char* name, size_t nameLength);
+    bool commitUpdate(uint32_t etag);
+    void abortUpdate();
+
+    // Hash of a roster listing, used as its ETag
+    static uint32_t hash(const char* text);
+
+private:
+    RosterCache() {
+        mutex = xSemaphoreCreateRecursiveMutex();
+    }
+
+    static constexpr uint32_t MAGIC = 0x54535254; // "TRST"
+    static constexpr size_t HEADER_SIZE = 16;
+    static constexpr size_t RECORD_SIZE = 2 + NAME_LENGTH;
+    static constexpr int BLOCK_SIZE = 16;
+    static constexpr const char* UPDATE_PATH = "/roster.add"; // Entries of an update, unsorted
+
+    // Read the header and build the index on first access
+    void ensureLoaded();
+    bool loadIndex();
+
+    static bool readRecord(File& file, int index, Entry& entry);
+    static void encodeRecord(int address, const char* name, size_t nameLength, uint8_t* record);
+
+    SemaphoreHandle_t mutex = nullptr; // Guards everything below
+    bool loaded = false;
+    int count = 0;
+    uint32_t etag = 0;
+    uint16_t blockFirst[MAX_ENTRIES / BLOCK_SIZE]; // Address of the first record of each block
+
+    // Update in progress: address << 16 | record position in UPDATE_PATH
+    bool updating = false;
+    File updateFile;
+    std::vector<uint32_t> updateEntries;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <string.h>
+
+// Single-writer sequence lock for small plain structs shared between cores.
+// The writer never blocks; readers retry while a write is in progress, so
+// neither side ever waits on a mutex held by the other core.
+template <typename T>
+class SeqLock {
+public:
+    // Publish a new value (only one task may write)
+    void write(const T& value) {
+        uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed); // Odd: write in progress
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(&data, &value, sizeof(T));
+        std::atomic_thread_fence(std::memory_order_release);
+        sequence.store(seq + 2, std::memory_order_relaxed);
+    }
+
+    // Read a consistent copy of the latest value
+    T read() const {
+        T copy;
+        uint32_t before, after;
+        do {
+            before = sequence.load(std::memory_order_acquire);
+            memcpy(&copy, &data, sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        return copy;
+    }
+
+private:
+    std::atomic<uint32_t> sequence{0};
+    T data{};
+};
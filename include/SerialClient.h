@@ -0,0 +1,49 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Client over a hardware UART, so a stream backend (DCC-EX) can run on a wire
+// instead of a socket. The core drains the UART into a ring buffer from its
+// interrupt; RX_BUFFER_SIZE makes that buffer deep enough to hold the traffic
+// of several session passes. Host and port of connect() are ignored.
+//
+// A UART has no connection state: connected() only reports whether the port
+// is open, from connect() until stop(). Whether a station listens is up to
+// the backend, DCC-EX probes it with <#> on connect and stops the client when
+// no reply came for its keepalive timeout.
+class SerialClient : public Client {
+public:
+    // Received bytes buffered between two reads
+    static constexpr size_t RX_BUFFER_SIZE = 1024;
+
+    // Line speed of DCC-EX's serial port
+    static constexpr uint32_t DEFAULT_BAUD_RATE = 115200;
+
+    SerialClient(SerialUART& serial, uint8_t txPin, uint8_t rxPin)
+        : serial(serial), txPin(txPin), rxPin(rxPin) {}
+
+    // Line speed used by the next connect()
+    void setBaudRate(uint32_t baud) {
+        baudRate = baud;
+    }
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char* host, uint16_t port) override;
+    size_t write(uint8_t value) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t* buffer, size_t size) override;
+    int peek() override;
+    void flush() override;
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override;
+
+private:
+    SerialUART& serial;
+    uint8_t txPin;
+    uint8_t rxPin;
+    uint32_t baudRate = DEFAULT_BAUD_RATE;
+    volatile bool open = false;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+
+// Single-producer single-consumer ring for small plain structs handed from one
+// task to another. Each index is only written by its own side with a plain
+// store (no read-modify-write, which the M0+ lacks), so neither side ever
+// blocks or waits on a mutex held by the other core.
+template <typename T, size_t N>
+class SpscQueue {
+public:
+    // Queue a value (producer only); false if the ring is full
+    bool push(const T& value) {
+        uint32_t head = writeIndex.load(std::memory_order_relaxed);
+        if (head - readIndex.load(std::memory_order_acquire) >= N) {
+            return false;
+        }
+        items[head % N] = value;
+        writeIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Take the oldest value (consumer only); false if the ring is empty
+    bool pop(T& value) {
+        uint32_t tail = readIndex.load(std::memory_order_relaxed);
+        if (tail == writeIndex.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = items[tail % N];
+        readIndex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::atomic<uint32_t> writeIndex{0};
+    std::atomic<uint32_t> readIndex{0};
+    T items[N];
+};
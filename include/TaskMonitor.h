@@ -0,0 +1,37 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Lightweight per-task timing: wake-up latency, run time and per-core load.
+// Each task only writes its own entry, readers only take snapshots, so the
+// probes add no locking to the measured tasks.
+class TaskMonitor {
+public:
+    static constexpr int MAX_TASKS = 8;
+
+    // Register the calling task; returns its probe id (-1 if the table is full)
+    static int registerTask(const char* name, uint8_t core, uint32_t periodMs);
+
+    // Mark the start and the end of one pass of the task's loop
+    static void beginRun(int id);
+    static void endRun(int id);
+
+    // Human readable report: load of each core since the previous report and
+    // worst latency/run time of each task
+    static String report();
+
+private:
+    struct Entry {
+        const char* name;
+        uint8_t core;
+        uint32_t periodMicros;
+        volatile uint32_t lastStart;
+        volatile uint32_t runStart;
+        volatile uint32_t busyMicros;        // Accumulated run time
+        volatile uint32_t worstLatencyMicros; // Worst lateness of a wake-up
+        volatile uint32_t worstRunMicros;
+    };
+
+    static Entry entries[MAX_TASKS];
+    static volatile int taskCount;
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+
+// Deterministic longitudinal train model advanced on a fixed timestep.
+// All state is integer/fixed-point so results are identical on the Pico and on
+// the host, and the cost of tick() is bounded (no loops, no floating point).
+// It has no Arduino dependency so it can be built and benchmarked on the host.
+class TrainPhysics {
+public:
+    // Simulation rate
+    static constexpr uint32_t TICK_HZ = 50;
+    static constexpr uint32_t TICK_MS = 1000 / TICK_HZ;
+
+    // Highest DCC speed step (128 step mode)
+    static constexpr int MAX_SPEED_STEP = 126;
+
+    // Train characteristics, defaults roughly match an Epoch IV mixed train
+    struct Parameters {
+        uint32_t massKg = 400000;             // Loco plus train
+        uint32_t maxTractiveEffortN = 280000; // Starting tractive effort
+        uint32_t maxPowerW = 3000000;         // Power at the rail
+        uint32_t rollingResistancePermille = 2; // Rolling resistance coefficient x1000
+        uint32_t dragNPerMps2 = 40;           // Aerodynamic drag coefficient, N/(m/s)^2
+        uint32_t maxBrakeForceN = 400000;     // Full service brake
+        uint32_t maxSpeedKmh = 120;           // Speed mapped to the top DCC step
+    };
+
+    TrainPhysics() {}
+    explicit TrainPhysics(const Parameters& params) : params(params) {}
+
+    // Set the throttle position (0-100%)
+    void setThrottle(int percent);
+
+    // Set the braking demand (0-100%)
+    void setBrake(int percent);
+
+    // Advance the model by one TICK_MS step
+    void tick();
+
+    // Force the current speed, e.g. when taking over a loco already moving
+    void setSpeedStep(int step);
+
+    // Current speed
+    uint32_t getSpeedKmh() const;
+    int getSpeedStep() const;
+
+    const Parameters& getParameters() const {
+        return params;
+    }
+
+private:
+    Parameters params;
+
+    int throttlePercent = 0;
+    int brakePercent = 0;
+
+    // Speed in micrometres per second
+    int64_t speedUmps = 0;
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <Arduino.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <atomic>
+#include "TrainPhysics.h"
+#include "AirBrake.h"
+#include "SeqLock.h"
+#include "SpscQueue.h"
+#include "LocoCommandManager.h"
+
+// Runs the train physics and air brake of the active loco on its own fixed-rate
+// task and sends the resulting DCC speed step whenever it changes.
+// The task runs on the control core and is the only one to change the slot
+// table on behalf of the UI: the UI queues its intents (loco selection,
+// functions, direction, consists) through a single-producer ring and reads
+// the active slot and the simulation output through seqlocks, so the slot
+// table mutex is never taken on the UI core.
+class TrainSimulator {
+public:
+    // Output of one tick, read by the UI as a single consistent snapshot
+    struct State {
+        uint32_t speedKmh = 0;
+        int32_t brakePipeMbar = AirBrake::RUNNING_PRESSURE_MBAR;
+        int32_t brakeCylinderMbar = 0;
+    };
+
+    // Get the singleton instance
+    static TrainSimulator& getInstance() {
+        static TrainSimulator instance;
+        return instance;
+    }
+
+    // Delete copy/move constructors and assignment operators
+    TrainSimulator(const TrainSimulator&) = delete;
+    TrainSimulator& operator=(const TrainSimulator&) = delete;
+    TrainSimulator(TrainSimulator&&) = delete;
+    TrainSimulator& operator=(TrainSimulator&&) = delete;
+
+    // Start the simulation task (no-op if already running)
+    void start();
+
+    // Throttle position (0-100%)
+    void setThrottle(int percent);
+
+    // Driver's brake valve position
+    void setBrakeValve(AirBrake::Valve position);
+
+    // Continue from the cached speed of the active loco, e.g. after another
+    // throttle changed it; read from the slot table on the next tick
+    void syncFromActiveSlot();
+
+    // Intents of the UI task, applied to the slot table on the next tick (the
+    // speed carries on from the cached one after a loco change). Each returns
+    // false if it was rejected up front or the queue is full.
+    // Make the given address the active loco; false if the address is invalid
+    bool selectLoco(int address);
+
+    // Select the default loco if none is active yet
+    bool selectDefaultLoco();
+
+    // Make the next (1) or previous (-1) acquired loco the active one
+    bool switchSlot(int direction);
+
+    // Set or toggle a function of the active loco
+    bool setFunction(int function, bool active);
+    bool toggleFunction(int function);
+
+    // Direction of travel of the active loco
+    bool setDirection(bool forward);
+
+    // Add a loco to the consist of the active loco; false if it cannot join
+    // according to the latest copy of the slot (invalid, already in, full)
+    bool addConsistMember(int address, bool reversed, int speedScale);
+
+    // Stop the members and dissolve the consist of the active loco
+    bool clearConsist();
+
+    // Copy of the active slot as of the last tick, address 0 if no loco is selected
+    LocoCommandManager::LocoSlot getActiveSlot() const {
+        return activeSlot.read();
+    }
+
+    // Emergency stop: the train stands still on the next tick and the throttle
+    // is closed. Requested by the input sampler
+    void emergencyStop();
+
+    // Emergency stops so far, for the UI to notice new ones
+    uint32_t getEmergencyStopCount() const {
+        return emergencyRequest.load(std::memory_order_relaxed);
+    }
+
+    // Latest simulated speed and brake pressures
+    State getState() const {
+        return state.read();
+    }
+
+    const TrainPhysics::Parameters& getParameters() const {
+        return physics.getParameters();
+    }
+
+    // Longest tick seen so far, physics and command emission included
+    uint32_t getWorstTickMicros() const {
+        return worstTickMicros;
+    }
+
+private:
+    // A change of the slot table requested by the UI
+    struct Intent {
+        enum class Type : uint8_t {
+            SELECT_LOCO,
+            SELECT_DEFAULT,
+            SWITCH_SLOT,
+            SET_FUNCTION,
+            TOGGLE_FUNCTION,
+            SET_DIRECTION,
+            ADD_CONSIST_MEMBER,
+            CLEAR_CONSIST
+        };
+        Type type;
+        int value = 0;     // Address, function or slot step
+        bool flag = false; // Function state, forward or reversed member
+        int speedScale = 100;
+    };
+
+    // Intents waiting at most; the UI queues one or two per pass and every tick drains them
+    static constexpr size_t MAX_INTENTS = 8;
+
+    TrainSimulator() {}
+
+    bool queueIntent(const Intent& intent) {
+        return intents.push(intent);
+    }
+
+    // Apply the queued intents to the current backend; true if the active loco changed
+    bool applyIntents(LocoCommandManager* locoManager);
+
+    // Continue the physics from the cached speed of the active loco
+    void takeOver(LocoCommandManager* locoManager);
+
+    // FreeRTOS task advancing the physics every TrainPhysics::TICK_MS
+    static void simulationTask(void* param);
+
+    TrainPhysics physics;
+    AirBrake airBrake;
+    TaskHandle_t taskHandle = nullptr;
+
+    // Written by the UI task, read by the simulation task
+    std::atomic<int> throttlePercent{0};
+    std::atomic<AirBrake::Valve> brakeValve{AirBrake::Valve::LAP};
+
+    // Speed takeover: the UI bumps the request counter, the simulation reads
+    // the cached speed when the counter differs from the last one seen
+    std::atomic<uint32_t> takeoverRequest{0};
+    uint32_t takeoverApplied = 0;
+
+    // Slot table changes, queued by the UI task only
+    SpscQueue<Intent, MAX_INTENTS> intents;
+
+    // Emergency stop, requested the same way by the input sampler
+    std::atomic<uint32_t> emergencyRequest{0};
+    uint32_t emergencyApplied = 0;
+
+    // Written by the simulation task
+    SeqLock<State> state;
+    SeqLock<LocoCommandManager::LocoSlot> activeSlot;
+    volatile uint32_t worstTickMicros = 0;
+    int lastSpeedStep = -1;
+};
@@ -6,7 +6,10 @@
 #include <task.h>
 #include "IKeyboard.h"
 #include "AnalogSwitch.h"
+#include "InputSampler.h"
 #include "WiFiConfigManager.h"
+#include "ConnectionManager.h"
+#include "IPage.h"
 
 class UIManager {
 public:
@@ -17,13 +20,27 @@ public:
     void startTask(); // Start the UI task
 
 private:
+    static constexpr uint32_t UI_PERIOD_MS = 10; // UI loop period
+    static constexpr uint32_t AUTO_DRIVE_WINDOW_MS = 30000; // Boot time after which the driver page is no longer opened by itself
+
     static void uiTask(void* param); // FreeRTOS task function
     void setupMenus();               // Setup the menus
     void setupLocoDriverPage();
 
+    // Loco selection: the cached roster a page at a time, or an address typed in
+    static constexpr int ROSTER_PAGE_SIZE = 4; // Leaves room for the navigation rows
+    static void showRosterPage(int first);
+    static void showAddressInput();
+    void handleLinkEvent(ConnectionManager::LinkEvent event); // Link changes posted by ConnectionManager
+
     TFT_eSPI tft;          // Encapsulated TFT display object
     TaskHandle_t uiTaskHandle; // Handle for the UI task
     IKeyboard* keyboard; // Pointer to the keyboard interface
     AnalogSwitch* analogSwitch; // Analog switch for channel selection
+    InputSampler* inputSampler; // Keyboard state sampled on the control core
+    bool awaitingConnect = false; // A "Connect" request is waiting for its outcome
+    IPage* mainMenuPage = nullptr; // Root of the page stack
+    bool splashDone = false;       // The splash has been dismissed
+    bool bootAutoDrive = true;     // Open the driver page when the link comes up at boot
     // No longer need a WiFiConfigManager pointer as we'll use singleton instance
 };
\ No newline at end of file
@@ -12,7 +12,7 @@ public:
     WebServerManager(WiFiConfigManager* wifiManager, LocoCommandManager* locoManager);
     ~WebServerManager();
 
-    // Initialize and start the web server
+    // Start listening, once WiFi is up (ConnectionManager calls it on every join)
     void begin();
     
     // Stop the web server
@@ -27,12 +27,19 @@ private:
     LocoCommandManager* locoManager;
     bool running = false;
     
+    // Largest configuration accepted for import
+    static constexpr size_t MAX_CONFIG_BODY = 2048;
+    
     // Setup routes for the web server
     void setupRoutes();
     
     // API endpoints
     void handleRoot(AsyncWebServerRequest *request);
     void handleGetWiFiStatus(AsyncWebServerRequest *request);
+    void handleGetConfig(AsyncWebServerRequest *request);
+    void handleGetLatency(AsyncWebServerRequest *request);
+    void handlePostConfig(AsyncWebServerRequest *request);
+    void handlePostConfigBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
     
     // Helper methods
     void sendJsonResponse(AsyncWebServerRequest *request, JsonDocument& doc);
@@ -2,14 +2,17 @@
 
 #include <Arduino.h> // For Arduino's String class
 #include <functional>
+#include <vector>
+#include <atomic>
 #include <FreeRTOS.h> // Include FreeRTOS header for TaskHandle_t
 #include <task.h>     // Include FreeRTOS task header
+#include <semphr.h>
 
 class WiFiConfigManager {
 public:
     // Get the singleton instance
-    static WiFiConfigManager& getInstance(const String& configFilePath = "") {
-        static WiFiConfigManager instance(configFilePath);
+    static WiFiConfigManager& getInstance() {
+        static WiFiConfigManager instance;
         return instance;
     }
 
@@ -41,22 +44,62 @@ public:
         String macAddress;
     };
 
+    // One network seen by the background scan
+    struct ScanResult {
+        String ssid;
+        uint8_t bssid[6] = {0};  // Strongest access point of the SSID
+        int32_t rssi = 0;        // dBm
+        int32_t channel = 0;
+        uint32_t lastSeen = 0;   // millis() of the last scan that reported it
+    };
+
+    // Bounds of the scan cache
+    static constexpr int MAX_SCAN_RESULTS = 16;
+    static constexpr uint32_t SCAN_INTERVAL_MS = 5000;
+    static constexpr uint32_t SCAN_STALE_MS = 20000; // Dropped after missing a few scans
+
+    // Longest wait for a join to the cached access point before scanning,
+    // and the core's default restored after it (WiFi has no getter for it)
+    static constexpr uint32_t FAST_JOIN_TIMEOUT_MS = 3000;
+    static constexpr uint32_t JOIN_TIMEOUT_MS = 10000;
+
+    // Time without commands after which the radio may save power again
+    static constexpr uint32_t POWER_SAVE_IDLE_MS = 5000;
+
     ~WiFiConfigManager();
 
-    // Start scanning for SSIDs
-    void startSSIDScan(const std::function<void(const String&)>& onSSIDFound);
+    // Start refreshing the scan cache in the background
+    void startSSIDScan();
 
-    // Stop scanning for SSIDs
+    // Stop refreshing the scan cache; the cached results stay available
     void stopSSIDScan();
 
-    // Save network properties to a file
+    // Copy of the cached networks, strongest first
+    std::vector<ScanResult> getScanResults();
+
+    // Incremented whenever the cache content changes
+    uint32_t getScanGeneration() const {
+        return scanGeneration.load(std::memory_order_acquire);
+    }
+
+    // Save network properties to the configuration store
     void saveNetworkProperties(const NetworkProperties& properties);
 
-    // Load network properties from a file
+    // Load network properties from the configuration store
     NetworkProperties loadNetworkProperties();
 
-    // Start the network connection
-    void startNetwork();
+    // Start joining the configured network; returns at once, poll isConnected().
+    // With fastPath, first tries a direct join to the last known access point
+    // starting on the cached DHCP lease, renewed through DHCP once joined
+    // (blocking, at most FAST_JOIN_TIMEOUT_MS); returns true if that join succeeded
+    bool startNetwork(bool fastPath = false);
+
+    // Cache the access point and lease of the current link for the next fast
+    // join; false while DHCP has not granted the address yet, call it again
+    bool rememberLink();
+
+    // Drop the cached link, the next join scans
+    void forgetLink();
 
     // Stop the network connection
     void stopNetwork();
@@ -67,14 +110,68 @@ public:
     // Get connection information
     ConnectionInfo getConnectionInfo();
 
+    // Power-save policy: the CYW43 power save adds tens of ms to every packet,
+    // so it is turned off while driving or sending commands and back on when idle.
+    // The hints may come from any task, the mode is only applied by updatePowerMode()
+
+    // The driver page is shown (or not)
+    void setDriving(bool active) {
+        driving.store(active, std::memory_order_relaxed);
+    }
+
+    // Commands have just been sent to the command station
+    void noteCommandTraffic() {
+        lastTrafficMs.store(millis(), std::memory_order_relaxed);
+    }
+
+    // Apply the mode the hints ask for; force reapplies it after a join.
+    // Called from the connection task while the link is up
+    void updatePowerMode(bool force = false);
+
+    // Power save currently disabled
+    bool isLowLatency() const {
+        return lowLatency.load(std::memory_order_relaxed);
+    }
+
 private:
     // Private constructor for singleton pattern
-    WiFiConfigManager(const String& configFilePath);
+    WiFiConfigManager();
     
-    String configFilePath;
-    bool scanning = false;
+    std::atomic<bool> driving{false};
+    std::atomic<uint32_t> lastTrafficMs{0};
+    std::atomic<bool> lowLatency{false};
+
+    std::atomic<bool> scanning{false};
     TaskHandle_t scanTaskHandle = nullptr; // Handle for the FreeRTOS task
 
-    // FreeRTOS task for scanning SSIDs
+    // Scan cache: results in a flat array, looked up by SSID through an
+    // open-addressing hash index kept at most half full
+    static constexpr int SCAN_BUCKETS = 32;
+    struct ScanEntry {
+        ScanResult result;
+        uint32_t hash;
+    };
+    ScanEntry scanEntries[MAX_SCAN_RESULTS];
+    int scanEntryCount = 0;
+    int8_t scanIndex[SCAN_BUCKETS]; // Position in scanEntries, -1 for an empty bucket
+    std::atomic<uint32_t> scanGeneration{0};
+    SemaphoreHandle_t scanMutex = nullptr; // Guards the cache and the task lifecycle
+
+    // FreeRTOS task refreshing the scan cache
     static void scanTask(void* parameter);
+
+    // Merge the results of the last WiFi.scanNetworks() into the cache
+    void mergeScanResults(int count, uint32_t now);
+
+    // Try the cached access point and lease; false if there is none or the join failed
+    bool joinCachedLink(const NetworkProperties& properties);
+
+    // "aa:bb:cc:dd:ee:ff" <-> 6 bytes
+    static String formatBSSID(const uint8_t* bssid);
+    static bool parseBSSID(const String& text, uint8_t* bssid);
+
+    // Cache helpers, called with scanMutex taken
+    static uint32_t hashSSID(const String& ssid);
+    int findScanEntry(uint32_t hash, const String& ssid) const;
+    void rebuildScanIndex();
 };
\ No newline at end of file
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <DialogListPage.h>
+#include <functional>
+#include "WiFiConfigManager.h"
+
+// Network selection dialog fed by the background scan cache of
+// WiFiConfigManager. It opens at once with the cached networks, strongest
+// first, and updates its list in place as new scan results arrive.
+class WiFiScanPage : public DialogListPage {
+public:
+    explicit WiFiScanPage(std::function<void(bool accepted, ListItem selected)> callback);
+    ~WiFiScanPage() override;
+
+    void handleInput(IKeyboard* keyboard) override;
+
+private:
+    // Cached networks as list items, strongest first
+    static std::vector<ListItem> cachedNetworks();
+
+    uint32_t shownGeneration;
+};
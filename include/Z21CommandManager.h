@@ -0,0 +1,149 @@
+#pragma once
+
+#include "LocoCommandBackend.h"
+#include <Arduino.h> // For Arduino's String class
+#include <WiFi.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#include <semphr.h>
+
+// Z21 LAN protocol client (Roco/Fleischmann Z21, z21 and compatible stations)
+// over UDP. Every message is a little-endian dataset "DataLen Header Data";
+// loco commands travel as X-Bus frames inside LAN_X datasets. A datagram may
+// carry several datasets, so a batch costs a single packet.
+class Z21CommandManager final : public LocoCommandBackend<Z21CommandManager> {
+    friend class LocoCommandBackend<Z21CommandManager>;
+
+public:
+    // Z21 LAN port, on the station and on our side
+    static constexpr uint16_t DEFAULT_PORT = 21105;
+
+    // Public constructor
+    Z21CommandManager();
+
+    // Use an externally provided transport instead of the internal WiFiUDP
+    // (e.g. a stand-in replaying captured Z21 traffic on the host)
+    explicit Z21CommandManager(UDP& transport);
+
+    ~Z21CommandManager() override;
+
+    void connect(const String& connectionUrl) override;
+    void disconnect() override;
+    bool isConnected() override;
+
+    // Send a raw datagram given as hex bytes, e.g. "04 00 85 00"
+    void sendCommand(const String& command) override;
+
+    // Broadcast flags the station reported for this client (LAN_GET_BROADCASTFLAGS)
+    uint32_t getBroadcastFlags() const {
+        return confirmedFlags;
+    }
+
+protected:
+    void acquireLoco(int address) override;
+    void releaseLoco(int address) override;
+    void beginBatch() override;
+    void endBatch() override;
+    void sendSpeedCommand(int address, int speed, bool forward) override;
+    void sendBrakeCommand(int address, int brake) override;
+    void sendFrontLightsCommand(int address, LightStatus status) override;
+    void sendBackLightsCommand(int address, LightStatus status) override;
+    void sendBellCommand(int address, bool active) override;
+    void sendHornCommand(int address, bool active) override;
+    void sendFunctionGroup(int address, int group, uint8_t states) override;
+    void sendEmergencyStop() override;
+    uint8_t confirmedFields() const override;
+
+private:
+    // LAN dataset headers
+    static constexpr uint16_t LAN_GET_SERIAL_NUMBER = 0x10;
+    static constexpr uint16_t LAN_LOGOFF = 0x30;
+    static constexpr uint16_t LAN_X = 0x40;
+    static constexpr uint16_t LAN_SET_BROADCASTFLAGS = 0x50;
+    static constexpr uint16_t LAN_GET_BROADCASTFLAGS = 0x51;
+    static constexpr uint16_t LAN_SYSTEMSTATE_DATACHANGED = 0x84;
+    static constexpr uint16_t LAN_SYSTEMSTATE_GETDATA = 0x85;
+
+    // X-Bus headers carried by LAN_X
+    static constexpr uint8_t X_SET_STOP = 0x80;
+    static constexpr uint8_t X_GET_LOCO_INFO = 0xE3;
+    static constexpr uint8_t X_SET_LOCO = 0xE4;
+    static constexpr uint8_t X_LOCO_INFO = 0xEF;
+
+    // Broadcasts to subscribe to: driving and switching, which brings the
+    // LAN_X_LOCO_INFO of the locos we asked about
+    static constexpr uint32_t BROADCAST_FLAGS = 0x00000001;
+
+    // Largest datagram built; a fuller batch is split over several
+    static constexpr size_t MAX_DATAGRAM = 256;
+
+    // Wait for the serial number answer that proves the station is there
+    static constexpr uint32_t CONNECT_TIMEOUT_MS = 1000;
+
+    // Pass period of the session task
+    static constexpr uint32_t SESSION_PERIOD_MS = 20;
+
+    // The station forgets a client silent for a minute: LAN_SYSTEMSTATE_GETDATA
+    // every ECHO_INTERVAL_MS keeps the session alive and times the round trip,
+    // and no datagram for KEEPALIVE_TIMEOUT_MS marks the link down
+    static constexpr uint32_t ECHO_INTERVAL_MS = 2000;
+    static constexpr uint32_t KEEPALIVE_TIMEOUT_MS = 10000;
+
+    // FreeRTOS task receiving datagrams and sending keepalives
+    static void sessionTask(void* param);
+
+    // Append a dataset to a buffer; returns its new length
+    static size_t appendDataset(uint8_t* buffer, size_t length, uint16_t header, const uint8_t* data, size_t dataLength);
+
+    // Append LAN_SET_BROADCASTFLAGS with our flags and LAN_GET_BROADCASTFLAGS to read them back
+    static size_t appendSubscription(uint8_t* buffer, size_t length);
+
+    // Send a dataset, or append it to the open batch
+    void queueDataset(uint16_t header, const uint8_t* data, size_t length);
+
+    // Send an X-Bus frame, its XOR checksum added, as a LAN_X dataset
+    void queueXBus(const uint8_t* frame, size_t length);
+
+    // Send one datagram to the station if the session is up (takes clientMutex)
+    void sendDatagram(const uint8_t* data, size_t length);
+
+    // Send one datagram, clientMutex taken by the caller
+    void writeDatagram(const uint8_t* data, size_t length);
+
+    // Set a function of the given loco
+    void sendFunctionCommand(int address, int function, bool active);
+
+    // Handle the datasets of one received datagram, collecting loco reports
+    void handleDatagram(const uint8_t* data, size_t length, StateReport* reports, int& reportCount);
+
+    // Parse a LAN_X_LOCO_INFO frame (X-Bus header included)
+    static bool parseLocoInfo(const uint8_t* frame, size_t length, StateReport& report);
+
+    // Address bytes of X-Bus loco commands; long addresses are flagged with 0xC0
+    static uint8_t addressMsb(int address) {
+        return address >= 128 ? (0xC0 | (address >> 8)) : 0;
+    }
+
+    static uint8_t addressLsb(int address) {
+        return address & 0xFF;
+    }
+
+    WiFiUDP ownUdp;
+    UDP* udp;
+    IPAddress stationIp;
+    uint16_t stationPort = DEFAULT_PORT;
+
+    SemaphoreHandle_t clientMutex = nullptr;  // Serialises access from UI and session tasks
+    volatile bool connected = false;          // UDP has no connection: set by the handshake
+    volatile uint32_t confirmedFlags = 0;
+
+    // Owned by the session task
+    unsigned long lastReceive = 0;
+    unsigned long lastEcho = 0;
+    bool echoAnswered = true; // The LAN_SYSTEMSTATE_DATACHANGED to the last probe came back
+
+    // Datasets collected between beginBatch() and endBatch()
+    uint8_t batchBuffer[MAX_DATAGRAM];
+    size_t batchLength = 0;
+    bool batching = false;
+};
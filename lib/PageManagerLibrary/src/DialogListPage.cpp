@@ -48,6 +48,26 @@ void DialogListPage::drawItems() {
     }
 }
 
+void DialogListPage::setItems(const std::vector<ListItem>& newItems) {
+    String selectedLabel = selectedIndex < (int)items.size() ? items[selectedIndex].label : String();
+    size_t previousCount = items.size();
+    items = newItems;
+
+    selectedIndex = 0;
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (items[i].label == selectedLabel) {
+            selectedIndex = i;
+            break;
+        }
+    }
+
+    // Clear the rows the old list used, then repaint only the list
+    ThreadSafeTFT::withLock([this, previousCount](TFT_eSPI& tft) {
+        tft.fillRect(0, listTopY, PAGE_LIBRARY_SCREEN_WIDTH, previousCount * itemHeight, TFT_BLACK);
+    });
+    drawItems();
+}
+
 void DialogListPage::drawButtons() {
     
     ThreadSafeTFT::withLock([this](TFT_eSPI& tft) {
@@ -70,7 +90,10 @@ void DialogListPage::drawButtons() {
 
 void DialogListPage::moveSelection(int delta) {
     if (!focusOnButtons) {
-        selectedIndex = constrain(selectedIndex + delta, 0, items.size() - 1);
+        if (items.empty()) {
+            return;
+        }
+        selectedIndex = constrain(selectedIndex + delta, 0, (int)items.size() - 1);
     } else {
         selectedButton = (selectedButton + 1) % 2;
     }
@@ -97,9 +120,12 @@ void DialogListPage::handleInput(IKeyboard* keyboard) {
         delay(200);
     } else if (pressedKeys & KEY_OK) {
         if (focusOnButtons) {
-            bool accepted = selectedButton == 0;
+            // Popping the page destroys it: keep what the callback needs first
+            bool accepted = selectedButton == 0 && !items.empty();
+            ListItem selected = items.empty() ? ListItem{"", 0} : items[selectedIndex];
+            auto onClose = callback;
             PageManager::popPage();
-            if (callback) callback(accepted, items[selectedIndex]);
+            if (onClose) onClose(accepted, selected);
         } else {
             focusOnButtons = true;
             draw();
@@ -21,6 +21,9 @@ public:
     void handleInput(IKeyboard* keyboard) override;
     void draw() override;
 
+    // Replace the items while the dialog is shown, keeping the selected label
+    void setItems(const std::vector<ListItem>& newItems);
+
 private:
     void drawItems();
     void drawButtons();
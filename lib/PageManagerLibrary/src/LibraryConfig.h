@@ -22,3 +22,7 @@
 #ifndef PAGE_LIBRARY_BTN_OK
 #define PAGE_LIBRARY_BTN_OK 17
 #endif
+
+#ifndef PAGE_LIBRARY_UI_CORE
+#define PAGE_LIBRARY_UI_CORE 0
+#endif
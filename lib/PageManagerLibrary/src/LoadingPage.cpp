@@ -6,7 +6,8 @@
 LoadingPage::LoadingPage(const String& msg)
     : message(msg) {
     draw(); // Draw initial frame
-    xTaskCreate(animationTask, "LoadingSpinner", 1024, this, 1, &animationTaskHandle);
+    // Rendering belongs to the UI core
+    xTaskCreateAffinitySet(animationTask, "LoadingSpinner", 1024, this, 1, 1 << PAGE_LIBRARY_UI_CORE, &animationTaskHandle);
 }
 
 LoadingPage::~LoadingPage() {
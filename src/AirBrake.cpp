@@ -0,0 +1,53 @@
+#include "AirBrake.h"
+#include "TrainPhysics.h"
+
+// Pressure change rates per tick (rates per second / TICK_HZ)
+static constexpr int32_t PIPE_VENT_MBAR = 500 / TrainPhysics::TICK_HZ;        // Brake valve in apply
+static constexpr int32_t PIPE_CHARGE_MBAR = 200 / TrainPhysics::TICK_HZ;      // Brake valve in release
+static constexpr int32_t CYLINDER_FILL_MBAR = 950 / TrainPhysics::TICK_HZ;    // Full service in ~4 s
+static constexpr int32_t CYLINDER_RELEASE_MBAR = 250 / TrainPhysics::TICK_HZ; // Full release in ~15 s
+static constexpr int32_t AUX_RECHARGE_MBAR = 100 / TrainPhysics::TICK_HZ;
+
+// Cylinder to auxiliary reservoir volume ratio, in percent
+static constexpr int32_t CYLINDER_VOLUME_PERCENT = 40;
+
+static int32_t clampMbar(int32_t value, int32_t low, int32_t high) {
+    return value < low ? low : (value > high ? high : value);
+}
+
+void AirBrake::tick() {
+    // Driver's brake valve acts on the brake pipe
+    switch (valve) {
+        case Valve::APPLY:
+            pipeMbar = clampMbar(pipeMbar - PIPE_VENT_MBAR, 0, RUNNING_PRESSURE_MBAR);
+            break;
+        case Valve::RELEASE:
+            pipeMbar = clampMbar(pipeMbar + PIPE_CHARGE_MBAR, 0, RUNNING_PRESSURE_MBAR);
+            break;
+        case Valve::LAP:
+            break;
+    }
+
+    // The distributor sets the cylinder in proportion to the pipe reduction,
+    // but never above what the auxiliary reservoir can still supply
+    int32_t reduction = RUNNING_PRESSURE_MBAR - pipeMbar;
+    int32_t target = clampMbar(reduction * MAX_CYLINDER_MBAR / FULL_SERVICE_REDUCTION_MBAR, 0, MAX_CYLINDER_MBAR);
+    if (target > auxReservoirMbar) {
+        target = auxReservoirMbar;
+    }
+
+    if (cylinderMbar < target) {
+        // Air flows from the auxiliary reservoir into the cylinder
+        int32_t step = clampMbar(target - cylinderMbar, 0, CYLINDER_FILL_MBAR);
+        cylinderMbar += step;
+        auxReservoirMbar -= step * CYLINDER_VOLUME_PERCENT / 100;
+    } else if (cylinderMbar > target) {
+        // Cylinder exhausts to atmosphere
+        cylinderMbar -= clampMbar(cylinderMbar - target, 0, CYLINDER_RELEASE_MBAR);
+    }
+
+    // Auxiliary reservoir recharges from the pipe while the pipe is higher
+    if (pipeMbar > auxReservoirMbar) {
+        auxReservoirMbar += clampMbar(pipeMbar - auxReservoirMbar, 0, AUX_RECHARGE_MBAR);
+    }
+}
@@ -0,0 +1,100 @@
+#include "BootSequence.h"
+#include "Config.h"
+#include "ConfigStore.h"
+#include "ConnectionManager.h"
+#include <LittleFS.h>
+#include <task.h>
+
+EventGroupHandle_t BootSequence::events = nullptr;
+volatile uint32_t BootSequence::startedMs[(int)Phase::COUNT];
+volatile uint32_t BootSequence::doneMs[(int)Phase::COUNT];
+
+static const char* const PHASE_NAMES[] = {"FS", "Config", "UI", "WiFi", "Station"};
+
+void BootSequence::start() {
+    if (events) {
+        return;
+    }
+    events = xEventGroupCreate();
+
+    TaskHandle_t taskHandle = nullptr;
+    // The UI core is busy with the display meanwhile
+    xTaskCreateAffinitySet(
+        bootTask,          // Task function
+        "Boot",            // Task name
+        4096,              // Stack size
+        nullptr,           // Task parameter
+        2,                 // Task priority
+        1 << CONTROL_CORE, // Core affinity
+        &taskHandle        // Task handle
+    );
+}
+
+void BootSequence::beginPhase(Phase phase) {
+    startedMs[(int)phase] = millis();
+}
+
+void BootSequence::endPhase(Phase phase) {
+    doneMs[(int)phase] = millis();
+    xEventGroupSetBits(events, 1 << (int)phase);
+}
+
+void BootSequence::waitFor(Phase phase) {
+    EventBits_t bit = 1 << (int)phase;
+    xEventGroupWaitBits(events, bit, pdFALSE, pdTRUE, portMAX_DELAY);
+}
+
+bool BootSequence::isDone(Phase phase) {
+    return events && (xEventGroupGetBits(events) & (1 << (int)phase));
+}
+
+String BootSequence::report() {
+    String text = "Boot (ms):\n";
+    for (int i = 0; i < (int)Phase::COUNT; i++) {
+        text += String(PHASE_NAMES[i]) + " " + String(startedMs[i]) + "-";
+        text += isDone((Phase)i) ? String(doneMs[i]) : String("...");
+        text += "\n";
+    }
+    return text;
+}
+
+void BootSequence::bootTask(void* param) {
+    beginPhase(Phase::FILESYSTEM);
+    LittleFS.begin();
+    endPhase(Phase::FILESYSTEM);
+
+    beginPhase(Phase::CONFIG);
+    ConfigStore& store = ConfigStore::getInstance();
+    store.load();
+    store.start();
+    endPhase(Phase::CONFIG);
+
+    // Association and connect run in the connection task; boot only timestamps them
+    beginPhase(Phase::WIFI);
+    ConnectionManager::getInstance().start();
+    uint32_t deadline = millis() + LINK_TIMEOUT_MS;
+    if (waitForLink((uint8_t)ConnectionManager::LinkState::WIFI_UP, deadline)) {
+        endPhase(Phase::WIFI);
+        beginPhase(Phase::STATION);
+        if (waitForLink((uint8_t)ConnectionManager::LinkState::ONLINE, deadline)) {
+            endPhase(Phase::STATION);
+        }
+    }
+
+    Serial1.print(report());
+    vTaskDelete(nullptr);
+}
+
+bool BootSequence::waitForLink(uint8_t state, uint32_t deadline) {
+    ConnectionManager& connection = ConnectionManager::getInstance();
+    // Link states are ordered, each one includes the previous
+    while ((uint8_t)connection.getLinkState() < state) {
+        // No network configured: nothing to wait for
+        if (connection.getLinkState() == ConnectionManager::LinkState::OFFLINE ||
+            (int32_t)(millis() - deadline) >= 0) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return true;
+}
@@ -0,0 +1,187 @@
+#include "CommandBenchmark.h"
+#include "Config.h"
+#include "DccExCommandManager.h"
+#include "JMRICommandManager.h"
+#include "Z21CommandManager.h"
+#include "LocoNetCommandManager.h"
+#include <memory>
+
+namespace {
+
+// Always connected transport dropping every byte. As an LbServer it grants
+// the slot asked for with OPC_LOCO_ADR, so LocoNet speeds go out too
+class NullClient : public Client {
+public:
+    int connect(IPAddress ip, uint16_t port) override { return 1; }
+    int connect(const char* host, uint16_t port) override { return 1; }
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override {
+        for (size_t i = 0; i < size; i++) {
+            if (buffer[i] != '\n') {
+                line += (char)buffer[i];
+                continue;
+            }
+            if (line.startsWith("SEND BF")) {
+                grantSlot();
+            }
+            speedsSent += line.startsWith("SEND A0");
+            line = "";
+        }
+        return size;
+    }
+    int available() override { return reply.length() - replyRead; }
+    int read() override { return available() > 0 ? reply[replyRead++] : -1; }
+    int read(uint8_t* buffer, size_t size) override {
+        size_t count = min(size, (size_t)available());
+        memcpy(buffer, reply.c_str() + replyRead, count);
+        replyRead += count;
+        return count;
+    }
+    int peek() override { return available() > 0 ? reply[replyRead] : -1; }
+    void flush() override {}
+    void stop() override {}
+    uint8_t connected() override { return 1; }
+    operator bool() override { return true; }
+
+    volatile int speedsSent = 0; // LocoNet OPC_LOCO_SPD lines written
+
+private:
+    // OPC_SL_RD_DATA for slot 1, in use, holding DEFAULT_LOCO_ADDRESS
+    void grantSlot() {
+        uint8_t message[14] = {0xE7, 0x0E, 0x01, 0x30, LocoCommandManager::DEFAULT_LOCO_ADDRESS & 0x7F, 0, 0x20,
+                               0, 0, LocoCommandManager::DEFAULT_LOCO_ADDRESS >> 7, 0, 0, 0, 0xFF};
+        for (int i = 0; i < 13; i++) {
+            message[13] ^= message[i];
+        }
+        char text[8 + 3 * sizeof(message) + 2] = "RECEIVE";
+        size_t used = 7;
+        for (uint8_t value : message) {
+            used += snprintf(text + used, sizeof(text) - used, " %02X", value);
+        }
+        reply = reply.substring(replyRead) + text + "\n";
+        replyRead = 0;
+    }
+
+    String line;
+    String reply;
+    size_t replyRead = 0;
+};
+
+// UDP counterpart of NullClient, answering the Z21 handshake
+// (LAN_GET_SERIAL_NUMBER) so the backend considers itself connected
+class NullUdp : public UDP {
+public:
+    uint8_t begin(uint16_t port) override { return 1; }
+    void stop() override {}
+    int beginPacket(IPAddress ip, uint16_t port) override { return 1; }
+    int beginPacket(const char* host, uint16_t port) override { return 1; }
+    int endPacket() override { return 1; }
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override {
+        if (size == 4 && buffer[2] == 0x10 && buffer[3] == 0x00) {
+            serialAsked = true;
+        }
+        return size;
+    }
+    int parsePacket() override { return serialAsked ? sizeof(SERIAL_ANSWER) : 0; }
+    int available() override { return parsePacket(); }
+    int read() override { return -1; }
+    int read(unsigned char* buffer, size_t size) override {
+        if (!serialAsked) {
+            return 0;
+        }
+        serialAsked = false;
+        size_t count = min(size, sizeof(SERIAL_ANSWER));
+        memcpy(buffer, SERIAL_ANSWER, count);
+        return count;
+    }
+    int read(char* buffer, size_t size) override { return read((unsigned char*)buffer, size); }
+    int peek() override { return -1; }
+    void flush() override {}
+    IPAddress remoteIP() override { return IPAddress(); }
+    uint16_t remotePort() override { return 0; }
+
+private:
+    static constexpr uint8_t SERIAL_ANSWER[] = {0x08, 0x00, 0x10, 0x00, 0x01, 0x00, 0x00, 0x00};
+    volatile bool serialAsked = false;
+};
+
+// Time ITERATIONS speed changes, driven through the base class as the simulator does
+uint32_t timeSpeedChanges(LocoCommandManager& manager) {
+    uint32_t start = micros();
+    for (int i = 0; i < CommandBenchmark::ITERATIONS; i++) {
+        manager.setSpeed(i % LocoCommandManager::MAX_SPEED_STEP + 1);
+        manager.flush();
+    }
+    uint32_t elapsed = micros() - start;
+    return elapsed * 1000 / CommandBenchmark::ITERATIONS;
+}
+
+}
+
+template <typename Backend>
+uint32_t CommandBenchmark::measure() {
+    NullClient sink;
+    std::unique_ptr<Backend> backend = std::make_unique<Backend>(sink);
+    LocoCommandManager& manager = *backend;
+    manager.selectLoco(LocoCommandManager::DEFAULT_LOCO_ADDRESS);
+    manager.flush();
+    return timeSpeedChanges(manager);
+}
+
+#if LOCO_BACKEND == LOCO_BACKEND_RUNTIME || LOCO_BACKEND == LOCO_BACKEND_Z21
+template <>
+uint32_t CommandBenchmark::measure<Z21CommandManager>() {
+    NullUdp sink;
+    std::unique_ptr<Z21CommandManager> backend = std::make_unique<Z21CommandManager>(sink);
+    LocoCommandManager& manager = *backend;
+    manager.connect("127.0.0.1");
+    if (!manager.isConnected()) {
+        return 0;
+    }
+    manager.selectLoco(LocoCommandManager::DEFAULT_LOCO_ADDRESS);
+    manager.flush();
+    return timeSpeedChanges(manager);
+}
+#endif
+
+#if LOCO_BACKEND == LOCO_BACKEND_RUNTIME || LOCO_BACKEND == LOCO_BACKEND_LOCONET
+template <>
+uint32_t CommandBenchmark::measure<LocoNetCommandManager>() {
+    NullClient sink;
+    std::unique_ptr<LocoNetCommandManager> backend = std::make_unique<LocoNetCommandManager>(sink);
+    LocoCommandManager& manager = *backend;
+    manager.connect("127.0.0.1");
+    manager.selectLoco(LocoCommandManager::DEFAULT_LOCO_ADDRESS);
+
+    // Speeds are only sent once the session task got the slot: the loco's state goes out then
+    uint32_t start = millis();
+    while (sink.speedsSent == 0) {
+        if (millis() - start > READY_TIMEOUT_MS) {
+            return 0;
+        }
+        delay(10);
+    }
+    return timeSpeedChanges(manager);
+}
+#endif
+
+String CommandBenchmark::run() {
+    String result = LOCO_VIRTUAL_DISPATCH ? "One virtual call per command\n" : "One virtual call per flush\n";
+
+#if LOCO_BACKEND == LOCO_BACKEND_RUNTIME || LOCO_BACKEND == LOCO_BACKEND_DCCEX
+    result += "DCC-EX: " + String(measure<DccExCommandManager>()) + " ns/command\n";
+#endif
+#if LOCO_BACKEND == LOCO_BACKEND_RUNTIME || LOCO_BACKEND == LOCO_BACKEND_JMRI
+    result += "JMRI: " + String(measure<JMRICommandManager>()) + " ns/command\n";
+#endif
+#if LOCO_BACKEND == LOCO_BACKEND_RUNTIME || LOCO_BACKEND == LOCO_BACKEND_Z21
+    uint32_t z21 = measure<Z21CommandManager>();
+    result += z21 > 0 ? "Z21: " + String(z21) + " ns/command\n" : "Z21: handshake failed\n";
+#endif
+#if LOCO_BACKEND == LOCO_BACKEND_RUNTIME || LOCO_BACKEND == LOCO_BACKEND_LOCONET
+    uint32_t loconet = measure<LocoNetCommandManager>();
+    result += loconet > 0 ? "LocoNet: " + String(loconet) + " ns/command\n" : "LocoNet: no slot\n";
+#endif
+    return result;
+}
@@ -0,0 +1,452 @@
+#include "ConfigStore.h"
+#include "Config.h"
+#include "BootSequence.h"
+#include <LittleFS.h>
+#include <vector>
+
+namespace {
+
+// Holds the recursive store mutex for the lifetime of the object
+class StoreLock {
+public:
+    explicit StoreLock(SemaphoreHandle_t mutex) : mutex(mutex) {
+        xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+    }
+    ~StoreLock() {
+        xSemaphoreGiveRecursive(mutex);
+    }
+private:
+    SemaphoreHandle_t mutex;
+};
+
+// JSON names of the keys, used for import/export and the legacy files
+struct KeyInfo {
+    ConfigStore::Key key;
+    const char* section;
+    const char* name;
+    bool secret;
+};
+
+const KeyInfo KEY_INFO[] = {
+    {ConfigStore::Key::WIFI_SSID, "wifi", "ssid", false},
+    {ConfigStore::Key::WIFI_PASSWORD, "wifi", "password", true},
+    {ConfigStore::Key::WIFI_IP, "wifi", "ip", false},
+    {ConfigStore::Key::WIFI_MASK, "wifi", "mask", false},
+    {ConfigStore::Key::WIFI_ROUTER, "wifi", "router", false},
+    {ConfigStore::Key::WIFI_DNS, "wifi", "dns", false},
+    {ConfigStore::Key::WIFI_DHCP, "wifi", "dhcp", false},
+    {ConfigStore::Key::LOCO_MANAGER_TYPE, "locoCommandManager", "managerType", false},
+    {ConfigStore::Key::LOCO_CONNECTION_URL, "locoCommandManager", "connectionUrl", false},
+    {ConfigStore::Key::LOCO_TRANSPORT, "locoCommandManager", "transport", false},
+    {ConfigStore::Key::LOCO_BAUD_RATE, "locoCommandManager", "baudRate", false},
+    {ConfigStore::Key::FUNCTION_KEY_MAP, "functions", "keyMap", false},
+};
+
+// JSON files used before the binary store, imported once
+struct LegacyFile {
+    const char* path;
+    const char* section;
+};
+
+const LegacyFile LEGACY_FILES[] = {
+    {"/wifi_config.json", "wifi"},
+    {"/locoCommandManager.json", "locoCommandManager"},
+};
+
+constexpr size_t HEADER_SIZE = 16;
+
+void putU16(uint8_t* out, uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+void putU32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+uint16_t getU16(const uint8_t* in) {
+    return in[0] | (in[1] << 8);
+}
+
+uint32_t getU32(const uint8_t* in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+} // namespace
+
+void ConfigStore::load() {
+    StoreLock lock(mutex);
+    ensureLoaded();
+}
+
+void ConfigStore::start() {
+    if (taskHandle) {
+        return;
+    }
+
+    xTaskCreateAffinitySet(
+        storeTask,         // Task function
+        "ConfigStore",     // Task name
+        2048,              // Stack size
+        this,              // Task parameter
+        1,                 // Task priority
+        1 << CONTROL_CORE, // Core affinity
+        &taskHandle        // Task handle
+    );
+}
+
+String ConfigStore::getString(Key key, const String& fallback) {
+    StoreLock lock(mutex);
+    ensureLoaded();
+    Record* record = find(key);
+    return record && record->type == Type::STRING ? record->text : fallback;
+}
+
+int32_t ConfigStore::getInt(Key key, int32_t fallback) {
+    StoreLock lock(mutex);
+    ensureLoaded();
+    Record* record = find(key);
+    return record && record->type == Type::INT ? record->number : fallback;
+}
+
+bool ConfigStore::getBool(Key key, bool fallback) {
+    StoreLock lock(mutex);
+    ensureLoaded();
+    Record* record = find(key);
+    return record && record->type == Type::BOOL ? record->number != 0 : fallback;
+}
+
+void ConfigStore::setString(Key key, const String& value) {
+    StoreLock lock(mutex);
+    ensureLoaded();
+    Record* record = find(key);
+    if (record && record->type == Type::STRING && record->text == value) {
+        return;
+    }
+    record = findOrAdd(key, Type::STRING);
+    if (record) {
+        record->text = value;
+        markDirty();
+    }
+}
+
+void ConfigStore::setInt(Key key, int32_t value) {
+    StoreLock lock(mutex);
+    ensureLoaded();
+    Record* record = find(key);
+    if (record && record->type == Type::INT && record->number == value) {
+        return;
+    }
+    record = findOrAdd(key, Type::INT);
+    if (record) {
+        record->number = value;
+        markDirty();
+    }
+}
+
+void ConfigStore::setBool(Key key, bool value) {
+    StoreLock lock(mutex);
+    ensureLoaded();
+    Record* record = find(key);
+    if (record && record->type == Type::BOOL && (record->number != 0) == value) {
+        return;
+    }
+    record = findOrAdd(key, Type::BOOL);
+    if (record) {
+        record->number = value ? 1 : 0;
+        markDirty();
+    }
+}
+
+void ConfigStore::flush() {
+    commit(true);
+}
+
+void ConfigStore::exportJson(JsonDocument& doc, bool includeSecrets) {
+    StoreLock lock(mutex);
+    ensureLoaded();
+    doc["version"] = SCHEMA_VERSION;
+    for (const KeyInfo& info : KEY_INFO) {
+        Record* record = find(info.key);
+        if (!record || (info.secret && !includeSecrets)) {
+            continue;
+        }
+        switch (record->type) {
+            case Type::INT:
+                doc[info.section][info.name] = record->number;
+                break;
+            case Type::BOOL:
+                doc[info.section][info.name] = record->number != 0;
+                break;
+            case Type::STRING:
+                doc[info.section][info.name] = record->text;
+                break;
+        }
+    }
+}
+
+int ConfigStore::importJson(JsonVariantConst doc) {
+    StoreLock lock(mutex);
+    ensureLoaded();
+    int applied = 0;
+    for (const KeyInfo& info : KEY_INFO) {
+        JsonVariantConst value = doc[info.section][info.name];
+        if (value.is<bool>()) {
+            setBool(info.key, value.as<bool>());
+        } else if (value.is<int32_t>()) {
+            setInt(info.key, value.as<int32_t>());
+        } else if (value.is<const char*>()) {
+            setString(info.key, value.as<const char*>());
+        } else {
+            continue;
+        }
+        applied++;
+    }
+    return applied;
+}
+
+void ConfigStore::ensureLoaded() {
+    if (loaded) {
+        return;
+    }
+    loaded = true;
+
+    // Settings read before the filesystem is mounted would silently be defaults
+    BootSequence::waitFor(BootSequence::Phase::FILESYSTEM);
+
+    if (!loadBinary()) {
+        recordCount = 0;
+
+        // First boot with the binary store, or a damaged file: start from the
+        // JSON files. Not over a newer file though, it is the configuration
+        if (!newerFile) {
+            importLegacyFiles();
+        }
+    }
+}
+
+bool ConfigStore::loadBinary() {
+    File file = LittleFS.open(FILE_PATH, "r");
+    if (!file) {
+        return false;
+    }
+
+    uint8_t header[HEADER_SIZE];
+    if (file.read(header, HEADER_SIZE) != HEADER_SIZE) {
+        file.close();
+        return false;
+    }
+
+    uint16_t version = getU16(header + 4);
+    uint16_t count = getU16(header + 6);
+    uint32_t payloadLength = getU32(header + 8);
+    if (getU32(header) != MAGIC || payloadLength > MAX_PAYLOAD) {
+        file.close();
+        return false;
+    }
+
+    // A newer firmware only adds keys, so the records known here are read
+    // as usual; the file is left alone, a rewrite would downgrade it
+    newerFile = version > SCHEMA_VERSION;
+
+    // The payload is small; read it whole to check the CRC before trusting any of it
+    std::vector<uint8_t> payload(payloadLength);
+    size_t read = file.read(payload.data(), payloadLength);
+    file.close();
+    if (read != payloadLength) {
+        return false;
+    }
+
+    uint32_t crc = crc32(0, header, 12);
+    crc = crc32(crc, payload.data(), payloadLength);
+    if (crc != getU32(header + 12)) {
+        return false;
+    }
+
+    // Unknown keys are kept so a rewrite preserves them; unknown types are skipped
+    size_t offset = 0;
+    recordCount = 0;
+    for (int i = 0; i < count && offset + 4 <= payloadLength; i++) {
+        Key key = (Key)payload[offset];
+        Type type = (Type)payload[offset + 1];
+        uint16_t length = getU16(&payload[offset + 2]);
+        offset += 4;
+        if (offset + length > payloadLength) {
+            break;
+        }
+
+        const uint8_t* value = &payload[offset];
+        offset += length;
+        if (type == Type::STRING) {
+            Record* record = findOrAdd(key, type);
+            if (record) {
+                record->text = String((const char*)value, length);
+            }
+        } else if ((type == Type::INT || type == Type::BOOL) && length == 4) {
+            Record* record = findOrAdd(key, type);
+            if (record) {
+                record->number = (int32_t)getU32(value);
+            }
+        }
+    }
+    return true;
+}
+
+void ConfigStore::importLegacyFiles() {
+    for (const LegacyFile& legacy : LEGACY_FILES) {
+        File file = LittleFS.open(legacy.path, "r");
+        if (!file) {
+            continue;
+        }
+
+        JsonDocument doc;
+        DeserializationError error = deserializeJson(doc, file);
+        file.close();
+        if (error) {
+            continue;
+        }
+
+        // The old files hold one section each, at their root
+        JsonDocument wrapped;
+        wrapped[legacy.section] = doc.as<JsonObjectConst>();
+        importJson(wrapped.as<JsonVariantConst>());
+    }
+}
+
+ConfigStore::Record* ConfigStore::find(Key key) {
+    for (int i = 0; i < recordCount; i++) {
+        if (records[i].key == key) {
+            return &records[i];
+        }
+    }
+    return nullptr;
+}
+
+ConfigStore::Record* ConfigStore::findOrAdd(Key key, Type type) {
+    Record* record = find(key);
+    if (!record) {
+        if (recordCount >= MAX_RECORDS) {
+            return nullptr;
+        }
+        record = &records[recordCount++];
+        record->key = key;
+        record->number = 0;
+        record->text = "";
+    }
+    record->type = type;
+    return record;
+}
+
+void ConfigStore::markDirty() {
+    if (dirty) {
+        coalescedCount++; // The previous change never reaches the flash on its own
+    }
+    dirty = true;
+    lastChange = millis();
+}
+
+void ConfigStore::storeTask(void* param) {
+    ConfigStore* self = static_cast<ConfigStore*>(param);
+
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(PERIOD_MS));
+        self->commit(false);
+    }
+}
+
+void ConfigStore::commit(bool force) {
+    xSemaphoreTake(commitMutex, portMAX_DELAY);
+
+    // Serialize under the lock, then write without it so setters never wait on the flash
+    std::vector<uint8_t> buffer;
+    {
+        StoreLock lock(mutex);
+        if (!dirty || newerFile || (!force && millis() - lastChange < QUIET_PERIOD_MS)) {
+            xSemaphoreGive(commitMutex);
+            return;
+        }
+        buffer.resize(HEADER_SIZE + MAX_PAYLOAD);
+        buffer.resize(serialize(buffer.data(), buffer.size()));
+        dirty = false;
+    }
+
+    if (!buffer.empty() && writeAtomically(FILE_PATH, buffer.data(), buffer.size())) {
+        commitCount++;
+    } else {
+        // Keep the change pending and retry after another quiet period
+        StoreLock lock(mutex);
+        if (!dirty) {
+            dirty = true;
+            lastChange = millis();
+        }
+    }
+
+    xSemaphoreGive(commitMutex);
+}
+
+size_t ConfigStore::serialize(uint8_t* buffer, size_t capacity) {
+    size_t offset = HEADER_SIZE;
+    uint16_t count = 0;
+    for (int i = 0; i < recordCount; i++) {
+        const Record& record = records[i];
+        size_t length = record.type == Type::STRING ? record.text.length() : 4;
+        if (offset + 4 + length > capacity || length > 0xFFFF) {
+            return 0; // Does not fit: better no commit than a partial configuration
+        }
+
+        buffer[offset] = (uint8_t)record.key;
+        buffer[offset + 1] = (uint8_t)record.type;
+        putU16(buffer + offset + 2, length);
+        offset += 4;
+        if (record.type == Type::STRING) {
+            memcpy(buffer + offset, record.text.c_str(), length);
+        } else {
+            putU32(buffer + offset, (uint32_t)record.number);
+        }
+        offset += length;
+        count++;
+    }
+
+    uint32_t payloadLength = offset - HEADER_SIZE;
+    putU32(buffer, MAGIC);
+    putU16(buffer + 4, SCHEMA_VERSION);
+    putU16(buffer + 6, count);
+    putU32(buffer + 8, payloadLength);
+    uint32_t crc = crc32(0, buffer, 12);
+    crc = crc32(crc, buffer + HEADER_SIZE, payloadLength);
+    putU32(buffer + 12, crc);
+    return offset;
+}
+
+bool ConfigStore::writeAtomically(const String& path, const uint8_t* data, size_t length) {
+    String tempPath = path + ".tmp";
+
+    File file = LittleFS.open(tempPath, "w");
+    if (!file) {
+        return false;
+    }
+    size_t written = file.write(data, length);
+    file.close();
+
+    if (written != length) {
+        LittleFS.remove(tempPath);
+        return false;
+    }
+
+    // LittleFS renames atomically, replacing the old file
+    return LittleFS.rename(tempPath, path);
+}
+
+uint32_t ConfigStore::crc32(uint32_t crc, const uint8_t* data, size_t length) {
+    // Bitwise CRC-32 (IEEE); the file is a few hundred bytes, no table needed
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
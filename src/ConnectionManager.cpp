@@ -0,0 +1,287 @@
+#include "ConnectionManager.h"
+#include "Config.h"
+#include "TaskMonitor.h"
+#include "WiFiConfigManager.h"
+#include "LocoCommandManagerFactory.h"
+#include "WebServerManager.h"
+
+void ConnectionManager::start() {
+    if (taskHandle) {
+        return;
+    }
+
+    commandQueue = xQueueCreate(4, sizeof(Command));
+    webServer = new WebServerManager(&WiFiConfigManager::getInstance(),
+                                     LocoCommandManagerFactory::getInstance().getLocoCommandManager());
+    eventQueue = xQueueCreate(EVENT_QUEUE_LENGTH, sizeof(LinkEvent));
+
+    // Bring the network up at boot when one has been configured
+    wifiWanted = !WiFiConfigManager::getInstance().loadNetworkProperties().ssid.isEmpty();
+    if (wifiWanted) {
+        linkState.store(LinkState::WIFI_CONNECTING, std::memory_order_relaxed);
+        wifiRequestedAt = millis();
+    }
+
+    xTaskCreateAffinitySet(
+        connectionTask,    // Task function
+        "Connection",      // Task name
+        4096,              // Stack size
+        this,              // Task parameter
+        1,                 // Task priority
+        1 << CONTROL_CORE, // Core affinity
+        &taskHandle        // Task handle
+    );
+}
+
+void ConnectionManager::requestConnect() {
+    Command command = Command::CONNECT;
+    xQueueSend(commandQueue, &command, 0);
+}
+
+void ConnectionManager::requestDisconnect() {
+    Command command = Command::DISCONNECT;
+    xQueueSend(commandQueue, &command, 0);
+}
+
+bool ConnectionManager::pollEvent(LinkEvent& event) {
+    return eventQueue && xQueueReceive(eventQueue, &event, 0) == pdTRUE;
+}
+
+void ConnectionManager::post(LinkEvent event) {
+    // Events are informative: if the UI falls behind the oldest ones are dropped
+    if (xQueueSend(eventQueue, &event, 0) != pdTRUE) {
+        LinkEvent dropped;
+        xQueueReceive(eventQueue, &dropped, 0);
+        xQueueSend(eventQueue, &event, 0);
+    }
+}
+
+uint32_t ConnectionManager::nextBackoff(uint32_t backoff) {
+    return backoff >= MAX_BACKOFF_MS / 2 ? MAX_BACKOFF_MS : backoff * 2;
+}
+
+void ConnectionManager::connectionTask(void* param) {
+    ConnectionManager* self = static_cast<ConnectionManager*>(param);
+    int probe = TaskMonitor::registerTask("Connection", CONTROL_CORE, PERIOD_MS);
+
+    while (true) {
+        // Commands wake the task right away, otherwise it runs every PERIOD_MS
+        Command command;
+        if (xQueueReceive(self->commandQueue, &command, pdMS_TO_TICKS(PERIOD_MS)) == pdTRUE) {
+            if (command == Command::CONNECT) {
+                // A manual request retries immediately, whatever the backoff
+                if (!self->wifiWanted) {
+                    self->wifiTryFast = true;
+                    self->wifiRequestedAt = millis();
+                }
+                self->wifiWanted = true;
+                self->wifiBackoffMs = INITIAL_BACKOFF_MS;
+                self->wifiNextAttempt = millis();
+                self->stationBackoffMs = INITIAL_BACKOFF_MS;
+                self->stationNextAttempt = millis();
+            } else {
+                self->wifiWanted = false;
+            }
+        }
+
+        TaskMonitor::beginRun(probe);
+        self->step();
+        TaskMonitor::endRun(probe);
+    }
+}
+
+void ConnectionManager::step() {
+    uint32_t now = millis();
+    WiFiConfigManager& wifi = WiFiConfigManager::getInstance();
+
+    stepSwap(now);
+
+    // A wired command station is kept connected whatever the WiFi does
+    bool wired = !LocoCommandManagerFactory::getInstance().getLocoCommandManager()->usesNetwork();
+
+    if (!wifiWanted) {
+        if (wifiUp || wifiJoining) {
+            dropStation();
+            webServer->stop();
+            wifi.stopNetwork();
+            if (wifiUp) {
+                post(LinkEvent::WIFI_DOWN);
+            }
+            wifiUp = false;
+            wifiJoining = false;
+        }
+    } else {
+        stepWiFi(now);
+    }
+
+    if (wifiUp || wired) {
+        stepStation(now);
+    }
+    if (wifiUp) {
+        wifi.updatePowerMode();
+    }
+
+    LinkState state = stationUp ? LinkState::ONLINE
+                    : wifiUp ? LinkState::WIFI_UP
+                    : wifiWanted ? LinkState::WIFI_CONNECTING
+                    : LinkState::OFFLINE;
+    linkState.store(state, std::memory_order_relaxed);
+}
+
+void ConnectionManager::stepWiFi(uint32_t now) {
+    WiFiConfigManager& wifi = WiFiConfigManager::getInstance();
+
+    if (wifi.isConnected()) {
+        if (!wifiUp) {
+            wifiUp = true;
+            wifiJoining = false;
+            wifiBackoffMs = INITIAL_BACKOFF_MS;
+            stationBackoffMs = INITIAL_BACKOFF_MS;
+            stationNextAttempt = now;
+            lastJoinMs = now - wifiRequestedAt;
+            lastJoinFast = wifiJoinedFast;
+            Serial1.print(String("WiFi up in ") + String(lastJoinMs) + " ms" +
+                          (wifiJoinedFast ? " (cached AP)\n" : " (scan)\n"));
+            // Access point and lease for the next join
+            linkRemembered = wifi.rememberLink();
+            wifi.updatePowerMode(true);
+            webServer->begin();
+            post(LinkEvent::WIFI_UP);
+        } else if (!linkRemembered) {
+            linkRemembered = wifi.rememberLink();
+        }
+        return;
+    }
+
+    if (wifiUp) {
+        // Lost the access point mid-session: the socket is dead too, rejoin at once
+        wifiUp = false;
+        dropStation();
+        webServer->stop();
+        post(LinkEvent::WIFI_DOWN);
+        wifiBackoffMs = INITIAL_BACKOFF_MS;
+        wifiNextAttempt = now;
+        wifiTryFast = true;
+        wifiRequestedAt = now;
+    }
+
+    if (wifiJoining) {
+        if (now - wifiJoinStart < WIFI_JOIN_TIMEOUT_MS) {
+            return;
+        }
+        wifiJoining = false;
+        wifi.stopNetwork();
+        post(LinkEvent::WIFI_FAILED);
+        wifiNextAttempt = now + wifiBackoffMs;
+        wifiBackoffMs = nextBackoff(wifiBackoffMs);
+        return;
+    }
+
+    if (reached(now, wifiNextAttempt)) {
+        // The cached access point gets one short try per outage, then regular joins
+        wifiJoinedFast = wifi.startNetwork(wifiTryFast);
+        wifiTryFast = false;
+        wifiJoining = true;
+        wifiJoinStart = millis();
+    }
+}
+
+void ConnectionManager::stepStation(uint32_t now) {
+    LocoCommandManagerFactory& factory = LocoCommandManagerFactory::getInstance();
+    LocoCommandManager* manager = factory.getLocoCommandManager();
+
+    // A swapped-in manager arrives connected, otherwise it is connected at once
+    if (manager != station) {
+        station = manager;
+        stationBackoffMs = INITIAL_BACKOFF_MS;
+        stationNextAttempt = now;
+    }
+
+    if (manager->isConnected()) {
+        if (!stationUp) {
+            stationUp = true;
+            stationBackoffMs = INITIAL_BACKOFF_MS;
+            post(LinkEvent::STATION_UP);
+        }
+        return;
+    }
+
+    if (stationUp) {
+        // Socket closed by the server or by the keepalive: retry at once
+        stationUp = false;
+        post(LinkEvent::STATION_DOWN);
+        stationBackoffMs = INITIAL_BACKOFF_MS;
+        stationNextAttempt = now;
+    }
+
+    if (!reached(now, stationNextAttempt) || (manager->usesNetwork() && factory.getConnectionUrl().isEmpty())) {
+        return;
+    }
+
+    manager->connect(factory.getConnectionUrl());
+    if (!manager->isConnected()) {
+        post(LinkEvent::STATION_FAILED);
+        stationNextAttempt = millis() + stationBackoffMs;
+        stationBackoffMs = nextBackoff(stationBackoffMs);
+    }
+}
+
+void ConnectionManager::stepSwap(uint32_t now) {
+    LocoCommandManagerFactory& factory = LocoCommandManagerFactory::getInstance();
+    factory.reclaim();
+
+    LocoCommandManager* candidate = factory.preparePendingManager();
+    if (candidate == nullptr || !factory.canSwap()) {
+        return;
+    }
+    if (candidate != swapCandidate) {
+        swapCandidate = candidate;
+        swapBackoffMs = INITIAL_BACKOFF_MS;
+        swapNextAttempt = now;
+    }
+
+    // The serial port cannot be opened twice, nor a WiThrottle session with the
+    // same hardware id: close the current manager and swap right away,
+    // stepStation connects the new one. disconnect() stops the session task,
+    // so no StateLock may be held here
+    LocoCommandManager* current = factory.getLocoCommandManager();
+    if (factory.swapNeedsDisconnect()) {
+        current->disconnect();
+        factory.commitSwap();
+        return;
+    }
+
+    // Same when nothing is driven through the current manager
+    String url = factory.getConnectionUrl();
+    if (!wifiUp || url.isEmpty() || !current->isConnected()) {
+        factory.commitSwap();
+        return;
+    }
+
+    // Otherwise keep driving through the current one until the new one is up
+    if (!candidate->isConnected() && reached(now, swapNextAttempt)) {
+        candidate->connect(url);
+        if (!candidate->isConnected()) {
+            swapNextAttempt = millis() + swapBackoffMs;
+            swapBackoffMs = nextBackoff(swapBackoffMs);
+        }
+    }
+    if (candidate->isConnected()) {
+        factory.commitSwap();
+    }
+}
+
+void ConnectionManager::dropStation() {
+    if (!LocoCommandManagerFactory::getInstance().getLocoCommandManager()->usesNetwork()) {
+        return; // The wire does not depend on WiFi
+    }
+    if (stationUp) {
+        // The factory may have replaced the manager since, only close the current one
+        LocoCommandManager* manager = LocoCommandManagerFactory::getInstance().getLocoCommandManager();
+        if (manager == station) {
+            manager->disconnect();
+        }
+        post(LinkEvent::STATION_DOWN);
+    }
+    stationUp = false;
+}
@@ -1,39 +1,391 @@
 #include "DccExCommandManager.h"
+#include "Config.h"
+#include "TaskMonitor.h"
+#include "RosterCache.h"
+
+DccExCommandManager::DccExCommandManager()
+    : serialClient(COMMAND_STATION_SERIAL, COMMAND_STATION_TX_PIN, COMMAND_STATION_RX_PIN), client(&ownClient) {
+    clientMutex = xSemaphoreCreateMutex();
+}
+
+DccExCommandManager::DccExCommandManager(Client& transport)
+    : serialClient(COMMAND_STATION_SERIAL, COMMAND_STATION_TX_PIN, COMMAND_STATION_RX_PIN), client(&transport) {
+    clientMutex = xSemaphoreCreateMutex();
+}
+
+DccExCommandManager::DccExCommandManager(uint32_t serialBaudRate)
+    : DccExCommandManager(COMMAND_STATION_SERIAL, serialBaudRate) {
+}
+
+DccExCommandManager::DccExCommandManager(SerialUART& serial, uint32_t serialBaudRate)
+    : serialClient(serial, COMMAND_STATION_TX_PIN, COMMAND_STATION_RX_PIN), client(&serialClient) {
+    serialClient.setBaudRate(serialBaudRate);
+    clientMutex = xSemaphoreCreateMutex();
+}
+
+DccExCommandManager::~DccExCommandManager() {
+    disconnect();
+    if (clientMutex) {
+        vSemaphoreDelete(clientMutex);
+    }
+}
 
 void DccExCommandManager::connect(const String& connectionUrl) {
-    // Add DccEx connection code here using the connectionUrl
+    disconnect();
+
+    // Accept "host", "host:port" and an optional "scheme://" prefix
+    String address = connectionUrl;
+    int schemeEnd = address.indexOf("://");
+    if (schemeEnd >= 0) {
+        address = address.substring(schemeEnd + 3);
+    }
+
+    String host = address;
+    uint16_t port = DEFAULT_PORT;
+    int colon = address.lastIndexOf(':');
+    if (colon >= 0) {
+        host = address.substring(0, colon);
+        port = address.substring(colon + 1).toInt();
+    }
+
+    // Opened under the mutex, so no other task uses the client half open.
+    // The serial port has no address, the URL is ignored
+    opening = true;
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    bool opened = (!usesNetwork() || !host.isEmpty()) && client->connect(host.c_str(), port);
+    if (opened && !usesNetwork() && !probeLink()) {
+        client->stop();
+        opened = false;
+    }
+    if (opened) {
+        parser.reset();
+        lastReceive = millis();
+        lastKeepalive = lastReceive;
+        keepaliveAnswered = true;
+    }
+    xSemaphoreGive(clientMutex);
+    opening = false;
+    if (!opened) {
+        return;
+    }
+
+    // Send the desired state of the slot table, changes made offline included, in one write
+    replayState();
+
+    // Check the cached roster against the station's
+    sendCommand("<JR>");
+
+    // Create the session task draining incoming data
+    startSession(sessionTask, "DccExSession");
 }
 
 void DccExCommandManager::disconnect() {
-    // Add DccEx disconnection code here
+    stopSession();
+    if (rosterPending > 0) {
+        // Cut short: the cached roster stays as it was
+        RosterCache::getInstance().abortUpdate();
+        rosterPending = 0;
+    }
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    client->stop();
+    xSemaphoreGive(clientMutex);
+}
+
+bool DccExCommandManager::probeLink() {
+    // A UART opens whether or not a station is wired to it: only an answer tells
+    client->print("<#>");
+    parser.reset();
+    bool answered = false;
+    uint8_t chunk[64];
+    unsigned long start = millis();
+    while (!answered && millis() - start < LINK_PROBE_TIMEOUT_MS) {
+        int count = client->read(chunk, sizeof(chunk));
+        if (count <= 0) {
+            delay(SESSION_PERIOD_MS);
+            continue;
+        }
+        // Anything ahead of <# n> was sent before we were listening
+        parser.feed(chunk, count, [&answered](const char* line, size_t length) {
+            answered |= strncmp(line, "<#", 2) == 0;
+        });
+    }
+    return answered;
+}
+
+bool DccExCommandManager::usesNetwork() const {
+    return client != &serialClient;
+}
+
+bool DccExCommandManager::isConnected() {
+    if (opening) {
+        return false; // Answered without waiting for the link being opened
+    }
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    bool connected = client->connected();
+    xSemaphoreGive(clientMutex);
+    return connected;
 }
 
 void DccExCommandManager::sendCommand(const String& command) {
-    // Add DccEx command handling code here
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    if (client->connected()) {
+        client->print(command);
+    }
+    xSemaphoreGive(clientMutex);
 }
 
-void DccExCommandManager::sendSpeedCommand(int speed) {
-    // Add DccEx speed handling code here
+void DccExCommandManager::acquireLoco(int address) {
+    // DCC-EX addresses every command directly, nothing to acquire
 }
 
-void DccExCommandManager::sendBrakeCommand(int brake) {
-    // Add DccEx brake handling code here
+void DccExCommandManager::releaseLoco(int address) {
+    // Nothing to release, see acquireLoco
 }
 
-void DccExCommandManager::sendFrontLightsCommand(LightStatus status) {
-    // Add DccEx front lights handling code here
+void DccExCommandManager::beginBatch() {
+    batchBuffer = "";
+    batching = true;
 }
 
-void DccExCommandManager::sendBackLightsCommand(LightStatus status) {
-    // Add DccEx back lights handling code here
+void DccExCommandManager::endBatch() {
+    batching = false;
+    if (batchBuffer.isEmpty()) {
+        return;
+    }
+
+    // One socket write for the whole batch
+    sendCommand(batchBuffer);
+    batchBuffer = "";
 }
 
-void DccExCommandManager::sendBellCommand(bool active) {
-    // Add DccEx bell handling code here
+void DccExCommandManager::queueCommand(const String& command) {
+    if (batching) {
+        batchBuffer += command;
+    } else {
+        sendCommand(command);
+    }
 }
 
-void DccExCommandManager::sendHornCommand(bool active) {
-    // Add DccEx horn handling code here
+void DccExCommandManager::sessionTask(void* param) {
+    DccExCommandManager* self = static_cast<DccExCommandManager*>(param);
+    uint8_t chunk[64];
+    StateReport reports[MAX_REPORTS_PER_PASS];
+    std::vector<String> rosterLines;
+    int probe = TaskMonitor::registerTask("DccExSession", CONTROL_CORE, SESSION_PERIOD_MS);
+
+    while (self->sessionRunning()) {
+        xSemaphoreTake(self->clientMutex, portMAX_DELAY);
+        TaskMonitor::beginRun(probe);
+        int reportCount = 0;
+
+        // Drain whatever arrived since the last pass so the socket never stalls
+        int available = self->client->available();
+        while (available > 0) {
+            int count = self->client->read(chunk, min(available, (int)sizeof(chunk)));
+            if (count <= 0) {
+                break;
+            }
+            self->lastReceive = millis();
+            self->parser.feed(chunk, count, [self, &reports, &reportCount, &rosterLines](const char* line, size_t length) {
+                // The keepalive doubles as the round trip probe: <#> is answered by <# n>
+                if (!self->keepaliveAnswered && strncmp(line, "<#", 2) == 0) {
+                    self->keepaliveAnswered = true;
+                    self->recordRoundTrip(millis() - self->lastKeepalive);
+                }
+                // Copied out: the roster is rewritten once the client mutex is released
+                else if (strncmp(line, "<jR", 3) == 0) {
+                    rosterLines.emplace_back(line);
+                }
+                // Loco state, answering our commands; extra reports wait for the next retransmit
+                else if (reportCount < MAX_REPORTS_PER_PASS && parseLocoState(line, reports[reportCount])) {
+                    reportCount++;
+                }
+            });
+            available = self->client->available();
+        }
+
+        unsigned long now = millis();
+        if (now - self->lastReceive > KEEPALIVE_TIMEOUT_MS) {
+            // No answer to the keepalives: give the socket up, ConnectionManager reconnects
+            self->client->stop();
+        } else if (now - self->lastKeepalive >= ECHO_INTERVAL_MS) {
+            if (!self->keepaliveAnswered) {
+                self->recordRoundTripTimeout();
+            }
+            self->lastKeepalive = now;
+            if (self->client->connected()) {
+                self->client->print("<#>");
+                self->keepaliveAnswered = false;
+            }
+        }
+
+        xSemaphoreGive(self->clientMutex);
+
+        // The slot table is locked before the client everywhere else, so reports
+        // are only applied once the client mutex is released
+        for (int i = 0; i < reportCount; i++) {
+            self->applyReport(reports[i]);
+        }
+
+        // The roster file is written without the client mutex, so flushes and
+        // emergency stops are not held up by the filesystem
+        for (const String& line : rosterLines) {
+            self->handleRosterLine(line.c_str());
+        }
+        rosterLines.clear();
+        if (self->rosterPending > 0 && millis() - self->rosterRequestedAt > ROSTER_TIMEOUT_MS) {
+            RosterCache::getInstance().abortUpdate();
+            self->rosterPending = 0;
+        }
+
+        TaskMonitor::endRun(probe);
+        vTaskDelay(pdMS_TO_TICKS(SESSION_PERIOD_MS));
+    }
+    self->endSession();
+}
+
+void DccExCommandManager::sendSpeedCommand(int address, int speed, bool forward) {
+    // <t cab speed dir>
+    queueCommand("<t " + String(address) + " " + String(speed) + " " + String(forward ? 1 : 0) + ">");
+}
+
+void DccExCommandManager::sendBrakeCommand(int address, int brake) {
+    // DCC has no brake; braking is applied by the throttle through the speed
+}
+
+void DccExCommandManager::sendFrontLightsCommand(int address, LightStatus status) {
+    sendFunctionCommand(address, FRONT_LIGHTS_FUNCTION, status != LightStatus::OFF);
+}
+
+void DccExCommandManager::sendBackLightsCommand(int address, LightStatus status) {
+    sendFunctionCommand(address, BACK_LIGHTS_FUNCTION, status != LightStatus::OFF);
+}
+
+void DccExCommandManager::sendBellCommand(int address, bool active) {
+    sendFunctionCommand(address, BELL_FUNCTION, active);
+}
+
+void DccExCommandManager::sendHornCommand(int address, bool active) {
+    sendFunctionCommand(address, HORN_FUNCTION, active);
+}
+
+void DccExCommandManager::sendFunctionGroup(int address, int group, uint8_t states) {
+    if (group < LEGACY_FUNCTION_GROUPS) {
+        // <f cab byte1 [byte2]> carries the DCC function instruction as is
+        uint8_t instruction[2];
+        size_t length = dccFunctionInstruction(group, states, instruction);
+        String command = "<f " + String(address) + " " + String(instruction[0]);
+        if (length > 1) {
+            command += " " + String(instruction[1]);
+        }
+        queueCommand(command + ">");
+        return;
+    }
+
+    // Higher functions are only set one by one; the batch still makes it one write
+    for (int function = FUNCTION_GROUP_FIRST[group]; function < FUNCTION_GROUP_FIRST[group + 1]; function++) {
+        sendFunctionCommand(address, function, states & (1 << (function - FUNCTION_GROUP_FIRST[group])));
+    }
+}
+
+void DccExCommandManager::sendEmergencyStop() {
+    // <!> stops every loco; written as is, without building a String
+    static constexpr char STOP[] = "<!>";
+    if (opening) {
+        return; // The replay on connect sends the zero speeds
+    }
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    if (client->connected()) {
+        client->write((const uint8_t*)STOP, sizeof(STOP) - 1);
+    }
+    xSemaphoreGive(clientMutex);
+}
+
+void DccExCommandManager::sendFunctionCommand(int address, int function, bool active) {
+    // <F cab funct state>
+    queueCommand("<F " + String(address) + " " + String(function) + " " + String(active ? 1 : 0) + ">");
+}
+
+void DccExCommandManager::handleRosterLine(const char* line) {
+    RosterCache& roster = RosterCache::getInstance();
+    const char* quote = strchr(line, '"');
+
+    if (quote == nullptr) {
+        // The list: same IDs as last time, nothing to fetch (renames keep their old name)
+        uint32_t etag = RosterCache::hash(line + 3);
+        if (rosterPending > 0 || etag == roster.getEtag() || !roster.beginUpdate()) {
+            return;
+        }
+        rosterEtag = etag;
+        String requests;
+        const char* next = line + 3;
+        char* end;
+        for (long id = strtol(next, &end, 10); end != next; id = strtol(next, &end, 10)) {
+            next = end;
+            RosterCache::Entry entry;
+            if (roster.find(id, entry)) {
+                roster.addEntry(id, entry.name, strlen(entry.name));
+            } else {
+                requests += "<JR " + String(id) + ">";
+                rosterPending++;
+            }
+        }
+        rosterRequestedAt = millis();
+        if (rosterPending == 0) {
+            roster.commitUpdate(rosterEtag);
+        } else {
+            sendCommand(requests);
+        }
+        return;
+    }
+
+    // One entry we asked for: <jR id "name" "functions">
+    const char* nameEnd = strchr(quote + 1, '"');
+    if (rosterPending == 0 || nameEnd == nullptr) {
+        return;
+    }
+    roster.addEntry(atoi(line + 3), quote + 1, nameEnd - quote - 1);
+    if (--rosterPending == 0) {
+        roster.commitUpdate(rosterEtag);
+    }
+}
+
+bool DccExCommandManager::parseLocoState(const char* line, StateReport& report) {
+    int address, reg, speedByte;
+    unsigned long functions;
+    if (sscanf(line, "<l %d %d %d %lu>", &address, &reg, &speedByte, &functions) != 4) {
+        return false;
+    }
+
+    // DCC speed byte: bit 7 is the direction, 0 is stop, 1 emergency stop, 2-127 the steps 1-126
+    int step = speedByte & 0x7F;
+    report = StateReport();
+    report.address = address;
+    report.speed = step <= 1 ? 0 : step - 1;
+    report.forward = (speedByte & 0x80) ? 1 : 0;
+    report.functionMask = 0x1FFFFFFF; // F0-F28
+    report.functionStates = functions;
+    return true;
+}
+
+uint8_t DccExCommandManager::confirmedFields() const {
+    // Speed and function commands are answered by an <l> broadcast
+    return DIRTY_SPEED | DIRTY_FRONT_LIGHTS | DIRTY_BACK_LIGHTS | DIRTY_BELL | DIRTY_HORN;
+}
+
+bool DccExCommandManager::supportsNativeConsist() const {
+    return true;
+}
+
+void DccExCommandManager::sendNativeConsist(int consistAddress, const ConsistMember* members, int count, bool active) {
+    // Advanced consisting: CV19 holds the consist address, bit 7 flags a reversed member.
+    // Written on the main track with <w cab cv value>.
+    beginBatch();
+    for (int i = 0; i < count; i++) {
+        int value = active ? (consistAddress | (members[i].reversed ? 0x80 : 0)) : 0;
+        queueCommand("<w " + String(members[i].address) + " 19 " + String(value) + ">");
+    }
+    endBatch();
 }
 
 String DccExCommandManager::lightStatusToString(LightStatus status) {
@@ -49,4 +401,4 @@ String DccExCommandManager::lightStatusToString(LightStatus status) {
         default:
             return "UNKNOWN";
     }
-}
\ No newline at end of file
+}
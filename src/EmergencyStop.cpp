@@ -0,0 +1,25 @@
+#include "EmergencyStop.h"
+#include "ExtendedKeys.h"
+#include "LocoCommandManagerFactory.h"
+#include "TrainSimulator.h"
+
+bool EmergencyStop::isRequested(uint16_t keys) {
+    constexpr uint16_t chord = ExtendedKeys::KEY_TIGHT_BRAKE | ExtendedKeys::KEY_RELEASE_BRAKE;
+    return (keys & ExtendedKeys::KEY_ESTOP) || (keys & chord) == chord;
+}
+
+void EmergencyStop::trigger(uint32_t sampledAt) {
+    // Physics first, so the next simulation tick does not drive the loco again
+    TrainSimulator::getInstance().emergencyStop();
+    LocoCommandManagerFactory::getInstance().getLocoCommandManager()->emergencyStop();
+    uint32_t elapsed = micros() - sampledAt;
+
+    Stats updated = stats.read();
+    updated.count++;
+    updated.lastMicros = elapsed;
+    updated.worstMicros = max(updated.worstMicros, elapsed);
+    if (elapsed > LATENCY_BUDGET_US) {
+        updated.overBudget++;
+    }
+    stats.write(updated);
+}
@@ -0,0 +1,101 @@
+#include "FunctionKeyMap.h"
+#include "ConfigStore.h"
+#include "ExtendedKeys.h"
+#include "LocoCommandManager.h"
+
+int FunctionKeyMap::functionFor(int address, uint16_t key) {
+    int fallback;
+    if (key == ExtendedKeys::KEY_HORN) {
+        fallback = DEFAULT_HORN_FUNCTION;
+    } else if (key == ExtendedKeys::KEY_BELL) {
+        fallback = DEFAULT_BELL_FUNCTION;
+    } else {
+        return -1;
+    }
+
+    reload();
+    for (int i = 0; i < entryCount; i++) {
+        if (entries[i].key == key && entries[i].address == address) {
+            return entries[i].function;
+        }
+    }
+    for (int i = 0; i < entryCount; i++) {
+        if (entries[i].key == key && entries[i].address == 0) {
+            fallback = entries[i].function;
+        }
+    }
+    return fallback;
+}
+
+bool FunctionKeyMap::isMomentary(uint16_t key) {
+    return key == ExtendedKeys::KEY_HORN;
+}
+
+void FunctionKeyMap::reload() {
+    String text = ConfigStore::getInstance().getString(ConfigStore::Key::FUNCTION_KEY_MAP);
+    if (loaded && text == source) {
+        return;
+    }
+    loaded = true;
+    source = text;
+    entryCount = 0;
+
+    // "address:key=function,...;..." with "*" as the address of the defaults;
+    // malformed parts are skipped
+    int start = 0;
+    while (start < (int)text.length()) {
+        int end = text.indexOf(';', start);
+        if (end < 0) {
+            end = text.length();
+        }
+        String loco = text.substring(start, end);
+        start = end + 1;
+
+        int colon = loco.indexOf(':');
+        if (colon < 0) {
+            continue;
+        }
+        String addressText = loco.substring(0, colon);
+        addressText.trim();
+        int address = addressText == "*" ? 0 : addressText.toInt();
+        if (address < 0 || (address == 0 && addressText != "*")) {
+            continue;
+        }
+
+        int pos = colon + 1;
+        while (pos < (int)loco.length() && entryCount < MAX_ENTRIES) {
+            int next = loco.indexOf(',', pos);
+            if (next < 0) {
+                next = loco.length();
+            }
+            String pair = loco.substring(pos, next);
+            pos = next + 1;
+
+            int equals = pair.indexOf('=');
+            if (equals < 0) {
+                continue;
+            }
+            String name = pair.substring(0, equals);
+            name.trim();
+            String functionText = pair.substring(equals + 1);
+            functionText.trim();
+            uint16_t key = keyFromName(name);
+            int function = functionText.toInt();
+            if (key == 0 || function < 0 || function > LocoCommandManager::MAX_FUNCTION ||
+                (function == 0 && functionText != "0")) {
+                continue;
+            }
+            entries[entryCount++] = {address, key, (uint8_t)function};
+        }
+    }
+}
+
+uint16_t FunctionKeyMap::keyFromName(const String& name) {
+    if (name.equalsIgnoreCase("horn")) {
+        return ExtendedKeys::KEY_HORN;
+    }
+    if (name.equalsIgnoreCase("bell")) {
+        return ExtendedKeys::KEY_BELL;
+    }
+    return 0;
+}
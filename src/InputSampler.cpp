@@ -0,0 +1,63 @@
+#include "InputSampler.h"
+#include "Config.h"
+#include "TaskMonitor.h"
+#include "EmergencyStop.h"
+#include "LocoCommandManagerFactory.h"
+
+InputSampler::InputSampler(IKeyboard* source, AnalogSwitch* analogSwitch)
+    : source(source), analogSwitch(analogSwitch) {}
+
+InputSampler::~InputSampler() {
+    if (taskHandle) {
+        vTaskDelete(taskHandle);
+    }
+}
+
+void InputSampler::start() {
+    if (taskHandle) {
+        return;
+    }
+
+    // Highest priority of the control core, and stack for the socket write:
+    // it carries the emergency stop
+    xTaskCreateAffinitySet(
+        sampleTask,        // Task function
+        "InputSampler",    // Task name
+        2048,              // Stack size
+        this,              // Task parameter
+        3,                 // Task priority
+        1 << CONTROL_CORE, // Core affinity
+        &taskHandle        // Task handle
+    );
+}
+
+uint16_t InputSampler::getPressedKeys() {
+    return keys.load(std::memory_order_relaxed);
+}
+
+void InputSampler::sampleTask(void* param) {
+    InputSampler* self = static_cast<InputSampler*>(param);
+    int probe = TaskMonitor::registerTask("InputSampler", CONTROL_CORE, SAMPLE_PERIOD_MS);
+    int reader = LocoCommandManagerFactory::registerReader();
+    TickType_t lastWake = xTaskGetTickCount();
+
+    while (true) {
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(SAMPLE_PERIOD_MS));
+        TaskMonitor::beginRun(probe);
+
+        self->analogSwitch->switchTo(0); // Keyboard is on channel 0
+        uint32_t sampledAt = micros();
+        uint16_t pressed = self->source->getPressedKeys();
+        self->keys.store(pressed, std::memory_order_relaxed);
+
+        // Straight from the sample to the socket, once per press
+        bool stop = EmergencyStop::isRequested(pressed);
+        if (stop && !self->stopHeld) {
+            EmergencyStop::getInstance().trigger(sampledAt);
+        }
+        self->stopHeld = stop;
+        LocoCommandManagerFactory::quiescent(reader);
+
+        TaskMonitor::endRun(probe);
+    }
+}
@@ -1,39 +1,355 @@
 #include "JMRICommandManager.h"
+#include "Config.h"
+#include "TaskMonitor.h"
+#include "RosterCache.h"
+
+JMRICommandManager::JMRICommandManager() : client(&ownClient) {
+    clientMutex = xSemaphoreCreateMutex();
+}
+
+JMRICommandManager::JMRICommandManager(Client& transport) : client(&transport) {
+    clientMutex = xSemaphoreCreateMutex();
+}
+
+JMRICommandManager::~JMRICommandManager() {
+    disconnect();
+    if (clientMutex) {
+        vSemaphoreDelete(clientMutex);
+    }
+}
 
 void JMRICommandManager::connect(const String& connectionUrl) {
-    // Add JMRI connection code here using the connectionUrl
+    disconnect();
+
+    // Accept "host", "host:port" and an optional "scheme://" prefix
+    String address = connectionUrl;
+    int schemeEnd = address.indexOf("://");
+    if (schemeEnd >= 0) {
+        address = address.substring(schemeEnd + 3);
+    }
+
+    String host = address;
+    uint16_t port = DEFAULT_PORT;
+    int colon = address.lastIndexOf(':');
+    if (colon >= 0) {
+        host = address.substring(0, colon);
+        port = address.substring(colon + 1).toInt();
+    }
+
+    // Opened under the mutex, so no other task uses the client half open
+    opening = true;
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    bool opened = !host.isEmpty() && client->connect(host.c_str(), port);
+    if (opened) {
+        // The server may not ask for heartbeats: let TCP keepalive detect a dead peer
+        if (client == &ownClient) {
+            ownClient.keepAlive(KEEPALIVE_IDLE_S, KEEPALIVE_INTERVAL_S, KEEPALIVE_COUNT);
+        }
+
+        parser.reset();
+        echoPending = false;
+        echoSentAt = millis();
+        heartbeatIntervalMs = 0;
+        lastHeartbeat = millis();
+    }
+    xSemaphoreGive(clientMutex);
+    opening = false;
+    if (!opened) {
+        return;
+    }
+
+    // Handshake: throttle name and unique hardware id
+    String hardwareId = WiFi.macAddress();
+    hardwareId.replace(":", "");
+    sendCommand("NTrainController");
+    sendCommand("HU" + hardwareId);
+
+    {
+        // Re-acquire the locos of the slot table (consists included), then their
+        // desired state, changes made offline included, in one write
+        StateLock lock(stateMutex);
+        for (const LocoSlot& slot : slots) {
+            if (slot.address != 0) {
+                acquireLoco(slot.address);
+            }
+            for (int i = 0; i < slot.consistSize; i++) {
+                acquireLoco(slot.consist[i].address);
+            }
+        }
+        replayState();
+    }
+
+    // Create the session task handling incoming data and heartbeats
+    startSession(sessionTask, "JMRISession");
 }
 
 void JMRICommandManager::disconnect() {
-    // Add JMRI disconnection code here
+    stopSession();
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    if (client->connected()) {
+        client->print("Q\n");
+    }
+    client->stop();
+    xSemaphoreGive(clientMutex);
+}
+
+bool JMRICommandManager::isConnected() {
+    if (opening) {
+        return false; // Not up yet, and a slow connect must not stall the caller
+    }
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    bool connected = client->connected();
+    xSemaphoreGive(clientMutex);
+    return connected;
 }
 
 void JMRICommandManager::sendCommand(const String& command) {
-    // Add JMRI command handling code here
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    if (client->connected()) {
+        client->print(command + "\n");
+    }
+    xSemaphoreGive(clientMutex);
+}
+
+void JMRICommandManager::acquireLoco(int address) {
+    // Every loco is added to the same multi-throttle "T"
+    String key = locoKey(address);
+    sendCommand("MT+" + key + "<;>" + key);
 }
 
-void JMRICommandManager::sendSpeedCommand(int speed) {
-    // Add JMRI speed handling code here
+void JMRICommandManager::releaseLoco(int address) {
+    sendCommand("MT-" + locoKey(address) + "<;>r");
 }
 
-void JMRICommandManager::sendBrakeCommand(int brake) {
-    // Add JMRI brake handling code here
+String JMRICommandManager::locoKey(int address) {
+    // Addresses above 127 must use the long (4 digit) form
+    return (address > 127 ? "L" : "S") + String(address);
 }
 
-void JMRICommandManager::sendFrontLightsCommand(LightStatus status) {
-    // Add JMRI front lights handling code here
+void JMRICommandManager::beginBatch() {
+    batchBuffer = "";
+    batching = true;
 }
 
-void JMRICommandManager::sendBackLightsCommand(LightStatus status) {
-    // Add JMRI back lights handling code here
+void JMRICommandManager::endBatch() {
+    batching = false;
+    if (batchBuffer.isEmpty()) {
+        return;
+    }
+
+    // One socket write for all the lines of the slot
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    if (client->connected()) {
+        client->write(reinterpret_cast<const uint8_t*>(batchBuffer.c_str()), batchBuffer.length());
+    }
+    xSemaphoreGive(clientMutex);
+    batchBuffer = "";
 }
 
-void JMRICommandManager::sendBellCommand(bool active) {
-    // Add JMRI bell handling code here
+void JMRICommandManager::queueCommand(const String& command) {
+    if (batching) {
+        batchBuffer += command;
+        batchBuffer += '\n';
+    } else {
+        sendCommand(command);
+    }
 }
 
-void JMRICommandManager::sendHornCommand(bool active) {
-    // Add JMRI horn handling code here
+void JMRICommandManager::sessionTask(void* param) {
+    JMRICommandManager* self = static_cast<JMRICommandManager*>(param);
+    uint8_t chunk[64];
+    StateReport reports[MAX_REPORTS_PER_PASS];
+    int probe = TaskMonitor::registerTask("JMRISession", CONTROL_CORE, SESSION_PERIOD_MS);
+
+    while (self->sessionRunning()) {
+        xSemaphoreTake(self->clientMutex, portMAX_DELAY);
+        TaskMonitor::beginRun(probe);
+        int reportCount = 0;
+
+        // Drain whatever arrived since the last pass
+        int available = self->client->available();
+        while (available > 0) {
+            int count = self->client->read(chunk, min(available, (int)sizeof(chunk)));
+            if (count <= 0) {
+                break;
+            }
+            self->parser.feed(chunk, count, [self, &reports, &reportCount](const char* line, size_t length) {
+                // Extra reports in one pass wait for the next retransmit
+                StateReport report;
+                if (self->handleLine(line, length, report) && reportCount < MAX_REPORTS_PER_PASS) {
+                    reports[reportCount++] = report;
+                }
+            });
+            available = self->client->available();
+        }
+
+        // Send the heartbeat at half the server timeout to stay well inside it
+        uint32_t interval = self->heartbeatIntervalMs;
+        if (interval > 0 && millis() - self->lastHeartbeat >= interval / 2) {
+            self->client->print("*\n");
+            self->lastHeartbeat = millis();
+        }
+
+        // Round trip probe; the active slot index is only read, a stale value costs one probe
+        unsigned long now = millis();
+        if (now - self->echoSentAt >= ECHO_INTERVAL_MS && self->getActiveSlotIndex() >= 0) {
+            if (self->echoPending) {
+                self->recordRoundTripTimeout();
+            }
+            self->client->print("MTA*<;>qV\n");
+            self->echoPending = true;
+            self->echoSentAt = now;
+        }
+
+        xSemaphoreGive(self->clientMutex);
+
+        // The slot table is locked before the client everywhere else, so reports
+        // are only applied once the client mutex is released
+        for (int i = 0; i < reportCount; i++) {
+            self->applyReport(reports[i]);
+        }
+
+        // The roster file is written without the client mutex, so flushes and
+        // emergency stops are not held up by the filesystem
+        if (!self->rosterLine.isEmpty()) {
+            handleRoster(self->rosterLine.c_str());
+            self->rosterLine = "";
+        }
+
+        TaskMonitor::endRun(probe);
+        vTaskDelay(pdMS_TO_TICKS(SESSION_PERIOD_MS));
+    }
+    self->endSession();
+}
+
+bool JMRICommandManager::handleLine(const char* line, size_t length, StateReport& report) {
+    // "*<seconds>" announces the heartbeat timeout; enable monitoring in reply
+    if (line[0] == '*' && length > 1) {
+        heartbeatIntervalMs = atoi(line + 1) * 1000UL;
+        client->print("*+\n");
+        lastHeartbeat = millis();
+        return false;
+    }
+
+    if (strncmp(line, "RL", 2) == 0) {
+        // Copied out: the roster is rewritten once the client mutex is released
+        rosterLine = line;
+        return false;
+    }
+
+    // Throttle state of our multi-throttle: "MTA<key><;><action>"; remaining
+    // messages (power, other throttles) are not used yet
+    const char* separator = strstr(line, "<;>");
+    if (strncmp(line, "MTA", 3) != 0 || separator == nullptr || (line[3] != 'S' && line[3] != 'L')) {
+        return false;
+    }
+    const char* action = separator + 3;
+
+    report = StateReport();
+    report.address = atoi(line + 4);
+    switch (action[0]) {
+        case 'V':
+            // First speed line after the probe answers it (an echo of our own speed write
+            // arriving meanwhile travelled the same path, so it times the link just as well)
+            if (echoPending) {
+                echoPending = false;
+                recordRoundTrip(millis() - echoSentAt);
+            }
+            report.speed = max(atoi(action + 1), 0); // -1 is an emergency stop
+            return true;
+        case 'R':
+            report.forward = action[1] == '1' ? 1 : 0;
+            return true;
+        case 'F': {
+            // "F<state><function>"
+            int function = atoi(action + 2);
+            if (function < 0 || function > 31) {
+                return false;
+            }
+            report.functionMask = 1UL << function;
+            report.functionStates = action[1] == '1' ? report.functionMask : 0;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+uint8_t JMRICommandManager::confirmedFields() const {
+    // The server echoes speed, direction and function changes to the throttle
+    return DIRTY_SPEED | DIRTY_FRONT_LIGHTS | DIRTY_BACK_LIGHTS | DIRTY_BELL | DIRTY_HORN;
+}
+
+void JMRICommandManager::sendSpeedCommand(int address, int speed, bool forward) {
+    // Direction (R1 forward, R0 reverse) then speed step
+    String key = locoKey(address);
+    queueCommand("MTA" + key + "<;>R" + String(forward ? 1 : 0));
+    queueCommand("MTA" + key + "<;>V" + String(speed));
+}
+
+void JMRICommandManager::sendBrakeCommand(int address, int brake) {
+    // WiThrottle has no brake; braking is applied by the throttle through the speed
+}
+
+void JMRICommandManager::sendFrontLightsCommand(int address, LightStatus status) {
+    sendFunctionCommand(address, FRONT_LIGHTS_FUNCTION, status != LightStatus::OFF);
+}
+
+void JMRICommandManager::sendBackLightsCommand(int address, LightStatus status) {
+    sendFunctionCommand(address, BACK_LIGHTS_FUNCTION, status != LightStatus::OFF);
+}
+
+void JMRICommandManager::sendBellCommand(int address, bool active) {
+    sendFunctionCommand(address, BELL_FUNCTION, active);
+}
+
+void JMRICommandManager::sendHornCommand(int address, bool active) {
+    sendFunctionCommand(address, HORN_FUNCTION, active);
+}
+
+void JMRICommandManager::sendFunctionGroup(int address, int group, uint8_t states) {
+    // WiThrottle sets functions one by one; the batch still makes the group one write
+    for (int function = FUNCTION_GROUP_FIRST[group]; function < FUNCTION_GROUP_FIRST[group + 1]; function++) {
+        sendFunctionCommand(address, function, states & (1 << (function - FUNCTION_GROUP_FIRST[group])));
+    }
+}
+
+void JMRICommandManager::sendEmergencyStop() {
+    // Emergency stop of every loco of the multi-throttle
+    static constexpr char STOP[] = "MTA*<;>X\n";
+    if (opening) {
+        return; // No session yet; the replay on connect sends the zero speeds
+    }
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    if (client->connected()) {
+        client->write((const uint8_t*)STOP, sizeof(STOP) - 1);
+    }
+    xSemaphoreGive(clientMutex);
+}
+
+void JMRICommandManager::sendFunctionCommand(int address, int function, bool active) {
+    // Forced function ("f") sets the state directly instead of toggling
+    queueCommand("MTA" + locoKey(address) + "<;>f" + String(active ? 1 : 0) + String(function));
+}
+
+void JMRICommandManager::handleRoster(const char* line) {
+    RosterCache& roster = RosterCache::getInstance();
+    uint32_t etag = RosterCache::hash(line + 2);
+    if (etag == roster.getEtag() || !roster.beginUpdate()) {
+        return;
+    }
+
+    // Entries follow "]\[", their name, address and L/S (long/short) separated by "}|{"
+    for (const char* entry = strstr(line, "]\\["); entry != nullptr; entry = strstr(entry, "]\\[")) {
+        entry += 3;
+        const char* separator = strstr(entry, "}|{");
+        if (separator == nullptr) {
+            break;
+        }
+        roster.addEntry(atoi(separator + 3), entry, separator - entry);
+        entry = separator;
+    }
+    roster.commitUpdate(etag);
 }
 
 String JMRICommandManager::lightStatusToString(LightStatus status) {
@@ -44,4 +360,4 @@ String JMRICommandManager::lightStatusToString(LightStatus status) {
         case LightStatus::DITCHES: return "DITCHES";
         default: return "UNKNOWN";
     }
-}
\ No newline at end of file
+}
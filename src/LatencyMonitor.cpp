@@ -0,0 +1,71 @@
+#include "LatencyMonitor.h"
+
+constexpr uint16_t LatencyMonitor::BUCKET_LIMITS_MS[];
+
+LatencyMonitor::LatencyMonitor() {
+    mutex = xSemaphoreCreateMutex();
+}
+
+LatencyMonitor::~LatencyMonitor() {
+    vSemaphoreDelete(mutex);
+}
+
+void LatencyMonitor::record(uint32_t ms) {
+    int bucket = 0;
+    while (bucket < BUCKET_COUNT - 1 && ms >= BUCKET_LIMITS_MS[bucket]) {
+        bucket++;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    data.buckets[bucket]++;
+    data.history[historyHead] = (uint16_t)min(ms, (uint32_t)UINT16_MAX);
+    historyHead = (historyHead + 1) % HISTORY_SIZE;
+    if (data.historyCount < HISTORY_SIZE) {
+        data.historyCount++;
+    }
+
+    data.minMs = data.samples == 0 ? ms : min(data.minMs, ms);
+    data.maxMs = max(data.maxMs, ms);
+    data.samples++;
+    totalMs += ms;
+    data.averageMs = (uint32_t)(totalMs / data.samples);
+    xSemaphoreGive(mutex);
+}
+
+void LatencyMonitor::recordTimeout() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    data.timeouts++;
+    xSemaphoreGive(mutex);
+}
+
+void LatencyMonitor::reset() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    data = Snapshot();
+    historyHead = 0;
+    totalMs = 0;
+    xSemaphoreGive(mutex);
+}
+
+LatencyMonitor::Snapshot LatencyMonitor::snapshot() const {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    Snapshot copy = data;
+    int head = historyHead;
+    xSemaphoreGive(mutex);
+
+    // Unroll the ring so the history reads oldest first
+    if (copy.historyCount == HISTORY_SIZE && head != 0) {
+        uint16_t ring[HISTORY_SIZE];
+        memcpy(ring, copy.history, sizeof(ring));
+        for (int i = 0; i < HISTORY_SIZE; i++) {
+            copy.history[i] = ring[(head + i) % HISTORY_SIZE];
+        }
+    }
+    return copy;
+}
+
+String LatencyMonitor::bucketLabel(int bucket) {
+    if (bucket < BUCKET_COUNT - 1) {
+        return "<" + String(BUCKET_LIMITS_MS[bucket]);
+    }
+    return ">=" + String(BUCKET_LIMITS_MS[BUCKET_COUNT - 2]);
+}
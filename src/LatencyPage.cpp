@@ -0,0 +1,100 @@
+#include "LatencyPage.h"
+#include "ThreadSafeTFT.h"
+#include "PageManager.h"
+#include "LocoCommandManagerFactory.h"
+#include "ConnectionManager.h"
+#include "WiFiConfigManager.h"
+
+LatencyPage::LatencyPage() {
+    refresh();
+}
+
+void LatencyPage::refresh() {
+    stats = LocoCommandManagerFactory::getInstance().getLocoCommandManager()->getLatencyMonitor().snapshot();
+    stopStats = EmergencyStop::getInstance().getStats();
+    shownCount = stats.samples + stats.timeouts + stopStats.count;
+
+    // The same figures are served by the web server while WiFi is up
+    apiUrl = "";
+    if (ConnectionManager::getInstance().getLinkState() >= ConnectionManager::LinkState::WIFI_UP) {
+        apiUrl = "http://" + WiFiConfigManager::getInstance().getConnectionInfo().ip + ":443/api/latency";
+    }
+}
+
+void LatencyPage::draw() {
+    ThreadSafeTFT::withLock([this](TFT_eSPI& tft) {
+        tft.fillScreen(TFT_BLACK);
+
+        tft.setTextColor(TFT_WHITE);
+        tft.drawCentreString("Link Latency (ms)", 160, 10, 2);
+        if (!apiUrl.isEmpty()) {
+            tft.setTextColor(TFT_DARKGREY);
+            tft.drawCentreString(apiUrl, 160, 28, 1);
+        }
+
+        // Histogram, one bar per bucket scaled to the fullest one
+        uint32_t fullest = 1;
+        for (int i = 0; i < LatencyMonitor::BUCKET_COUNT; i++) {
+            fullest = max(fullest, stats.buckets[i]);
+        }
+        for (int i = 0; i < LatencyMonitor::BUCKET_COUNT; i++) {
+            int y = HISTOGRAM_Y + i * (BAR_HEIGHT + 2);
+            int width = stats.buckets[i] * BAR_MAX_WIDTH / fullest;
+            tft.setTextColor(TFT_CYAN);
+            tft.drawRightString(LatencyMonitor::bucketLabel(i), HISTOGRAM_X - 4, y, 1);
+            tft.fillRect(HISTOGRAM_X, y, width, BAR_HEIGHT, TFT_GREEN);
+            tft.setTextColor(TFT_WHITE);
+            tft.drawString(String(stats.buckets[i]), HISTOGRAM_X + width + 4, y, 1);
+        }
+
+        // Summary
+        int x = HISTOGRAM_X + BAR_MAX_WIDTH + 40;
+        tft.setTextColor(TFT_YELLOW);
+        tft.drawString("Samples " + String(stats.samples), x, HISTOGRAM_Y, 2);
+        tft.drawString("Lost " + String(stats.timeouts), x, HISTOGRAM_Y + 18, 2);
+        tft.drawString("Min " + String(stats.minMs), x, HISTOGRAM_Y + 36, 2);
+        tft.drawString("Avg " + String(stats.averageMs), x, HISTOGRAM_Y + 54, 2);
+        tft.drawString("Max " + String(stats.maxMs), x, HISTOGRAM_Y + 72, 2);
+
+        // Recent samples, oldest on the left, scaled to the largest one shown
+        tft.drawRect(CHART_X, CHART_Y, CHART_WIDTH, CHART_HEIGHT, TFT_DARKGREY);
+        uint32_t top = 1;
+        for (int i = 0; i < stats.historyCount; i++) {
+            top = max(top, (uint32_t)stats.history[i]);
+        }
+        int step = CHART_WIDTH / LatencyMonitor::HISTORY_SIZE;
+        for (int i = 0; i < stats.historyCount; i++) {
+            int height = stats.history[i] * (CHART_HEIGHT - 2) / top;
+            tft.fillRect(CHART_X + 1 + i * step, CHART_Y + CHART_HEIGHT - 1 - height, step - 1, height, TFT_ORANGE);
+        }
+        tft.setTextColor(TFT_WHITE);
+        tft.drawString("Last " + String(LatencyMonitor::HISTORY_SIZE) + ", top " + String(top) + " ms",
+                       CHART_X, CHART_Y + CHART_HEIGHT + 4, 1);
+
+        tft.setTextColor(TFT_CYAN);
+        tft.drawString("OK: Back", 10, 225, 2);
+
+        // Emergency stops, sample to wire; red once one missed the budget
+        tft.setTextColor(stopStats.overBudget ? TFT_RED : TFT_GREEN);
+        tft.drawString("Stops " + String(stopStats.count) + " last " + String(stopStats.lastMicros) +
+                       "us max " + String(stopStats.worstMicros) + "us late " + String(stopStats.overBudget),
+                       100, 229, 1);
+    });
+}
+
+void LatencyPage::handleInput(IKeyboard* keyboard) {
+    if (keyboard->getPressedKeys() & KEY_OK) {
+        PageManager::popPage();
+        return;
+    }
+
+    // Probes come every couple of seconds, only repaint when one was counted
+    LatencyMonitor::Snapshot latest = LocoCommandManagerFactory::getInstance().getLocoCommandManager()->getLatencyMonitor().snapshot();
+    EmergencyStop::Stats latestStops = EmergencyStop::getInstance().getStats();
+    if (latest.samples + latest.timeouts + latestStops.count != shownCount) {
+        stats = latest;
+        stopStats = latestStops;
+        shownCount = stats.samples + stats.timeouts + stopStats.count;
+        draw();
+    }
+}
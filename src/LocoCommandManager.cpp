@@ -1,43 +1,731 @@
 #include "LocoCommandManager.h"
+#include "Config.h"
+
+bool LocoCommandManager::selectLoco(int address) {
+    StateLock lock(stateMutex);
+    if (successor) {
+        // Replaced while the caller held this pointer, as in updateField()
+        return successor->selectLoco(address);
+    }
+
+    if (!isValidAddress(address)) {
+        return false;
+    }
+
+    int freeSlot = -1;
+    for (int i = 0; i < MAX_LOCO_SLOTS; i++) {
+        if (slots[i].address == address) {
+            activeSlot = i; // Already acquired, just swap
+            return true;
+        }
+        if (freeSlot < 0 && slots[i].address == 0) {
+            freeSlot = i;
+        }
+    }
+
+    if (freeSlot < 0) {
+        // Table full: release the next slot in round-robin order, never the active one
+        freeSlot = nextEvictSlot;
+        if (freeSlot == activeSlot) {
+            freeSlot = (freeSlot + 1) % MAX_LOCO_SLOTS;
+        }
+        nextEvictSlot = (freeSlot + 1) % MAX_LOCO_SLOTS;
+
+        flush();
+        dissolveConsist(slots[freeSlot]);
+        releaseLoco(slots[freeSlot].address);
+    }
+
+    slots[freeSlot] = LocoSlot();
+    slots[freeSlot].address = address;
+    activeSlot = freeSlot;
+    acquireLoco(address);
+    return true;
+}
+
+bool LocoCommandManager::selectSlot(int index) {
+    StateLock lock(stateMutex);
+    if (successor) {
+        return successor->selectSlot(index);
+    }
+    if (index < 0 || index >= MAX_LOCO_SLOTS || slots[index].address == 0) {
+        return false;
+    }
+    activeSlot = index;
+    return true;
+}
+
+LocoCommandManager::LocoSlot LocoCommandManager::copyActiveSlot() {
+    StateLock lock(stateMutex);
+    if (successor) {
+        return successor->copyActiveSlot();
+    }
+    return activeSlot >= 0 ? slots[activeSlot] : LocoSlot();
+}
+
+void LocoCommandManager::invalidateSlots() {
+    StateLock lock(stateMutex);
+    for (LocoSlot& slot : slots) {
+        if (slot.address != 0) {
+            slot.sent = 0;
+            markSlotDirty(slot);
+            slot.pending = 0;
+            slot.retries = 0;
+        }
+    }
+}
+
+void LocoCommandManager::markSlotDirty(LocoSlot& slot) {
+    slot.dirty = DIRTY_ALL;
+
+    // Functions start off: only the groups with one switched on need a write
+    slot.dirtyGroups = 0;
+    for (int group = 0; group < FUNCTION_GROUPS; group++) {
+        if (functionGroupStates(slot, group) & (group == 0 ? 0x10 : 0xFF)) {
+            slot.dirtyGroups |= 1 << group;
+        }
+    }
+}
+
+template <typename T>
+void LocoCommandManager::updateField(T LocoSlot::*field, T value, uint8_t bit) {
+    StateLock lock(stateMutex);
+    if (successor) {
+        // Replaced while the caller held this pointer: the change belongs to the new table
+        successor->updateField(field, value, bit);
+        return;
+    }
+    if (activeSlot < 0) {
+        return;
+    }
+    LocoSlot& slot = slots[activeSlot];
+    if (!(slot.sent & bit) || slot.*field != value) {
+        if (slot.dirty & bit) {
+            coalescedCount = coalescedCount + 1; // Replaces a value never sent
+        }
+        slot.*field = value;
+        slot.dirty |= bit;
+        slot.retries = 0; // A new value gets its own retries
+    }
+}
 
 void LocoCommandManager::setSpeed(int speed) {
-    if (!lastSpeed.has_value() || lastSpeed.value() != speed) {
-        lastSpeed = speed;
-        sendSpeedCommand(speed);
+    StateLock lock(stateMutex);
+    if (successor) {
+        successor->setSpeed(speed);
+        return;
+    }
+    holdStoppedSlots();
+    if (activeSlot >= 0 && slots[activeSlot].stopHeld) {
+        // Computed before the emergency stop, or while it is not confirmed yet
+        if (speed != 0 || (confirmedFields() & DIRTY_SPEED)) {
+            return;
+        }
+        slots[activeSlot].stopHeld = false;
     }
+    updateField(&LocoSlot::speed, speed, DIRTY_SPEED);
 }
 
-void LocoCommandManager::setBrake(int brake) {
-    if (!lastBrake.has_value() || lastBrake.value() != brake) {
-        lastBrake = brake;
-        sendBrakeCommand(brake);
+void LocoCommandManager::emergencyStop() {
+    // Written first, under the backend's client lock only: a flush stuck in a
+    // write or a menu action holding the slot table cannot delay it. Counted
+    // before the write, so a flush building its commands meanwhile notices it
+    stopGeneration.fetch_add(1, std::memory_order_acq_rel);
+    sendEmergencyStop();
+
+    StateLock lock(stateMutex);
+    if (successor) {
+        successor->emergencyStop();
+        return;
     }
+    holdStoppedSlots();
 }
 
-void LocoCommandManager::setFrontLights(LightStatus status) {
-    if (!lastFrontLights.has_value() || lastFrontLights.value() != status) {
-        lastFrontLights = status;
-        sendFrontLightsCommand(status);
+void LocoCommandManager::holdStoppedSlots() {
+    uint32_t generation = stopGeneration.load(std::memory_order_acquire);
+    if (generation == heldGeneration) {
+        return;
+    }
+    heldGeneration = generation;
+
+    uint8_t tracked = confirmedFields() & DIRTY_SPEED;
+    uint32_t now = millis();
+    for (LocoSlot& slot : slots) {
+        if (slot.address == 0) {
+            continue;
+        }
+        // A speed not sent yet predates the stop: dropped
+        slot.speed = 0;
+        slot.stopHeld = true;
+        slot.dirty &= ~DIRTY_SPEED;
+        slot.sent |= DIRTY_SPEED;
+
+        // The zero speed waits for its confirmation like a sent one: a late
+        // echo of the speed from before the stop is then stale, not a change
+        // made elsewhere, and the zero speed is resent if none comes
+        if (tracked) {
+            slot.pending |= DIRTY_SPEED;
+            slot.pendingSince = now;
+            slot.retries = 0;
+        }
     }
 }
 
-void LocoCommandManager::setBackLights(LightStatus status) {
-    if (!lastBackLights.has_value() || lastBackLights.value() != status) {
-        lastBackLights = status;
-        sendBackLightsCommand(status);
+bool LocoCommandManager::sendSlots(uint32_t now, bool singleBatch) {
+    holdStoppedSlots();
+    uint32_t generation = heldGeneration;
+    bool sent = sendDirtySlots(now, singleBatch);
+
+    // A stop written while these commands were built may have gone out ahead
+    // of them: written again, so it stays the last word on the link
+    if (stopGeneration.load(std::memory_order_acquire) != generation) {
+        sendEmergencyStop();
     }
+    return sent;
+}
+
+void LocoCommandManager::setDirection(bool forward) {
+    // Direction travels with the speed command
+    updateField(&LocoSlot::forward, forward, DIRTY_SPEED);
+}
+
+void LocoCommandManager::setBrake(int brake) {
+    updateField(&LocoSlot::brake, brake, DIRTY_BRAKE);
+}
+
+void LocoCommandManager::setFrontLights(LightStatus status) {
+    updateField(&LocoSlot::frontLights, status, DIRTY_FRONT_LIGHTS);
+}
+
+void LocoCommandManager::setBackLights(LightStatus status) {
+    updateField(&LocoSlot::backLights, status, DIRTY_BACK_LIGHTS);
 }
 
 void LocoCommandManager::setBell(bool active) {
-    if (!lastBell.has_value() || lastBell.value() != active) {
-        lastBell = active;
-        sendBellCommand(active);
-    }
+    updateField(&LocoSlot::bell, active, DIRTY_BELL);
 }
 
 void LocoCommandManager::setHorn(bool active) {
-    if (!lastHorn.has_value() || lastHorn.value() != active) {
-        lastHorn = active;
-        sendHornCommand(active);
+    updateField(&LocoSlot::horn, active, DIRTY_HORN);
+}
+
+void LocoCommandManager::setFunction(int function, bool active) {
+    switch (function) {
+        case FRONT_LIGHTS_FUNCTION:
+            setFrontLights(active ? LightStatus::BRIGHT : LightStatus::OFF);
+            return;
+        case BACK_LIGHTS_FUNCTION:
+            setBackLights(active ? LightStatus::BRIGHT : LightStatus::OFF);
+            return;
+        case BELL_FUNCTION:
+            setBell(active);
+            return;
+        case HORN_FUNCTION:
+            setHorn(active);
+            return;
+        default:
+            break;
+    }
+
+    StateLock lock(stateMutex);
+    if (successor) {
+        successor->setFunction(function, active);
+        return;
+    }
+    if (activeSlot < 0 || function < 0 || function > MAX_FUNCTION) {
+        return;
+    }
+
+    LocoSlot& slot = slots[activeSlot];
+    uint32_t& word = slot.functions[function / 32];
+    uint32_t bit = 1UL << (function % 32);
+    if (((word & bit) != 0) == active) {
+        return;
+    }
+    word ^= bit;
+
+    // Collected per group: every change of the tick goes out in one group write
+    uint16_t group = 1 << functionGroup(function);
+    if (slot.dirtyGroups & group) {
+        coalescedCount = coalescedCount + 1;
+    }
+    slot.dirtyGroups |= group;
+    slot.dirty |= DIRTY_FUNCTIONS;
+}
+
+bool LocoCommandManager::getFunction(int function) {
+    StateLock lock(stateMutex);
+    if (successor) {
+        return successor->getFunction(function);
+    }
+    if (activeSlot < 0 || function < 0 || function > MAX_FUNCTION) {
+        return false;
+    }
+    int group = functionGroup(function);
+    return functionGroupStates(slots[activeSlot], group) & (1 << (function - FUNCTION_GROUP_FIRST[group]));
+}
+
+int LocoCommandManager::functionGroup(int function) {
+    int group = 0;
+    while (function >= FUNCTION_GROUP_FIRST[group + 1]) {
+        group++;
+    }
+    return group;
+}
+
+uint8_t LocoCommandManager::functionGroupStates(const LocoSlot& slot, int group) {
+    uint8_t states = 0;
+    for (int function = FUNCTION_GROUP_FIRST[group]; function < FUNCTION_GROUP_FIRST[group + 1]; function++) {
+        if (slot.functions[function / 32] & (1UL << (function % 32))) {
+            states |= 1 << (function - FUNCTION_GROUP_FIRST[group]);
+        }
+    }
+    if (group == 0) {
+        // F0-F3 are held by the cab controls
+        states &= ~0x0F;
+        states |= (slot.frontLights != LightStatus::OFF) << FRONT_LIGHTS_FUNCTION;
+        states |= slot.bell << BELL_FUNCTION;
+        states |= slot.horn << HORN_FUNCTION;
+        states |= (slot.backLights != LightStatus::OFF) << BACK_LIGHTS_FUNCTION;
+    }
+    return states;
+}
+
+size_t LocoCommandManager::dccFunctionInstruction(int group, uint8_t states, uint8_t* instruction) {
+    switch (group) {
+        case 0:
+            // 100 F0 F4 F3 F2 F1
+            instruction[0] = 0x80 | ((states & 0x01) << 4) | ((states >> 1) & 0x0F);
+            return 1;
+        case 1:
+            instruction[0] = 0xB0 | (states & 0x0F); // 1011 F8-F5
+            return 1;
+        case 2:
+            instruction[0] = 0xA0 | (states & 0x0F); // 1010 F12-F9
+            return 1;
+        default: {
+            // Feature expansion: F13-F20 and F21-F28, then F29-F68 eight at a time
+            static constexpr uint8_t EXPANSION[] = {0xDE, 0xDF, 0xD8, 0xD9, 0xDA, 0xDB, 0xDC};
+            instruction[0] = EXPANSION[group - 3];
+            instruction[1] = states;
+            return 2;
+        }
+    }
+}
+
+bool LocoCommandManager::addConsistMember(int address, bool reversed, int speedScale) {
+    StateLock lock(stateMutex);
+    if (successor) {
+        return successor->addConsistMember(address, reversed, speedScale);
+    }
+
+    if (activeSlot < 0 || !isValidAddress(address)) {
+        return false;
+    }
+
+    LocoSlot& slot = slots[activeSlot];
+    if (address == slot.address || slot.consistSize >= MAX_CONSIST_MEMBERS) {
+        return false;
+    }
+    for (int i = 0; i < slot.consistSize; i++) {
+        if (slot.consist[i].address == address) {
+            return false;
+        }
+    }
+
+    ConsistMember& member = slot.consist[slot.consistSize++];
+    member.address = address;
+    member.reversed = reversed;
+    member.speedScale = constrain(speedScale, 0, 200);
+
+    acquireLoco(address);
+    updateConsistMode(slot);
+    return true;
+}
+
+void LocoCommandManager::clearConsist() {
+    StateLock lock(stateMutex);
+    if (successor) {
+        successor->clearConsist();
+        return;
+    }
+    if (activeSlot >= 0) {
+        dissolveConsist(slots[activeSlot]);
     }
-}
\ No newline at end of file
+}
+
+void LocoCommandManager::dissolveConsist(LocoSlot& slot) {
+    if (slot.consistSize == 0) {
+        return;
+    }
+
+    if (slot.nativeConsist) {
+        sendNativeConsist(slot.address, slot.consist, slot.consistSize, false);
+        slot.nativeConsist = false;
+    }
+
+    // Members fall back to their own address: leave them stopped
+    beginBatch();
+    for (int i = 0; i < slot.consistSize; i++) {
+        sendSpeedCommand(slot.consist[i].address, 0, !slot.consist[i].reversed);
+    }
+    endBatch();
+
+    for (int i = 0; i < slot.consistSize; i++) {
+        releaseLoco(slot.consist[i].address);
+    }
+    slot.consistSize = 0;
+}
+
+void LocoCommandManager::updateConsistMode(LocoSlot& slot) {
+    // Decoders can only follow a short consist address and cannot scale the speed
+    bool native = supportsNativeConsist() && slot.address <= 127;
+    for (int i = 0; i < slot.consistSize && native; i++) {
+        native = slot.consist[i].speedScale == 100;
+    }
+
+    int previous = slot.consistSize - 1; // Members before the one just added
+    if (slot.nativeConsist && native) {
+        sendNativeConsist(slot.address, &slot.consist[previous], 1, true);
+    } else if (slot.nativeConsist) {
+        sendNativeConsist(slot.address, slot.consist, previous, false);
+    } else if (native) {
+        sendNativeConsist(slot.address, slot.consist, slot.consistSize, true);
+    }
+    slot.nativeConsist = native;
+
+    // Bring the members to the current speed
+    slot.dirty |= DIRTY_SPEED;
+}
+
+void LocoCommandManager::flush() {
+    StateLock lock(stateMutex);
+    if (successor) {
+        // The changes forwarded to the new table are sent by it
+        successor->flush();
+        return;
+    }
+    bool work = false;
+    for (const LocoSlot& slot : slots) {
+        work |= slot.address != 0 && (slot.dirty != 0 || slot.pending != 0);
+    }
+
+    // Offline the slot table is the journal: changes stay dirty and collapse
+    // into the latest value until replayState() sends them on reconnect
+    if (!work || !isConnected()) {
+        return;
+    }
+
+    uint32_t now = millis();
+    checkConfirmations(now);
+    if (sendSlots(now, false) && radioHooks.commandsSent) {
+        // Keeps the radio out of power save while commands flow
+        radioHooks.commandsSent();
+    }
+}
+
+#if LOCO_VIRTUAL_DISPATCH
+bool LocoCommandManager::sendDirtySlotsVirtual(uint32_t now, bool singleBatch) {
+    bool sentAny = false;
+
+    if (singleBatch) {
+        beginBatch();
+    }
+    for (LocoSlot& slot : slots) {
+        if (slot.address == 0 || slot.dirty == 0) {
+            continue;
+        }
+
+        uint8_t dirty = slot.dirty;
+        slot.dirty = 0;
+
+        if (!singleBatch) {
+            beginBatch();
+        }
+        if (dirty & DIRTY_SPEED) {
+            sendSpeedCommand(slot.address, slot.speed, slot.forward);
+            if (!slot.nativeConsist) {
+                for (int i = 0; i < slot.consistSize; i++) {
+                    const ConsistMember& member = slot.consist[i];
+                    int memberSpeed = min(slot.speed * member.speedScale / 100, MAX_SPEED_STEP);
+                    sendSpeedCommand(member.address, memberSpeed, slot.forward != member.reversed);
+                }
+            }
+        }
+        if (dirty & DIRTY_BRAKE) sendBrakeCommand(slot.address, slot.brake);
+
+        uint8_t single = dirty;
+        if (dirty & DIRTY_FUNCTIONS) {
+            uint16_t groups = slot.dirtyGroups;
+            slot.dirtyGroups = 0;
+            for (int group = 0; group < FUNCTION_GROUPS; group++) {
+                if (groups & (1 << group)) {
+                    sendFunctionGroup(slot.address, group, functionGroupStates(slot, group));
+                }
+            }
+            if (groups & 1) {
+                single &= ~(DIRTY_FRONT_LIGHTS | DIRTY_BACK_LIGHTS | DIRTY_BELL | DIRTY_HORN);
+            }
+        }
+        if (single & DIRTY_FRONT_LIGHTS) sendFrontLightsCommand(slot.address, slot.frontLights);
+        if (single & DIRTY_BACK_LIGHTS) sendBackLightsCommand(slot.address, slot.backLights);
+        if (single & DIRTY_BELL) sendBellCommand(slot.address, slot.bell);
+        if (single & DIRTY_HORN) sendHornCommand(slot.address, slot.horn);
+        if (!singleBatch) {
+            endBatch();
+        }
+
+        slot.sent |= dirty;
+        sentAny = true;
+
+        uint8_t tracked = dirty & confirmedFields();
+        if (tracked) {
+            slot.pending |= tracked;
+            slot.pendingSince = now;
+        }
+    }
+    if (singleBatch) {
+        endBatch();
+    }
+    return sentAny;
+}
+#endif
+
+void LocoCommandManager::replayState() {
+    StateLock lock(stateMutex);
+    // A stop written while the link was opening zeroes the speeds replayed here
+    holdStoppedSlots();
+    invalidateSlots();
+    if (sendSlots(millis(), true) && radioHooks.commandsSent) {
+        radioHooks.commandsSent();
+    }
+}
+
+void LocoCommandManager::takeOver(const LocoCommandManager& previous) {
+    StateLock lock(stateMutex);
+    for (int i = 0; i < MAX_LOCO_SLOTS; i++) {
+        slots[i] = previous.slots[i];
+        // Decoder consists are set up again by this backend, if it supports them
+        slots[i].nativeConsist = false;
+    }
+    activeSlot = previous.activeSlot;
+    nextEvictSlot = previous.nextEvictSlot;
+
+    if (!isConnected()) {
+        // connect() acquires the locos and replays the table
+        invalidateSlots();
+        return;
+    }
+
+    for (LocoSlot& slot : slots) {
+        if (slot.address == 0) {
+            continue;
+        }
+        acquireLoco(slot.address);
+        for (int i = 0; i < slot.consistSize; i++) {
+            acquireLoco(slot.consist[i].address);
+        }
+        if (slot.consistSize > 0) {
+            updateConsistMode(slot);
+        }
+    }
+    replayState();
+}
+
+void LocoCommandManager::checkConfirmations(uint32_t now) {
+    for (LocoSlot& slot : slots) {
+        if (slot.address == 0 || slot.pending == 0 || now - slot.pendingSince < ACK_TIMEOUT_MS) {
+            continue;
+        }
+        if (slot.retries >= MAX_RETRIES) {
+            // The command station keeps ignoring it: stop, the state of the loco
+            // is unknown. A stop is not held forever, the driver takes over
+            divergenceCount = divergenceCount + 1;
+            slot.pending = 0;
+            slot.retries = 0;
+            slot.stopHeld = false;
+            continue;
+        }
+
+        // Only the unconfirmed values go out again, with their latest state
+        slot.dirty |= slot.pending;
+        slot.retries++;
+        retryCount = retryCount + __builtin_popcount(slot.pending);
+    }
+}
+
+void LocoCommandManager::applyReport(const StateReport& report) {
+    StateLock lock(stateMutex);
+    if (successor) {
+        return; // Retired: the table was handed over and no longer changes
+    }
+    LocoSlot* slot = nullptr;
+    for (LocoSlot& candidate : slots) {
+        if (candidate.address != 0 && candidate.address == report.address) {
+            slot = &candidate;
+        }
+    }
+    if (slot == nullptr) {
+        return; // Not one of ours (consist members are driven through their lead)
+    }
+    // The stop's own report may come in before emergencyStop() got the table
+    holdStoppedSlots();
+
+    uint8_t changed = 0;
+    if (report.speed >= 0 || report.forward >= 0) {
+        int speed = report.speed >= 0 ? report.speed : slot->speed;
+        bool forward = report.forward >= 0 ? report.forward == 1 : slot->forward;
+        bool matches = speed == slot->speed && forward == slot->forward;
+
+        // A direction alone does not confirm the speed sent along with it
+        if (!(matches && report.speed < 0) && acceptReport(*slot, DIRTY_SPEED, matches)) {
+            slot->speed = speed;
+            slot->forward = forward;
+            changed |= DIRTY_SPEED;
+        }
+
+        // Stop confirmed: the slot takes speeds again
+        if (slot->stopHeld && !(slot->pending & DIRTY_SPEED)) {
+            slot->stopHeld = false;
+        }
+    }
+
+    // Lights only report on/off: a light switched on elsewhere shows as bright
+    struct LightField {
+        int function;
+        uint8_t bit;
+        LightStatus LocoSlot::*value;
+    };
+    const LightField lights[] = {
+        {FRONT_LIGHTS_FUNCTION, DIRTY_FRONT_LIGHTS, &LocoSlot::frontLights},
+        {BACK_LIGHTS_FUNCTION, DIRTY_BACK_LIGHTS, &LocoSlot::backLights},
+    };
+    for (const LightField& field : lights) {
+        uint32_t mask = 1UL << field.function;
+        if (report.functionMask & mask) {
+            bool active = (report.functionStates & mask) != 0;
+            if (acceptReport(*slot, field.bit, active == (slot->*field.value != LightStatus::OFF))) {
+                slot->*field.value = active ? LightStatus::BRIGHT : LightStatus::OFF;
+                changed |= field.bit;
+            }
+        }
+    }
+
+    struct SwitchField {
+        int function;
+        uint8_t bit;
+        bool LocoSlot::*value;
+    };
+    const SwitchField switches[] = {
+        {BELL_FUNCTION, DIRTY_BELL, &LocoSlot::bell},
+        {HORN_FUNCTION, DIRTY_HORN, &LocoSlot::horn},
+    };
+    for (const SwitchField& field : switches) {
+        uint32_t mask = 1UL << field.function;
+        if (report.functionMask & mask) {
+            bool active = (report.functionStates & mask) != 0;
+            if (acceptReport(*slot, field.bit, active == slot->*field.value)) {
+                slot->*field.value = active;
+                changed |= field.bit;
+            }
+        }
+    }
+
+    if (changed) {
+        // Informative like the link events: when the page falls behind the oldest are dropped
+        StateChange change = {slot->address, changed};
+        if (xQueueSend(changeQueue, &change, 0) != pdTRUE) {
+            StateChange dropped;
+            xQueueReceive(changeQueue, &dropped, 0);
+            xQueueSend(changeQueue, &change, 0);
+        }
+    }
+}
+
+void LocoCommandManager::resendLoco(int address) {
+    StateLock lock(stateMutex);
+    if (successor) {
+        return; // Retired, see applyReport()
+    }
+    for (LocoSlot& slot : slots) {
+        if (slot.address == 0) {
+            continue;
+        }
+        if (slot.address == address) {
+            markSlotDirty(slot);
+        }
+        for (int i = 0; i < slot.consistSize; i++) {
+            if (slot.consist[i].address == address) {
+                slot.dirty |= DIRTY_SPEED; // Members only follow the speed
+            }
+        }
+    }
+    flush();
+}
+
+bool LocoCommandManager::acceptReport(LocoSlot& slot, uint8_t bit, bool matches) {
+    if (matches) {
+        slot.pending &= ~bit;
+        if (slot.pending == 0) {
+            slot.retries = 0;
+        }
+        return false;
+    }
+    if ((slot.pending | slot.dirty) & bit) {
+        // Report of an older value, ours is on its way or about to be sent
+        return false;
+    }
+
+    // Changed by another throttle or lost by the command station: the loco
+    // runs with the reported value, so the slot follows it
+    divergenceCount = divergenceCount + 1;
+    slot.sent |= bit;
+    return true;
+}
+
+void LocoCommandManager::startSession(TaskFunction_t task, const char* name) {
+    sessionActive.store(true, std::memory_order_release);
+    xTaskCreateAffinitySet(
+        task,               // Task function
+        name,               // Task name
+        2048,               // Stack size
+        this,               // Task parameter
+        1,                  // Task priority
+        1 << CONTROL_CORE,  // Core affinity
+        &sessionTaskHandle  // Task handle
+    );
+}
+
+void LocoCommandManager::stopSession() {
+    if (sessionTaskHandle == nullptr) {
+        return;
+    }
+    // The task finishes its pass, reports included, and leaves the loop
+    sessionActive.store(false, std::memory_order_release);
+    xSemaphoreTake(sessionExited, portMAX_DELAY);
+    sessionTaskHandle = nullptr;
+}
+
+void LocoCommandManager::endSession() {
+    // The last use of the object: stopSession() may destroy it once this is given
+    xSemaphoreGive(sessionExited);
+    vTaskDelete(nullptr);
+}
+
+bool LocoCommandManager::pollStateChange(StateChange& change) {
+    return xQueueReceive(changeQueue, &change, 0) == pdTRUE;
+}
+
+void LocoCommandManager::recordRoundTrip(uint32_t ms) {
+    lastRoundTripMs = ms;
+    latency.record(ms);
+
+    // Exponential average over roughly the last 8 samples of the current radio mode
+    int mode = radioHooks.lowLatency && radioHooks.lowLatency() ? 1 : 0;
+    uint32_t average = averageRoundTripMs[mode];
+    averageRoundTripMs[mode] = average == 0 ? ms : (average * 7 + ms) / 8;
+}
+
+void LocoCommandManager::recordRoundTripTimeout() {
+    latency.recordTimeout();
+}
@@ -1,106 +1,250 @@
 #include "LocoCommandManagerFactory.h"
 #include <Arduino.h>
-#include <ArduinoJson.h>
-#include <FS.h>
-#include <LittleFS.h>
+#include "ConfigStore.h"
+#include "WiFiConfigManager.h"
 
-// Constructor now takes the file path as parameter
-LocoCommandManagerFactory::LocoCommandManagerFactory(const char* filePath)
-    : configFilePath(filePath), connectionUrl(""), currentManagerType(ManagerType::DccEx), isInitialized(false) {
+volatile uint32_t LocoCommandManagerFactory::readerPasses[MAX_READERS];
+volatile int LocoCommandManagerFactory::readerCount = 0;
+
+LocoCommandManagerFactory::LocoCommandManagerFactory()
+    : connectionUrl(""), currentManagerType(ManagerType::DccEx) {
+    swapMutex = xSemaphoreCreateMutex();
     loadConfiguration();
 }
 
-bool LocoCommandManagerFactory::loadConfiguration() {
-
-    if (!LittleFS.exists(configFilePath)) {
-        return createDefaultConfigFile(); // If file doesn't exist, create it
-    }
-
-    File configFile = LittleFS.open(configFilePath, "r");
-    if (!configFile) {
-        return createDefaultConfigFile(); // If file can't be opened, create it
-    }
+// Manager types as stored in the configuration, default first
+static const struct {
+    LocoCommandManagerFactory::ManagerType type;
+    const char* key;
+} MANAGER_TYPE_KEYS[] = {
+    {LocoCommandManagerFactory::ManagerType::DccEx, "DccEx"},
+    {LocoCommandManagerFactory::ManagerType::JMRI, "JMRI"},
+    {LocoCommandManagerFactory::ManagerType::Z21, "Z21"},
+    {LocoCommandManagerFactory::ManagerType::LocoNet, "LocoNet"},
+};
 
-    JsonDocument doc;
-    DeserializationError error = deserializeJson(doc, configFile);
-    configFile.close();
+void LocoCommandManagerFactory::loadConfiguration() {
+    ConfigStore& store = ConfigStore::getInstance();
 
-    if (error) {
-        return createDefaultConfigFile(); // If parsing fails, recreate the file
+    // The first backend built in (DCC-EX unless single-protocol) and an empty
+    // URL when nothing has been configured yet, or the stored type is left out
+    String type = store.getString(ConfigStore::Key::LOCO_MANAGER_TYPE);
+    bool found = false;
+    for (const auto& entry : MANAGER_TYPE_KEYS) {
+        if (isAvailable(entry.type) && (!found || type == entry.key)) {
+            currentManagerType = entry.type;
+            found = true;
+        }
     }
+    connectionUrl = store.getString(ConfigStore::Key::LOCO_CONNECTION_URL);
+    transport = store.getString(ConfigStore::Key::LOCO_TRANSPORT) == "serial" ? Transport::Serial : Transport::Network;
+    baudRate = store.getInt(ConfigStore::Key::LOCO_BAUD_RATE, DEFAULT_BAUD_RATE);
+}
 
-    const char* managerType = doc["managerType"];
-    if (managerType && strcmp(managerType, "JMRI") == 0) {
-        currentManagerType = ManagerType::JMRI;
-    } else {
-        currentManagerType = ManagerType::DccEx;
+bool LocoCommandManagerFactory::saveConfiguration() {
+    ConfigStore& store = ConfigStore::getInstance();
+    const char* type = MANAGER_TYPE_KEYS[0].key;
+    for (const auto& entry : MANAGER_TYPE_KEYS) {
+        if (entry.type == currentManagerType) {
+            type = entry.key;
+        }
     }
+    store.setString(ConfigStore::Key::LOCO_MANAGER_TYPE, type);
+    store.setString(ConfigStore::Key::LOCO_CONNECTION_URL, connectionUrl);
+    store.setString(ConfigStore::Key::LOCO_TRANSPORT, transport == Transport::Serial ? "serial" : "tcp");
     
-    // Load connection URL if available
-    const char* url = doc["connectionUrl"];
-    if (url) {
-        connectionUrl = String(url);
-    }
-
+    // The connection task replaces the manager with one using the new settings
+    reconfigure = true;
     return true;
 }
 
-// New method to create default configuration file
-bool LocoCommandManagerFactory::createDefaultConfigFile() {
-    
-    // Set default manager type
-    currentManagerType = ManagerType::DccEx;
-    connectionUrl = ""; // Default empty URL
-    
-    return saveConfiguration();
-}
+bool LocoCommandManagerFactory::reloadConfiguration() {
+    xSemaphoreTake(swapMutex, portMAX_DELAY);
+    ManagerType previousType = currentManagerType;
+    String previousUrl = connectionUrl;
+    Transport previousTransport = transport;
+    uint32_t previousBaudRate = baudRate;
+    loadConfiguration();
+    bool changed = currentManagerType != previousType || connectionUrl != previousUrl ||
+                   transport != previousTransport || baudRate != previousBaudRate;
+    xSemaphoreGive(swapMutex);
 
-bool LocoCommandManagerFactory::saveConfiguration() {
-    
-    // Create configuration file
-    File configFile = LittleFS.open(configFilePath, "w");
-    if (!configFile) {
-        return false;
+    if (changed) {
+        reconfigure = true;
     }
-    
-    JsonDocument doc;
-    doc["managerType"] = (currentManagerType == ManagerType::JMRI) ? "JMRI" : "DccEx";
-    doc["connectionUrl"] = connectionUrl;
-    
-    // Write JSON to file
-    if (serializeJson(doc, configFile) == 0) {
-        configFile.close();
-        return false;
-    }
-    
-    configFile.close();
-    // Reset the initialized flag to recreate the manager with new settings
-    isInitialized = false;
+    return changed;
+}
+
+bool LocoCommandManagerFactory::isAvailable(ManagerType type) {
+#if LOCO_BACKEND == LOCO_BACKEND_DCCEX
+    return type == ManagerType::DccEx;
+#elif LOCO_BACKEND == LOCO_BACKEND_JMRI
+    return type == ManagerType::JMRI;
+#elif LOCO_BACKEND == LOCO_BACKEND_Z21
+    return type == ManagerType::Z21;
+#elif LOCO_BACKEND == LOCO_BACKEND_LOCONET
+    return type == ManagerType::LocoNet;
+#else
     return true;
+#endif
 }
 
 bool LocoCommandManagerFactory::setManagerType(ManagerType type) {
+    if (type == currentManagerType) {
+        return true; // Unchanged: keep the current manager
+    }
+    if (!isAvailable(type)) {
+        return false;
+    }
     currentManagerType = type;
     return saveConfiguration();
 }
 
 bool LocoCommandManagerFactory::setConnectionUrl(const String& url) {
+    if (url == connectionUrl) {
+        return true; // Unchanged: keep the current manager
+    }
     connectionUrl = url;
     return saveConfiguration();
 }
 
+bool LocoCommandManagerFactory::setTransport(Transport value) {
+    if (value == transport) {
+        return true; // Unchanged: keep the current manager
+    }
+    transport = value;
+    return saveConfiguration();
+}
+
+std::unique_ptr<LocoCommandManager> LocoCommandManagerFactory::createManager() {
+    std::unique_ptr<LocoCommandManager> manager = createBackend();
+
+    LocoCommandManager::RadioHooks hooks;
+    hooks.commandsSent = []() {
+        WiFiConfigManager::getInstance().noteCommandTraffic();
+    };
+    hooks.lowLatency = []() {
+        return WiFiConfigManager::getInstance().isLowLatency();
+    };
+    manager->setRadioHooks(hooks);
+    return manager;
+}
+
+std::unique_ptr<LocoCommandManager> LocoCommandManagerFactory::createBackend() {
+#if LOCO_BACKEND == LOCO_BACKEND_RUNTIME || LOCO_BACKEND == LOCO_BACKEND_DCCEX
+    if (currentManagerType == ManagerType::DccEx && transport == Transport::Serial) {
+        return std::make_unique<DccExCommandManager>(baudRate);
+    }
+#endif
+#if LOCO_BACKEND == LOCO_BACKEND_DCCEX
+    return std::make_unique<DccExCommandManager>();
+#elif LOCO_BACKEND == LOCO_BACKEND_JMRI
+    return std::make_unique<JMRICommandManager>();
+#elif LOCO_BACKEND == LOCO_BACKEND_Z21
+    return std::make_unique<Z21CommandManager>();
+#elif LOCO_BACKEND == LOCO_BACKEND_LOCONET
+    return std::make_unique<LocoNetCommandManager>();
+#else
+    if (currentManagerType == ManagerType::JMRI) {
+        return std::make_unique<JMRICommandManager>();
+    }
+    if (currentManagerType == ManagerType::Z21) {
+        return std::make_unique<Z21CommandManager>();
+    }
+    if (currentManagerType == ManagerType::LocoNet) {
+        return std::make_unique<LocoNetCommandManager>();
+    }
+    return std::make_unique<DccExCommandManager>();
+#endif
+}
+
 LocoCommandManager* LocoCommandManagerFactory::getLocoCommandManager() {
-    if (!isInitialized) {
-        // Create the appropriate manager based on configuration
-        if (currentManagerType == ManagerType::JMRI) {
-            commandManager = std::make_unique<JMRICommandManager>();
-            commandManager->connect(connectionUrl);
-        } else {
-            commandManager = std::make_unique<DccExCommandManager>();
-            commandManager->connect(connectionUrl);
+    LocoCommandManager* manager = current.load(std::memory_order_acquire);
+    if (manager != nullptr) {
+        return manager;
+    }
+
+    // First use: create the manager based on configuration;
+    // ConnectionManager connects it once the network is up
+    xSemaphoreTake(swapMutex, portMAX_DELAY);
+    if (!activeManager) {
+        activeManager = createManager();
+        activeType = currentManagerType;
+        current.store(activeManager.get(), std::memory_order_release);
+    }
+    manager = activeManager.get();
+    xSemaphoreGive(swapMutex);
+    return manager;
+}
+
+int LocoCommandManagerFactory::registerReader() {
+    int id = -1;
+    taskENTER_CRITICAL();
+    if (readerCount < MAX_READERS) {
+        id = readerCount;
+        readerPasses[id] = 0;
+        readerCount = readerCount + 1;
+    }
+    taskEXIT_CRITICAL();
+    return id;
+}
+
+LocoCommandManager* LocoCommandManagerFactory::preparePendingManager() {
+    if (reconfigure.exchange(false)) {
+        // A newer configuration supersedes a backend still being connected
+        xSemaphoreTake(swapMutex, portMAX_DELAY);
+        pendingManager = createManager();
+        pendingType = currentManagerType;
+        xSemaphoreGive(swapMutex);
+    }
+    return pendingManager.get();
+}
+
+bool LocoCommandManagerFactory::swapNeedsDisconnect() {
+    LocoCommandManager* previous = getLocoCommandManager();
+    return !pendingManager->usesNetwork() || !previous->usesNetwork() ||
+           (pendingType == ManagerType::JMRI && activeType == ManagerType::JMRI);
+}
+
+void LocoCommandManagerFactory::commitSwap() {
+    if (!pendingManager || retiredManager) {
+        return; // The previous swap is still in its grace period
+    }
+    LocoCommandManager* previous = getLocoCommandManager();
+
+    // No report may land in the old table once it is copied; stopSession()
+    // waits for the task's pass, so it runs before the state mutex is taken
+    previous->stopSession();
+
+    xSemaphoreTake(swapMutex, portMAX_DELAY);
+    {
+        // Holding the old slot table until the pointer is published: a late
+        // change through the old pointer is forwarded to the new table
+        LocoCommandManager::StateLock lock(previous->stateMutex);
+        pendingManager->takeOver(*previous);
+        previous->successor = pendingManager.get();
+        current.store(pendingManager.get(), std::memory_order_release);
+    }
+    retiredManager = std::move(activeManager);
+    activeManager = std::move(pendingManager);
+    activeType = pendingType;
+    xSemaphoreGive(swapMutex);
+
+    retiredAt = millis();
+    for (int i = 0; i < readerCount; i++) {
+        retiredPasses[i] = readerPasses[i];
+    }
+}
+
+void LocoCommandManagerFactory::reclaim() {
+    if (!retiredManager || millis() - retiredAt < GRACE_PERIOD_MS) {
+        return;
+    }
+    for (int i = 0; i < readerCount; i++) {
+        if (readerPasses[i] == retiredPasses[i]) {
+            return; // This reader may still be in the pass that fetched the old pointer
         }
-        isInitialized = true;
     }
-    
-    return commandManager.get();
-}
\ No newline at end of file
+    // Closes its connection and stops its session task
+    retiredManager.reset();
+}
@@ -3,15 +3,69 @@
 #include "PageManager.h"
 #include "ExtendedKeys.h"
 #include "LocoCommandManagerFactory.h"
+#include "TrainSimulator.h"
+#include "WiFiConfigManager.h"
+#include "FunctionKeyMap.h"
 
 // Updated constructor to use LocoCommandManagerFactory
 LocoDriverPage::LocoDriverPage() {
-    // Get the command manager through the factory with default config file path
-    locoManager = LocoCommandManagerFactory::getInstance().getLocoCommandManager();
+    // The simulator picks the default loco on its next tick if none is active
+    TrainSimulator& simulator = TrainSimulator::getInstance();
+    simulator.selectDefaultLoco();
     
-    // Initialize with default values
-    currentSpeed = 0;
-    currentBrake = 0;
+    // Initialize with the cached values of the active loco
+    loadActiveSlot();
+    
+    // The physics drive the speed from now on
+    speedGaugeMax = simulator.getParameters().maxSpeedKmh;
+    simulator.setThrottle(currentThrottle);
+    simulator.setBrakeValve(AirBrake::Valve::LAP);
+    emergencyStops = simulator.getEmergencyStopCount();
+    TrainSimulator::State state = simulator.getState();
+    currentSpeed = state.speedKmh;
+    currentBrake = state.brakeCylinderMbar / 100;
+    currentBrakePipe = state.brakePipeMbar / 100;
+    currentLink = ConnectionManager::getInstance().getLinkState();
+    
+    // Keep the radio responsive while driving
+    WiFiConfigManager::getInstance().setDriving(true);
+}
+
+LocoDriverPage::~LocoDriverPage() {
+    WiFiConfigManager::getInstance().setDriving(false);
+}
+
+bool LocoDriverPage::loadActiveSlot() {
+    LocoCommandManager::LocoSlot slot = TrainSimulator::getInstance().getActiveSlot();
+    bool changed = slot.address != currentAddress;
+    currentAddress = slot.address;
+    return changed;
+}
+
+void LocoDriverPage::handleFunctionKeys(uint16_t keys) {
+    static constexpr uint16_t FUNCTION_KEYS[] = {ExtendedKeys::KEY_HORN, ExtendedKeys::KEY_BELL};
+    
+    uint16_t changed = keys ^ previousKeys;
+    previousKeys = keys;
+    
+    // Momentary keys follow the key, the others toggle on each press; the
+    // simulator applies the change and its next flush sends it
+    FunctionKeyMap& keyMap = FunctionKeyMap::getInstance();
+    for (uint16_t key : FUNCTION_KEYS) {
+        if (!(changed & key)) {
+            continue;
+        }
+        int function = keyMap.functionFor(currentAddress, key);
+        if (function < 0) {
+            continue;
+        }
+        bool pressed = keys & key;
+        if (FunctionKeyMap::isMomentary(key)) {
+            TrainSimulator::getInstance().setFunction(function, pressed);
+        } else if (pressed) {
+            TrainSimulator::getInstance().toggleFunction(function);
+        }
+    }
 }
 
 void LocoDriverPage::draw() {
@@ -21,7 +75,16 @@ void LocoDriverPage::draw() {
         
         // Draw title
         tft.setTextColor(TFT_WHITE);
-        tft.drawCentreString("Train Controls", 160, 20, 4);
+        tft.drawCentreString("Loco " + String(currentAddress), 160, 20, 4);
+        if (emergencyStopped) {
+            tft.setTextColor(TFT_RED);
+            tft.drawCentreString("EMERGENCY STOP", 160, 45, 2);
+        } else {
+            tft.setTextColor(TFT_YELLOW);
+            tft.drawCentreString("Throttle " + String(currentThrottle) + "%", 160, 45, 2);
+        }
+        
+        drawLinkIndicator(tft);
         
         // Draw the gauges
         drawSpeedGauge(tft);
@@ -32,14 +95,9 @@ void LocoDriverPage::draw() {
         tft.drawCentreString("Speed", speedGaugeX, speedGaugeY + gaugeRadius + 10, 2);
         tft.drawCentreString("Brake", brakeGaugeX, brakeGaugeY + gaugeRadius + 10, 2);
         
-        // Draw current values
-        tft.setTextColor(TFT_YELLOW);
-        tft.drawCentreString(String(currentSpeed) + " km/h", speedGaugeX, speedGaugeY + gaugeRadius + 30, 2);
-        tft.drawCentreString(String(currentBrake) + " psi", brakeGaugeX, brakeGaugeY + gaugeRadius + 30, 2);
-        
         // Draw key instructions at bottom of screen
         tft.setTextColor(TFT_CYAN);
-        tft.drawString("UP/DOWN: Speed", 10, 220, 2);
+        tft.drawString("UP/DOWN: Throttle", 10, 220, 2);
         tft.drawString("B1/B2: Brake", 220, 220, 2);
     });
 }
@@ -50,10 +108,14 @@ void LocoDriverPage::drawSpeedGauge(TFT_eSPI& tft) {
     tft.fillCircle(speedGaugeX, speedGaugeY, gaugeRadius - 5, TFT_BLACK);
     
     // Draw gauge labels
-    drawGaugeLabels(tft, speedGaugeX, speedGaugeY, 100, gaugeRadius);
+    drawGaugeLabels(tft, speedGaugeX, speedGaugeY, speedGaugeMax, gaugeRadius);
     
     // Draw the needle
-    drawNeedle(tft, speedGaugeX, speedGaugeY, currentSpeed, 100, gaugeRadius - 10, TFT_RED);
+    drawNeedle(tft, speedGaugeX, speedGaugeY, currentSpeed, speedGaugeMax, gaugeRadius - 10, TFT_RED);
+    
+    // Draw the current value inside the dial
+    tft.setTextColor(TFT_YELLOW);
+    tft.drawCentreString(String(currentSpeed) + " km/h", speedGaugeX, speedGaugeY + 35, 2);
 }
 
 void LocoDriverPage::drawBrakeGauge(TFT_eSPI& tft) {
@@ -62,10 +124,38 @@ void LocoDriverPage::drawBrakeGauge(TFT_eSPI& tft) {
     tft.fillCircle(brakeGaugeX, brakeGaugeY, gaugeRadius - 5, TFT_BLACK);
     
     // Draw gauge labels
-    drawGaugeLabels(tft, brakeGaugeX, brakeGaugeY, 100, gaugeRadius);
+    drawGaugeLabels(tft, brakeGaugeX, brakeGaugeY, brakeGaugeMax, gaugeRadius);
     
-    // Draw the needle
-    drawNeedle(tft, brakeGaugeX, brakeGaugeY, currentBrake, 100, gaugeRadius - 10, TFT_GREEN);
+    // Draw the needles: brake pipe and brake cylinder, values in 0.1 bar
+    drawNeedle(tft, brakeGaugeX, brakeGaugeY, currentBrakePipe, brakeGaugeMax * 10, gaugeRadius - 10, TFT_GREEN);
+    drawNeedle(tft, brakeGaugeX, brakeGaugeY, currentBrake, brakeGaugeMax * 10, gaugeRadius - 20, TFT_ORANGE);
+    
+    // Draw the cylinder pressure inside the dial
+    tft.setTextColor(TFT_YELLOW);
+    tft.drawCentreString(String(currentBrake / 10) + "." + String(currentBrake % 10) + " bar", brakeGaugeX, brakeGaugeY + 35, 2);
+}
+
+void LocoDriverPage::drawLinkIndicator(TFT_eSPI& tft) {
+    // Green: command station connected, yellow: WiFi only, red: no network
+    uint16_t color = TFT_RED;
+    if (currentLink == ConnectionManager::LinkState::ONLINE) {
+        color = TFT_GREEN;
+    } else if (currentLink == ConnectionManager::LinkState::WIFI_UP) {
+        color = TFT_YELLOW;
+    }
+    tft.fillCircle(300, 20, 6, color);
+}
+
+void LocoDriverPage::redrawSpeedGauge() {
+    ThreadSafeTFT::withLock([this](TFT_eSPI& tft) {
+        drawSpeedGauge(tft);
+    });
+}
+
+void LocoDriverPage::redrawBrakeGauge() {
+    ThreadSafeTFT::withLock([this](TFT_eSPI& tft) {
+        drawBrakeGauge(tft);
+    });
 }
 
 void LocoDriverPage::drawNeedle(TFT_eSPI& tft, int centerX, int centerY, int value, int maxValue, int radius, uint16_t color) {
@@ -113,36 +203,54 @@ void LocoDriverPage::drawGaugeLabels(TFT_eSPI& tft, int centerX, int centerY, in
 
 void LocoDriverPage::handleInput(IKeyboard* keyboard) {
     uint16_t keys = keyboard->getPressedKeys();
+    TrainSimulator& simulator = TrainSimulator::getInstance();
     
     bool needsRedraw = false;
     
-    // Check for brake control keys
-    if (keys & ExtendedKeys::KEY_TIGHT_BRAKE) {
-        // Increase brake pressure (max 100)
-        currentBrake = min(currentBrake + 5, 100);
-        locoManager->setBrake(currentBrake);  // Changed from . to ->
+    // The input sampler already stopped the train: close the throttle to match
+    uint32_t stops = simulator.getEmergencyStopCount();
+    if (stops != emergencyStops) {
+        emergencyStops = stops;
+        emergencyStopped = true;
+        currentThrottle = 0;
         needsRedraw = true;
     }
     
-    if (keys & ExtendedKeys::KEY_RELEASE_BRAKE) {
-        // Decrease brake pressure (min 0)
-        currentBrake = max(currentBrake - 5, 0);
-        locoManager->setBrake(currentBrake);  // Changed from . to ->
-        needsRedraw = true;
+    // Brake keys work the driver's brake valve, with no key pressed it stays in lap
+    AirBrake::Valve valve = AirBrake::Valve::LAP;
+    if (keys & ExtendedKeys::KEY_TIGHT_BRAKE) {
+        valve = AirBrake::Valve::APPLY;
+    } else if (keys & ExtendedKeys::KEY_RELEASE_BRAKE) {
+        valve = AirBrake::Valve::RELEASE;
     }
+    simulator.setBrakeValve(valve);
+    
+    // Keys going down this pass, taken before handleFunctionKeys moves previousKeys on
+    uint16_t pressed = keys & ~previousKeys;
+    handleFunctionKeys(keys);
     
-    // Normal navigation keys can be used for speed control
+    // Normal navigation keys move the throttle, the simulator works out the speed
     if (keys & KEY_UP) {
-        // Increase speed (max 100)
-        currentSpeed = min(currentSpeed + 5, 100);
-        locoManager->setSpeed(currentSpeed);  // Changed from . to ->
+        // Open the throttle (max 100)
+        currentThrottle = min(currentThrottle + 5, 100);
+        emergencyStopped = false;
+        simulator.setThrottle(currentThrottle);
         needsRedraw = true;
     }
     
     if (keys & KEY_DOWN) {
-        // Decrease speed (min 0)
-        currentSpeed = max(currentSpeed - 5, 0);
-        locoManager->setSpeed(currentSpeed);  // Changed from . to ->
+        // Close the throttle (min 0)
+        currentThrottle = max(currentThrottle - 5, 0);
+        simulator.setThrottle(currentThrottle);
+        needsRedraw = true;
+    }
+    
+    // Left/right cycle through the acquired locos, one loco per press; the
+    // title follows once the simulator made the switch
+    if (pressed & (KEY_LEFT | KEY_RIGHT)) {
+        simulator.switchSlot((pressed & KEY_LEFT) ? -1 : 1);
+    }
+    if (loadActiveSlot()) {
         needsRedraw = true;
     }
     
@@ -152,22 +260,53 @@ void LocoDriverPage::handleInput(IKeyboard* keyboard) {
         return;
     }
     
-    // Only redraw if values changed
+    // Speed set by another throttle on the command station: the physics continue
+    // from it and the speed gauge follows on the next tick
+    LocoCommandManager::StateChange change;
+    while (manager()->pollStateChange(change)) {
+        if (change.address == currentAddress && (change.fields & LocoCommandManager::DIRTY_SPEED)) {
+            simulator.syncFromActiveSlot();
+        }
+    }
+    
+    // Follow the simulation, repainting a gauge only when its displayed value changes.
+    // One snapshot per pass so speed and pressures always come from the same tick.
+    TrainSimulator::State state = simulator.getState();
+    int brakeCylinder = state.brakeCylinderMbar / 100;
+    int brakePipe = state.brakePipeMbar / 100;
+    
+    // The link state only changes the indicator, driving carries on regardless
+    ConnectionManager::LinkState link = ConnectionManager::getInstance().getLinkState();
+    bool linkChanged = link != currentLink;
+    currentLink = link;
+    
     if (needsRedraw) {
+        currentSpeed = state.speedKmh;
+        currentBrake = brakeCylinder;
+        currentBrakePipe = brakePipe;
         draw();
+    } else {
+        if (linkChanged) {
+            ThreadSafeTFT::withLock([this](TFT_eSPI& tft) {
+                drawLinkIndicator(tft);
+            });
+        }
+        updateSpeed(state.speedKmh);
+        updateBrake(brakeCylinder, brakePipe);
     }
 }
 
 void LocoDriverPage::updateSpeed(int speed) {
     if (currentSpeed != speed) {
         currentSpeed = speed;
-        draw();
+        redrawSpeedGauge();
     }
 }
 
-void LocoDriverPage::updateBrake(int brake) {
-    if (currentBrake != brake) {
+void LocoDriverPage::updateBrake(int brake, int brakePipe) {
+    if (currentBrake != brake || currentBrakePipe != brakePipe) {
         currentBrake = brake;
-        draw();
+        currentBrakePipe = brakePipe;
+        redrawBrakeGauge();
     }
-}
\ No newline at end of file
+}
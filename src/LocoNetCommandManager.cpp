@@ -0,0 +1,623 @@
+#include "LocoNetCommandManager.h"
+#include "Config.h"
+#include "TaskMonitor.h"
+
+namespace {
+
+const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+int hexNibble(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+}
+
+LocoNetCommandManager::LocoNetCommandManager() : client(&ownClient) {
+    clientMutex = xSemaphoreCreateMutex();
+}
+
+LocoNetCommandManager::LocoNetCommandManager(Client& transport) : client(&transport) {
+    clientMutex = xSemaphoreCreateMutex();
+}
+
+LocoNetCommandManager::~LocoNetCommandManager() {
+    disconnect();
+    if (clientMutex) {
+        vSemaphoreDelete(clientMutex);
+    }
+}
+
+void LocoNetCommandManager::connect(const String& connectionUrl) {
+    disconnect();
+
+    // Accept "host", "host:port" and an optional "scheme://" prefix
+    String address = connectionUrl;
+    int schemeEnd = address.indexOf("://");
+    if (schemeEnd >= 0) {
+        address = address.substring(schemeEnd + 3);
+    }
+
+    String host = address;
+    uint16_t port = DEFAULT_PORT;
+    int colon = address.lastIndexOf(':');
+    if (colon >= 0) {
+        host = address.substring(0, colon);
+        port = address.substring(colon + 1).toInt();
+    }
+
+    // Opened under the mutex, so no other task uses the client half open
+    opening = true;
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    bool opened = !host.isEmpty() && client->connect(host.c_str(), port);
+    if (opened) {
+        // LbServer has no heartbeat: let TCP keepalive detect a dead peer as well
+        if (client == &ownClient) {
+            ownClient.keepAlive(KEEPALIVE_IDLE_S, KEEPALIVE_INTERVAL_S, KEEPALIVE_COUNT);
+        }
+
+        parser.reset();
+        sendsWritten = 0;
+        sendsAnswered = 0;
+        echoPending = false;
+        lastReceive = millis();
+        echoSentAt = lastReceive;
+        // Slots held before the link went down are taken in use again; their
+        // numbers are kept, so that costs a null move instead of an address lookup
+        for (SlotEntry& entry : slotCache) {
+            entry.state = SlotState::RELEASED;
+        }
+    }
+    xSemaphoreGive(clientMutex);
+    opening = false;
+    if (!opened) {
+        return;
+    }
+
+    {
+        // Request the slots of the slot table (consists included), then the desired
+        // state; commands for a loco go out once its slot is in use
+        StateLock lock(stateMutex);
+        for (const LocoSlot& slot : slots) {
+            if (slot.address != 0) {
+                acquireLoco(slot.address);
+            }
+            for (int i = 0; i < slot.consistSize; i++) {
+                acquireLoco(slot.consist[i].address);
+            }
+        }
+        replayState();
+    }
+
+    // Create the session task handling incoming messages and the link probe
+    startSession(sessionTask, "LocoNetSession");
+}
+
+void LocoNetCommandManager::disconnect() {
+    stopSession();
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    // Hand our slots back as common so other throttles can take the locos
+    for (SlotEntry& entry : slotCache) {
+        if (entry.address != 0 && entry.state == SlotState::IN_USE) {
+            uint8_t message[] = {OPC_SLOT_STAT1, entry.slot, (uint8_t)((entry.stat1 & ~STAT1_STATUS) | STAT1_COMMON)};
+            writeMessage(message, sizeof(message));
+        }
+        entry.state = SlotState::RELEASED;
+    }
+    client->stop();
+    xSemaphoreGive(clientMutex);
+}
+
+bool LocoNetCommandManager::isConnected() {
+    if (opening) {
+        return false;
+    }
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    bool connected = client->connected();
+    xSemaphoreGive(clientMutex);
+    return connected;
+}
+
+void LocoNetCommandManager::sendCommand(const String& command) {
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    if (client->connected()) {
+        client->print(command + "\n");
+        if (command.startsWith("SEND")) {
+            sendsWritten++;
+        }
+    }
+    xSemaphoreGive(clientMutex);
+}
+
+size_t LocoNetCommandManager::formatSend(const uint8_t* message, size_t length, char* text) {
+    // The checksum byte makes the XOR of the whole message 0xFF
+    uint8_t checksum = 0xFF;
+    size_t used = 4;
+    memcpy(text, "SEND", used);
+    for (size_t i = 0; i <= length; i++) {
+        uint8_t value = i < length ? message[i] : checksum;
+        checksum ^= value;
+        text[used++] = ' ';
+        text[used++] = HEX_DIGITS[value >> 4];
+        text[used++] = HEX_DIGITS[value & 0x0F];
+    }
+    text[used++] = '\n';
+    text[used] = '\0';
+    return used;
+}
+
+size_t LocoNetCommandManager::decodeMessage(const char* hex, uint8_t* message) {
+    // Bytes are decoded straight from the line buffer, no intermediate string
+    size_t length = 0;
+    while (*hex) {
+        if (*hex == ' ') {
+            hex++;
+            continue;
+        }
+        int high = hexNibble(hex[0]);
+        int low = high >= 0 ? hexNibble(hex[1]) : -1;
+        if (low < 0 || length >= MAX_MESSAGE) {
+            return 0;
+        }
+        message[length++] = (high << 4) | low;
+        hex += 2;
+    }
+    if (length < 2) {
+        return 0;
+    }
+
+    // The opcode gives the length: 2, 4 or 6 bytes, or a count in the second byte
+    size_t expected;
+    switch (message[0] & 0x60) {
+        case 0x00: expected = 2; break;
+        case 0x20: expected = 4; break;
+        case 0x40: expected = 6; break;
+        default: expected = message[1]; break;
+    }
+    uint8_t checksum = 0;
+    for (size_t i = 0; i < length; i++) {
+        checksum ^= message[i];
+    }
+    return (length == expected && checksum == 0xFF) ? length : 0;
+}
+
+void LocoNetCommandManager::beginBatch() {
+    batchBuffer = "";
+    batchSends = 0;
+    batching = true;
+}
+
+void LocoNetCommandManager::endBatch() {
+    batching = false;
+    if (batchBuffer.isEmpty()) {
+        return;
+    }
+
+    // One socket write for all the lines of the batch
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    if (client->connected()) {
+        client->write(reinterpret_cast<const uint8_t*>(batchBuffer.c_str()), batchBuffer.length());
+        sendsWritten += batchSends;
+    }
+    xSemaphoreGive(clientMutex);
+    batchBuffer = "";
+}
+
+void LocoNetCommandManager::queueMessage(const uint8_t* message, size_t length) {
+    if (batching) {
+        char text[4 + 3 * (MAX_MESSAGE + 1) + 2];
+        formatSend(message, length, text);
+        batchBuffer += text;
+        batchSends++;
+        return;
+    }
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    writeMessage(message, length);
+    xSemaphoreGive(clientMutex);
+}
+
+void LocoNetCommandManager::writeMessage(const uint8_t* message, size_t length) {
+    if (!client->connected()) {
+        return;
+    }
+    char text[4 + 3 * (MAX_MESSAGE + 1) + 2];
+    size_t used = formatSend(message, length, text);
+    client->write(reinterpret_cast<const uint8_t*>(text), used);
+    sendsWritten++;
+}
+
+LocoNetCommandManager::SlotEntry* LocoNetCommandManager::findEntry(int address) {
+    if (address == 0) {
+        return nullptr;
+    }
+    for (SlotEntry& entry : slotCache) {
+        if (entry.address == address) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+LocoNetCommandManager::SlotEntry* LocoNetCommandManager::findSlot(uint8_t slot) {
+    if (slot == 0) {
+        return nullptr; // Slot 0 is the dispatch slot, never one of ours
+    }
+    for (SlotEntry& entry : slotCache) {
+        if (entry.address != 0 && entry.slot == slot) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+void LocoNetCommandManager::requestSlot(SlotEntry& entry, uint32_t now) {
+    if (entry.slot != 0) {
+        // Known slot: a null move takes it in use, the slot data confirms the address
+        uint8_t message[] = {OPC_MOVE_SLOTS, entry.slot, entry.slot};
+        writeMessage(message, sizeof(message));
+        entry.state = SlotState::MOVING;
+    } else {
+        uint8_t message[] = {OPC_LOCO_ADR, (uint8_t)((entry.address >> 7) & 0x7F), (uint8_t)(entry.address & 0x7F)};
+        writeMessage(message, sizeof(message));
+        entry.state = SlotState::REQUESTED;
+    }
+    entry.requestedAt = now;
+}
+
+void LocoNetCommandManager::acquireLoco(int address) {
+    // Answered asynchronously: the session task completes the request
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    SlotEntry* entry = findEntry(address);
+    if (entry == nullptr) {
+        // A free entry, or else a released one whose slot number is forgotten
+        for (SlotEntry& candidate : slotCache) {
+            if (candidate.address == 0) {
+                entry = &candidate;
+                break;
+            }
+        }
+        for (int i = 0; i < SLOT_CACHE_SIZE && entry == nullptr; i++) {
+            if (slotCache[i].state == SlotState::RELEASED) {
+                entry = &slotCache[i];
+            }
+        }
+        if (entry != nullptr) {
+            *entry = SlotEntry();
+            entry->address = address;
+        }
+    }
+    if (entry != nullptr && entry->state == SlotState::RELEASED) {
+        requestSlot(*entry, millis());
+    }
+    xSemaphoreGive(clientMutex);
+}
+
+void LocoNetCommandManager::releaseLoco(int address) {
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    SlotEntry* entry = findEntry(address);
+    if (entry != nullptr) {
+        if (entry->state == SlotState::IN_USE) {
+            uint8_t message[] = {OPC_SLOT_STAT1, entry->slot, (uint8_t)((entry->stat1 & ~STAT1_STATUS) | STAT1_COMMON)};
+            writeMessage(message, sizeof(message));
+        }
+        // The slot number stays cached for the next acquire
+        entry->state = SlotState::RELEASED;
+    }
+    xSemaphoreGive(clientMutex);
+}
+
+void LocoNetCommandManager::sessionTask(void* param) {
+    LocoNetCommandManager* self = static_cast<LocoNetCommandManager*>(param);
+    uint8_t chunk[64];
+    StateReport reports[MAX_REPORTS_PER_PASS];
+    int ready[MAX_REPORTS_PER_PASS];
+    int probe = TaskMonitor::registerTask("LocoNetSession", CONTROL_CORE, SESSION_PERIOD_MS);
+
+    while (self->sessionRunning()) {
+        xSemaphoreTake(self->clientMutex, portMAX_DELAY);
+        TaskMonitor::beginRun(probe);
+        int reportCount = 0;
+        int readyCount = 0;
+
+        // Drain whatever arrived since the last pass so the socket never stalls
+        int available = self->client->available();
+        while (available > 0) {
+            int count = self->client->read(chunk, min(available, (int)sizeof(chunk)));
+            if (count <= 0) {
+                break;
+            }
+            self->lastReceive = millis();
+            self->parser.feed(chunk, count, [self, &reports, &reportCount, &ready, &readyCount](const char* line, size_t length) {
+                // "SENT OK" / "SENT ERROR ...": the probe is answered once every send up to it is
+                if (strncmp(line, "SENT", 4) == 0) {
+                    self->sendsAnswered++;
+                    if (self->echoPending && (int32_t)(self->sendsAnswered - self->echoTarget) >= 0) {
+                        self->echoPending = false;
+                        self->recordRoundTrip(millis() - self->echoSentAt);
+                    }
+                    return;
+                }
+                if (strncmp(line, "RECEIVE ", 8) != 0) {
+                    return;
+                }
+
+                uint8_t message[MAX_MESSAGE];
+                size_t messageLength = decodeMessage(line + 8, message);
+                if (messageLength == 0) {
+                    return;
+                }
+                // Extra reports and acquisitions in one pass wait for the next retransmit
+                StateReport report;
+                int readyAddress = 0;
+                if (self->handleMessage(message, messageLength, report, readyAddress) && reportCount < MAX_REPORTS_PER_PASS) {
+                    reports[reportCount++] = report;
+                }
+                if (readyAddress != 0 && readyCount < MAX_REPORTS_PER_PASS) {
+                    ready[readyCount++] = readyAddress;
+                }
+            });
+            available = self->client->available();
+        }
+
+        unsigned long now = millis();
+
+        // Slot requests lost on the bus go out again
+        for (SlotEntry& entry : self->slotCache) {
+            if (entry.address != 0 && (entry.state == SlotState::REQUESTED || entry.state == SlotState::MOVING) &&
+                now - entry.requestedAt >= SLOT_TIMEOUT_MS) {
+                self->requestSlot(entry, now);
+            }
+        }
+
+        if (now - self->lastReceive > KEEPALIVE_TIMEOUT_MS) {
+            // No answer to the probes: give the socket up, ConnectionManager reconnects
+            self->client->stop();
+        } else if (now - self->echoSentAt >= ECHO_INTERVAL_MS) {
+            if (self->echoPending) {
+                self->recordRoundTripTimeout();
+            }
+            // Read of the dispatch slot: harmless, and answered by "SENT" like any send
+            uint8_t message[] = {OPC_RQ_SL_DATA, 0, 0};
+            self->writeMessage(message, sizeof(message));
+            self->echoTarget = self->sendsWritten;
+            self->echoPending = true;
+            self->echoSentAt = now;
+        }
+
+        xSemaphoreGive(self->clientMutex);
+
+        // The slot table is locked before the client everywhere else, so reports
+        // are only applied once the client mutex is released
+        for (int i = 0; i < reportCount; i++) {
+            self->applyReport(reports[i]);
+        }
+        // Locos whose slot just came in use get their state, dropped until now
+        for (int i = 0; i < readyCount; i++) {
+            self->resendLoco(ready[i]);
+        }
+
+        TaskMonitor::endRun(probe);
+        vTaskDelay(pdMS_TO_TICKS(SESSION_PERIOD_MS));
+    }
+    self->endSession();
+}
+
+bool LocoNetCommandManager::handleMessage(const uint8_t* message, size_t length, StateReport& report, int& readyAddress) {
+    switch (message[0]) {
+        case OPC_SL_RD_DATA: {
+            // E7 0E slot stat1 adr spd dirf trk ss2 adr2 snd id1 id2 chk
+            if (length != 14) {
+                return false;
+            }
+            uint8_t slot = message[2];
+            uint8_t stat1 = message[3];
+            int address = message[4] | (message[9] << 7);
+            SlotEntry* entry = findEntry(address);
+            if (entry == nullptr) {
+                // A cached slot number now holds another loco: look ours up by address
+                SlotEntry* stale = findSlot(slot);
+                if (stale != nullptr && stale->state == SlotState::MOVING) {
+                    stale->slot = 0;
+                    requestSlot(*stale, millis());
+                }
+                return false;
+            }
+
+            if (entry->state == SlotState::REQUESTED || entry->state == SlotState::MOVING) {
+                entry->slot = slot;
+                entry->stat1 = stat1;
+                if ((stat1 & STAT1_STATUS) == STAT1_IN_USE) {
+                    entry->state = SlotState::IN_USE;
+                    readyAddress = address;
+                } else if (entry->state == SlotState::REQUESTED) {
+                    requestSlot(*entry, millis());
+                }
+            }
+            if (entry->state != SlotState::IN_USE || entry->slot != slot) {
+                return false;
+            }
+            entry->stat1 = stat1;
+            entry->dirf = message[6];
+            entry->snd = message[10];
+            reportSlotData(address, message[5], message[6], message[10], report);
+            return true;
+        }
+        case OPC_LOCO_SPD:
+        case OPC_LOCO_DIRF:
+        case OPC_LOCO_SND: {
+            // Ours echoed back or another throttle driving one of our slots
+            SlotEntry* entry = length == 4 ? findSlot(message[1]) : nullptr;
+            if (entry == nullptr || entry->state != SlotState::IN_USE) {
+                return false;
+            }
+            report = StateReport();
+            report.address = entry->address;
+            if (message[0] == OPC_LOCO_SPD) {
+                report.speed = message[2] <= 1 ? 0 : message[2] - 1;
+            } else if (message[0] == OPC_LOCO_DIRF) {
+                entry->dirf = message[2];
+                report.forward = (message[2] & DIRF_REVERSE) ? 0 : 1;
+                report.functionMask = 0x1F; // F0-F4
+                report.functionStates = ((message[2] >> 4) & 0x01) | ((message[2] & 0x0F) << 1);
+            } else {
+                entry->snd = message[2];
+                report.functionMask = 0x1E0; // F5-F8
+                report.functionStates = (message[2] & 0x0F) << 5;
+            }
+            return true;
+        }
+        default:
+            // OPC_LONG_ACK refusing an OPC_LOCO_ADR (no free slot) is retried on the timeout
+            return false;
+    }
+}
+
+void LocoNetCommandManager::reportSlotData(int address, uint8_t speed, uint8_t dirf, uint8_t snd, StateReport& report) {
+    report = StateReport();
+    report.address = address;
+    report.speed = speed <= 1 ? 0 : speed - 1;
+    report.forward = (dirf & DIRF_REVERSE) ? 0 : 1;
+    // F0 sits in bit 4 of DIRF, F1-F4 below it; SND carries F5-F8
+    report.functionMask = 0x1FF;
+    report.functionStates = ((dirf >> 4) & 0x01) | ((dirf & 0x0F) << 1) | ((uint32_t)(snd & 0x0F) << 5);
+}
+
+void LocoNetCommandManager::sendSpeedCommand(int address, int speed, bool forward) {
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    SlotEntry* entry = findEntry(address);
+    if (entry == nullptr || entry->state != SlotState::IN_USE) {
+        // No slot yet: sent once it is in use (resendLoco)
+        xSemaphoreGive(clientMutex);
+        return;
+    }
+    uint8_t slot = entry->slot;
+    bool turn = ((entry->dirf & DIRF_REVERSE) == 0) != forward;
+    if (turn) {
+        entry->dirf ^= DIRF_REVERSE;
+    }
+    uint8_t dirf = entry->dirf;
+    xSemaphoreGive(clientMutex);
+
+    // Direction travels with the functions: OPC_LOCO_DIRF only when it changes
+    if (turn) {
+        uint8_t message[] = {OPC_LOCO_DIRF, slot, dirf};
+        queueMessage(message, sizeof(message));
+    }
+    // 0 stop, 1 emergency stop, 2-127 the steps 1-126
+    uint8_t steps = speed <= 0 ? 0 : min(speed, (int)MAX_SPEED_STEP) + 1;
+    uint8_t message[] = {OPC_LOCO_SPD, slot, steps};
+    queueMessage(message, sizeof(message));
+}
+
+void LocoNetCommandManager::sendBrakeCommand(int address, int brake) {
+    // DCC has no brake; braking is applied by the throttle through the speed
+}
+
+void LocoNetCommandManager::sendFrontLightsCommand(int address, LightStatus status) {
+    sendFunctionCommand(address, FRONT_LIGHTS_FUNCTION, status != LightStatus::OFF);
+}
+
+void LocoNetCommandManager::sendBackLightsCommand(int address, LightStatus status) {
+    sendFunctionCommand(address, BACK_LIGHTS_FUNCTION, status != LightStatus::OFF);
+}
+
+void LocoNetCommandManager::sendBellCommand(int address, bool active) {
+    sendFunctionCommand(address, BELL_FUNCTION, active);
+}
+
+void LocoNetCommandManager::sendHornCommand(int address, bool active) {
+    sendFunctionCommand(address, HORN_FUNCTION, active);
+}
+
+void LocoNetCommandManager::sendFunctionCommand(int address, int function, bool active) {
+    if (function > 8) {
+        return; // Higher functions need the expanded slot messages
+    }
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    SlotEntry* entry = findEntry(address);
+    if (entry == nullptr || entry->state != SlotState::IN_USE) {
+        xSemaphoreGive(clientMutex);
+        return;
+    }
+
+    // A message carries a whole function group, so the cached byte is updated and resent
+    uint8_t message[3];
+    message[1] = entry->slot;
+    if (function <= 4) {
+        uint8_t bit = function == 0 ? 0x10 : 1 << (function - 1);
+        entry->dirf = active ? (entry->dirf | bit) : (entry->dirf & ~bit);
+        message[0] = OPC_LOCO_DIRF;
+        message[2] = entry->dirf;
+    } else {
+        uint8_t bit = 1 << (function - 5);
+        entry->snd = active ? (entry->snd | bit) : (entry->snd & ~bit);
+        message[0] = OPC_LOCO_SND;
+        message[2] = entry->snd;
+    }
+    xSemaphoreGive(clientMutex);
+    queueMessage(message, sizeof(message));
+}
+
+void LocoNetCommandManager::sendFunctionGroup(int address, int group, uint8_t states) {
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    SlotEntry* entry = findEntry(address);
+    if (entry == nullptr || entry->state != SlotState::IN_USE) {
+        xSemaphoreGive(clientMutex);
+        return;
+    }
+
+    // F0-F8 live in the slot (DIRF keeps its direction bit), the higher
+    // groups go to the track as DCC packets through OPC_IMM_PACKET
+    if (group <= 1) {
+        uint8_t message[3];
+        message[1] = entry->slot;
+        if (group == 0) {
+            entry->dirf = (entry->dirf & ~0x1F) | ((states & 0x01) << 4) | ((states >> 1) & 0x0F);
+            message[0] = OPC_LOCO_DIRF;
+            message[2] = entry->dirf;
+        } else {
+            entry->snd = (entry->snd & ~0x0F) | (states & 0x0F);
+            message[0] = OPC_LOCO_SND;
+            message[2] = entry->snd;
+        }
+        xSemaphoreGive(clientMutex);
+        queueMessage(message, sizeof(message));
+        return;
+    }
+    xSemaphoreGive(clientMutex);
+
+    uint8_t packet[4];
+    size_t length = 0;
+    if (address > 127) {
+        packet[length++] = 0xC0 | (address >> 8);
+    }
+    packet[length++] = address & 0xFF;
+    length += dccFunctionInstruction(group, states, packet + length);
+
+    // ED 0B 7F REPS DHI IM1-IM5: REPS holds the packet length and repeats,
+    // DHI the top bits of the packet bytes, which LocoNet data cannot carry
+    uint8_t message[10] = {OPC_IMM_PACKET, 0x0B, 0x7F, (uint8_t)((length << 4) | IMM_PACKET_REPEATS), 0x20};
+    for (size_t i = 0; i < length; i++) {
+        message[4] |= (packet[i] >> 7) << i;
+        message[5 + i] = packet[i] & 0x7F;
+    }
+    queueMessage(message, sizeof(message));
+}
+
+void LocoNetCommandManager::sendEmergencyStop() {
+    // OPC_IDLE: the command station stops every loco, the track stays powered
+    static constexpr uint8_t STOP[] = {OPC_IDLE};
+    if (opening) {
+        return;
+    }
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    writeMessage(STOP, sizeof(STOP));
+    xSemaphoreGive(clientMutex);
+}
+
+uint8_t LocoNetCommandManager::confirmedFields() const {
+    // LbServer echoes every message put on the bus, ours included
+    return DIRTY_SPEED | DIRTY_FRONT_LIGHTS | DIRTY_BACK_LIGHTS | DIRTY_BELL | DIRTY_HORN;
+}
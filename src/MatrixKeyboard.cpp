@@ -1,12 +1,13 @@
 #include "MatrixKeyboard.h"
 #include "ExtendedKeys.h" 
 
-MatrixKeyboard::MatrixKeyboard(const uint8_t rows[2], const uint8_t cols[3], uint8_t powerPin) 
+MatrixKeyboard::MatrixKeyboard(const uint8_t rows[3], const uint8_t cols[3], uint8_t powerPin) 
     : softPowerPin(powerPin) {
     
     // Store row and column pins
     rowPins[0] = rows[0];
     rowPins[1] = rows[1];
+    rowPins[2] = rows[2];
     
     colPins[0] = cols[0];
     colPins[1] = cols[1];
@@ -23,13 +24,18 @@ MatrixKeyboard::MatrixKeyboard(const uint8_t rows[2], const uint8_t cols[3], uin
     keyMap[1][1] = ExtendedKeys::KEY_TIGHT_BRAKE;   // Bottom-middle 
     keyMap[1][2] = ExtendedKeys::KEY_RELEASE_BRAKE;  // Bottom-right 
     
+    // Row 2: function keys
+    keyMap[2][0] = ExtendedKeys::KEY_HORN;
+    keyMap[2][1] = ExtendedKeys::KEY_BELL;
+    keyMap[2][2] = ExtendedKeys::KEY_ESTOP;
+    
     // Initialize all pins
     initializePins();
 }
 
 void MatrixKeyboard::initializePins() {
     // Set row pins as outputs with HIGH state (inactive)
-    for (int i = 0; i < 2; i++) {
+    for (int i = 0; i < 3; i++) {
         pinMode(rowPins[i], OUTPUT);
         digitalWrite(rowPins[i], HIGH);
     }
@@ -47,7 +53,7 @@ uint16_t MatrixKeyboard::getPressedKeys() {
     uint16_t pressedKeys = 0;
     
     // Scan each row of the matrix
-    for (int row = 0; row < 2; row++) {
+    for (int row = 0; row < 3; row++) {
         scanRow(row, pressedKeys);
     }
     
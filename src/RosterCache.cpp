@@ -0,0 +1,279 @@
+#include "RosterCache.h"
+#include "BootSequence.h"
+#include <algorithm>
+
+namespace {
+
+// Holds the recursive cache mutex for the lifetime of the object
+class CacheLock {
+public:
+    explicit CacheLock(SemaphoreHandle_t mutex) : mutex(mutex) {
+        xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+    }
+    ~CacheLock() {
+        xSemaphoreGiveRecursive(mutex);
+    }
+private:
+    SemaphoreHandle_t mutex;
+};
+
+void putU16(uint8_t* out, uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+void putU32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+uint16_t getU16(const uint8_t* in) {
+    return in[0] | (in[1] << 8);
+}
+
+uint32_t getU32(const uint8_t* in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+} // namespace
+
+int RosterCache::getCount() {
+    CacheLock lock(mutex);
+    ensureLoaded();
+    return count;
+}
+
+uint32_t RosterCache::getEtag() {
+    CacheLock lock(mutex);
+    ensureLoaded();
+    return etag;
+}
+
+bool RosterCache::find(int address, Entry& entry) {
+    CacheLock lock(mutex);
+    ensureLoaded();
+
+    // Last block starting at or below the address
+    int blockCount = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    int low = 0;
+    int high = blockCount - 1;
+    int block = -1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (blockFirst[mid] <= address) {
+            block = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    if (block < 0) {
+        return false;
+    }
+
+    // Then the records of that block, read from the file
+    File file = LittleFS.open(FILE_PATH, "r");
+    if (!file) {
+        return false;
+    }
+    low = block * BLOCK_SIZE;
+    high = min(low + BLOCK_SIZE, count) - 1;
+    bool found = false;
+    while (low <= high && !found) {
+        int mid = (low + high) / 2;
+        if (!readRecord(file, mid, entry)) {
+            break;
+        }
+        if (entry.address == address) {
+            found = true;
+        } else if (entry.address < address) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    file.close();
+    return found;
+}
+
+int RosterCache::readPage(int first, Entry* entries, int maxCount) {
+    CacheLock lock(mutex);
+    ensureLoaded();
+    if (first < 0 || first >= count) {
+        return 0;
+    }
+
+    File file = LittleFS.open(FILE_PATH, "r");
+    if (!file) {
+        return 0;
+    }
+    int read = 0;
+    while (read < maxCount && first + read < count && readRecord(file, first + read, entries[read])) {
+        read++;
+    }
+    file.close();
+    return read;
+}
+
+bool RosterCache::beginUpdate() {
+    CacheLock lock(mutex);
+    ensureLoaded();
+    if (updating) {
+        return false;
+    }
+    updateFile = LittleFS.open(UPDATE_PATH, "w");
+    if (!updateFile) {
+        return false;
+    }
+    updating = true;
+    updateEntries.clear();
+    return true;
+}
+
+void RosterCache::addEntry(int address, const char* name, size_t nameLength) {
+    CacheLock lock(mutex);
+    if (!updating || address < 1 || address > 10239 || (int)updateEntries.size() >= MAX_ENTRIES) {
+        return;
+    }
+    uint8_t record[RECORD_SIZE];
+    encodeRecord(address, name, nameLength, record);
+    if (updateFile.write(record, RECORD_SIZE) == RECORD_SIZE) {
+        updateEntries.push_back(((uint32_t)address << 16) | updateEntries.size());
+    }
+}
+
+bool RosterCache::commitUpdate(uint32_t newEtag) {
+    CacheLock lock(mutex);
+    if (!updating) {
+        return false;
+    }
+    updating = false;
+    updateFile.close();
+
+    // Address order; an address listed twice keeps its first entry
+    std::sort(updateEntries.begin(), updateEntries.end());
+    auto sameAddress = [](uint32_t a, uint32_t b) { return (a >> 16) == (b >> 16); };
+    updateEntries.erase(std::unique(updateEntries.begin(), updateEntries.end(), sameAddress), updateEntries.end());
+
+    File source = LittleFS.open(UPDATE_PATH, "r");
+    String tempPath = String(FILE_PATH) + ".tmp";
+    File target = LittleFS.open(tempPath, "w");
+    bool ok = source && target;
+
+    uint8_t buffer[RECORD_SIZE > HEADER_SIZE ? RECORD_SIZE : HEADER_SIZE];
+    if (ok) {
+        memset(buffer, 0, HEADER_SIZE);
+        putU32(buffer, MAGIC);
+        putU16(buffer + 4, SCHEMA_VERSION);
+        putU16(buffer + 6, updateEntries.size());
+        putU32(buffer + 8, newEtag);
+        ok = target.write(buffer, HEADER_SIZE) == HEADER_SIZE;
+    }
+    for (size_t i = 0; ok && i < updateEntries.size(); i++) {
+        uint32_t position = updateEntries[i] & 0xFFFF;
+        ok = source.seek(position * RECORD_SIZE) &&
+             source.read(buffer, RECORD_SIZE) == RECORD_SIZE &&
+             target.write(buffer, RECORD_SIZE) == RECORD_SIZE;
+    }
+    if (source) {
+        source.close();
+    }
+    if (target) {
+        target.close();
+    }
+    LittleFS.remove(UPDATE_PATH);
+    updateEntries.clear();
+    updateEntries.shrink_to_fit();
+
+    // LittleFS renames atomically: readers see the old roster or the new one
+    if (!ok || !LittleFS.rename(tempPath, FILE_PATH)) {
+        LittleFS.remove(tempPath);
+        return false;
+    }
+    return loadIndex();
+}
+
+void RosterCache::abortUpdate() {
+    CacheLock lock(mutex);
+    if (!updating) {
+        return;
+    }
+    updating = false;
+    updateFile.close();
+    LittleFS.remove(UPDATE_PATH);
+    updateEntries.clear();
+    updateEntries.shrink_to_fit();
+}
+
+uint32_t RosterCache::hash(const char* text) {
+    // FNV-1a: only has to notice that the listing changed
+    uint32_t value = 2166136261UL;
+    while (*text) {
+        value = (value ^ (uint8_t)*text++) * 16777619UL;
+    }
+    return value;
+}
+
+void RosterCache::ensureLoaded() {
+    if (loaded) {
+        return;
+    }
+    loaded = true;
+
+    // The file cannot be read before the filesystem is mounted
+    BootSequence::waitFor(BootSequence::Phase::FILESYSTEM);
+    loadIndex();
+}
+
+bool RosterCache::loadIndex() {
+    count = 0;
+    etag = 0;
+
+    File file = LittleFS.open(FILE_PATH, "r");
+    if (!file) {
+        return false;
+    }
+
+    // A header that does not match the file size is treated as no cache:
+    // the next sync rebuilds it
+    uint8_t header[HEADER_SIZE];
+    int records = 0;
+    bool valid = file.read(header, HEADER_SIZE) == HEADER_SIZE &&
+                 getU32(header) == MAGIC &&
+                 getU16(header + 4) == SCHEMA_VERSION;
+    if (valid) {
+        records = getU16(header + 6);
+        valid = records <= MAX_ENTRIES && file.size() == HEADER_SIZE + records * RECORD_SIZE;
+    }
+
+    Entry entry;
+    for (int block = 0; valid && block * BLOCK_SIZE < records; block++) {
+        valid = readRecord(file, block * BLOCK_SIZE, entry);
+        blockFirst[block] = entry.address;
+    }
+    file.close();
+
+    if (valid) {
+        count = records;
+        etag = getU32(header + 8);
+    }
+    return valid;
+}
+
+bool RosterCache::readRecord(File& file, int index, Entry& entry) {
+    uint8_t record[RECORD_SIZE];
+    if (!file.seek(HEADER_SIZE + index * RECORD_SIZE) || file.read(record, RECORD_SIZE) != RECORD_SIZE) {
+        return false;
+    }
+    entry.address = getU16(record);
+    memcpy(entry.name, record + 2, NAME_LENGTH);
+    entry.name[NAME_LENGTH] = '\0';
+    return true;
+}
+
+void RosterCache::encodeRecord(int address, const char* name, size_t nameLength, uint8_t* record) {
+    memset(record, 0, RECORD_SIZE);
+    putU16(record, address);
+    memcpy(record + 2, name, min(nameLength, (size_t)NAME_LENGTH));
+}
@@ -0,0 +1,71 @@
+#include "SerialClient.h"
+
+int SerialClient::connect(IPAddress ip, uint16_t port) {
+    return connect("", port);
+}
+
+int SerialClient::connect(const char* host, uint16_t port) {
+    // Restart the UART so a changed baud rate or buffer size takes effect
+    serial.end();
+    serial.setTX(txPin);
+    serial.setRX(rxPin);
+    serial.setFIFOSize(RX_BUFFER_SIZE);
+    serial.begin(baudRate);
+
+    // Bytes of a previous session would start the new one mid-message
+    while (serial.available() > 0) {
+        serial.read();
+    }
+    open = true;
+    return 1;
+}
+
+size_t SerialClient::write(uint8_t value) {
+    return open ? serial.write(value) : 0;
+}
+
+size_t SerialClient::write(const uint8_t* buffer, size_t size) {
+    return open ? serial.write(buffer, size) : 0;
+}
+
+int SerialClient::available() {
+    return open ? serial.available() : 0;
+}
+
+int SerialClient::read() {
+    return open ? serial.read() : -1;
+}
+
+int SerialClient::read(uint8_t* buffer, size_t size) {
+    if (!open) {
+        return 0;
+    }
+    // Only what is already buffered: a read never waits for the line
+    size_t count = min((size_t)serial.available(), size);
+    for (size_t i = 0; i < count; i++) {
+        buffer[i] = serial.read();
+    }
+    return count;
+}
+
+int SerialClient::peek() {
+    return open ? serial.peek() : -1;
+}
+
+void SerialClient::flush() {
+    serial.flush();
+}
+
+void SerialClient::stop() {
+    // The UART keeps running: a replacing manager may already be using it
+    open = false;
+}
+
+uint8_t SerialClient::connected() {
+    // Open, not necessarily answered: see the class comment
+    return open;
+}
+
+SerialClient::operator bool() {
+    return open;
+}
@@ -0,0 +1,100 @@
+#include "TaskMonitor.h"
+#include <FreeRTOS.h>
+#include <task.h>
+
+TaskMonitor::Entry TaskMonitor::entries[TaskMonitor::MAX_TASKS];
+volatile int TaskMonitor::taskCount = 0;
+
+int TaskMonitor::registerTask(const char* name, uint8_t core, uint32_t periodMs) {
+    int id = -1;
+
+    // Registration happens once per task at start-up, a short critical section is fine
+    taskENTER_CRITICAL();
+    for (int i = 0; i < taskCount; i++) {
+        // A restarted task (e.g. a session after a reconnect) keeps its entry and history
+        if (strcmp(entries[i].name, name) == 0) {
+            id = i;
+            entries[i].lastStart = 0;
+            break;
+        }
+    }
+    if (id < 0 && taskCount < MAX_TASKS) {
+        id = taskCount;
+        Entry& entry = entries[id];
+        entry.name = name;
+        entry.core = core;
+        entry.periodMicros = periodMs * 1000;
+        entry.lastStart = 0;
+        entry.busyMicros = 0;
+        entry.worstLatencyMicros = 0;
+        entry.worstRunMicros = 0;
+        taskCount = id + 1;
+    }
+    taskEXIT_CRITICAL();
+
+    return id;
+}
+
+void TaskMonitor::beginRun(int id) {
+    if (id < 0) {
+        return;
+    }
+    Entry& entry = entries[id];
+    uint32_t now = micros();
+
+    // Lateness is how much longer than the nominal period this wake-up took
+    if (entry.lastStart != 0) {
+        uint32_t interval = now - entry.lastStart;
+        if (interval > entry.periodMicros) {
+            uint32_t latency = interval - entry.periodMicros;
+            if (latency > entry.worstLatencyMicros) {
+                entry.worstLatencyMicros = latency;
+            }
+        }
+    }
+    entry.lastStart = now;
+    entry.runStart = now;
+}
+
+void TaskMonitor::endRun(int id) {
+    if (id < 0) {
+        return;
+    }
+    Entry& entry = entries[id];
+    uint32_t run = micros() - entry.runStart;
+    entry.busyMicros += run;
+    if (run > entry.worstRunMicros) {
+        entry.worstRunMicros = run;
+    }
+}
+
+String TaskMonitor::report() {
+    // Reader-side history used to turn the accumulated busy time into a load figure
+    static uint32_t previousBusy[MAX_TASKS];
+    static uint32_t previousReport = 0;
+
+    uint32_t now = micros();
+    uint32_t window = previousReport ? now - previousReport : now;
+    previousReport = now;
+
+    uint32_t coreBusy[2] = {0, 0};
+    String text;
+    int count = taskCount;
+    for (int i = 0; i < count; i++) {
+        const Entry& entry = entries[i];
+        uint32_t busy = entry.busyMicros;
+        coreBusy[entry.core & 1] += busy - previousBusy[i];
+        previousBusy[i] = busy;
+
+        text += String(entry.name) + " c" + String(entry.core) +
+                " lat " + String(entry.worstLatencyMicros) + "us" +
+                " run " + String(entry.worstRunMicros) + "us\n";
+    }
+
+    String header;
+    for (int core = 0; core < 2; core++) {
+        uint32_t load = window ? (uint32_t)((uint64_t)coreBusy[core] * 100 / window) : 0;
+        header += "Core " + String(core) + ": " + String(load) + "%\n";
+    }
+    return header + text;
+}
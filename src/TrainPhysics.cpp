@@ -0,0 +1,67 @@
+#include "TrainPhysics.h"
+
+// Gravity in cm/s^2
+static constexpr int64_t GRAVITY_CMPS2 = 981;
+
+void TrainPhysics::setThrottle(int percent) {
+    throttlePercent = percent < 0 ? 0 : (percent > 100 ? 100 : percent);
+}
+
+void TrainPhysics::setBrake(int percent) {
+    brakePercent = percent < 0 ? 0 : (percent > 100 ? 100 : percent);
+}
+
+void TrainPhysics::tick() {
+    const int64_t mass = params.massKg;
+    const int64_t speedMmps = speedUmps / 1000;
+
+    // Tractive effort, limited by the available power once the train is moving
+    // and cut off by the governor at the maximum speed
+    int64_t tractive = (int64_t)params.maxTractiveEffortN * throttlePercent / 100;
+    if (getSpeedKmh() >= params.maxSpeedKmh) {
+        tractive = 0;
+    } else if (speedMmps > 0) {
+        int64_t powerLimited = (int64_t)params.maxPowerW * throttlePercent * 10 / speedMmps; // P / v
+        if (powerLimited < tractive) {
+            tractive = powerLimited;
+        }
+    }
+
+    // Opposing forces: rolling resistance, drag (v^2) and brakes
+    int64_t rolling = mass * GRAVITY_CMPS2 * params.rollingResistancePermille / 100000;
+    int64_t drag = (int64_t)params.dragNPerMps2 * speedMmps * speedMmps / 1000000;
+    int64_t braking = (int64_t)params.maxBrakeForceN * brakePercent / 100;
+
+    int64_t net = tractive - rolling - drag - braking;
+
+    // At standstill the train only moves once traction overcomes the resistance
+    if (speedUmps == 0 && net <= 0) {
+        return;
+    }
+
+    // dv = F / m * dt, in micrometres per second
+    speedUmps += net * (int64_t)TICK_MS * 1000 / mass;
+
+    // Resistances and brakes stop the train but never push it backwards
+    if (speedUmps < 0) {
+        speedUmps = 0;
+    }
+}
+
+void TrainPhysics::setSpeedStep(int step) {
+    if (step < 0) step = 0;
+    if (step > MAX_SPEED_STEP) step = MAX_SPEED_STEP;
+
+    // km/h to um/s is x 1e6 / 3.6, rounded up so getSpeedStep() gives the step back
+    const int64_t divisor = 36 * MAX_SPEED_STEP;
+    speedUmps = ((int64_t)params.maxSpeedKmh * step * 10000000 + divisor - 1) / divisor;
+}
+
+uint32_t TrainPhysics::getSpeedKmh() const {
+    return (uint32_t)(speedUmps * 36 / 10000000);
+}
+
+int TrainPhysics::getSpeedStep() const {
+    int64_t step = speedUmps * 36 * MAX_SPEED_STEP / ((int64_t)params.maxSpeedKmh * 10000000);
+    return step > MAX_SPEED_STEP ? MAX_SPEED_STEP : (int)step;
+}
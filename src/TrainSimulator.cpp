@@ -0,0 +1,219 @@
+#include "TrainSimulator.h"
+#include "LocoCommandManagerFactory.h"
+#include "Config.h"
+#include "TaskMonitor.h"
+
+void TrainSimulator::start() {
+    if (taskHandle) {
+        return;
+    }
+
+    syncFromActiveSlot();
+
+    // Above the UI task so input handling and redraws never delay a tick
+    xTaskCreateAffinitySet(
+        simulationTask,    // Task function
+        "TrainSim",        // Task name
+        2048,              // Stack size
+        this,              // Task parameter
+        2,                 // Task priority
+        1 << CONTROL_CORE, // Core affinity
+        &taskHandle        // Task handle
+    );
+}
+
+void TrainSimulator::setThrottle(int percent) {
+    throttlePercent.store(percent, std::memory_order_relaxed);
+}
+
+void TrainSimulator::setBrakeValve(AirBrake::Valve position) {
+    brakeValve.store(position, std::memory_order_relaxed);
+}
+
+void TrainSimulator::syncFromActiveSlot() {
+    // Only the UI task requests takeovers, a plain store is enough (no RMW on the M0+)
+    takeoverRequest.store(takeoverRequest.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+bool TrainSimulator::selectLoco(int address) {
+    if (!LocoCommandManager::isValidAddress(address)) {
+        return false;
+    }
+    Intent intent{Intent::Type::SELECT_LOCO};
+    intent.value = address;
+    return queueIntent(intent);
+}
+
+bool TrainSimulator::selectDefaultLoco() {
+    return queueIntent(Intent{Intent::Type::SELECT_DEFAULT});
+}
+
+bool TrainSimulator::switchSlot(int direction) {
+    Intent intent{Intent::Type::SWITCH_SLOT};
+    intent.value = direction;
+    return queueIntent(intent);
+}
+
+bool TrainSimulator::setFunction(int function, bool active) {
+    Intent intent{Intent::Type::SET_FUNCTION};
+    intent.value = function;
+    intent.flag = active;
+    return queueIntent(intent);
+}
+
+bool TrainSimulator::toggleFunction(int function) {
+    Intent intent{Intent::Type::TOGGLE_FUNCTION};
+    intent.value = function;
+    return queueIntent(intent);
+}
+
+bool TrainSimulator::setDirection(bool forward) {
+    Intent intent{Intent::Type::SET_DIRECTION};
+    intent.flag = forward;
+    return queueIntent(intent);
+}
+
+bool TrainSimulator::addConsistMember(int address, bool reversed, int speedScale) {
+    // Same checks as the slot table, on the latest copy, so the UI can answer at once
+    LocoCommandManager::LocoSlot slot = getActiveSlot();
+    if (slot.address == 0 || address == slot.address || !LocoCommandManager::isValidAddress(address) ||
+        slot.consistSize >= LocoCommandManager::MAX_CONSIST_MEMBERS) {
+        return false;
+    }
+    for (int i = 0; i < slot.consistSize; i++) {
+        if (slot.consist[i].address == address) {
+            return false;
+        }
+    }
+    Intent intent{Intent::Type::ADD_CONSIST_MEMBER};
+    intent.value = address;
+    intent.flag = reversed;
+    intent.speedScale = speedScale;
+    return queueIntent(intent);
+}
+
+bool TrainSimulator::clearConsist() {
+    return queueIntent(Intent{Intent::Type::CLEAR_CONSIST});
+}
+
+bool TrainSimulator::applyIntents(LocoCommandManager* locoManager) {
+    bool locoChanged = false;
+    Intent intent;
+    while (intents.pop(intent)) {
+        switch (intent.type) {
+            case Intent::Type::SELECT_LOCO:
+                locoChanged |= locoManager->selectLoco(intent.value);
+                break;
+            case Intent::Type::SELECT_DEFAULT:
+                if (locoManager->getActiveSlotIndex() < 0) {
+                    locoChanged |= locoManager->selectLoco(LocoCommandManager::DEFAULT_LOCO_ADDRESS);
+                }
+                break;
+            case Intent::Type::SWITCH_SLOT: {
+                // Walk the slot table to the next acquired loco; this never touches the network
+                int index = locoManager->getActiveSlotIndex();
+                for (int i = 0; i < LocoCommandManager::MAX_LOCO_SLOTS; i++) {
+                    index = (index + intent.value + LocoCommandManager::MAX_LOCO_SLOTS) % LocoCommandManager::MAX_LOCO_SLOTS;
+                    if (locoManager->selectSlot(index)) {
+                        locoChanged = true;
+                        break;
+                    }
+                }
+                break;
+            }
+            case Intent::Type::SET_FUNCTION:
+                locoManager->setFunction(intent.value, intent.flag);
+                break;
+            case Intent::Type::TOGGLE_FUNCTION:
+                locoManager->setFunction(intent.value, !locoManager->getFunction(intent.value));
+                break;
+            case Intent::Type::SET_DIRECTION:
+                locoManager->setDirection(intent.flag);
+                break;
+            case Intent::Type::ADD_CONSIST_MEMBER:
+                locoManager->addConsistMember(intent.value, intent.flag, intent.speedScale);
+                break;
+            case Intent::Type::CLEAR_CONSIST:
+                locoManager->clearConsist();
+                break;
+        }
+    }
+    return locoChanged;
+}
+
+void TrainSimulator::takeOver(LocoCommandManager* locoManager) {
+    LocoCommandManager::LocoSlot slot = locoManager->copyActiveSlot();
+    if (slot.address != 0) {
+        physics.setSpeedStep(slot.speed);
+        lastSpeedStep = slot.speed;
+    }
+}
+
+void TrainSimulator::emergencyStop() {
+    throttlePercent.store(0, std::memory_order_relaxed);
+    // Only the input sampler requests it, a plain store is enough
+    emergencyRequest.store(emergencyRequest.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void TrainSimulator::simulationTask(void* param) {
+    TrainSimulator* self = static_cast<TrainSimulator*>(param);
+    int probe = TaskMonitor::registerTask("TrainSim", CONTROL_CORE, TrainPhysics::TICK_MS);
+    int reader = LocoCommandManagerFactory::registerReader();
+    TickType_t lastWake = xTaskGetTickCount();
+
+    while (true) {
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(TrainPhysics::TICK_MS));
+        TaskMonitor::beginRun(probe);
+        unsigned long start = micros();
+
+        // Apply the UI's changes to the slot table, then a takeover (requested
+        // or due to a loco change) before advancing
+        LocoCommandManager* locoManager = LocoCommandManagerFactory::getInstance().getLocoCommandManager();
+        bool locoChanged = self->applyIntents(locoManager);
+        uint32_t request = self->takeoverRequest.load(std::memory_order_acquire);
+        if (request != self->takeoverApplied || locoChanged) {
+            self->takeoverApplied = request;
+            self->takeOver(locoManager);
+        }
+
+        // Emergency stop: the model stops with the loco; the slot ignores the
+        // speeds computed before it until the command station confirms the stop
+        uint32_t emergency = self->emergencyRequest.load(std::memory_order_acquire);
+        if (emergency != self->emergencyApplied) {
+            self->emergencyApplied = emergency;
+            self->physics.setSpeedStep(0);
+            self->lastSpeedStep = -1;
+        }
+
+        // Brakes first: the cylinder pressure sets the brake force of this tick
+        self->airBrake.setValve(self->brakeValve.load(std::memory_order_relaxed));
+        self->airBrake.tick();
+
+        self->physics.setThrottle(self->throttlePercent.load(std::memory_order_relaxed));
+        self->physics.setBrake(self->airBrake.getBrakePercent());
+        self->physics.tick();
+
+        State snapshot;
+        snapshot.speedKmh = self->physics.getSpeedKmh();
+        snapshot.brakePipeMbar = self->airBrake.getPipeMbar();
+        snapshot.brakeCylinderMbar = self->airBrake.getCylinderMbar();
+        self->state.write(snapshot);
+
+        // Only mark the speed when the DCC step actually changes; the flush also
+        // sends whatever the UI changed, so network I/O stays on this core
+        int step = self->physics.getSpeedStep();
+        if (step != self->lastSpeedStep) {
+            self->lastSpeedStep = step;
+            locoManager->setSpeed(step);
+        }
+        locoManager->flush();
+        self->activeSlot.write(locoManager->copyActiveSlot());
+        LocoCommandManagerFactory::quiescent(reader);
+
+        uint32_t elapsed = micros() - start;
+        if (elapsed > self->worstTickMicros) {
+            self->worstTickMicros = elapsed;
+        }
+        TaskMonitor::endRun(probe);
+    }
+}
@@ -7,6 +7,15 @@
 #include "MatrixKeyboard.h"
 #include "LocoDriverPage.h"
 #include "LocoCommandManagerFactory.h" 
+#include "TaskMonitor.h"
+#include "ConnectionManager.h"
+#include "WiFiScanPage.h"
+#include "LatencyPage.h"
+#include "CommandBenchmark.h"
+#include "ConfigStore.h"
+#include "BootSequence.h"
+#include "RosterCache.h"
+#include "TrainSimulator.h"
 
 UIManager::UIManager() : tft(), uiTaskHandle(nullptr) {}
 
@@ -18,17 +27,21 @@ UIManager::~UIManager() {
 }
 
 void UIManager::begin() {
+    BootSequence::beginPhase(BootSequence::Phase::UI);
 
     //create an instance of keyboard
-    static constexpr uint8_t rowPins[] = {D17, D18};
+    static constexpr uint8_t rowPins[] = {D17, D18, D28};
     static constexpr uint8_t colPins[] = {D14, D15, D16};
     keyboard = new MatrixKeyboard(rowPins, colPins, D19);
     
     // Create an instance of AnalogSwitch
     analogSwitch = new AnalogSwitch(D21, D22);
     
-    // Initialize the WiFiConfigManager singleton with config path
-    WiFiConfigManager::getInstance("/wifi_config.json");
+    // Sample the keyboard on the control core, the UI only reads the result
+    inputSampler = new InputSampler(keyboard, analogSwitch);
+    
+    // Initialize the WiFiConfigManager singleton
+    WiFiConfigManager::getInstance();
     
     // Initialize the TFT display
     tft.begin();
@@ -42,27 +55,59 @@ void UIManager::begin() {
     setupMenus();
     // Show splash screen
     PageManager::showSplash(trainControllerImage, false, trainControllerPalette, 360, 240, 3000);
+    BootSequence::endPhase(BootSequence::Phase::UI);
 }
 
 void UIManager::startTask() {
     // Create the UI task
-    xTaskCreate(
+    // UI and rendering own the UI core
+    xTaskCreateAffinitySet(
         uiTask,         // Task function
         "UITask",       // Task name
         4096,           // Stack size (in bytes)
         this,           // Task parameter (pass the UIManager instance)
         1,              // Task priority
+        1 << UI_CORE,   // Core affinity
         &uiTaskHandle   // Task handle
     );
+
+    inputSampler->start();
+
+    // Applies the menus' loco and consist changes even before the driver page opens
+    TrainSimulator::getInstance().start();
 }
 
 void UIManager::uiTask(void* param) {
     UIManager* self = static_cast<UIManager*>(param);
+    int probe = TaskMonitor::registerTask("UITask", UI_CORE, UI_PERIOD_MS);
+    int reader = LocoCommandManagerFactory::registerReader();
+    TickType_t lastWake = xTaskGetTickCount();
 
     while (true) {
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(UI_PERIOD_MS));
+        TaskMonitor::beginRun(probe);
+
+        // The splash pops itself; once the main menu showed up the user is in control
+        if (!self->splashDone && PageManager::currentPage() == self->mainMenuPage) {
+            self->splashDone = true;
+        }
+        if (self->bootAutoDrive && self->splashDone &&
+            (PageManager::currentPage() != self->mainMenuPage || millis() > AUTO_DRIVE_WINDOW_MS)) {
+            self->bootAutoDrive = false; // The user navigated or the boot took too long
+        }
+
+        // React to link changes posted by the connection task
+        ConnectionManager::LinkEvent event;
+        while (ConnectionManager::getInstance().pollEvent(event)) {
+            self->handleLinkEvent(event);
+        }
+
         // Handle input and draw the current page
-        self->analogSwitch->switchTo(0); // Switch to channel 0
-        PageManager::handleInput(self->keyboard);
+        PageManager::handleInput(self->inputSampler);
+
+        // No command manager pointer is held past this point
+        LocoCommandManagerFactory::quiescent(reader);
+        TaskMonitor::endRun(probe);
     }
 }
 
@@ -72,38 +117,9 @@ void UIManager::setupMenus() {
     auto controlSystemMenu = std::make_unique<MenuPage>(mainMenu.get());
 
     // Setup WiFi submenu
-    wifiSubMenu->addItem("Scan for Networks", nullptr, [this]() {
-        // Show loading during scan
-        PageManager::showLoading("Scanning for WiFi networks...");
-        
-        // Vector to store discovered SSIDs
-        std::vector<ListItem> networks;
-        
-        // Start scanning for SSIDs using singleton
-        WiFiConfigManager::getInstance().startSSIDScan([&networks](const String& ssid) {
-            // Check if SSID is already in the list to avoid duplicates
-            bool isDuplicate = false;
-            for (const auto& network : networks) {
-                if (network.label == ssid) {
-                    isDuplicate = true;
-                    break;
-                }
-            }
-            
-            if (!isDuplicate) {
-                networks.push_back({ssid, 0}); // Add to list with dummy value
-            }
-        });
-        
-        // Wait a bit for scan results
-        delay(5000);
-        
-        // Stop scanning
-        WiFiConfigManager::getInstance().stopSSIDScan();
-        PageManager::hideLoading();
-        
-        // Show list dialog with discovered networks
-        PageManager::showListDialog("Select WiFi Network", networks,
+    wifiSubMenu->addItem("Scan for Networks", nullptr, []() {
+        // Opens straight from the scan cache and refreshes itself in the background
+        PageManager::pushPage(std::make_unique<WiFiScanPage>(
             [](bool accepted, ListItem selected) {
                 if (accepted) {
                     // Load current properties to update just the SSID
@@ -125,7 +141,7 @@ void UIManager::setupMenus() {
                             }
                         });
                 }
-            });
+            }));
     });
 
     wifiSubMenu->addItem("Network Settings", nullptr, []() {
@@ -195,41 +211,16 @@ void UIManager::setupMenus() {
     });
     
     // Connect to network option
-    wifiSubMenu->addItem("Connect", nullptr, []() {
+    wifiSubMenu->addItem("Connect", nullptr, [this]() {
+        // The connection task does the work, the result comes back as a link event
         PageManager::showLoading("Connecting to WiFi...");
-        WiFiConfigManager::getInstance().startNetwork();
-        
-        // Wait for connection (you might want to implement a timeout)
-        for (int i = 0; i < 20; i++) {
-            if (WiFiConfigManager::getInstance().isConnected()) {
-                break;
-            }
-            delay(500);
-        }
-        
-        PageManager::hideLoading();
-        
-        if (WiFiConfigManager::getInstance().isConnected()) {
-            // Get current connection information
-            WiFiConfigManager::ConnectionInfo info = WiFiConfigManager::getInstance().getConnectionInfo();
-
-            // Display in a popup or status screen
-            String statusMessage = "SSID: " + info.ssid + "\n" +
-                                "IP: " + info.ip + "\n" +
-                                "Subnet: " + info.subnet + "\n" +
-                                "Gateway: " + info.gateway + "\n" +
-                                "Signal: " + String(info.rssi) + " dBm\n" +
-                                "MAC: " + info.macAddress;
-
-            PageManager::showPopup(statusMessage.c_str());
-        } else {
-            PageManager::showPopup("Failed to connect");
-        }
+        awaitingConnect = true;
+        ConnectionManager::getInstance().requestConnect();
     });
     
     // Disconnect from network option
     wifiSubMenu->addItem("Disconnect", nullptr, []() {
-        WiFiConfigManager::getInstance().stopNetwork();
+        ConnectionManager::getInstance().requestDisconnect();
         PageManager::showPopup("Disconnected from WiFi");
     });
 
@@ -264,7 +255,9 @@ void UIManager::setupMenus() {
         // Create vector for system type options
         std::vector<ListItem> systemTypes = {
             {"DCC-Ex", static_cast<int>(LocoCommandManagerFactory::ManagerType::DccEx)},
-            {"JMRI", static_cast<int>(LocoCommandManagerFactory::ManagerType::JMRI)}
+            {"JMRI", static_cast<int>(LocoCommandManagerFactory::ManagerType::JMRI)},
+            {"Z21", static_cast<int>(LocoCommandManagerFactory::ManagerType::Z21)},
+            {"LocoNet", static_cast<int>(LocoCommandManagerFactory::ManagerType::LocoNet)}
         };
         
         // Get current manager type
@@ -272,7 +265,12 @@ void UIManager::setupMenus() {
         auto currentType = factory.getManagerType();
         
         // Pre-select current type
-        int selectedIndex = (currentType == LocoCommandManagerFactory::ManagerType::JMRI) ? 1 : 0;
+        int selectedIndex = 0;
+        for (size_t i = 0; i < systemTypes.size(); i++) {
+            if (systemTypes[i].value == static_cast<int>(currentType)) {
+                selectedIndex = i;
+            }
+        }
         
         // Show list dialog with system types
         PageManager::showListDialog("Select System Type", systemTypes, selectedIndex,
@@ -280,8 +278,11 @@ void UIManager::setupMenus() {
                 if (accepted) {
                     auto& factory = LocoCommandManagerFactory::getInstance();
                     auto newType = static_cast<LocoCommandManagerFactory::ManagerType>(selected.value);
-                    factory.setManagerType(newType);
-                    PageManager::showPopup("System Type updated to " + selected.label);
+                    if (factory.setManagerType(newType)) {
+                        PageManager::showPopup("System Type updated to " + selected.label);
+                    } else {
+                        PageManager::showPopup(selected.label + " is not built into this firmware");
+                    }
                 }
             });
     });
@@ -301,11 +302,84 @@ void UIManager::setupMenus() {
                 }
             });
     });
+
+    controlSystemMenu->addItem("Transport", nullptr, []() {
+        std::vector<ListItem> transports = {
+            {"WiFi", static_cast<int>(LocoCommandManagerFactory::Transport::Network)},
+            {"Serial (DCC-Ex)", static_cast<int>(LocoCommandManagerFactory::Transport::Serial)}
+        };
+        auto& factory = LocoCommandManagerFactory::getInstance();
+        int selectedIndex = factory.getTransport() == LocoCommandManagerFactory::Transport::Serial ? 1 : 0;
+
+        PageManager::showListDialog("Select Transport", transports, selectedIndex,
+            [](bool accepted, ListItem selected) {
+                if (accepted) {
+                    auto& factory = LocoCommandManagerFactory::getInstance();
+                    factory.setTransport(static_cast<LocoCommandManagerFactory::Transport>(selected.value));
+                    PageManager::showPopup("Transport updated to " + selected.label);
+                }
+            });
+    });
+    
+    controlSystemMenu->addItem("Select Loco", nullptr, []() {
+        if (RosterCache::getInstance().getCount() > 0) {
+            showRosterPage(0);
+        } else {
+            showAddressInput();
+        }
+    });
+    
+    controlSystemMenu->addItem("Add Consist Member", nullptr, []() {
+        PageManager::showInput("Enter Member Address:", NUMERIC, [](String address, bool ok) {
+            if (!ok) {
+                return;
+            }
+            std::vector<ListItem> directions = {
+                {"Same direction", 0},
+                {"Reversed", 1}
+            };
+            PageManager::showListDialog("Member Direction", directions,
+                [address](bool accepted, ListItem selected) {
+                    if (!accepted) {
+                        return;
+                    }
+                    bool reversed = selected.value == 1;
+                    PageManager::showInput("Speed Scale (%):", NUMERIC, "100",
+                        [address, reversed](String scale, bool ok) {
+                            if (!ok) {
+                                return;
+                            }
+                            // The simulator adds it to the slot table and sends it on its next tick
+                            if (TrainSimulator::getInstance().addConsistMember(address.toInt(), reversed, scale.toInt())) {
+                                PageManager::showPopup("Loco " + address + " added to consist");
+                            } else {
+                                PageManager::showPopup("Could not add loco " + address);
+                            }
+                        });
+                });
+        });
+    });
+    
+    controlSystemMenu->addItem("Clear Consist", nullptr, []() {
+        TrainSimulator::getInstance().clearConsist();
+        PageManager::showPopup("Consist cleared");
+    });
+    
+    controlSystemMenu->addItem("Benchmark Commands", nullptr, []() {
+        PageManager::showPopup(CommandBenchmark::run());
+    });
     
     controlSystemMenu->addItem("Show Current Config", nullptr, []() {
         auto& factory = LocoCommandManagerFactory::getInstance();
         auto managerType = factory.getManagerType();
-        String systemType = (managerType == LocoCommandManagerFactory::ManagerType::JMRI) ? "JMRI" : "DCC-Ex";
+        String systemType = "DCC-Ex";
+        if (managerType == LocoCommandManagerFactory::ManagerType::JMRI) {
+            systemType = "JMRI";
+        } else if (managerType == LocoCommandManagerFactory::ManagerType::Z21) {
+            systemType = "Z21";
+        } else if (managerType == LocoCommandManagerFactory::ManagerType::LocoNet) {
+            systemType = "LocoNet";
+        }
         String url = factory.getConnectionUrl();
         if (url.isEmpty()) {
             url = "<Not Set>";
@@ -313,6 +387,9 @@ void UIManager::setupMenus() {
         
         String configInfo = "System Type: " + systemType + "\n" +
                            "Connection URL: " + url;
+        if (factory.getTransport() == LocoCommandManagerFactory::Transport::Serial) {
+            configInfo += "\nSerial: " + String(factory.getBaudRate()) + " baud";
+        }
                            
         PageManager::showPopup(configInfo.c_str());
     });
@@ -320,12 +397,138 @@ void UIManager::setupMenus() {
     // Setup main menu
     mainMenu->addItem("Configure WiFi", std::move(wifiSubMenu));
     mainMenu->addItem("Control System", std::move(controlSystemMenu));
+    mainMenu->addItem("Drive", nullptr, [this]() {
+        setupLocoDriverPage();
+    });
+    mainMenu->addItem("Link Latency", nullptr, []() {
+        PageManager::pushPage(std::make_unique<LatencyPage>());
+    });
+    mainMenu->addItem("System Status", nullptr, []() {
+        ConfigStore& store = ConfigStore::getInstance();
+        ConnectionManager& connection = ConnectionManager::getInstance();
+        LocoCommandManager* manager = LocoCommandManagerFactory::getInstance().getLocoCommandManager();
+        PageManager::showPopup(TaskMonitor::report() + BootSequence::report() +
+                               "Config writes: " + String(store.getCommitCount()) +
+                               " (" + String(store.getCoalescedCount()) + " coalesced)\n" +
+                               "WiFi join: " + String(connection.getLastJoinTime()) + " ms" +
+                               (connection.wasLastJoinFast() ? " (cached AP)" : "") + "\n" +
+                               "Round trip: " + String(manager->getLastRoundTrip()) + " ms, avg " +
+                               String(manager->getAverageRoundTrip(false)) + " saving / " +
+                               String(manager->getAverageRoundTrip(true)) + " fast" +
+                               (WiFiConfigManager::getInstance().isLowLatency() ? " [fast]" : " [saving]") + "\n" +
+                               "Retries: " + String(manager->getRetryCount()) +
+                               ", diverged: " + String(manager->getDivergenceCount()) +
+                               ", coalesced: " + String(manager->getCoalescedCount()));
+    });
     
 
     // Push the main menu to the PageManager
+    mainMenuPage = mainMenu.get();
     PageManager::pushPage(std::move(mainMenu));
 }
 
+void UIManager::showRosterPage(int first) {
+    // Rows that are not locos
+    constexpr int ENTER_ADDRESS = -1;
+    constexpr int PREVIOUS_PAGE = -2;
+    constexpr int NEXT_PAGE = -3;
+
+    // Only the shown page is read from the cache file
+    RosterCache& roster = RosterCache::getInstance();
+    RosterCache::Entry entries[ROSTER_PAGE_SIZE];
+    int count = roster.readPage(first, entries, ROSTER_PAGE_SIZE);
+
+    std::vector<ListItem> items;
+    if (first > 0) {
+        items.push_back({"< Previous", PREVIOUS_PAGE});
+    }
+    for (int i = 0; i < count; i++) {
+        items.push_back({String(entries[i].address) + " " + entries[i].name, entries[i].address});
+    }
+    if (first + count < roster.getCount()) {
+        items.push_back({"More >", NEXT_PAGE});
+    }
+    items.push_back({"Enter address...", ENTER_ADDRESS});
+
+    PageManager::showListDialog("Select Loco", items, first > 0 ? 1 : 0, [first](bool accepted, ListItem selected) {
+        if (!accepted) {
+            return;
+        }
+        switch (selected.value) {
+            case PREVIOUS_PAGE:
+                showRosterPage(max(first - ROSTER_PAGE_SIZE, 0));
+                break;
+            case NEXT_PAGE:
+                showRosterPage(first + ROSTER_PAGE_SIZE);
+                break;
+            case ENTER_ADDRESS:
+                showAddressInput();
+                break;
+            default: {
+                if (TrainSimulator::getInstance().selectLoco(selected.value)) {
+                    PageManager::showPopup("Loco " + selected.label + " selected");
+                } else {
+                    PageManager::showPopup("Invalid address");
+                }
+                break;
+            }
+        }
+    });
+}
+
+void UIManager::showAddressInput() {
+    PageManager::showInput("Enter DCC Address:", NUMERIC, [](String input, bool ok) {
+        if (ok) {
+            if (TrainSimulator::getInstance().selectLoco(input.toInt())) {
+                PageManager::showPopup("Loco " + input + " selected");
+            } else {
+                PageManager::showPopup("Invalid address");
+            }
+        }
+    });
+}
+
 void UIManager::setupLocoDriverPage() {
     PageManager::pushPage(std::make_unique<LocoDriverPage>());
-}
\ No newline at end of file
+}
+
+void UIManager::handleLinkEvent(ConnectionManager::LinkEvent event) {
+    // At boot, go straight to the driver page as soon as the command station answers
+    if (bootAutoDrive && event == ConnectionManager::LinkEvent::STATION_UP) {
+        bootAutoDrive = false;
+        if (!splashDone) {
+            PageManager::popPage(); // Splash still up, cut it short
+            splashDone = true;
+        }
+        setupLocoDriverPage();
+        return;
+    }
+
+    // Only a manual connect reports back with a popup; background reconnects
+    // show up in the link indicator of the driver page instead
+    if (!awaitingConnect) {
+        return;
+    }
+
+    if (event == ConnectionManager::LinkEvent::WIFI_UP) {
+        awaitingConnect = false;
+        PageManager::hideLoading();
+
+        // Get current connection information
+        WiFiConfigManager::ConnectionInfo info = WiFiConfigManager::getInstance().getConnectionInfo();
+
+        // Display in a popup or status screen
+        String statusMessage = "SSID: " + info.ssid + "\n" +
+                            "IP: " + info.ip + "\n" +
+                            "Subnet: " + info.subnet + "\n" +
+                            "Gateway: " + info.gateway + "\n" +
+                            "Signal: " + String(info.rssi) + " dBm\n" +
+                            "MAC: " + info.macAddress;
+
+        PageManager::showPopup(statusMessage.c_str());
+    } else if (event == ConnectionManager::LinkEvent::WIFI_FAILED) {
+        awaitingConnect = false;
+        PageManager::hideLoading();
+        PageManager::showPopup("Failed to connect\nRetrying in background");
+    }
+}
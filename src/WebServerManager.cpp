@@ -1,8 +1,13 @@
 #include "WebServerManager.h"
 #include <LittleFS.h>
+#include "ConfigStore.h"
+#include "LocoCommandManagerFactory.h"
+#include "EmergencyStop.h"
 
 WebServerManager::WebServerManager(WiFiConfigManager* wifiManager, LocoCommandManager* locoManager)
     : server(443), wifiManager(wifiManager), locoManager(locoManager) {
+    // Registered once: the server is stopped and started again with WiFi
+    setupRoutes();
 }
 
 WebServerManager::~WebServerManager() {
@@ -14,9 +19,6 @@ void WebServerManager::begin() {
         return;
     }
 
-    // Setup all API routes
-    setupRoutes();
-
     // Start server with SSL
     server.begin();
     running = true;
@@ -42,6 +44,21 @@ void WebServerManager::setupRoutes() {
         handleGetWiFiStatus(request);
     });
     
+    // Configuration export/import; JSON only exists at this boundary
+    server.on("/api/config", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        handleGetConfig(request);
+    });
+    server.on("/api/config", HTTP_POST, [this](AsyncWebServerRequest *request) {
+        handlePostConfig(request);
+    }, nullptr, [this](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+        handlePostConfigBody(request, data, len, index, total);
+    });
+    
+    // Command station round trip statistics
+    server.on("/api/latency", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        handleGetLatency(request);
+    });
+    
     // Not found handler
     server.onNotFound([](AsyncWebServerRequest *request) {
         request->send(404, "text/plain", "Not found");
@@ -63,6 +80,97 @@ void WebServerManager::handleGetWiFiStatus(AsyncWebServerRequest *request) {
     sendJsonResponse(request, doc);
 }
 
+void WebServerManager::handleGetConfig(AsyncWebServerRequest *request) {
+    // The WiFi password never leaves the device
+    JsonDocument doc;
+    ConfigStore::getInstance().exportJson(doc);
+    sendJsonResponse(request, doc);
+}
+
+void WebServerManager::handleGetLatency(AsyncWebServerRequest *request) {
+    // The factory may have replaced the backend since the server was created
+    LocoCommandManager* manager = LocoCommandManagerFactory::getInstance().getLocoCommandManager();
+    LatencyMonitor::Snapshot stats = manager->getLatencyMonitor().snapshot();
+    
+    JsonDocument doc;
+    doc["samples"] = stats.samples;
+    doc["timeouts"] = stats.timeouts;
+    doc["minMs"] = stats.minMs;
+    doc["averageMs"] = stats.averageMs;
+    doc["maxMs"] = stats.maxMs;
+    doc["retries"] = manager->getRetryCount();
+    doc["divergences"] = manager->getDivergenceCount();
+    
+    // Bucket i counts the samples below limitMs (the last one has no limit)
+    JsonArray buckets = doc["buckets"].to<JsonArray>();
+    for (int i = 0; i < LatencyMonitor::BUCKET_COUNT; i++) {
+        JsonObject bucket = buckets.add<JsonObject>();
+        if (i < LatencyMonitor::BUCKET_COUNT - 1) {
+            bucket["limitMs"] = LatencyMonitor::BUCKET_LIMITS_MS[i];
+        }
+        bucket["count"] = stats.buckets[i];
+    }
+    
+    JsonArray history = doc["historyMs"].to<JsonArray>();
+    for (int i = 0; i < stats.historyCount; i++) {
+        history.add(stats.history[i]);
+    }
+    
+    // Key sample to socket write of the emergency stops
+    EmergencyStop::Stats stops = EmergencyStop::getInstance().getStats();
+    JsonObject stop = doc["emergencyStop"].to<JsonObject>();
+    stop["count"] = stops.count;
+    stop["lastMicros"] = stops.lastMicros;
+    stop["worstMicros"] = stops.worstMicros;
+    stop["overBudget"] = stops.overBudget;
+    stop["budgetMicros"] = EmergencyStop::LATENCY_BUDGET_US;
+    
+    sendJsonResponse(request, doc);
+}
+
+void WebServerManager::handlePostConfigBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    if (total > MAX_CONFIG_BODY) {
+        return; // Refused once the whole request is in
+    }
+
+    // The body may arrive in several chunks; it is kept with its request
+    // (freed along with it), so two uploads at once cannot mix
+    if (index == 0) {
+        request->_tempObject = calloc(total + 1, 1);
+    }
+    if (request->_tempObject != nullptr) {
+        memcpy((uint8_t*)request->_tempObject + index, data, len);
+    }
+}
+
+void WebServerManager::handlePostConfig(AsyncWebServerRequest *request) {
+    if (request->contentLength() > MAX_CONFIG_BODY) {
+        sendErrorResponse(request, 413, "Configuration too large");
+        return;
+    }
+
+    // No body handler call at all for an empty body
+    const char* body = (const char*)request->_tempObject;
+    if (body == nullptr || body[0] == '\0') {
+        sendErrorResponse(request, 400, "Empty body");
+        return;
+    }
+
+    JsonDocument doc;
+    DeserializationError error = deserializeJson(doc, body);
+    if (error) {
+        sendErrorResponse(request, 400, "Invalid JSON");
+        return;
+    }
+
+    JsonDocument result;
+    result["success"] = true;
+    result["applied"] = ConfigStore::getInstance().importJson(doc.as<JsonVariantConst>());
+
+    // The factory keeps its own copy of the command station settings
+    result["reconnecting"] = LocoCommandManagerFactory::getInstance().reloadConfiguration();
+    sendJsonResponse(request, result);
+}
 
 void WebServerManager::sendJsonResponse(AsyncWebServerRequest *request, JsonDocument& doc) {
     String response;
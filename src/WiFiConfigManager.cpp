@@ -1,158 +1,358 @@
 #include "WiFiConfigManager.h"
+#include "Config.h"
 #include <FreeRTOS.h>
 #include <task.h>
 #include <WiFi.h> // Include WiFi library for network operations
-#include <LittleFS.h>
-#include <ArduinoJson.h>
+#include <lwip/dhcp.h>
+#include <lwip/netif.h>
+#include "ConfigStore.h"
+#include <algorithm>
 
-WiFiConfigManager::WiFiConfigManager(const String& configFilePath)
-    : configFilePath(configFilePath) {}
+// Static addressing; fromString() returns a success flag, not the address
+static void configureAddresses(const String& ip, const String& dns, const String& router, const String& mask) {
+    IPAddress address, dnsServer, gateway, subnet;
+    address.fromString(ip);
+    dnsServer.fromString(dns);
+    gateway.fromString(router);
+    subnet.fromString(mask);
+    WiFi.config(address, dnsServer, gateway, subnet);
+}
+
+WiFiConfigManager::WiFiConfigManager() {
+    scanMutex = xSemaphoreCreateMutex();
+    rebuildScanIndex();
+}
 
 WiFiConfigManager::~WiFiConfigManager() {
     stopSSIDScan();
 }
 
-void WiFiConfigManager::startSSIDScan(const std::function<void(const String&)>& onSSIDFound) {
-    if (scanning) {
-        return; // Scan already running
-    }
-
+void WiFiConfigManager::startSSIDScan() {
+    xSemaphoreTake(scanMutex, portMAX_DELAY);
     scanning = true;
 
-    // Create a FreeRTOS task for scanning SSIDs
-    xTaskCreate(
-        scanTask,                // Task function
-        "SSIDScanTask",          // Task name
-        4096,                    // Stack size
-        new std::pair<WiFiConfigManager*, std::function<void(const String&)>>(this, onSSIDFound), // Pass the instance and callback as a parameter
-        1,                       // Task priority
-        &scanTaskHandle          // Task handle
-    );
+    // A task still finishing its last pass simply carries on
+    if (scanTaskHandle == nullptr) {
+        // Create a FreeRTOS task for scanning SSIDs
+        // Network work stays off the UI core
+        xTaskCreateAffinitySet(
+            scanTask,                // Task function
+            "SSIDScanTask",          // Task name
+            4096,                    // Stack size
+            this,                    // Task parameter
+            1,                       // Task priority
+            1 << CONTROL_CORE,       // Core affinity
+            &scanTaskHandle          // Task handle
+        );
+    }
+    xSemaphoreGive(scanMutex);
 }
 
 void WiFiConfigManager::stopSSIDScan() {
-    if (scanning && scanTaskHandle != nullptr) {
-        scanning = false;
-        vTaskDelete(scanTaskHandle); // Delete the FreeRTOS task
-        scanTaskHandle = nullptr;
-    }
+    // The task notices at the end of its current pass and exits by itself,
+    // so it is never killed in the middle of a scan or while holding the cache
+    scanning = false;
 }
 
-void WiFiConfigManager::scanTask(void* parameter) {
-    // Retrieve the callback function passed as a parameter
-    auto param = static_cast<std::pair<WiFiConfigManager*, std::function<void(const String&)>>*>(parameter);
-    WiFiConfigManager* instance = param->first;
-    auto onSSIDFound = &param->second;
+std::vector<WiFiConfigManager::ScanResult> WiFiConfigManager::getScanResults() {
+    std::vector<ScanResult> results;
+    results.reserve(MAX_SCAN_RESULTS);
 
-    // Perform the WiFi scan
-    while (WiFi.scanNetworks() == -1) {
-        vTaskDelay(pdMS_TO_TICKS(1000)); // Wait for WiFi hardware to initialize
+    xSemaphoreTake(scanMutex, portMAX_DELAY);
+    for (int i = 0; i < scanEntryCount; i++) {
+        results.push_back(scanEntries[i].result);
     }
+    xSemaphoreGive(scanMutex);
+
+    std::sort(results.begin(), results.end(), [](const ScanResult& a, const ScanResult& b) {
+        return a.rssi > b.rssi;
+    });
+    return results;
+}
+
+void WiFiConfigManager::scanTask(void* parameter) {
+    WiFiConfigManager* instance = static_cast<WiFiConfigManager*>(parameter);
 
     while (true) {
-        // Check if scanning was canceled
+        xSemaphoreTake(instance->scanMutex, portMAX_DELAY);
         if (!instance->scanning) {
-            delete param; // Clean up the parameter
+            // Decided under the mutex so startSSIDScan() either sees the handle or creates a new task
+            instance->scanTaskHandle = nullptr;
+            xSemaphoreGive(instance->scanMutex);
             vTaskDelete(nullptr); // End the task
             return;
         }
-        
-        // Get the number of networks found
+        xSemaphoreGive(instance->scanMutex);
+
+        // Blocking scan, fine on the control core
         int numNetworks = WiFi.scanNetworks();
-        
-        // Iterate through all found networks
-        for (int i = 0; i < numNetworks; i++) {
-            // Check again in case scanning was stopped during iteration
-            if (!instance->scanning) {
-                WiFi.scanDelete(); // Clean up scan results
-                delete param;      // Clean up the parameter
-                vTaskDelete(nullptr); // End the task
-                return;
-            }
-            
-            // Call the callback with each SSID found
-            (*onSSIDFound)(WiFi.SSID(i));
+        if (numNetworks >= 0) {
+            instance->mergeScanResults(numNetworks, millis());
         }
-        
+
         // Delete the scan results to free memory
         WiFi.scanDelete();
-        
-        // Wait before rescanning
-        vTaskDelay(pdMS_TO_TICKS(5000));
+
+        // Wait before rescanning, checking regularly whether the scan was stopped
+        for (uint32_t waited = 0; waited < SCAN_INTERVAL_MS && instance->scanning; waited += 100) {
+            vTaskDelay(pdMS_TO_TICKS(100));
+        }
     }
 }
 
-void WiFiConfigManager::saveNetworkProperties(const NetworkProperties& properties) {
-    File file = LittleFS.open(configFilePath, "w");
-    if (!file) {
-        return; // Failed to open file
-    }
+void WiFiConfigManager::mergeScanResults(int count, uint32_t now) {
+    xSemaphoreTake(scanMutex, portMAX_DELAY);
+
+    for (int i = 0; i < count; i++) {
+        String ssid = WiFi.SSID(i);
+        if (ssid.isEmpty()) {
+            continue; // Hidden network
+        }
 
-    // Create a JSON document with appropriate capacity
-    JsonDocument doc;
+        ScanResult result;
+        result.ssid = ssid;
+        WiFi.BSSID(i, result.bssid);
+        result.rssi = WiFi.RSSI(i);
+        result.channel = WiFi.channel(i);
+        result.lastSeen = now;
 
-    // Populate the JSON document
-    doc["ssid"] = properties.ssid;
-    doc["password"] = properties.password;
-    doc["ip"] = properties.ip;
-    doc["mask"] = properties.mask;
-    doc["router"] = properties.router;
-    doc["dns"] = properties.dns;
-    doc["dhcp"] = properties.dhcp;
+        uint32_t hash = hashSSID(ssid);
+        int position = findScanEntry(hash, ssid);
+        if (position >= 0) {
+            // Keep the strongest access point of this scan for the SSID
+            ScanResult& cached = scanEntries[position].result;
+            if (cached.lastSeen != now || result.rssi > cached.rssi) {
+                cached = result;
+            }
+        } else if (scanEntryCount < MAX_SCAN_RESULTS) {
+            scanEntries[scanEntryCount].result = result;
+            scanEntries[scanEntryCount].hash = hash;
+            scanEntryCount++;
+            rebuildScanIndex();
+        } else {
+            // Full: the new network replaces the weakest one if it is stronger
+            int weakest = 0;
+            for (int j = 1; j < scanEntryCount; j++) {
+                if (scanEntries[j].result.rssi < scanEntries[weakest].result.rssi) {
+                    weakest = j;
+                }
+            }
+            if (result.rssi > scanEntries[weakest].result.rssi) {
+                scanEntries[weakest].result = result;
+                scanEntries[weakest].hash = hash;
+                rebuildScanIndex();
+            }
+        }
+    }
 
-    // Serialize the JSON document to the file
-    if (serializeJson(doc, file) == 0) {
-        // Handle serialization error (optional)
+    // Forget networks that have not been seen for a while
+    int kept = 0;
+    for (int i = 0; i < scanEntryCount; i++) {
+        if (now - scanEntries[i].result.lastSeen <= SCAN_STALE_MS) {
+            if (kept != i) {
+                scanEntries[kept] = scanEntries[i];
+            }
+            kept++;
+        }
+    }
+    if (kept != scanEntryCount) {
+        scanEntryCount = kept;
+        rebuildScanIndex();
     }
 
-    file.close();
+    // Only the scan task writes it, no read-modify-write needed
+    scanGeneration.store(scanGeneration.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    xSemaphoreGive(scanMutex);
 }
 
-WiFiConfigManager::NetworkProperties WiFiConfigManager::loadNetworkProperties() {
-    NetworkProperties properties;
-
-    File file = LittleFS.open(configFilePath, "r");
-    if (!file) {
-        return properties; // Failed to open file
+uint32_t WiFiConfigManager::hashSSID(const String& ssid) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (unsigned int i = 0; i < ssid.length(); i++) {
+        hash ^= (uint8_t)ssid[i];
+        hash *= 16777619u;
     }
+    return hash;
+}
 
-    // Create a JSON document
-    JsonDocument doc;
+int WiFiConfigManager::findScanEntry(uint32_t hash, const String& ssid) const {
+    for (int probe = 0; probe < SCAN_BUCKETS; probe++) {
+        int position = scanIndex[(hash + probe) & (SCAN_BUCKETS - 1)];
+        if (position < 0) {
+            return -1;
+        }
+        if (scanEntries[position].hash == hash && scanEntries[position].result.ssid == ssid) {
+            return position;
+        }
+    }
+    return -1;
+}
 
-    // Parse the JSON file
-    DeserializationError error = deserializeJson(doc, file);
-    file.close();
+void WiFiConfigManager::rebuildScanIndex() {
+    memset(scanIndex, -1, sizeof(scanIndex));
+    for (int i = 0; i < scanEntryCount; i++) {
+        uint32_t bucket = scanEntries[i].hash & (SCAN_BUCKETS - 1);
+        while (scanIndex[bucket] >= 0) {
+            bucket = (bucket + 1) & (SCAN_BUCKETS - 1);
+        }
+        scanIndex[bucket] = i;
+    }
+}
 
-    if (error) {
-        // Return default properties if parsing fails
-        return properties;
+void WiFiConfigManager::saveNetworkProperties(const NetworkProperties& properties) {
+    // The store only writes the flash for fields that actually changed
+    ConfigStore& store = ConfigStore::getInstance();
+    if (store.getString(ConfigStore::Key::WIFI_SSID) != properties.ssid) {
+        forgetLink(); // Cached for the old network
     }
+    store.setString(ConfigStore::Key::WIFI_SSID, properties.ssid);
+    store.setString(ConfigStore::Key::WIFI_PASSWORD, properties.password);
+    store.setString(ConfigStore::Key::WIFI_IP, properties.ip);
+    store.setString(ConfigStore::Key::WIFI_MASK, properties.mask);
+    store.setString(ConfigStore::Key::WIFI_ROUTER, properties.router);
+    store.setString(ConfigStore::Key::WIFI_DNS, properties.dns);
+    store.setBool(ConfigStore::Key::WIFI_DHCP, properties.dhcp);
+}
+
+WiFiConfigManager::NetworkProperties WiFiConfigManager::loadNetworkProperties() {
+    NetworkProperties properties;
 
-    // Extract values from the JSON document
-    properties.ssid = doc["ssid"] | ""; // Default to empty string if not found
-    properties.password = doc["password"] | "";
-    properties.ip = doc["ip"] | "";
-    properties.mask = doc["mask"] | "";
-    properties.router = doc["router"] | "";
-    properties.dns = doc["dns"] | "";
-    properties.dhcp = doc["dhcp"] | true; // Default to true if not found
+    // Served from RAM by the store, defaults for missing fields
+    ConfigStore& store = ConfigStore::getInstance();
+    properties.ssid = store.getString(ConfigStore::Key::WIFI_SSID);
+    properties.password = store.getString(ConfigStore::Key::WIFI_PASSWORD);
+    properties.ip = store.getString(ConfigStore::Key::WIFI_IP);
+    properties.mask = store.getString(ConfigStore::Key::WIFI_MASK);
+    properties.router = store.getString(ConfigStore::Key::WIFI_ROUTER);
+    properties.dns = store.getString(ConfigStore::Key::WIFI_DNS);
+    properties.dhcp = store.getBool(ConfigStore::Key::WIFI_DHCP, true); // Default to DHCP
 
     return properties;
 }
 
-void WiFiConfigManager::startNetwork() {
+bool WiFiConfigManager::startNetwork(bool fastPath) {
     NetworkProperties properties = loadNetworkProperties();
+    if (fastPath && joinCachedLink(properties)) {
+        return true;
+    }
+
     if (properties.dhcp) {
-        WiFi.begin(properties.ssid.c_str(), properties.password.c_str());
+        // Back to DHCP in case a fast join left the cached lease configured
+        WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
+        WiFi.beginNoBlock(properties.ssid.c_str(), properties.password.c_str());
     } else {
-        WiFi.config(
-            IPAddress().fromString(properties.ip),
-            IPAddress().fromString(properties.dns),
-            IPAddress().fromString(properties.router),
-            IPAddress().fromString(properties.mask) 
-        );
-        WiFi.begin(properties.ssid.c_str(), properties.password.c_str());
+        configureAddresses(properties.ip, properties.dns, properties.router, properties.mask);
+        WiFi.beginNoBlock(properties.ssid.c_str(), properties.password.c_str());
+    }
+    return false;
+}
+
+bool WiFiConfigManager::joinCachedLink(const NetworkProperties& properties) {
+    ConfigStore& store = ConfigStore::getInstance();
+    uint8_t bssid[6];
+    if (!parseBSSID(store.getString(ConfigStore::Key::WIFI_LINK_BSSID), bssid)) {
+        return false;
+    }
+
+    // An access point the scan now reports on another channel has been reconfigured
+    int32_t channel = store.getInt(ConfigStore::Key::WIFI_LINK_CHANNEL);
+    xSemaphoreTake(scanMutex, portMAX_DELAY);
+    int position = findScanEntry(hashSSID(properties.ssid), properties.ssid);
+    bool moved = position >= 0 && memcmp(scanEntries[position].result.bssid, bssid, 6) == 0 &&
+                 scanEntries[position].result.channel != channel;
+    xSemaphoreGive(scanMutex);
+    if (moved) {
+        forgetLink();
+        return false;
+    }
+
+    // Reusing the lease skips waiting for DHCP; a static setup has its own addresses
+    String leaseIp = store.getString(ConfigStore::Key::WIFI_LEASE_IP);
+    bool reuseLease = properties.dhcp && !leaseIp.isEmpty();
+    if (reuseLease) {
+        configureAddresses(leaseIp,
+                           store.getString(ConfigStore::Key::WIFI_LEASE_DNS),
+                           store.getString(ConfigStore::Key::WIFI_LEASE_ROUTER),
+                           store.getString(ConfigStore::Key::WIFI_LEASE_MASK));
+    } else if (!properties.dhcp) {
+        configureAddresses(properties.ip, properties.dns, properties.router, properties.mask);
+    }
+
+    // The core only takes the BSSID; the channel is kept to spot a moved access point
+    WiFi.setTimeout(FAST_JOIN_TIMEOUT_MS);
+    WiFi.beginBSSID(properties.ssid.c_str(), properties.password.c_str(), bssid);
+    WiFi.setTimeout(JOIN_TIMEOUT_MS);
+    if (isConnected()) {
+        if (reuseLease) {
+            // The cached lease may have expired meanwhile: the address is only
+            // used until DHCP, started right away, confirms it or moves off it
+            dhcp_start(netif_default);
+        }
+        return true;
+    }
+
+    // Gone or refused: forget it so the full join is not delayed again next time
+    WiFi.disconnect();
+    forgetLink();
+    return false;
+}
+
+bool WiFiConfigManager::rememberLink() {
+    if (!isConnected()) {
+        return false;
+    }
+
+    // Setters ignore unchanged values, so reconnecting to the same access point writes nothing
+    ConfigStore& store = ConfigStore::getInstance();
+    store.setString(ConfigStore::Key::WIFI_LINK_BSSID, formatBSSID(WiFi.BSSID()));
+    store.setInt(ConfigStore::Key::WIFI_LINK_CHANNEL, WiFi.channel());
+    if (!store.getBool(ConfigStore::Key::WIFI_DHCP, true)) {
+        return true;
+    }
+
+    // Only an address granted by the DHCP server is a lease; right after a
+    // fast join the address is still the cached one, set statically
+    if (!dhcp_supplied_address(netif_default)) {
+        return false;
+    }
+    store.setString(ConfigStore::Key::WIFI_LEASE_IP, WiFi.localIP().toString());
+    store.setString(ConfigStore::Key::WIFI_LEASE_MASK, WiFi.subnetMask().toString());
+    store.setString(ConfigStore::Key::WIFI_LEASE_ROUTER, WiFi.gatewayIP().toString());
+    store.setString(ConfigStore::Key::WIFI_LEASE_DNS, WiFi.dnsIP().toString());
+    return true;
+}
+
+void WiFiConfigManager::forgetLink() {
+    ConfigStore& store = ConfigStore::getInstance();
+    store.setString(ConfigStore::Key::WIFI_LINK_BSSID, "");
+    store.setInt(ConfigStore::Key::WIFI_LINK_CHANNEL, 0);
+    store.setString(ConfigStore::Key::WIFI_LEASE_IP, "");
+    store.setString(ConfigStore::Key::WIFI_LEASE_MASK, "");
+    store.setString(ConfigStore::Key::WIFI_LEASE_ROUTER, "");
+    store.setString(ConfigStore::Key::WIFI_LEASE_DNS, "");
+}
+
+String WiFiConfigManager::formatBSSID(const uint8_t* bssid) {
+    if (bssid == nullptr) {
+        return "";
     }
+    char text[18];
+    snprintf(text, sizeof(text), "%02x:%02x:%02x:%02x:%02x:%02x",
+             bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5]);
+    return String(text);
+}
+
+bool WiFiConfigManager::parseBSSID(const String& text, uint8_t* bssid) {
+    unsigned int bytes[6];
+    if (text.length() != 17 ||
+        sscanf(text.c_str(), "%2x:%2x:%2x:%2x:%2x:%2x",
+               &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5]) != 6) {
+        return false;
+    }
+    for (int i = 0; i < 6; i++) {
+        bssid[i] = (uint8_t)bytes[i];
+    }
+    return true;
 }
 
 void WiFiConfigManager::stopNetwork() {
@@ -163,6 +363,21 @@ bool WiFiConfigManager::isConnected() {
     return WiFi.status() == WL_CONNECTED;
 }
 
+void WiFiConfigManager::updatePowerMode(bool force) {
+    bool wanted = driving.load(std::memory_order_relaxed) ||
+                  millis() - lastTrafficMs.load(std::memory_order_relaxed) < POWER_SAVE_IDLE_MS;
+    if (wanted == isLowLatency() && !force) {
+        return;
+    }
+
+    if (wanted) {
+        WiFi.noLowPowerMode();
+    } else {
+        WiFi.lowPowerMode();
+    }
+    lowLatency.store(wanted, std::memory_order_relaxed);
+}
+
 WiFiConfigManager::ConnectionInfo WiFiConfigManager::getConnectionInfo() {
     ConnectionInfo info;
     
@@ -0,0 +1,34 @@
+#include "WiFiScanPage.h"
+
+WiFiScanPage::WiFiScanPage(std::function<void(bool, ListItem)> callback)
+    : DialogListPage("Select WiFi Network", cachedNetworks(), callback) {
+    WiFiConfigManager& wifi = WiFiConfigManager::getInstance();
+    shownGeneration = wifi.getScanGeneration();
+    wifi.startSSIDScan();
+}
+
+WiFiScanPage::~WiFiScanPage() {
+    WiFiConfigManager::getInstance().stopSSIDScan();
+}
+
+void WiFiScanPage::handleInput(IKeyboard* keyboard) {
+    // Pick up the results of a finished scan before handling the keys
+    uint32_t generation = WiFiConfigManager::getInstance().getScanGeneration();
+    if (generation != shownGeneration) {
+        shownGeneration = generation;
+        setItems(cachedNetworks());
+    }
+
+    DialogListPage::handleInput(keyboard);
+}
+
+std::vector<ListItem> WiFiScanPage::cachedNetworks() {
+    std::vector<WiFiConfigManager::ScanResult> results = WiFiConfigManager::getInstance().getScanResults();
+
+    std::vector<ListItem> items;
+    items.reserve(results.size());
+    for (const WiFiConfigManager::ScanResult& result : results) {
+        items.push_back({result.ssid, (int)result.rssi});
+    }
+    return items;
+}
@@ -0,0 +1,408 @@
+#include "Z21CommandManager.h"
+#include "Config.h"
+#include "TaskMonitor.h"
+
+Z21CommandManager::Z21CommandManager() : udp(&ownUdp) {
+    clientMutex = xSemaphoreCreateMutex();
+}
+
+Z21CommandManager::Z21CommandManager(UDP& transport) : udp(&transport) {
+    clientMutex = xSemaphoreCreateMutex();
+}
+
+Z21CommandManager::~Z21CommandManager() {
+    disconnect();
+    if (clientMutex) {
+        vSemaphoreDelete(clientMutex);
+    }
+}
+
+void Z21CommandManager::connect(const String& connectionUrl) {
+    disconnect();
+
+    // Accept "host", "host:port" and an optional "scheme://" prefix
+    String address = connectionUrl;
+    int schemeEnd = address.indexOf("://");
+    if (schemeEnd >= 0) {
+        address = address.substring(schemeEnd + 3);
+    }
+
+    String host = address;
+    uint16_t port = DEFAULT_PORT;
+    int colon = address.lastIndexOf(':');
+    if (colon >= 0) {
+        host = address.substring(0, colon);
+        port = address.substring(colon + 1).toInt();
+    }
+
+    // Resolved once: every datagram goes to the same address
+    IPAddress ip;
+    if (host.isEmpty() || (!ip.fromString(host) && !WiFi.hostByName(host.c_str(), ip))) {
+        return;
+    }
+
+    // The socket is only used under the mutex, given back between handshake
+    // polls; other writers wait for the session to be marked connected
+    uint8_t packet[MAX_DATAGRAM];
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    stationIp = ip;
+    stationPort = port;
+    bool opened = udp->begin(DEFAULT_PORT);
+    if (opened) {
+        // Handshake: the serial number answer proves the station is listening
+        writeDatagram(packet, appendDataset(packet, 0, LAN_GET_SERIAL_NUMBER, nullptr, 0));
+    }
+    xSemaphoreGive(clientMutex);
+    if (!opened) {
+        return;
+    }
+
+    unsigned long start = millis();
+    bool answered = false;
+    while (!answered && millis() - start < CONNECT_TIMEOUT_MS) {
+        xSemaphoreTake(clientMutex, portMAX_DELAY);
+        int size = udp->parsePacket();
+        if (size > 0) {
+            int count = udp->read(packet, min(size, (int)sizeof(packet)));
+            answered = count >= 4 && packet[2] == LAN_GET_SERIAL_NUMBER && packet[3] == 0;
+        }
+        xSemaphoreGive(clientMutex);
+        if (size <= 0) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    }
+
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    if (!answered) {
+        udp->stop();
+        xSemaphoreGive(clientMutex);
+        return;
+    }
+    connected = true;
+    confirmedFlags = 0;
+    lastReceive = millis();
+    lastEcho = lastReceive;
+    echoAnswered = true;
+
+    // Subscribe to the loco broadcasts and read the flags back, in one datagram
+    writeDatagram(packet, appendSubscription(packet, 0));
+    xSemaphoreGive(clientMutex);
+
+    {
+        // Ask for the locos of the slot table (consists included), which subscribes
+        // to their LAN_X_LOCO_INFO, then send their desired state in one datagram
+        StateLock lock(stateMutex);
+        beginBatch();
+        for (const LocoSlot& slot : slots) {
+            if (slot.address != 0) {
+                acquireLoco(slot.address);
+            }
+            for (int i = 0; i < slot.consistSize; i++) {
+                acquireLoco(slot.consist[i].address);
+            }
+        }
+        endBatch();
+        replayState();
+    }
+
+    // Create the session task handling incoming datagrams and keepalives
+    startSession(sessionTask, "Z21Session");
+}
+
+void Z21CommandManager::disconnect() {
+    stopSession();
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    if (connected) {
+        // Lets the station drop our subscriptions right away
+        uint8_t packet[4];
+        writeDatagram(packet, appendDataset(packet, 0, LAN_LOGOFF, nullptr, 0));
+        connected = false;
+    }
+    udp->stop();
+    xSemaphoreGive(clientMutex);
+}
+
+bool Z21CommandManager::isConnected() {
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    bool up = connected;
+    xSemaphoreGive(clientMutex);
+    return up;
+}
+
+void Z21CommandManager::sendCommand(const String& command) {
+    uint8_t packet[MAX_DATAGRAM];
+    size_t length = 0;
+    const char* text = command.c_str();
+    while (*text && length < sizeof(packet)) {
+        if (!isxdigit(*text)) {
+            text++;
+            continue;
+        }
+        char* end;
+        packet[length++] = strtoul(text, &end, 16);
+        text = end;
+    }
+    if (length > 0) {
+        sendDatagram(packet, length);
+    }
+}
+
+size_t Z21CommandManager::appendDataset(uint8_t* buffer, size_t length, uint16_t header, const uint8_t* data, size_t dataLength) {
+    size_t datasetLength = dataLength + 4;
+    buffer[length++] = datasetLength & 0xFF;
+    buffer[length++] = datasetLength >> 8;
+    buffer[length++] = header & 0xFF;
+    buffer[length++] = header >> 8;
+    if (dataLength > 0) {
+        memcpy(buffer + length, data, dataLength);
+    }
+    return length + dataLength;
+}
+
+size_t Z21CommandManager::appendSubscription(uint8_t* buffer, size_t length) {
+    uint8_t flags[4] = {BROADCAST_FLAGS & 0xFF, (BROADCAST_FLAGS >> 8) & 0xFF,
+                        (BROADCAST_FLAGS >> 16) & 0xFF, (BROADCAST_FLAGS >> 24) & 0xFF};
+    length = appendDataset(buffer, length, LAN_SET_BROADCASTFLAGS, flags, sizeof(flags));
+    return appendDataset(buffer, length, LAN_GET_BROADCASTFLAGS, nullptr, 0);
+}
+
+void Z21CommandManager::beginBatch() {
+    batchLength = 0;
+    batching = true;
+}
+
+void Z21CommandManager::endBatch() {
+    batching = false;
+    if (batchLength == 0) {
+        return;
+    }
+
+    // One datagram for the whole batch
+    sendDatagram(batchBuffer, batchLength);
+    batchLength = 0;
+}
+
+void Z21CommandManager::queueDataset(uint16_t header, const uint8_t* data, size_t length) {
+    if (!batching) {
+        uint8_t packet[32];
+        sendDatagram(packet, appendDataset(packet, 0, header, data, length));
+        return;
+    }
+    if (batchLength + length + 4 > sizeof(batchBuffer)) {
+        // Datagram full: send it and start the next one
+        sendDatagram(batchBuffer, batchLength);
+        batchLength = 0;
+    }
+    batchLength = appendDataset(batchBuffer, batchLength, header, data, length);
+}
+
+void Z21CommandManager::queueXBus(const uint8_t* frame, size_t length) {
+    uint8_t data[16];
+    uint8_t checksum = 0;
+    for (size_t i = 0; i < length; i++) {
+        data[i] = frame[i];
+        checksum ^= frame[i];
+    }
+    data[length] = checksum;
+    queueDataset(LAN_X, data, length + 1);
+}
+
+void Z21CommandManager::sendDatagram(const uint8_t* data, size_t length) {
+    xSemaphoreTake(clientMutex, portMAX_DELAY);
+    if (connected) {
+        writeDatagram(data, length);
+    }
+    xSemaphoreGive(clientMutex);
+}
+
+void Z21CommandManager::writeDatagram(const uint8_t* data, size_t length) {
+    udp->beginPacket(stationIp, stationPort);
+    udp->write(data, length);
+    udp->endPacket();
+}
+
+void Z21CommandManager::acquireLoco(int address) {
+    // LAN_X_GET_LOCO_INFO subscribes this client to the broadcasts of the loco
+    uint8_t frame[] = {X_GET_LOCO_INFO, 0xF0, addressMsb(address), addressLsb(address)};
+    queueXBus(frame, sizeof(frame));
+}
+
+void Z21CommandManager::releaseLoco(int address) {
+    // The station keeps the last 16 subscriptions and drops the oldest itself
+}
+
+void Z21CommandManager::sessionTask(void* param) {
+    Z21CommandManager* self = static_cast<Z21CommandManager*>(param);
+    uint8_t packet[MAX_DATAGRAM];
+    StateReport reports[MAX_REPORTS_PER_PASS];
+    int probe = TaskMonitor::registerTask("Z21Session", CONTROL_CORE, SESSION_PERIOD_MS);
+
+    while (self->sessionRunning()) {
+        xSemaphoreTake(self->clientMutex, portMAX_DELAY);
+        TaskMonitor::beginRun(probe);
+        int reportCount = 0;
+
+        // Drain every datagram that arrived since the last pass
+        int size = self->udp->parsePacket();
+        while (size > 0) {
+            int count = self->udp->read(packet, min(size, (int)sizeof(packet)));
+            if (count > 0) {
+                self->lastReceive = millis();
+                self->handleDatagram(packet, count, reports, reportCount);
+            }
+            size = self->udp->parsePacket();
+        }
+
+        unsigned long now = millis();
+        if (self->connected && now - self->lastReceive > KEEPALIVE_TIMEOUT_MS) {
+            // Station gone: ConnectionManager reconnects, which subscribes again
+            self->connected = false;
+        } else if (self->connected && now - self->lastEcho >= ECHO_INTERVAL_MS) {
+            if (!self->echoAnswered) {
+                self->recordRoundTripTimeout();
+            }
+            self->lastEcho = now;
+            self->echoAnswered = false;
+
+            // The probe also carries the subscription again while the station has not confirmed it
+            size_t length = appendDataset(packet, 0, LAN_SYSTEMSTATE_GETDATA, nullptr, 0);
+            if (self->confirmedFlags != BROADCAST_FLAGS) {
+                length = appendSubscription(packet, length);
+            }
+            self->writeDatagram(packet, length);
+        }
+
+        xSemaphoreGive(self->clientMutex);
+
+        // The slot table is locked before the client everywhere else, so reports
+        // are only applied once the client mutex is released
+        for (int i = 0; i < reportCount; i++) {
+            self->applyReport(reports[i]);
+        }
+
+        TaskMonitor::endRun(probe);
+        vTaskDelay(pdMS_TO_TICKS(SESSION_PERIOD_MS));
+    }
+    self->endSession();
+}
+
+void Z21CommandManager::handleDatagram(const uint8_t* data, size_t length, StateReport* reports, int& reportCount) {
+    size_t offset = 0;
+    while (offset + 4 <= length) {
+        size_t datasetLength = data[offset] | (data[offset + 1] << 8);
+        if (datasetLength < 4 || offset + datasetLength > length) {
+            return; // Truncated or malformed: drop the rest of the datagram
+        }
+        uint16_t header = data[offset + 2] | (data[offset + 3] << 8);
+        const uint8_t* payload = data + offset + 4;
+        size_t payloadLength = datasetLength - 4;
+        offset += datasetLength;
+
+        switch (header) {
+            case LAN_SYSTEMSTATE_DATACHANGED:
+                // Answer to the keepalive probe
+                if (!echoAnswered) {
+                    echoAnswered = true;
+                    recordRoundTrip(millis() - lastEcho);
+                }
+                break;
+            case LAN_GET_BROADCASTFLAGS:
+                if (payloadLength >= 4) {
+                    confirmedFlags = payload[0] | (payload[1] << 8) | (payload[2] << 16) | ((uint32_t)payload[3] << 24);
+                }
+                break;
+            case LAN_X:
+                // Loco state; extra reports wait for the next retransmit
+                if (reportCount < MAX_REPORTS_PER_PASS && parseLocoInfo(payload, payloadLength, reports[reportCount])) {
+                    reportCount++;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void Z21CommandManager::sendSpeedCommand(int address, int speed, bool forward) {
+    // LAN_X_SET_LOCO_DRIVE in 128 step mode: RVVVVVVV, 0 stop, 1 emergency stop, 2-127 the steps 1-126
+    uint8_t steps = speed <= 0 ? 0 : min(speed, (int)MAX_SPEED_STEP) + 1;
+    uint8_t frame[] = {X_SET_LOCO, 0x13, addressMsb(address), addressLsb(address),
+                       (uint8_t)((forward ? 0x80 : 0) | steps)};
+    queueXBus(frame, sizeof(frame));
+}
+
+void Z21CommandManager::sendBrakeCommand(int address, int brake) {
+    // DCC has no brake; braking is applied by the throttle through the speed
+}
+
+void Z21CommandManager::sendFrontLightsCommand(int address, LightStatus status) {
+    sendFunctionCommand(address, FRONT_LIGHTS_FUNCTION, status != LightStatus::OFF);
+}
+
+void Z21CommandManager::sendBackLightsCommand(int address, LightStatus status) {
+    sendFunctionCommand(address, BACK_LIGHTS_FUNCTION, status != LightStatus::OFF);
+}
+
+void Z21CommandManager::sendBellCommand(int address, bool active) {
+    sendFunctionCommand(address, BELL_FUNCTION, active);
+}
+
+void Z21CommandManager::sendHornCommand(int address, bool active) {
+    sendFunctionCommand(address, HORN_FUNCTION, active);
+}
+
+void Z21CommandManager::sendFunctionCommand(int address, int function, bool active) {
+    // LAN_X_SET_LOCO_FUNCTION: TTNNNNNN, TT 00 off, 01 on
+    uint8_t frame[] = {X_SET_LOCO, 0xF8, addressMsb(address), addressLsb(address),
+                       (uint8_t)((active ? 0x40 : 0) | (function & 0x3F))};
+    queueXBus(frame, sizeof(frame));
+}
+
+void Z21CommandManager::sendFunctionGroup(int address, int group, uint8_t states) {
+    // LAN_X_SET_LOCO_FUNCTION_GROUP (firmware 1.42): 000 F0 F4 F3 F2 F1 for the
+    // first group, the functions in ascending bit order for the others
+    static constexpr uint8_t GROUP_CODES[FUNCTION_GROUPS] = {0x20, 0x21, 0x22, 0x23, 0x28, 0x29, 0x2A, 0x2B, 0x50, 0x51};
+    uint8_t functions = group == 0 ? (((states & 0x01) << 4) | ((states >> 1) & 0x0F)) : states;
+    uint8_t frame[] = {X_SET_LOCO, GROUP_CODES[group], addressMsb(address), addressLsb(address), functions};
+    queueXBus(frame, sizeof(frame));
+}
+
+void Z21CommandManager::sendEmergencyStop() {
+    // LAN_X_SET_STOP: every loco stops, the track stays powered
+    static constexpr uint8_t STOP[] = {0x06, 0x00, LAN_X, 0x00, X_SET_STOP, X_SET_STOP};
+    sendDatagram(STOP, sizeof(STOP));
+}
+
+bool Z21CommandManager::parseLocoInfo(const uint8_t* frame, size_t length, StateReport& report) {
+    // X-header, address (2), steps, RVVVVVVV, 0DSLFGHJ, F5-F12, F13-F20, F21-F28, ..., XOR
+    if (length < 10 || frame[0] != X_LOCO_INFO) {
+        return false;
+    }
+    uint8_t checksum = 0;
+    for (size_t i = 0; i < length; i++) {
+        checksum ^= frame[i];
+    }
+    if (checksum != 0) {
+        return false;
+    }
+
+    report = StateReport();
+    report.address = ((frame[1] & 0x3F) << 8) | frame[2];
+    report.forward = (frame[4] & 0x80) ? 1 : 0;
+    // Only 128 step mode, the one we drive in, maps directly to our steps
+    if ((frame[3] & 0x07) == 4) {
+        int step = frame[4] & 0x7F;
+        report.speed = step <= 1 ? 0 : step - 1;
+    }
+
+    // F0 sits in bit 4 of its byte, F1-F4 below it
+    report.functionMask = 0x1FFFFFFF; // F0-F28
+    report.functionStates = ((frame[5] >> 4) & 0x01) | ((uint32_t)(frame[5] & 0x0F) << 1) |
+                            ((uint32_t)frame[6] << 5) | ((uint32_t)frame[7] << 13) | ((uint32_t)frame[8] << 21);
+    return true;
+}
+
+uint8_t Z21CommandManager::confirmedFields() const {
+    // Speed and function changes come back as LAN_X_LOCO_INFO to subscribed clients
+    return DIRTY_SPEED | DIRTY_FRONT_LIGHTS | DIRTY_BACK_LIGHTS | DIRTY_BELL | DIRTY_HORN;
+}
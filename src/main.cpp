@@ -1,5 +1,6 @@
 #include <Arduino.h>
 #include "UIManager.h"
+#include "BootSequence.h"
 
 // Create UIManager instance
 UIManager uiManager;
@@ -7,6 +8,9 @@ UIManager uiManager;
 void setup() {
   Serial1.begin(115200); // Debug only
 
+  // Filesystem, configuration and network come up on the control core
+  // while the UI core initialises the display behind the splash
+  BootSequence::start();
 
   // Initialize the UI
   uiManager.begin();
@@ -0,0 +1,210 @@
+#pragma once
+
+// Host stand-in for the parts of the Arduino core used by the sources built
+// in the native test environment: String, timing, Print/Stream, Client and
+// the UART.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <strings.h>
+#include <thread>
+
+using std::max;
+using std::min;
+
+template <typename T, typename L, typename H>
+T constrain(T value, L low, H high) {
+    return value < low ? low : (value > high ? high : value);
+}
+
+inline unsigned long hostStartMicros() {
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline unsigned long micros() {
+    return hostStartMicros();
+}
+
+inline unsigned long millis() {
+    return hostStartMicros() / 1000;
+}
+
+inline void delay(unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline void yield() {
+    std::this_thread::yield();
+}
+
+class String {
+public:
+    String() = default;
+    String(const char* text) : text(text ? text : "") {}
+    String(const char* text, unsigned int length) : text(text, length) {}
+    explicit String(char c) : text(1, c) {}
+    explicit String(unsigned char value, unsigned char base = 10) : String((unsigned long)value, base) {}
+    explicit String(int value, unsigned char base = 10) : String((long)value, base) {}
+    explicit String(unsigned int value, unsigned char base = 10) : String((unsigned long)value, base) {}
+    explicit String(long value, unsigned char base = 10) {
+        if (value < 0) {
+            text = "-" + String((unsigned long)-value, base).text;
+        } else {
+            text = String((unsigned long)value, base).text;
+        }
+    }
+    explicit String(unsigned long value, unsigned char base = 10) {
+        do {
+            text.insert(text.begin(), "0123456789abcdefghijklmnopqrstuvwxyz"[value % base]);
+            value /= base;
+        } while (value > 0);
+    }
+    explicit String(double value, unsigned char decimals = 2) {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+        text = buffer;
+    }
+    explicit String(float value, unsigned char decimals = 2) : String((double)value, decimals) {}
+
+    const char* c_str() const { return text.c_str(); }
+    unsigned int length() const { return text.size(); }
+    bool isEmpty() const { return text.empty(); }
+    void reserve(unsigned int size) { text.reserve(size); }
+
+    char charAt(unsigned int index) const { return index < text.size() ? text[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+
+    int indexOf(char c, unsigned int from = 0) const { return position(text.find(c, from)); }
+    int indexOf(const String& s, unsigned int from = 0) const { return position(text.find(s.text, from)); }
+    int lastIndexOf(char c) const { return position(text.rfind(c)); }
+    int lastIndexOf(const String& s) const { return position(text.rfind(s.text)); }
+
+    String substring(unsigned int from) const { return from < text.size() ? String(text.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const {
+        if (from > to) {
+            std::swap(from, to);
+        }
+        return from < text.size() ? String(text.substr(from, to - from)) : String();
+    }
+
+    bool startsWith(const String& prefix) const { return text.compare(0, prefix.text.size(), prefix.text) == 0; }
+    bool endsWith(const String& suffix) const {
+        return text.size() >= suffix.text.size() &&
+               text.compare(text.size() - suffix.text.size(), suffix.text.size(), suffix.text) == 0;
+    }
+    bool equals(const String& other) const { return text == other.text; }
+    bool equalsIgnoreCase(const String& other) const { return strcasecmp(c_str(), other.c_str()) == 0; }
+
+    long toInt() const { return atol(text.c_str()); }
+    float toFloat() const { return atof(text.c_str()); }
+
+    void replace(const String& find, const String& with) {
+        if (find.text.empty()) {
+            return;
+        }
+        for (size_t at = text.find(find.text); at != std::string::npos; at = text.find(find.text, at + with.text.size())) {
+            text.replace(at, find.text.size(), with.text);
+        }
+    }
+    void trim() {
+        size_t first = text.find_first_not_of(" \t\r\n");
+        size_t last = text.find_last_not_of(" \t\r\n");
+        text = first == std::string::npos ? std::string() : text.substr(first, last - first + 1);
+    }
+    void toLowerCase() { std::transform(text.begin(), text.end(), text.begin(), ::tolower); }
+    void toUpperCase() { std::transform(text.begin(), text.end(), text.begin(), ::toupper); }
+
+    bool concat(const char* data, unsigned int length) { text.append(data, length); return true; }
+    String& operator+=(const String& other) { text += other.text; return *this; }
+    String& operator+=(const char* other) { text += other; return *this; }
+    String& operator+=(char c) { text += c; return *this; }
+    String& operator+=(int value) { return *this += String(value); }
+    String& operator+=(unsigned long value) { return *this += String(value); }
+
+    bool operator==(const String& other) const { return text == other.text; }
+    bool operator==(const char* other) const { return text == other; }
+    bool operator!=(const String& other) const { return text != other.text; }
+    bool operator!=(const char* other) const { return text != other; }
+    bool operator<(const String& other) const { return text < other.text; }
+
+    friend String operator+(const String& a, const String& b) { return String(a.text + b.text); }
+    friend String operator+(const String& a, const char* b) { return String(a.text + b); }
+    friend String operator+(const char* a, const String& b) { return String(a + b.text); }
+    friend String operator+(const String& a, char b) { return String(a.text + b); }
+
+private:
+    explicit String(const std::string& text) : text(text) {}
+
+    static int position(size_t at) { return at == std::string::npos ? -1 : (int)at; }
+
+    std::string text;
+};
+
+class Print {
+public:
+    virtual ~Print() = default;
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t written = 0;
+        while (size-- > 0) {
+            written += write(*buffer++);
+        }
+        return written;
+    }
+    virtual void flush() {}
+
+    size_t print(const String& s) { return write(reinterpret_cast<const uint8_t*>(s.c_str()), s.length()); }
+    size_t print(const char* s) { return write(reinterpret_cast<const uint8_t*>(s), strlen(s)); }
+    size_t print(long value) { return print(String(value)); }
+    size_t println(const String& s) { return print(s) + print("\r\n"); }
+    size_t println(const char* s) { return print(s) + print("\r\n"); }
+    size_t println() { return print("\r\n"); }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    void setTimeout(unsigned long ms) { timeoutMs = ms; }
+
+protected:
+    unsigned long timeoutMs = 1000;
+};
+
+#include "IPAddress.h"
+
+class Client : public Stream {
+public:
+    virtual int connect(IPAddress ip, uint16_t port) = 0;
+    virtual int connect(const char* host, uint16_t port) = 0;
+    using Print::write;
+    virtual int read(uint8_t* buffer, size_t size) = 0;
+    using Stream::read;
+    virtual void stop() = 0;
+    virtual uint8_t connected() = 0;
+    virtual operator bool() = 0;
+};
+
+// UART of the RP2040 core, with nothing wired to it. Virtual here so a test
+// can put a scripted station on the wire
+class SerialUART : public Stream {
+public:
+    virtual bool setTX(uint8_t pin) { return true; }
+    virtual bool setRX(uint8_t pin) { return true; }
+    virtual bool setFIFOSize(size_t size) { return true; }
+    virtual void begin(unsigned long baud) {}
+    virtual void end() {}
+    size_t write(uint8_t c) override { return 1; }
+    using Print::write;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+};
+
+inline SerialUART Serial2;
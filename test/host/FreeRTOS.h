@@ -0,0 +1,29 @@
+#pragma once
+
+// Host stand-in for the FreeRTOS kernel: tasks are threads, a tick is 1 ms
+
+#include <cstdint>
+#include <mutex>
+
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define errQUEUE_FULL pdFALSE
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFF)
+#define configTICK_RATE_HZ 1000
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portTICK_PERIOD_MS 1
+
+// Critical sections exclude each other, which is all the callers rely on
+inline std::recursive_mutex& hostCriticalSection() {
+    static std::recursive_mutex section;
+    return section;
+}
+
+#define taskENTER_CRITICAL() hostCriticalSection().lock()
+#define taskEXIT_CRITICAL() hostCriticalSection().unlock()
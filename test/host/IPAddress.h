@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Arduino.h>
+
+class IPAddress {
+public:
+    IPAddress() = default;
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes{a, b, c, d} {}
+    IPAddress(uint32_t address) {
+        memcpy(bytes, &address, sizeof(bytes));
+    }
+
+    bool fromString(const char* text) {
+        unsigned int parts[4];
+        char tail;
+        if (sscanf(text, "%u.%u.%u.%u%c", &parts[0], &parts[1], &parts[2], &parts[3], &tail) != 4) {
+            return false;
+        }
+        for (int i = 0; i < 4; i++) {
+            if (parts[i] > 255) {
+                return false;
+            }
+            bytes[i] = parts[i];
+        }
+        return true;
+    }
+    bool fromString(const String& text) { return fromString(text.c_str()); }
+
+    String toString() const {
+        char text[16];
+        snprintf(text, sizeof(text), "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+        return String(text);
+    }
+
+    bool isSet() const { return (uint32_t)*this != 0; }
+    uint8_t operator[](int index) const { return bytes[index]; }
+    operator uint32_t() const {
+        uint32_t address;
+        memcpy(&address, bytes, sizeof(address));
+        return address;
+    }
+    bool operator==(const IPAddress& other) const { return (uint32_t)*this == (uint32_t)other; }
+
+private:
+    uint8_t bytes[4] = {0, 0, 0, 0};
+};
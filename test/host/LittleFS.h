@@ -0,0 +1,106 @@
+#pragma once
+
+// Host stand-in for LittleFS, held in memory. Writes land in the stored file
+// right away, as the sources never read a file they are still writing.
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class File : public Stream {
+public:
+    File() = default;
+    File(std::shared_ptr<std::vector<uint8_t>> data, bool writable) : data(data), writable(writable) {}
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override {
+        if (!data || !writable) {
+            return 0;
+        }
+        if (data->size() < position + size) {
+            data->resize(position + size);
+        }
+        memcpy(data->data() + position, buffer, size);
+        position += size;
+        return size;
+    }
+    using Print::write;
+
+    int available() override { return data ? (int)(data->size() - position) : 0; }
+    int read() override { return available() > 0 ? (*data)[position++] : -1; }
+    int peek() override { return available() > 0 ? (*data)[position] : -1; }
+    size_t read(uint8_t* buffer, size_t size) {
+        size_t count = min(size, (size_t)available());
+        if (count > 0) {
+            memcpy(buffer, data->data() + position, count);
+            position += count;
+        }
+        return count;
+    }
+
+    bool seek(uint32_t offset) {
+        if (!data || offset > data->size()) {
+            return false;
+        }
+        position = offset;
+        return true;
+    }
+    size_t size() const { return data ? data->size() : 0; }
+    void close() { data.reset(); }
+    operator bool() const { return data != nullptr; }
+
+private:
+    std::shared_ptr<std::vector<uint8_t>> data;
+    bool writable = false;
+    size_t position = 0;
+};
+
+class HostFS {
+public:
+    bool begin() { return true; }
+
+    File open(const char* path, const char* mode) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto file = files.find(path);
+        if (mode[0] == 'r') {
+            if (file == files.end()) {
+                return File();
+            }
+            return File(file->second, mode[1] == '+');
+        }
+        auto data = std::make_shared<std::vector<uint8_t>>();
+        files[path] = data;
+        return File(data, true);
+    }
+    File open(const String& path, const char* mode) { return open(path.c_str(), mode); }
+
+    bool exists(const char* path) {
+        std::lock_guard<std::mutex> guard(lock);
+        return files.count(path) > 0;
+    }
+    bool remove(const char* path) {
+        std::lock_guard<std::mutex> guard(lock);
+        return files.erase(path) > 0;
+    }
+    bool remove(const String& path) { return remove(path.c_str()); }
+    bool rename(const char* from, const char* to) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto file = files.find(from);
+        if (file == files.end()) {
+            return false;
+        }
+        files[to] = file->second;
+        files.erase(from);
+        return true;
+    }
+    bool rename(const String& from, const String& to) { return rename(from.c_str(), to.c_str()); }
+
+private:
+    std::mutex lock;
+    std::map<std::string, std::shared_ptr<std::vector<uint8_t>>> files;
+};
+
+inline HostFS LittleFS;
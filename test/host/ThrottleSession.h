@@ -0,0 +1,25 @@
+#pragma once
+
+#include "LocoCommandManager.h"
+#include "WaitUntil.h"
+
+// Throttle connected to a stand-in with loco 3 selected. The constructor
+// returns once the session task has taken in everything the stand-in
+// answered, which the stand-in tells through settled(): it was read dry
+// and polled again, so the pass that read it has applied it.
+template <typename Throttle, typename StandIn>
+struct ThrottleSession {
+    StandIn station;
+    Throttle throttle{station};
+
+    explicit ThrottleSession(const char* url, bool silent = false) {
+        station.silent = silent;
+        throttle.connect(url);
+        throttle.selectLoco(3);
+        waitUntil([this] { return station.settled(); });
+    }
+
+    const LocoCommandManager::LocoSlot& slot() {
+        return throttle.getSlot(throttle.getActiveSlotIndex());
+    }
+};
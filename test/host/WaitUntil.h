@@ -0,0 +1,16 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Wait up to timeoutMs for a condition polled by another thread's work
+template <typename Condition>
+bool waitUntil(Condition&& condition, unsigned long timeoutMs = 2000) {
+    unsigned long start = millis();
+    while (!condition()) {
+        if (millis() - start >= timeoutMs) {
+            return false;
+        }
+        delay(5);
+    }
+    return true;
+}
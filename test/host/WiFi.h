@@ -0,0 +1,68 @@
+#pragma once
+
+// Host stand-in for the WiFi library: no radio, so the built-in socket
+// classes never connect. Tests hand the backends their own Client or UDP.
+
+#include <Arduino.h>
+
+class WiFiClient : public Client {
+public:
+    int connect(IPAddress, uint16_t) override { return 0; }
+    int connect(const char*, uint16_t) override { return 0; }
+    size_t write(uint8_t) override { return 0; }
+    size_t write(const uint8_t*, size_t) override { return 0; }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int read(uint8_t*, size_t) override { return 0; }
+    int peek() override { return -1; }
+    void stop() override {}
+    uint8_t connected() override { return 0; }
+    operator bool() override { return false; }
+    void setNoDelay(bool) {}
+    void keepAlive(int, int, int) {}
+};
+
+class UDP : public Stream {
+public:
+    virtual uint8_t begin(uint16_t port) = 0;
+    virtual void stop() = 0;
+    virtual int beginPacket(IPAddress ip, uint16_t port) = 0;
+    virtual int beginPacket(const char* host, uint16_t port) = 0;
+    virtual int endPacket() = 0;
+    using Print::write;
+    virtual int parsePacket() = 0;
+    virtual int read(unsigned char* buffer, size_t length) = 0;
+    virtual int read(char* buffer, size_t length) = 0;
+    using Stream::read;
+    virtual IPAddress remoteIP() = 0;
+    virtual uint16_t remotePort() = 0;
+};
+
+class WiFiUDP : public UDP {
+public:
+    uint8_t begin(uint16_t) override { return 0; }
+    void stop() override {}
+    int beginPacket(IPAddress, uint16_t) override { return 0; }
+    int beginPacket(const char*, uint16_t) override { return 0; }
+    int endPacket() override { return 0; }
+    size_t write(uint8_t) override { return 0; }
+    size_t write(const uint8_t*, size_t) override { return 0; }
+    int parsePacket() override { return 0; }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int read(unsigned char*, size_t) override { return 0; }
+    int read(char*, size_t) override { return 0; }
+    int peek() override { return -1; }
+    IPAddress remoteIP() override { return IPAddress(); }
+    uint16_t remotePort() override { return 0; }
+};
+
+class WiFiClass {
+public:
+    String macAddress() { return "02:00:00:00:00:01"; }
+
+    // Only dotted addresses resolve, there is no DNS on the host
+    int hostByName(const char* host, IPAddress& address) { return address.fromString(host) ? 1 : 0; }
+};
+
+inline WiFiClass WiFi;
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+// Only the handle type: the host runtime stubs out BootSequence
+struct HostEventGroup;
+typedef HostEventGroup* EventGroupHandle_t;
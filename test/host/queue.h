@@ -0,0 +1,64 @@
+#pragma once
+
+#include "FreeRTOS.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+struct HostQueue {
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<std::vector<uint8_t>> items;
+    size_t length = 0;
+    size_t itemSize = 0;
+};
+typedef HostQueue* QueueHandle_t;
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    QueueHandle_t queue = new HostQueue;
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+inline void vQueueDelete(QueueHandle_t queue) {
+    delete queue;
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks) {
+    std::unique_lock<std::mutex> guard(queue->lock);
+    auto ready = [queue] { return queue->items.size() < queue->length; };
+    if (ticks == portMAX_DELAY) {
+        queue->changed.wait(guard, ready);
+    } else if (!queue->changed.wait_for(guard, std::chrono::milliseconds(ticks), ready)) {
+        return errQUEUE_FULL;
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(item);
+    queue->items.emplace_back(bytes, bytes + queue->itemSize);
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+#define xQueueSendToBack xQueueSend
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks) {
+    std::unique_lock<std::mutex> guard(queue->lock);
+    auto ready = [queue] { return !queue->items.empty(); };
+    if (ticks == portMAX_DELAY) {
+        queue->changed.wait(guard, ready);
+    } else if (!queue->changed.wait_for(guard, std::chrono::milliseconds(ticks), ready)) {
+        return pdFALSE;
+    }
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    std::lock_guard<std::mutex> guard(queue->lock);
+    return queue->items.size();
+}
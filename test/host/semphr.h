@@ -0,0 +1,99 @@
+#pragma once
+
+#include "FreeRTOS.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Counting semaphore; mutexes are created with one token, recursive ones
+// also count the nested takes of their owner
+struct HostSemaphore {
+    std::mutex lock;
+    std::condition_variable released;
+    int tokens = 0;
+    int maxTokens = 1;
+    std::thread::id owner;
+    int depth = 0;
+};
+typedef HostSemaphore* SemaphoreHandle_t;
+
+inline SemaphoreHandle_t hostSemaphoreCreate(int tokens, int maxTokens) {
+    SemaphoreHandle_t semaphore = new HostSemaphore;
+    semaphore->tokens = tokens;
+    semaphore->maxTokens = maxTokens;
+    return semaphore;
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return hostSemaphoreCreate(1, 1);
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutex() {
+    return hostSemaphoreCreate(1, 1);
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateBinary() {
+    return hostSemaphoreCreate(0, 1);
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount) {
+    return hostSemaphoreCreate(initialCount, maxCount);
+}
+
+inline void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    delete semaphore;
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    std::unique_lock<std::mutex> guard(semaphore->lock);
+    auto ready = [semaphore] { return semaphore->tokens > 0; };
+    if (ticks == portMAX_DELAY) {
+        semaphore->released.wait(guard, ready);
+    } else if (!semaphore->released.wait_for(guard, std::chrono::milliseconds(ticks), ready)) {
+        return pdFALSE;
+    }
+    semaphore->tokens--;
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    std::lock_guard<std::mutex> guard(semaphore->lock);
+    if (semaphore->tokens >= semaphore->maxTokens) {
+        return pdFALSE;
+    }
+    semaphore->tokens++;
+    semaphore->released.notify_one();
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t semaphore, TickType_t ticks) {
+    {
+        std::lock_guard<std::mutex> guard(semaphore->lock);
+        if (semaphore->depth > 0 && semaphore->owner == std::this_thread::get_id()) {
+            semaphore->depth++;
+            return pdTRUE;
+        }
+    }
+    if (xSemaphoreTake(semaphore, ticks) != pdTRUE) {
+        return pdFALSE;
+    }
+    std::lock_guard<std::mutex> guard(semaphore->lock);
+    semaphore->owner = std::this_thread::get_id();
+    semaphore->depth = 1;
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t semaphore) {
+    {
+        std::lock_guard<std::mutex> guard(semaphore->lock);
+        if (semaphore->depth == 0 || semaphore->owner != std::this_thread::get_id()) {
+            return pdFALSE;
+        }
+        if (--semaphore->depth > 0) {
+            return pdTRUE;
+        }
+        semaphore->owner = std::thread::id();
+    }
+    return xSemaphoreGive(semaphore);
+}
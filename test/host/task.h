@@ -0,0 +1,57 @@
+#pragma once
+
+#include "FreeRTOS.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+typedef void (*TaskFunction_t)(void*);
+
+struct HostTask {
+    std::thread::id id;
+};
+typedef HostTask* TaskHandle_t;
+
+inline BaseType_t xTaskCreate(TaskFunction_t function, const char* name, uint32_t stackDepth, void* param,
+                              UBaseType_t priority, TaskHandle_t* handle) {
+    HostTask* task = new HostTask;
+    std::thread thread(function, param);
+    task->id = thread.get_id();
+    thread.detach();
+    if (handle) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+inline BaseType_t xTaskCreateAffinitySet(TaskFunction_t function, const char* name, uint32_t stackDepth, void* param,
+                                         UBaseType_t priority, UBaseType_t affinity, TaskHandle_t* handle) {
+    return xTaskCreate(function, name, stackDepth, param, priority, handle);
+}
+
+// A task ending itself returns from its function right after; deleting
+// another task is never safe, so the host refuses it outright
+inline void vTaskDelete(TaskHandle_t task) {
+    if (task != nullptr && task->id != std::this_thread::get_id()) {
+        fprintf(stderr, "vTaskDelete() of another task\n");
+        abort();
+    }
+}
+
+inline void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+inline TickType_t xTaskGetTickCount() {
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline void vTaskDelayUntil(TickType_t* previousWake, TickType_t period) {
+    *previousWake += period;
+    TickType_t now = xTaskGetTickCount();
+    if ((int32_t)(*previousWake - now) > 0) {
+        vTaskDelay(*previousWake - now);
+    }
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <Arduino.h>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Scripted DCC-EX station on the far end of the UART, handed to
+// DccExCommandManager as its serial port. It answers <#> and <JR>, keeps
+// the state of every loco it was sent a command for and broadcasts it as
+// <l cab reg speedByte functions> after every change, like DCC-EX does.
+// Every command and every write it got is recorded.
+class DccExStandIn : public SerialUART {
+public:
+    // Leave loco commands unanswered, as on a lossy line
+    bool silent = false;
+
+    // Send a command as if the station had (another throttle changing a loco, ...)
+    void send(const std::string& command) {
+        std::lock_guard<std::mutex> guard(lock);
+        queue(command);
+    }
+
+    // Take the station off the wire: from now on nothing is answered
+    void unplug() {
+        std::lock_guard<std::mutex> guard(lock);
+        unplugged = true;
+    }
+
+    // Every command received so far, brackets included
+    std::vector<std::string> commands() {
+        std::lock_guard<std::mutex> guard(lock);
+        return received;
+    }
+
+    // Raw writes, to check what went out together
+    std::vector<std::string> writes() {
+        std::lock_guard<std::mutex> guard(lock);
+        return chunks;
+    }
+
+    int count(const std::string& command) {
+        std::lock_guard<std::mutex> guard(lock);
+        int matches = 0;
+        for (const std::string& candidate : received) {
+            matches += candidate == command;
+        }
+        return matches;
+    }
+
+    bool hasCommand(const std::string& command) {
+        return count(command) > 0;
+    }
+
+    // Whether the throttle read everything sent and polled again since,
+    // so the session pass that read the last broadcast has applied it
+    bool settled() {
+        std::lock_guard<std::mutex> guard(lock);
+        return outgoing.empty() && quietPolls >= 2;
+    }
+
+    unsigned long baudRate() {
+        std::lock_guard<std::mutex> guard(lock);
+        return baud;
+    }
+
+    // UART interface, used by SerialClient
+    void begin(unsigned long rate) override {
+        std::lock_guard<std::mutex> guard(lock);
+        baud = rate;
+    }
+
+    size_t write(uint8_t c) override {
+        return write(&c, 1);
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) override {
+        std::lock_guard<std::mutex> guard(lock);
+        chunks.emplace_back(reinterpret_cast<const char*>(buffer), size);
+        for (size_t i = 0; i < size; i++) {
+            if (buffer[i] == '<') {
+                incoming = "<";
+            } else if (!incoming.empty()) {
+                incoming += (char)buffer[i];
+                if (buffer[i] == '>') {
+                    handle(incoming);
+                    incoming.clear();
+                }
+            }
+        }
+        return size;
+    }
+
+    int available() override {
+        std::lock_guard<std::mutex> guard(lock);
+        quietPolls += outgoing.empty();
+        return outgoing.size();
+    }
+
+    int read() override {
+        std::lock_guard<std::mutex> guard(lock);
+        if (outgoing.empty()) {
+            return -1;
+        }
+        uint8_t c = outgoing.front();
+        outgoing.pop_front();
+        return c;
+    }
+
+    int peek() override {
+        std::lock_guard<std::mutex> guard(lock);
+        return outgoing.empty() ? -1 : outgoing.front();
+    }
+
+private:
+    struct Loco {
+        int speedByte = 0x80;   // Stopped, forward
+        uint32_t functions = 0; // Bit n is Fn
+    };
+
+    void queue(const std::string& command) {
+        quietPolls = 0;
+        outgoing.insert(outgoing.end(), command.begin(), command.end());
+        outgoing.push_back('\n');
+    }
+
+    void queueState(int cab) {
+        const Loco& loco = locos[cab];
+        queue("<l " + std::to_string(cab) + " 0 " + std::to_string(loco.speedByte) + " " +
+              std::to_string(loco.functions) + ">");
+    }
+
+    // Answer one command of the throttle, as DCC-EX would
+    void handle(const std::string& command) {
+        received.push_back(command);
+        if (unplugged) {
+            return;
+        }
+
+        int values[4] = {};
+        int count = sscanf(command.c_str() + 2, "%d %d %d %d", &values[0], &values[1], &values[2], &values[3]);
+        switch (command[1]) {
+            case '#':
+                queue("<# 50>");
+                return;
+            case 'J':
+                if (command == "<JR>") {
+                    queue("<jR>"); // Empty roster
+                }
+                return;
+            case '!':
+                // Every loco to emergency stop, keeping its direction
+                for (auto& loco : locos) {
+                    loco.second.speedByte = (loco.second.speedByte & 0x80) | 1;
+                    queueState(loco.first);
+                }
+                return;
+            case 't':
+                // <t cab speed dir>: speed byte 0 is stop, 2-127 the steps 1-126
+                if (count == 3) {
+                    locos[values[0]].speedByte = (values[2] ? 0x80 : 0) | (values[1] > 0 ? values[1] + 1 : 0);
+                    break;
+                }
+                return;
+            case 'F':
+                // <F cab function state>
+                if (count == 3) {
+                    uint32_t bit = 1UL << values[1];
+                    Loco& loco = locos[values[0]];
+                    loco.functions = values[2] ? (loco.functions | bit) : (loco.functions & ~bit);
+                    break;
+                }
+                return;
+            case 'f':
+                // <f cab byte1 [byte2]>, the DCC function instruction
+                if (count >= 2) {
+                    setFunctionGroup(locos[values[0]], values[1], values[2]);
+                    break;
+                }
+                return;
+            default:
+                return;
+        }
+        if (!silent) {
+            queueState(values[0]);
+        }
+    }
+
+    static void setFunctionGroup(Loco& loco, int instruction, int states) {
+        int first;
+        int size;
+        if ((instruction & 0xE0) == 0x80) {
+            // 100 F0 F4 F3 F2 F1
+            states = ((instruction >> 4) & 0x01) | ((instruction & 0x0F) << 1);
+            first = 0;
+            size = 5;
+        } else if ((instruction & 0xF0) == 0xB0 || (instruction & 0xF0) == 0xA0) {
+            // 1011 F8-F5, 1010 F12-F9
+            states = instruction & 0x0F;
+            first = (instruction & 0xF0) == 0xB0 ? 5 : 9;
+            size = 4;
+        } else if (instruction == 0xDE || instruction == 0xDF) {
+            // F13-F20, F21-F28
+            first = instruction == 0xDE ? 13 : 21;
+            size = 8;
+        } else {
+            return;
+        }
+        uint32_t mask = ((1UL << size) - 1) << first;
+        loco.functions = (loco.functions & ~mask) | (((uint32_t)states << first) & mask);
+    }
+
+    std::mutex lock;
+    bool unplugged = false;
+    unsigned long baud = 0;
+    std::string incoming;         // Partial command from the throttle
+    std::deque<uint8_t> outgoing; // Bytes waiting to be read by the throttle
+    int quietPolls = 0;           // Polls finding nothing since the last reply queued
+    std::vector<std::string> received;
+    std::vector<std::string> chunks;
+    std::map<int, Loco> locos;    // State of every loco commanded, by cab
+};
@@ -0,0 +1,141 @@
+#include <unity.h>
+#include "HostRuntime.h"
+#include "DccExCommandManager.h"
+#include "ThrottleSession.h"
+#include "DccExStandIn.h"
+
+namespace {
+
+// Throttle wired to the station with loco 3 selected; the URL is not used on a UART
+struct Session : ThrottleSession<DccExCommandManager, DccExStandIn> {
+    explicit Session(bool silent = false) : ThrottleSession("", silent) {}
+};
+
+} // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_answered_probe_brings_the_link_up() {
+    Session session;
+    TEST_ASSERT_TRUE(session.throttle.isConnected());
+    TEST_ASSERT_FALSE(session.throttle.usesNetwork());
+    TEST_ASSERT_EQUAL(SerialClient::DEFAULT_BAUD_RATE, session.station.baudRate());
+
+    // The probe goes out first, the roster request once it was answered
+    std::vector<std::string> commands = session.station.commands();
+    TEST_ASSERT_TRUE(commands.size() >= 2);
+    TEST_ASSERT_EQUAL_STRING("<#>", commands[0].c_str());
+    TEST_ASSERT_TRUE(session.station.hasCommand("<JR>"));
+}
+
+void test_unanswered_probe_stays_down() {
+    DccExStandIn station;
+    station.unplug();
+    DccExCommandManager throttle(station);
+
+    unsigned long start = millis();
+    throttle.connect("");
+    TEST_ASSERT_FALSE(throttle.isConnected());
+    TEST_ASSERT_TRUE(millis() - start >= DccExCommandManager::LINK_PROBE_TIMEOUT_MS);
+
+    // Nothing but the probe went down the wire
+    TEST_ASSERT_EQUAL(1, (int)station.commands().size());
+    TEST_ASSERT_EQUAL_STRING("<#>", station.commands()[0].c_str());
+}
+
+void test_silent_station_dropped_after_keepalive_timeout() {
+    Session session;
+    session.station.unplug();
+    unsigned long start = millis();
+
+    TEST_ASSERT_TRUE(waitUntil([&] { return !session.throttle.isConnected(); },
+                               DccExCommandManager::KEEPALIVE_TIMEOUT_MS + 3000));
+    TEST_ASSERT_TRUE(millis() - start >= DccExCommandManager::KEEPALIVE_TIMEOUT_MS - 2 * DccExCommandManager::ECHO_INTERVAL_MS);
+
+    // Kept asking in the meantime
+    TEST_ASSERT_TRUE(session.station.count("<#>") >= 3);
+}
+
+void test_speed_and_functions_sent_in_one_write() {
+    Session session;
+    session.throttle.setSpeed(40);
+    session.throttle.setFunction(6, true);
+    session.throttle.flush();
+
+    // <t 3 40 1> and F5-F8 with F6 on (1011 0010)
+    bool together = false;
+    for (const std::string& write : session.station.writes()) {
+        together |= write.find("<t 3 40 1>") != std::string::npos && write.find("<f 3 178>") != std::string::npos;
+    }
+    TEST_ASSERT_TRUE(together);
+}
+
+void test_speed_confirmed_by_loco_broadcast() {
+    Session session;
+    session.throttle.setSpeed(40);
+    session.throttle.flush();
+
+    TEST_ASSERT_TRUE(waitUntil([&] { return (session.slot().pending & LocoCommandManager::DIRTY_SPEED) == 0; }));
+    TEST_ASSERT_EQUAL(40, session.slot().speed);
+    TEST_ASSERT_EQUAL(0, session.throttle.getRetryCount());
+}
+
+void test_loco_broadcast_from_another_throttle_is_taken_over() {
+    Session session;
+    // Forward at step 77 (speed byte 0x80 | 78), F0 on
+    session.station.send("<l 3 0 206 1>");
+    TEST_ASSERT_TRUE(waitUntil([&] { return session.slot().speed == 77; }));
+    TEST_ASSERT_TRUE(session.slot().forward);
+    TEST_ASSERT_TRUE(session.slot().frontLights == LocoCommandManager::LightStatus::BRIGHT);
+    TEST_ASSERT_TRUE(session.throttle.getDivergenceCount() >= 1);
+}
+
+void test_unconfirmed_speed_is_retransmitted() {
+    Session session(true);
+    session.throttle.setSpeed(20);
+    session.throttle.flush();
+    TEST_ASSERT_EQUAL(1, session.station.count("<t 3 20 1>"));
+
+    TEST_ASSERT_TRUE(waitUntil([&] {
+        session.throttle.flush();
+        return session.station.count("<t 3 20 1>") >= 2;
+    }, 3000));
+    TEST_ASSERT_TRUE(session.throttle.getRetryCount() >= 1);
+}
+
+void test_emergency_stop_held_until_broadcast() {
+    Session session;
+    session.throttle.setSpeed(50);
+    session.throttle.flush();
+    session.throttle.emergencyStop();
+
+    TEST_ASSERT_TRUE(session.station.hasCommand("<!>"));
+    TEST_ASSERT_TRUE(waitUntil([&] { return !session.slot().stopHeld; }));
+    TEST_ASSERT_EQUAL(0, session.slot().speed);
+}
+
+void test_disconnect_closes_the_link() {
+    Session session;
+    session.throttle.disconnect();
+    TEST_ASSERT_FALSE(session.throttle.isConnected());
+
+    // Nothing is written once closed
+    session.throttle.sendCommand("<s>");
+    TEST_ASSERT_FALSE(session.station.hasCommand("<s>"));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_answered_probe_brings_the_link_up);
+    RUN_TEST(test_unanswered_probe_stays_down);
+    RUN_TEST(test_silent_station_dropped_after_keepalive_timeout);
+    RUN_TEST(test_speed_and_functions_sent_in_one_write);
+    RUN_TEST(test_speed_confirmed_by_loco_broadcast);
+    RUN_TEST(test_loco_broadcast_from_another_throttle_is_taken_over);
+    RUN_TEST(test_unconfirmed_speed_is_retransmitted);
+    RUN_TEST(test_emergency_stop_held_until_broadcast);
+    RUN_TEST(test_disconnect_closes_the_link);
+    return UNITY_END();
+}
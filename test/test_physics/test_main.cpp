@@ -0,0 +1,195 @@
+#include <unity.h>
+#include <chrono>
+#include <cstdio>
+#include "HostRuntime.h"
+#include "TrainPhysics.h"
+#include "AirBrake.h"
+
+namespace {
+
+// Ticks in one simulated second
+constexpr int SECOND = TrainPhysics::TICK_HZ;
+
+void run(TrainPhysics& train, int ticks) {
+    for (int i = 0; i < ticks; i++) {
+        train.tick();
+    }
+}
+
+void run(AirBrake& brake, int ticks) {
+    for (int i = 0; i < ticks; i++) {
+        brake.tick();
+    }
+}
+
+} // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_standstill_without_throttle() {
+    TrainPhysics train;
+    run(train, 10 * SECOND);
+    TEST_ASSERT_EQUAL(0, train.getSpeedKmh());
+
+    // Brakes alone never push the train backwards
+    train.setBrake(100);
+    run(train, SECOND);
+    TEST_ASSERT_EQUAL(0, train.getSpeedStep());
+}
+
+void test_throttle_accelerates_up_to_the_governor() {
+    TrainPhysics train;
+    train.setThrottle(100);
+
+    uint32_t previous = 0;
+    for (int second = 0; second < 30; second++) {
+        run(train, SECOND);
+        TEST_ASSERT_TRUE(train.getSpeedKmh() >= previous);
+        previous = train.getSpeedKmh();
+    }
+    TEST_ASSERT_TRUE(previous > 0);
+
+    // Traction is cut at the top speed, the last tick may overshoot it by a step
+    run(train, 600 * SECOND);
+    uint32_t top = train.getParameters().maxSpeedKmh;
+    TEST_ASSERT_TRUE(train.getSpeedKmh() >= top - 1);
+    TEST_ASSERT_TRUE(train.getSpeedKmh() <= top + 1);
+    TEST_ASSERT_TRUE(train.getSpeedStep() <= TrainPhysics::MAX_SPEED_STEP);
+}
+
+void test_power_limit_flattens_acceleration() {
+    TrainPhysics train;
+    train.setThrottle(100);
+    run(train, 10 * SECOND);
+    uint32_t early = train.getSpeedKmh();
+    run(train, 10 * SECOND);
+    uint32_t late = train.getSpeedKmh() - early;
+    TEST_ASSERT_TRUE(late < early);
+}
+
+void test_brake_stops_the_train() {
+    TrainPhysics train;
+    train.setSpeedStep(100);
+    train.setBrake(100);
+    run(train, 120 * SECOND);
+    TEST_ASSERT_EQUAL(0, train.getSpeedKmh());
+}
+
+void test_inputs_are_clamped() {
+    TrainPhysics over;
+    TrainPhysics full;
+    over.setThrottle(150);
+    full.setThrottle(100);
+    run(over, 5 * SECOND);
+    run(full, 5 * SECOND);
+    TEST_ASSERT_EQUAL(full.getSpeedStep(), over.getSpeedStep());
+
+    over.setSpeedStep(500);
+    TEST_ASSERT_EQUAL(TrainPhysics::MAX_SPEED_STEP, over.getSpeedStep());
+    over.setSpeedStep(-3);
+    TEST_ASSERT_EQUAL(0, over.getSpeedStep());
+}
+
+void test_speed_step_round_trip() {
+    TrainPhysics train;
+    for (int step = 0; step <= TrainPhysics::MAX_SPEED_STEP; step++) {
+        train.setSpeedStep(step);
+        TEST_ASSERT_EQUAL(step, train.getSpeedStep());
+    }
+}
+
+void test_model_is_deterministic() {
+    TrainPhysics a;
+    TrainPhysics b;
+    for (int i = 0; i < 60 * SECOND; i++) {
+        int throttle = (i / SECOND) % 3 == 0 ? 80 : 20;
+        a.setThrottle(throttle);
+        b.setThrottle(throttle);
+        a.tick();
+        b.tick();
+    }
+    TEST_ASSERT_EQUAL(a.getSpeedStep(), b.getSpeedStep());
+    TEST_ASSERT_EQUAL(a.getSpeedKmh(), b.getSpeedKmh());
+}
+
+void test_air_brake_applies_and_releases() {
+    AirBrake brake;
+    TEST_ASSERT_EQUAL(0, brake.getBrakePercent());
+
+    // A full service reduction fills the cylinder within a few seconds
+    brake.setValve(AirBrake::Valve::APPLY);
+    run(brake, 3 * SECOND);
+    TEST_ASSERT_EQUAL(AirBrake::RUNNING_PRESSURE_MBAR - AirBrake::FULL_SERVICE_REDUCTION_MBAR, brake.getPipeMbar());
+    run(brake, 3 * SECOND);
+    TEST_ASSERT_TRUE(brake.getBrakePercent() > 50);
+    TEST_ASSERT_TRUE(brake.getCylinderMbar() <= AirBrake::MAX_CYLINDER_MBAR);
+    TEST_ASSERT_TRUE(brake.getAuxReservoirMbar() < AirBrake::RUNNING_PRESSURE_MBAR);
+
+    // Lap holds the pipe
+    brake.setValve(AirBrake::Valve::LAP);
+    int32_t pipe = brake.getPipeMbar();
+    run(brake, 5 * SECOND);
+    TEST_ASSERT_EQUAL(pipe, brake.getPipeMbar());
+
+    // Release recharges the pipe and empties the cylinder
+    brake.setValve(AirBrake::Valve::RELEASE);
+    run(brake, 60 * SECOND);
+    TEST_ASSERT_EQUAL(AirBrake::RUNNING_PRESSURE_MBAR, brake.getPipeMbar());
+    TEST_ASSERT_EQUAL(0, brake.getCylinderMbar());
+    TEST_ASSERT_EQUAL(AirBrake::RUNNING_PRESSURE_MBAR, brake.getAuxReservoirMbar());
+}
+
+void test_pressures_stay_in_range() {
+    AirBrake brake;
+    brake.setValve(AirBrake::Valve::APPLY);
+    for (int i = 0; i < 120 * SECOND; i++) {
+        brake.tick();
+        TEST_ASSERT_TRUE(brake.getPipeMbar() >= 0);
+        TEST_ASSERT_TRUE(brake.getAuxReservoirMbar() >= 0);
+        TEST_ASSERT_TRUE(brake.getCylinderMbar() >= 0);
+        TEST_ASSERT_TRUE(brake.getBrakePercent() <= 100);
+    }
+}
+
+// Cost of one simulation tick (train plus brake), as run by TrainSimulator.
+// The host figure only compares changes; the Pico runs it far slower
+void test_tick_benchmark() {
+    constexpr int TICKS = 1000000;
+    TrainPhysics train;
+    AirBrake brake;
+    train.setThrottle(70);
+    brake.setValve(AirBrake::Valve::LAP);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < TICKS; i++) {
+        brake.tick();
+        train.setBrake(brake.getBrakePercent());
+        train.tick();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double nsPerTick = std::chrono::duration<double, std::nano>(elapsed).count() / TICKS;
+
+    char message[64];
+    snprintf(message, sizeof(message), "tick: %.1f ns (speed step %d)", nsPerTick, train.getSpeedStep());
+    TEST_MESSAGE(message);
+
+    // Only catches a pathological regression, e.g. a loop sneaking into tick()
+    TEST_ASSERT_TRUE(nsPerTick < 1000);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_standstill_without_throttle);
+    RUN_TEST(test_throttle_accelerates_up_to_the_governor);
+    RUN_TEST(test_power_limit_flattens_acceleration);
+    RUN_TEST(test_brake_stops_the_train);
+    RUN_TEST(test_inputs_are_clamped);
+    RUN_TEST(test_speed_step_round_trip);
+    RUN_TEST(test_model_is_deterministic);
+    RUN_TEST(test_air_brake_applies_and_releases);
+    RUN_TEST(test_pressures_stay_in_range);
+    RUN_TEST(test_tick_benchmark);
+    return UNITY_END();
+}
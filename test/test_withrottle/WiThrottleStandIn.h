@@ -0,0 +1,238 @@
+#pragma once
+
+#include <Arduino.h>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Scripted WiThrottle server, handed to JMRICommandManager as its Client.
+// It greets the throttle like JMRI does, answers acquires, echoes the
+// throttle's speed, direction and function writes and the speed query, and
+// records every line and every write it got.
+class WiThrottleStandIn : public Client {
+public:
+    // Lines sent once the throttle connects
+    std::vector<std::string> greeting = {"VN2.0", "RL1]\\[Big Boy}|{4014}|{L", "PPA1", "*10"};
+
+    // Refuse the TCP connection
+    bool refuse = false;
+
+    // Leave throttle writes and speed queries unanswered, as on a lossy link
+    bool silent = false;
+
+    // Send a line as if the server had (another throttle changing a loco, ...)
+    void send(const std::string& line) {
+        std::lock_guard<std::mutex> guard(lock);
+        queue(line);
+    }
+
+    // Everything received so far, one entry per line
+    std::vector<std::string> lines() {
+        std::lock_guard<std::mutex> guard(lock);
+        return received;
+    }
+
+    // Raw writes, to check what went out together
+    std::vector<std::string> writes() {
+        std::lock_guard<std::mutex> guard(lock);
+        return chunks;
+    }
+
+    int count(const std::string& line) {
+        std::lock_guard<std::mutex> guard(lock);
+        int matches = 0;
+        for (const std::string& candidate : received) {
+            matches += candidate == line;
+        }
+        return matches;
+    }
+
+    bool hasLine(const std::string& line) {
+        return count(line) > 0;
+    }
+
+    // Whether the throttle read everything sent and polled again since,
+    // so the session pass that read the last line has applied it
+    bool settled() {
+        std::lock_guard<std::mutex> guard(lock);
+        return outgoing.empty() && quietPolls >= 2;
+    }
+
+    std::string host() {
+        std::lock_guard<std::mutex> guard(lock);
+        return connectedHost;
+    }
+
+    uint16_t port() {
+        std::lock_guard<std::mutex> guard(lock);
+        return connectedPort;
+    }
+
+    // Client interface, used by the backend
+    int connect(IPAddress ip, uint16_t port) override {
+        return connect(ip.toString().c_str(), port);
+    }
+
+    int connect(const char* host, uint16_t port) override {
+        std::lock_guard<std::mutex> guard(lock);
+        if (refuse) {
+            return 0;
+        }
+        open = true;
+        connectedHost = host;
+        connectedPort = port;
+        incoming.clear();
+        outgoing.clear();
+        for (const std::string& line : greeting) {
+            queue(line);
+        }
+        return 1;
+    }
+
+    size_t write(uint8_t c) override {
+        return write(&c, 1);
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) override {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!open) {
+            return 0;
+        }
+        chunks.emplace_back(reinterpret_cast<const char*>(buffer), size);
+        for (size_t i = 0; i < size; i++) {
+            if (buffer[i] == '\n') {
+                handle(incoming);
+                incoming.clear();
+            } else {
+                incoming += (char)buffer[i];
+            }
+        }
+        return size;
+    }
+
+    int available() override {
+        std::lock_guard<std::mutex> guard(lock);
+        quietPolls += outgoing.empty();
+        return outgoing.size();
+    }
+
+    int read() override {
+        uint8_t c;
+        return read(&c, 1) == 1 ? c : -1;
+    }
+
+    int read(uint8_t* buffer, size_t size) override {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t count = 0;
+        while (count < size && !outgoing.empty()) {
+            buffer[count++] = outgoing.front();
+            outgoing.pop_front();
+        }
+        return count;
+    }
+
+    int peek() override {
+        std::lock_guard<std::mutex> guard(lock);
+        return outgoing.empty() ? -1 : outgoing.front();
+    }
+
+    void stop() override {
+        std::lock_guard<std::mutex> guard(lock);
+        open = false;
+    }
+
+    uint8_t connected() override {
+        std::lock_guard<std::mutex> guard(lock);
+        return open;
+    }
+
+    operator bool() override {
+        return connected();
+    }
+
+private:
+    void queue(const std::string& line) {
+        quietPolls = 0;
+        outgoing.insert(outgoing.end(), line.begin(), line.end());
+        outgoing.push_back('\n');
+    }
+
+    // Answer one line of the throttle, as JMRI would
+    void handle(const std::string& line) {
+        received.push_back(line);
+
+        if (line == "Q") {
+            open = false;
+            return;
+        }
+
+        size_t separator = line.find("<;>");
+        if (line.size() < 4 || line.compare(0, 2, "MT") != 0 || separator == std::string::npos) {
+            return;
+        }
+        std::string key = line.substr(3, separator - 3);
+        std::string action = line.substr(separator + 3);
+
+        if (line[2] == '+') {
+            // Acquire: confirm, then the loco's current state
+            speeds[key] = 0;
+            queue("MT+" + key + "<;>");
+            queue("MTA" + key + "<;>V0");
+            queue("MTA" + key + "<;>R1");
+            return;
+        }
+        if (line[2] == '-') {
+            speeds.erase(key);
+            queue("MT-" + key + "<;>");
+            return;
+        }
+        if (line[2] != 'A' || action.empty()) {
+            return;
+        }
+
+        if (key == "*") {
+            if (action == "X" && !silent) {
+                // Emergency stop, reported as speed -1 on every loco
+                for (auto& loco : speeds) {
+                    loco.second = 0;
+                    queue("MTA" + loco.first + "<;>V-1");
+                }
+            } else if (action == "qV" && !silent) {
+                for (const auto& loco : speeds) {
+                    queue("MTA" + loco.first + "<;>V" + std::to_string(loco.second));
+                }
+            }
+            return;
+        }
+
+        switch (action[0]) {
+            case 'V':
+                speeds[key] = atoi(action.c_str() + 1);
+                break;
+            case 'f':
+                // Forced functions come back as the function's state
+                action[0] = 'F';
+                break;
+            case 'R':
+                break;
+            default:
+                return;
+        }
+        if (!silent) {
+            queue("MTA" + key + "<;>" + action);
+        }
+    }
+
+    std::mutex lock;
+    bool open = false;
+    std::string connectedHost;
+    uint16_t connectedPort = 0;
+    std::string incoming;         // Partial line from the throttle
+    std::deque<uint8_t> outgoing; // Bytes waiting to be read by the throttle
+    int quietPolls = 0;           // Polls finding nothing since the last line queued
+    std::vector<std::string> received;
+    std::vector<std::string> chunks;
+    std::map<std::string, int> speeds; // Speed of every acquired loco, by key
+};
@@ -0,0 +1,199 @@
+#include <unity.h>
+#include "HostRuntime.h"
+#include "JMRICommandManager.h"
+#include "RosterCache.h"
+#include "ThrottleSession.h"
+#include "WiThrottleStandIn.h"
+
+namespace {
+
+// Connected throttle with loco 3 selected
+struct Session : ThrottleSession<JMRICommandManager, WiThrottleStandIn> {
+    explicit Session(bool silent = false) : ThrottleSession("jmri.local:12090", silent) {}
+};
+
+} // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_handshake_sends_name_and_hardware_id() {
+    Session session;
+    TEST_ASSERT_TRUE(session.throttle.isConnected());
+    TEST_ASSERT_EQUAL_STRING("jmri.local", session.station.host().c_str());
+    TEST_ASSERT_EQUAL(12090, session.station.port());
+    TEST_ASSERT_TRUE(session.station.hasLine("NTrainController"));
+    TEST_ASSERT_TRUE(session.station.hasLine("HU020000000001"));
+}
+
+void test_url_scheme_and_default_port() {
+    WiThrottleStandIn server;
+    JMRICommandManager throttle(server);
+    throttle.connect("withrottle://10.0.0.5");
+    TEST_ASSERT_EQUAL_STRING("10.0.0.5", server.host().c_str());
+    TEST_ASSERT_EQUAL(JMRICommandManager::DEFAULT_PORT, server.port());
+}
+
+void test_refused_connection_stays_down() {
+    WiThrottleStandIn server;
+    server.refuse = true;
+    JMRICommandManager throttle(server);
+    throttle.connect("jmri.local");
+    TEST_ASSERT_FALSE(throttle.isConnected());
+    TEST_ASSERT_TRUE(server.lines().empty());
+}
+
+void test_acquire_uses_short_and_long_keys() {
+    Session session;
+    TEST_ASSERT_TRUE(session.station.hasLine("MT+S3<;>S3"));
+    session.throttle.selectLoco(1234);
+    TEST_ASSERT_TRUE(session.station.hasLine("MT+L1234<;>L1234"));
+}
+
+void test_heartbeat_enabled_and_sent() {
+    WiThrottleStandIn server;
+    server.greeting = {"VN2.0", "*2"};
+    JMRICommandManager throttle(server);
+    throttle.connect("jmri.local");
+
+    // Enabled in reply to the timeout, then sent at half of it
+    TEST_ASSERT_TRUE(waitUntil([&] { return server.hasLine("*+"); }));
+    TEST_ASSERT_TRUE(waitUntil([&] { return server.hasLine("*"); }, 2000));
+}
+
+void test_speed_sent_in_one_write_and_confirmed() {
+    Session session;
+    session.throttle.setSpeed(40);
+    session.throttle.flush();
+
+    bool together = false;
+    for (const std::string& write : session.station.writes()) {
+        together |= write.find("MTAS3<;>R1\nMTAS3<;>V40\n") != std::string::npos;
+    }
+    TEST_ASSERT_TRUE(together);
+
+    // The server's echo confirms the speed
+    TEST_ASSERT_TRUE(waitUntil([&] { return (session.slot().pending & LocoCommandManager::DIRTY_SPEED) == 0; }));
+    TEST_ASSERT_EQUAL(40, session.slot().speed);
+    TEST_ASSERT_EQUAL(0, session.throttle.getRetryCount());
+}
+
+void test_unconfirmed_speed_is_retransmitted() {
+    Session session(true);
+    session.throttle.setSpeed(20);
+    session.throttle.flush();
+    TEST_ASSERT_EQUAL(1, session.station.count("MTAS3<;>V20"));
+
+    // Nothing comes back: sent again once the confirmation is overdue
+    TEST_ASSERT_TRUE(waitUntil([&] {
+        session.throttle.flush();
+        return session.station.count("MTAS3<;>V20") >= 2;
+    }, 3000));
+    TEST_ASSERT_TRUE(session.throttle.getRetryCount() >= 1);
+}
+
+void test_speed_from_another_throttle_is_taken_over() {
+    Session session;
+    session.station.send("MTAS3<;>V77");
+    TEST_ASSERT_TRUE(waitUntil([&] { return session.slot().speed == 77; }));
+
+    LocoCommandManager::StateChange change;
+    bool speedChanged = false;
+    while (session.throttle.pollStateChange(change)) {
+        speedChanged |= change.address == 3 && (change.fields & LocoCommandManager::DIRTY_SPEED);
+    }
+    TEST_ASSERT_TRUE(speedChanged);
+    TEST_ASSERT_TRUE(session.throttle.getDivergenceCount() >= 1);
+}
+
+void test_function_written_forced_and_confirmed() {
+    Session session;
+    session.throttle.setFunction(12, true);
+    session.throttle.flush();
+    TEST_ASSERT_TRUE(session.station.hasLine("MTAS3<;>f112"));
+    TEST_ASSERT_TRUE(session.throttle.getFunction(12));
+}
+
+void test_emergency_stop_goes_out_at_once() {
+    Session session;
+    session.throttle.setSpeed(50);
+    session.throttle.emergencyStop();
+
+    TEST_ASSERT_TRUE(session.station.hasLine("MTA*<;>X"));
+    TEST_ASSERT_EQUAL(0, session.slot().speed);
+
+    // The speed set before the stop is never sent
+    session.throttle.flush();
+    TEST_ASSERT_EQUAL(0, session.station.count("MTAS3<;>V50"));
+}
+
+void test_stale_echo_after_stop_is_ignored() {
+    Session session;
+    session.throttle.setSpeed(50);
+    session.throttle.flush();
+    session.throttle.emergencyStop();
+
+    // The echo of V50 arrives after the stop was written, then the stop's own report
+    TEST_ASSERT_TRUE(waitUntil([&] { return !session.slot().stopHeld; }));
+    TEST_ASSERT_EQUAL(0, session.slot().speed);
+    TEST_ASSERT_EQUAL(0, session.throttle.getDivergenceCount());
+}
+
+void test_stop_held_until_confirmed() {
+    Session session(true);
+    session.throttle.setSpeed(50);
+    session.throttle.flush();
+    session.throttle.emergencyStop();
+
+    // Neither the zero from the simulator nor a later speed release it
+    session.throttle.setSpeed(0);
+    session.throttle.setSpeed(30);
+    TEST_ASSERT_TRUE(session.slot().stopHeld);
+    TEST_ASSERT_EQUAL(0, session.slot().speed);
+
+    session.station.send("MTAS3<;>V0");
+    TEST_ASSERT_TRUE(waitUntil([&] { return !session.slot().stopHeld; }));
+    session.throttle.setSpeed(30);
+    TEST_ASSERT_EQUAL(30, session.slot().speed);
+}
+
+void test_roster_cached_from_greeting() {
+    Session session;
+    TEST_ASSERT_TRUE(waitUntil([] { return RosterCache::getInstance().getCount() == 1; }));
+
+    RosterCache::Entry entry;
+    TEST_ASSERT_TRUE(RosterCache::getInstance().find(4014, entry));
+    TEST_ASSERT_EQUAL_STRING("Big Boy", entry.name);
+}
+
+void test_disconnect_quits_and_stops_session() {
+    Session session;
+    session.throttle.disconnect();
+    TEST_ASSERT_TRUE(session.station.hasLine("Q"));
+    TEST_ASSERT_FALSE(session.throttle.isConnected());
+
+    // No session task left reading the link
+    session.station.send("*1");
+    delay(100);
+    TEST_ASSERT_TRUE(session.station.available() > 0);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_handshake_sends_name_and_hardware_id);
+    RUN_TEST(test_url_scheme_and_default_port);
+    RUN_TEST(test_refused_connection_stays_down);
+    RUN_TEST(test_acquire_uses_short_and_long_keys);
+    RUN_TEST(test_heartbeat_enabled_and_sent);
+    RUN_TEST(test_speed_sent_in_one_write_and_confirmed);
+    RUN_TEST(test_unconfirmed_speed_is_retransmitted);
+    RUN_TEST(test_speed_from_another_throttle_is_taken_over);
+    RUN_TEST(test_function_written_forced_and_confirmed);
+    RUN_TEST(test_emergency_stop_goes_out_at_once);
+    RUN_TEST(test_stale_echo_after_stop_is_ignored);
+    RUN_TEST(test_stop_held_until_confirmed);
+    RUN_TEST(test_roster_cached_from_greeting);
+    RUN_TEST(test_disconnect_quits_and_stops_session);
+    return UNITY_END();
+}
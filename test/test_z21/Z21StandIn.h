@@ -0,0 +1,275 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+
+using Datagram = std::vector<uint8_t>;
+
+// Scripted Z21 station, handed to Z21CommandManager as its UDP socket.
+// It answers the handshake, the broadcast flags and the keepalive probe,
+// keeps the state of every loco it was asked about and broadcasts it back
+// as LAN_X_LOCO_INFO after every change, like a Z21 does to a subscribed
+// client. Captured datagrams can be replayed to the throttle with send().
+class Z21StandIn : public UDP {
+public:
+    // Leave the handshake unanswered, as with no station at the address
+    bool refuse = false;
+
+    // Leave loco commands unanswered, as on a lossy link
+    bool silent = false;
+
+    // Queue a datagram for the throttle, as if the station had sent it
+    void send(const Datagram& datagram) {
+        std::lock_guard<std::mutex> guard(lock);
+        incoming.push_back(datagram);
+        quietPolls = 0;
+    }
+
+    // Every datagram received so far
+    std::vector<Datagram> datagrams() {
+        std::lock_guard<std::mutex> guard(lock);
+        return received;
+    }
+
+    // Whether a received datagram holds the given bytes
+    bool hasBytes(const Datagram& bytes) {
+        std::lock_guard<std::mutex> guard(lock);
+        for (const Datagram& datagram : received) {
+            if (std::search(datagram.begin(), datagram.end(), bytes.begin(), bytes.end()) != datagram.end()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Whether the throttle read every datagram and polled again since,
+    // so the session pass that read the last one has applied it
+    bool settled() {
+        std::lock_guard<std::mutex> guard(lock);
+        return incoming.empty() && current.empty() && quietPolls >= 2;
+    }
+
+    uint32_t broadcastFlags() {
+        std::lock_guard<std::mutex> guard(lock);
+        return flags;
+    }
+
+    IPAddress station() {
+        std::lock_guard<std::mutex> guard(lock);
+        return stationIp;
+    }
+
+    // UDP interface, used by the backend
+    uint8_t begin(uint16_t port) override {
+        return 1;
+    }
+
+    void stop() override {}
+
+    int beginPacket(IPAddress ip, uint16_t port) override {
+        std::lock_guard<std::mutex> guard(lock);
+        stationIp = ip;
+        outgoing.clear();
+        return 1;
+    }
+
+    int beginPacket(const char* host, uint16_t port) override {
+        std::lock_guard<std::mutex> guard(lock);
+        outgoing.clear();
+        return 1;
+    }
+
+    size_t write(uint8_t c) override {
+        return write(&c, 1);
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) override {
+        std::lock_guard<std::mutex> guard(lock);
+        outgoing.insert(outgoing.end(), buffer, buffer + size);
+        return size;
+    }
+
+    int endPacket() override {
+        std::lock_guard<std::mutex> guard(lock);
+        received.push_back(outgoing);
+        handle(outgoing);
+        return 1;
+    }
+
+    int parsePacket() override {
+        std::lock_guard<std::mutex> guard(lock);
+        if (incoming.empty()) {
+            current.clear();
+            quietPolls++;
+            return 0;
+        }
+        current = incoming.front();
+        incoming.pop_front();
+        return current.size();
+    }
+
+    int available() override {
+        std::lock_guard<std::mutex> guard(lock);
+        return current.size();
+    }
+
+    int read() override {
+        uint8_t c;
+        return read(&c, 1) == 1 ? c : -1;
+    }
+
+    int read(unsigned char* buffer, size_t size) override {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t count = min(size, current.size());
+        std::copy(current.begin(), current.begin() + count, buffer);
+        current.erase(current.begin(), current.begin() + count);
+        return count;
+    }
+
+    int read(char* buffer, size_t size) override {
+        return read(reinterpret_cast<unsigned char*>(buffer), size);
+    }
+
+    int peek() override {
+        std::lock_guard<std::mutex> guard(lock);
+        return current.empty() ? -1 : current.front();
+    }
+
+    IPAddress remoteIP() override {
+        return stationIp;
+    }
+
+    uint16_t remotePort() override {
+        return 21105;
+    }
+
+private:
+    struct Loco {
+        uint8_t speed = 0x80;   // RVVVVVVV, 128 steps, forward
+        uint32_t functions = 0; // Bit n is Fn
+    };
+
+    // Answer every dataset of one datagram, as a Z21 would
+    void handle(const Datagram& datagram) {
+        size_t offset = 0;
+        while (offset + 4 <= datagram.size()) {
+            size_t length = datagram[offset] | (datagram[offset + 1] << 8);
+            if (length < 4 || offset + length > datagram.size()) {
+                return;
+            }
+            uint16_t header = datagram[offset + 2] | (datagram[offset + 3] << 8);
+            Datagram payload(datagram.begin() + offset + 4, datagram.begin() + offset + length);
+            offset += length;
+
+            switch (header) {
+                case 0x10: // LAN_GET_SERIAL_NUMBER
+                    if (!refuse) {
+                        queue(0x10, {0x2A, 0x00, 0x01, 0x00});
+                    }
+                    break;
+                case 0x50: // LAN_SET_BROADCASTFLAGS
+                    if (payload.size() >= 4) {
+                        flags = payload[0] | (payload[1] << 8) | (payload[2] << 16) | ((uint32_t)payload[3] << 24);
+                    }
+                    break;
+                case 0x51: // LAN_GET_BROADCASTFLAGS
+                    queue(0x51, {(uint8_t)flags, (uint8_t)(flags >> 8), (uint8_t)(flags >> 16), (uint8_t)(flags >> 24)});
+                    break;
+                case 0x85: // LAN_SYSTEMSTATE_GETDATA, answered with LAN_SYSTEMSTATE_DATACHANGED
+                    queue(0x84, Datagram(16, 0));
+                    break;
+                case 0x40: // LAN_X
+                    handleXBus(payload);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    void handleXBus(const Datagram& frame) {
+        if (frame.empty()) {
+            return;
+        }
+        if (frame[0] == 0x80) {
+            // LAN_X_SET_STOP: every loco stops, LAN_X_BC_STOPPED then their state
+            queue(0x40, {0x81, 0x00, 0x81});
+            for (auto& loco : locos) {
+                loco.second.speed &= 0x80;
+                queueLocoInfo(loco.first);
+            }
+            return;
+        }
+        if (frame.size() < 5 || (frame[0] != 0xE3 && frame[0] != 0xE4)) {
+            return;
+        }
+        int address = ((frame[2] & 0x3F) << 8) | frame[3];
+        Loco& loco = locos[address];
+
+        if (frame[0] == 0xE4 && frame.size() >= 6) {
+            uint8_t value = frame[4];
+            if (frame[1] == 0x13) {
+                loco.speed = value; // LAN_X_SET_LOCO_DRIVE, 128 steps
+            } else if (frame[1] == 0xF8) {
+                uint32_t bit = 1UL << (value & 0x3F); // LAN_X_SET_LOCO_FUNCTION
+                loco.functions = (value & 0x40) ? (loco.functions | bit) : (loco.functions & ~bit);
+            } else if (frame[1] == 0x20) {
+                // 000 F0 F4 F3 F2 F1
+                uint32_t states = ((value >> 4) & 0x01) | ((value & 0x0F) << 1);
+                loco.functions = (loco.functions & ~0x1FUL) | states;
+            } else {
+                // F5-F8, F9-F12, F13-F20, F21-F28
+                static const std::map<uint8_t, std::pair<int, int>> GROUPS = {
+                    {0x21, {5, 4}}, {0x22, {9, 4}}, {0x23, {13, 8}}, {0x28, {21, 8}}};
+                auto group = GROUPS.find(frame[1]);
+                if (group == GROUPS.end()) {
+                    return;
+                }
+                uint32_t mask = ((1UL << group->second.second) - 1) << group->second.first;
+                loco.functions = (loco.functions & ~mask) | (((uint32_t)value << group->second.first) & mask);
+            }
+            if (silent) {
+                return;
+            }
+        }
+        // LAN_X_GET_LOCO_INFO, or the broadcast following a change
+        queueLocoInfo(address);
+    }
+
+    // LAN_X_LOCO_INFO: EF, address, 128 steps, RVVVVVVV, 0DSLFGHJ, F5-F12, F13-F20, F21-F28, XOR
+    void queueLocoInfo(int address) {
+        const Loco& loco = locos[address];
+        uint32_t f = loco.functions;
+        Datagram frame = {0xEF, (uint8_t)(address >= 128 ? 0xC0 | (address >> 8) : 0), (uint8_t)(address & 0xFF), 0x04,
+                          loco.speed, (uint8_t)(((f & 0x01) << 4) | ((f >> 1) & 0x0F)), (uint8_t)(f >> 5),
+                          (uint8_t)(f >> 13), (uint8_t)(f >> 21)};
+        uint8_t checksum = 0;
+        for (uint8_t value : frame) {
+            checksum ^= value;
+        }
+        frame.push_back(checksum);
+        queue(0x40, frame);
+    }
+
+    void queue(uint16_t header, const Datagram& payload) {
+        Datagram datagram = {(uint8_t)(payload.size() + 4), 0, (uint8_t)header, (uint8_t)(header >> 8)};
+        datagram.insert(datagram.end(), payload.begin(), payload.end());
+        incoming.push_back(datagram);
+        quietPolls = 0;
+    }
+
+    std::mutex lock;
+    IPAddress stationIp;
+    uint32_t flags = 0;
+    Datagram outgoing;                 // Datagram being written by the throttle
+    Datagram current;                  // Datagram being read by the throttle
+    std::deque<Datagram> incoming;     // Datagrams waiting to be read by the throttle
+    int quietPolls = 0;                // Polls finding nothing since the last datagram queued
+    std::vector<Datagram> received;
+    std::map<int, Loco> locos;         // State of every loco asked about, by address
+};
@@ -0,0 +1,191 @@
+#include <unity.h>
+#include "HostRuntime.h"
+#include "Z21CommandManager.h"
+#include "ThrottleSession.h"
+#include "Z21StandIn.h"
+
+namespace {
+
+// Datagrams captured from a Z21 (firmware 1.42) answering another throttle
+
+// LAN_X_LOCO_INFO, loco 3, 128 steps, forward at step 77, F0 and F5 on
+const Datagram INFO_3_STEP_77 = {0x0E, 0x00, 0x40, 0x00, 0xEF, 0x00, 0x03, 0x04, 0xCE, 0x10, 0x01, 0x00, 0x00, 0x37};
+
+// LAN_X_LOCO_INFO, long address 1234, 128 steps, reverse at step 20
+const Datagram INFO_1234_STEP_20 = {0x0E, 0x00, 0x40, 0x00, 0xEF, 0xC4, 0xD2, 0x04, 0x15, 0x00, 0x00, 0x00, 0x00, 0xE8};
+
+// LAN_X_LOCO_INFO, loco 3 driven by a throttle in 28 step mode
+const Datagram INFO_3_28_STEPS = {0x0E, 0x00, 0x40, 0x00, 0xEF, 0x00, 0x03, 0x02, 0x8A, 0x00, 0x00, 0x00, 0x00, 0x64};
+
+// LAN_GET_BROADCASTFLAGS answer, driving and switching
+const Datagram FLAGS_DRIVING = {0x08, 0x00, 0x51, 0x00, 0x01, 0x00, 0x00, 0x00};
+
+// Datagram whose datasets follow each other
+Datagram joined(const Datagram& first, const Datagram& second) {
+    Datagram datagram = first;
+    datagram.insert(datagram.end(), second.begin(), second.end());
+    return datagram;
+}
+
+// Connected throttle with loco 3 selected
+struct Session : ThrottleSession<Z21CommandManager, Z21StandIn> {
+    explicit Session(bool silent = false) : ThrottleSession("192.168.0.111", silent) {}
+};
+
+} // namespace
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_handshake_and_subscription() {
+    Session session;
+    TEST_ASSERT_TRUE(session.throttle.isConnected());
+    TEST_ASSERT_EQUAL_STRING("192.168.0.111", session.station.station().toString().c_str());
+
+    // LAN_SET_BROADCASTFLAGS, then the flags read back
+    TEST_ASSERT_TRUE(session.station.hasBytes({0x08, 0x00, 0x50, 0x00, 0x01, 0x00, 0x00, 0x00, 0x04, 0x00, 0x51, 0x00}));
+    TEST_ASSERT_EQUAL(1, session.station.broadcastFlags());
+    TEST_ASSERT_TRUE(waitUntil([&] { return session.throttle.getBroadcastFlags() == 1; }));
+}
+
+void test_unanswered_handshake_stays_down() {
+    Z21StandIn station;
+    station.refuse = true;
+    Z21CommandManager throttle(station);
+    throttle.connect("192.168.0.111");
+    TEST_ASSERT_FALSE(throttle.isConnected());
+}
+
+void test_acquire_asks_for_loco_info() {
+    Session session;
+    // LAN_X_GET_LOCO_INFO 3
+    TEST_ASSERT_TRUE(session.station.hasBytes({0x09, 0x00, 0x40, 0x00, 0xE3, 0xF0, 0x00, 0x03, 0x10}));
+}
+
+void test_speed_sent_and_confirmed_by_loco_info() {
+    Session session;
+    session.throttle.setSpeed(40);
+    session.throttle.flush();
+
+    // LAN_X_SET_LOCO_DRIVE 3, 128 steps, forward, step 40
+    TEST_ASSERT_TRUE(session.station.hasBytes({0x0A, 0x00, 0x40, 0x00, 0xE4, 0x13, 0x00, 0x03, 0xA9, 0x5D}));
+    TEST_ASSERT_TRUE(waitUntil([&] { return (session.slot().pending & LocoCommandManager::DIRTY_SPEED) == 0; }));
+    TEST_ASSERT_EQUAL(40, session.slot().speed);
+    TEST_ASSERT_EQUAL(0, session.throttle.getRetryCount());
+}
+
+void test_loco_info_from_another_throttle_is_taken_over() {
+    Session session;
+    session.station.send(INFO_3_STEP_77);
+    TEST_ASSERT_TRUE(waitUntil([&] { return session.slot().speed == 77; }));
+    TEST_ASSERT_TRUE(session.slot().forward);
+    TEST_ASSERT_TRUE(session.slot().frontLights == LocoCommandManager::LightStatus::BRIGHT);
+    TEST_ASSERT_FALSE(session.slot().bell);
+
+    // Only the cab functions are taken from reports, F5 stays as it was
+    TEST_ASSERT_FALSE(session.throttle.getFunction(5));
+    TEST_ASSERT_TRUE(session.throttle.getDivergenceCount() >= 1);
+}
+
+void test_long_address_is_decoded() {
+    Session session;
+    session.throttle.selectLoco(1234);
+    session.station.send(INFO_1234_STEP_20);
+    TEST_ASSERT_TRUE(waitUntil([&] { return session.slot().speed == 20; }));
+    TEST_ASSERT_FALSE(session.slot().forward);
+}
+
+void test_other_step_modes_leave_the_speed() {
+    Session session;
+    session.station.send(INFO_3_28_STEPS);
+    TEST_ASSERT_TRUE(waitUntil([&] { return session.station.settled(); }));
+    TEST_ASSERT_EQUAL(0, session.slot().speed);
+}
+
+void test_several_datasets_in_one_datagram() {
+    Session session;
+    session.station.send(joined(FLAGS_DRIVING, INFO_3_STEP_77));
+    TEST_ASSERT_TRUE(waitUntil([&] { return session.slot().speed == 77; }));
+    TEST_ASSERT_EQUAL(1, session.throttle.getBroadcastFlags());
+}
+
+void test_malformed_datagrams_are_dropped() {
+    Session session;
+
+    // Checksum off by one bit
+    Datagram corrupt = INFO_3_STEP_77;
+    corrupt.back() ^= 0x01;
+    session.station.send(corrupt);
+
+    // Dataset longer than the datagram
+    session.station.send(Datagram(INFO_3_STEP_77.begin(), INFO_3_STEP_77.end() - 2));
+
+    // Dataset length below the header size, ahead of a valid one
+    session.station.send(joined({0x02, 0x00, 0x40, 0x00}, INFO_3_STEP_77));
+
+    TEST_ASSERT_TRUE(waitUntil([&] { return session.station.settled(); }));
+    TEST_ASSERT_EQUAL(0, session.slot().speed);
+    TEST_ASSERT_EQUAL(0, session.throttle.getDivergenceCount());
+}
+
+void test_function_group_sent_and_confirmed() {
+    Session session;
+    session.throttle.setFunction(6, true);
+    session.throttle.flush();
+
+    // LAN_X_SET_LOCO_FUNCTION_GROUP F5-F8 of loco 3, F6 on
+    TEST_ASSERT_TRUE(session.station.hasBytes({0xE4, 0x21, 0x00, 0x03, 0x02}));
+    TEST_ASSERT_TRUE(waitUntil([&] { return session.slot().pending == 0; }));
+    TEST_ASSERT_TRUE(session.throttle.getFunction(6));
+}
+
+void test_emergency_stop_held_until_reported() {
+    Session session;
+    session.throttle.setSpeed(50);
+    session.throttle.flush();
+    session.throttle.emergencyStop();
+
+    // LAN_X_SET_STOP, then the stopped locos come back as loco info
+    TEST_ASSERT_TRUE(session.station.hasBytes({0x06, 0x00, 0x40, 0x00, 0x80, 0x80}));
+    TEST_ASSERT_TRUE(waitUntil([&] { return !session.slot().stopHeld; }));
+    TEST_ASSERT_EQUAL(0, session.slot().speed);
+    TEST_ASSERT_EQUAL(0, session.throttle.getDivergenceCount());
+}
+
+void test_unconfirmed_speed_is_retransmitted() {
+    Session session(true);
+    session.throttle.setSpeed(20);
+    session.throttle.flush();
+
+    TEST_ASSERT_TRUE(waitUntil([&] {
+        session.throttle.flush();
+        return session.throttle.getRetryCount() >= 1;
+    }, 3000));
+}
+
+void test_disconnect_logs_off() {
+    Session session;
+    session.throttle.disconnect();
+    TEST_ASSERT_FALSE(session.throttle.isConnected());
+    // LAN_LOGOFF
+    TEST_ASSERT_TRUE(session.station.hasBytes({0x04, 0x00, 0x30, 0x00}));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_handshake_and_subscription);
+    RUN_TEST(test_unanswered_handshake_stays_down);
+    RUN_TEST(test_acquire_asks_for_loco_info);
+    RUN_TEST(test_speed_sent_and_confirmed_by_loco_info);
+    RUN_TEST(test_loco_info_from_another_throttle_is_taken_over);
+    RUN_TEST(test_long_address_is_decoded);
+    RUN_TEST(test_other_step_modes_leave_the_speed);
+    RUN_TEST(test_several_datasets_in_one_datagram);
+    RUN_TEST(test_malformed_datagrams_are_dropped);
+    RUN_TEST(test_function_group_sent_and_confirmed);
+    RUN_TEST(test_emergency_stop_held_until_reported);
+    RUN_TEST(test_unconfirmed_speed_is_retransmitted);
+    RUN_TEST(test_disconnect_logs_off);
+    return UNITY_END();
+}